@@ -0,0 +1,265 @@
+// BenchUtil.h - Shared helpers for the SevenZipCore benchmark executables
+#pragma once
+
+#include <Windows.h>
+#include <psapi.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace bench {
+
+//////////////////////////////////////////////////////////////////////////////
+// Timing
+//////////////////////////////////////////////////////////////////////////////
+
+class Stopwatch {
+public:
+    Stopwatch() : m_start(std::chrono::steady_clock::now()) {}
+    double Seconds() const {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - m_start).count();
+    }
+
+private:
+    std::chrono::steady_clock::time_point m_start;
+};
+
+//////////////////////////////////////////////////////////////////////////////
+// Peak working set of the process while a run is in flight. The OS peak
+// counter is monotonic over the process lifetime, so it is sampled instead.
+//////////////////////////////////////////////////////////////////////////////
+
+inline uint64_t CurrentRss() {
+    PROCESS_MEMORY_COUNTERS pmc = {};
+    pmc.cb = sizeof(pmc);
+    if (!GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc))) return 0;
+    return pmc.WorkingSetSize;
+}
+
+class RssSampler {
+public:
+    RssSampler() : m_peak(CurrentRss()), m_stop(false) {
+        m_thread = std::thread([this] {
+            while (!m_stop.load()) {
+                uint64_t rss = CurrentRss();
+                uint64_t prev = m_peak.load();
+                while (rss > prev && !m_peak.compare_exchange_weak(prev, rss)) {
+                }
+                Sleep(5);
+            }
+        });
+    }
+
+    ~RssSampler() { Stop(); }
+
+    uint64_t Stop() {
+        if (m_thread.joinable()) {
+            m_stop.store(true);
+            m_thread.join();
+        }
+        uint64_t rss = CurrentRss();
+        return rss > m_peak.load() ? rss : m_peak.load();
+    }
+
+private:
+    std::atomic<uint64_t> m_peak;
+    std::atomic<bool> m_stop;
+    std::thread m_thread;
+};
+
+//////////////////////////////////////////////////////////////////////////////
+// Deterministic data generation
+//////////////////////////////////////////////////////////////////////////////
+
+class Rng {
+public:
+    explicit Rng(uint64_t seed) : m_state(seed ? seed : 0x9E3779B97F4A7C15ull) {}
+
+    uint64_t Next() {
+        m_state ^= m_state << 13;
+        m_state ^= m_state >> 7;
+        m_state ^= m_state << 17;
+        return m_state;
+    }
+
+    uint32_t Below(uint32_t bound) { return (uint32_t)(Next() % bound); }
+
+    void Fill(uint8_t* data, size_t size) {
+        size_t i = 0;
+        for (; i + 8 <= size; i += 8) {
+            uint64_t v = Next();
+            memcpy(data + i, &v, 8);
+        }
+        for (uint64_t v = Next(); i < size; i++, v >>= 8) {
+            data[i] = (uint8_t)v;
+        }
+    }
+
+private:
+    uint64_t m_state;
+};
+
+// Text drawn from a small vocabulary: compresses roughly like source code
+inline void FillText(Rng& rng, std::string& out, size_t size) {
+    static const char* const kWords[] = {
+        "int ", "return ", "if (", ") {\n", "}\n", "for (", "const ", "auto ",
+        "std::vector<", ">& ", "value", "index", "count", "size_t ", " = ", ";\n",
+        "    ", "// ", "nullptr", "static ", "void ", "bool ", "while (", "buffer",
+        "0x", "42", "data[", "]", "->", "::", "struct ", "class ",
+    };
+    const uint32_t numWords = (uint32_t)(sizeof(kWords) / sizeof(kWords[0]));
+    out.clear();
+    out.reserve(size);
+    while (out.size() < size) {
+        out += kWords[rng.Below(numWords)];
+    }
+    out.resize(size);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// File system helpers
+//////////////////////////////////////////////////////////////////////////////
+
+inline void EnsureDir(const std::wstring& path) {
+    size_t pos = 0;
+    while ((pos = path.find(L'\\', pos + 1)) != std::wstring::npos) {
+        CreateDirectoryW(path.substr(0, pos).c_str(), NULL);
+    }
+    CreateDirectoryW(path.c_str(), NULL);
+}
+
+inline bool WriteWholeFile(const std::wstring& path, const void* data, size_t size) {
+    HANDLE h = CreateFileW(path.c_str(), GENERIC_WRITE, 0, NULL, CREATE_ALWAYS,
+                           FILE_ATTRIBUTE_NORMAL, NULL);
+    if (h == INVALID_HANDLE_VALUE) return false;
+    const uint8_t* p = (const uint8_t*)data;
+    bool ok = true;
+    while (size > 0 && ok) {
+        DWORD chunk = (DWORD)(size > (1u << 30) ? (1u << 30) : size);
+        DWORD written = 0;
+        ok = WriteFile(h, p, chunk, &written, NULL) && written == chunk;
+        p += chunk;
+        size -= chunk;
+    }
+    CloseHandle(h);
+    return ok;
+}
+
+inline uint64_t FileSize(const std::wstring& path) {
+    WIN32_FILE_ATTRIBUTE_DATA fad;
+    if (!GetFileAttributesExW(path.c_str(), GetFileExInfoStandard, &fad)) return 0;
+    return ((uint64_t)fad.nFileSizeHigh << 32) | fad.nFileSizeLow;
+}
+
+inline void RemoveTree(const std::wstring& path) {
+    DWORD attrs = GetFileAttributesW(path.c_str());
+    if (attrs == INVALID_FILE_ATTRIBUTES) return;
+    if (!(attrs & FILE_ATTRIBUTE_DIRECTORY)) {
+        DeleteFileW(path.c_str());
+        return;
+    }
+    WIN32_FIND_DATAW fd;
+    HANDLE hFind = FindFirstFileW((path + L"\\*").c_str(), &fd);
+    if (hFind != INVALID_HANDLE_VALUE) {
+        do {
+            if (wcscmp(fd.cFileName, L".") == 0 || wcscmp(fd.cFileName, L"..") == 0) continue;
+            RemoveTree(path + L"\\" + fd.cFileName);
+        } while (FindNextFileW(hFind, &fd));
+        FindClose(hFind);
+    }
+    RemoveDirectoryW(path.c_str());
+}
+
+// Full paths of the entries of a directory, in FindFirstFile order
+inline std::vector<std::wstring> ListDir(const std::wstring& path) {
+    std::vector<std::wstring> entries;
+    WIN32_FIND_DATAW fd;
+    HANDLE hFind = FindFirstFileW((path + L"\\*").c_str(), &fd);
+    if (hFind != INVALID_HANDLE_VALUE) {
+        do {
+            if (wcscmp(fd.cFileName, L".") == 0 || wcscmp(fd.cFileName, L"..") == 0) continue;
+            entries.push_back(path + L"\\" + fd.cFileName);
+        } while (FindNextFileW(hFind, &fd));
+        FindClose(hFind);
+    }
+    return entries;
+}
+
+inline std::wstring DefaultWorkDir(const wchar_t* name) {
+    wchar_t tempPath[MAX_PATH];
+    GetTempPathW(MAX_PATH, tempPath);
+    return std::wstring(tempPath) + name;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Argument and output helpers
+//////////////////////////////////////////////////////////////////////////////
+
+inline std::string Narrow(const std::wstring& s) {
+    int len = WideCharToMultiByte(CP_UTF8, 0, s.c_str(), (int)s.size(), NULL, 0, NULL, NULL);
+    std::string out(len, '\0');
+    WideCharToMultiByte(CP_UTF8, 0, s.c_str(), (int)s.size(), &out[0], len, NULL, NULL);
+    return out;
+}
+
+// "1,2,4" -> {1,2,4}
+inline std::vector<uint32_t> ParseList(const wchar_t* s) {
+    std::vector<uint32_t> out;
+    while (*s) {
+        wchar_t* end = nullptr;
+        unsigned long v = wcstoul(s, &end, 10);
+        if (end == s) break;
+        out.push_back((uint32_t)v);
+        s = (*end == L',') ? end + 1 : end;
+    }
+    return out;
+}
+
+inline std::vector<std::wstring> SplitList(const wchar_t* s) {
+    std::vector<std::wstring> out;
+    std::wstring cur;
+    for (; *s; s++) {
+        if (*s == L',') {
+            if (!cur.empty()) out.push_back(cur);
+            cur.clear();
+        } else {
+            cur += *s;
+        }
+    }
+    if (!cur.empty()) out.push_back(cur);
+    return out;
+}
+
+// One JSON object per line, mirrored to stdout and the optional results file
+class ResultWriter {
+public:
+    explicit ResultWriter(const std::wstring& path) {
+        if (!path.empty()) m_file = _wfopen(path.c_str(), L"w");
+    }
+    ~ResultWriter() {
+        if (m_file) fclose(m_file);
+    }
+
+    void Line(const std::string& json) {
+        fputs(json.c_str(), stdout);
+        fputc('\n', stdout);
+        fflush(stdout);
+        if (m_file) {
+            fputs(json.c_str(), m_file);
+            fputc('\n', m_file);
+            fflush(m_file);
+        }
+    }
+
+private:
+    FILE* m_file = nullptr;
+};
+
+} // namespace bench
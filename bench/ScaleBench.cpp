@@ -0,0 +1,397 @@
+// ScaleBench.cpp - Metadata-scale benchmark for archives with very many entries
+//
+// Builds 7z, zip and tar archives with N tiny synthetic entries (no files on
+// disk; entries are generated by an in-memory update callback), then times
+// OpenArchive - split into header parse and the encryption scan - plus
+// GetItemCount, GetItems and SelectMatching with a glob filter (include
+// "*7.txt", exclude "d1*"), with peak working set and allocation counts.
+// The timed pass runs without stats; a second pass collects the open phases
+// and the allocation counts (C++ allocations through operator new).
+// Results are written as CSV with one row per (format, entries) so they can be
+// plotted against entry count (see plot_scale.py).
+//
+//   sevenzipcore_scale_bench [--work DIR] [--entries 100000,1000000,10000000]
+//                            [--formats 7z,Zip,Tar] [--payload BYTES]
+//                            [--archive existing.iso ...] [--csv scale.csv]
+//
+// 7-Zip cannot create ISO images, so ISO (or any other read-only format) is
+// measured from existing archives passed with --archive.
+
+#include "SevenZipCore.h"
+#include "BenchUtil.h"
+
+#include "Common/Common.h"
+#include "7zip/Archive/IArchive.h"
+#include "7zip/PropID.h"
+#include "Common/MyCom.h"
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+#include <shlwapi.h>
+
+using namespace bench;
+
+//////////////////////////////////////////////////////////////////////////////
+// Allocation counting. The global operators forward to malloc/free as the
+// CRT's own do, in every build; they count only while a CAllocCounter is
+// alive, so the timed pass pays one relaxed load per allocation.
+//////////////////////////////////////////////////////////////////////////////
+
+static std::atomic<bool> g_allocCounting{false};
+static std::atomic<uint64_t> g_allocCount{0};
+static std::atomic<uint64_t> g_allocBytes{0};
+
+void* operator new(size_t size) {
+    if (g_allocCounting.load(std::memory_order_relaxed)) {
+        g_allocCount.fetch_add(1, std::memory_order_relaxed);
+        g_allocBytes.fetch_add(size, std::memory_order_relaxed);
+    }
+    void* p = malloc(size ? size : 1);
+    if (!p) throw std::bad_alloc();
+    return p;
+}
+
+void* operator new[](size_t size) {
+    return operator new(size);
+}
+
+void operator delete(void* p) noexcept { free(p); }
+void operator delete[](void* p) noexcept { free(p); }
+void operator delete(void* p, size_t) noexcept { free(p); }
+void operator delete[](void* p, size_t) noexcept { free(p); }
+
+namespace {
+
+// Counts the allocations of one pass, from construction to destruction
+class CAllocCounter {
+public:
+    CAllocCounter() {
+        g_allocCount = 0;
+        g_allocBytes = 0;
+        g_allocCounting = true;
+    }
+
+    ~CAllocCounter() {
+        g_allocCounting = false;
+    }
+
+    CAllocCounter(const CAllocCounter&) = delete;
+    CAllocCounter& operator=(const CAllocCounter&) = delete;
+
+    uint64_t GetCount() const { return g_allocCount.load(); }
+    uint64_t GetBytes() const { return g_allocBytes.load(); }
+};
+
+//////////////////////////////////////////////////////////////////////////////
+// Synthetic entry content
+//////////////////////////////////////////////////////////////////////////////
+
+class CPatternInStream :
+    public ISequentialInStream,
+    public CMyUnknownImp
+{
+public:
+    CPatternInStream(UInt32 index, UInt32 size) : m_index(index), m_remaining(size), m_refCount(0) {}
+    virtual ~CPatternInStream() {}
+
+    STDMETHOD(QueryInterface)(REFIID iid, void **outObject) {
+        if (iid == IID_IUnknown || iid == IID_ISequentialInStream) {
+            *outObject = this;
+            AddRef();
+            return S_OK;
+        }
+        *outObject = NULL;
+        return E_NOINTERFACE;
+    }
+
+    STDMETHOD_(ULONG, AddRef)() { return ++m_refCount; }
+    STDMETHOD_(ULONG, Release)() {
+        ULONG res = --m_refCount;
+        if (res == 0) delete this;
+        return res;
+    }
+
+    STDMETHOD(Read)(void *data, UInt32 size, UInt32 *processedSize) {
+        if (size > m_remaining) size = m_remaining;
+        Byte* p = (Byte*)data;
+        for (UInt32 i = 0; i < size; i++) {
+            p[i] = (Byte)('a' + (m_index + i) % 26);
+        }
+        m_remaining -= size;
+        if (processedSize) *processedSize = size;
+        return S_OK;
+    }
+
+private:
+    UInt32 m_index;
+    UInt32 m_remaining;
+    ULONG m_refCount;
+};
+
+//////////////////////////////////////////////////////////////////////////////
+// Update callback producing N entries laid out as d<k>\f<i>.txt
+//////////////////////////////////////////////////////////////////////////////
+
+class CSyntheticUpdateCallback :
+    public IArchiveUpdateCallback,
+    public CMyUnknownImp
+{
+public:
+    static const UInt32 kFilesPerDir = 1000;
+
+    CSyntheticUpdateCallback(UInt32 numFiles, UInt32 payload)
+        : m_numFiles(numFiles)
+        , m_numDirs((numFiles + kFilesPerDir - 1) / kFilesPerDir)
+        , m_payload(payload)
+        , m_refCount(0)
+    {
+        GetSystemTimeAsFileTime(&m_mtime);
+    }
+
+    UInt32 GetItemCount() const { return m_numDirs + m_numFiles; }
+
+    STDMETHOD(QueryInterface)(REFIID iid, void **outObject) {
+        if (iid == IID_IUnknown || iid == IID_IArchiveUpdateCallback) {
+            *outObject = static_cast<IArchiveUpdateCallback*>(this);
+            AddRef();
+            return S_OK;
+        }
+        *outObject = NULL;
+        return E_NOINTERFACE;
+    }
+
+    STDMETHOD_(ULONG, AddRef)() { return ++m_refCount; }
+    STDMETHOD_(ULONG, Release)() {
+        ULONG res = --m_refCount;
+        if (res == 0) delete this;
+        return res;
+    }
+
+    STDMETHOD(SetTotal)(UInt64 total) { return S_OK; }
+    STDMETHOD(SetCompleted)(const UInt64 *completeValue) { return S_OK; }
+
+    STDMETHOD(GetUpdateItemInfo)(UInt32 index, Int32 *newData, Int32 *newProps, UInt32 *indexInArchive) {
+        if (newData) *newData = 1;
+        if (newProps) *newProps = 1;
+        if (indexInArchive) *indexInArchive = (UInt32)-1;
+        return S_OK;
+    }
+
+    STDMETHOD(GetProperty)(UInt32 index, PROPID propID, PROPVARIANT *value) {
+        PropVariantInit(value);
+        bool isDir = index < m_numDirs;
+        switch (propID) {
+            case kpidPath: {
+                wchar_t name[64];
+                if (isDir) {
+                    swprintf(name, 64, L"d%u", index);
+                } else {
+                    UInt32 file = index - m_numDirs;
+                    swprintf(name, 64, L"d%u\\f%u.txt", file / kFilesPerDir, file);
+                }
+                value->vt = VT_BSTR;
+                value->bstrVal = SysAllocString(name);
+                break;
+            }
+            case kpidIsDir:
+                value->vt = VT_BOOL;
+                value->boolVal = isDir ? VARIANT_TRUE : VARIANT_FALSE;
+                break;
+            case kpidSize:
+                if (!isDir) {
+                    value->vt = VT_UI8;
+                    value->uhVal.QuadPart = m_payload;
+                }
+                break;
+            case kpidAttrib:
+                value->vt = VT_UI4;
+                value->ulVal = isDir ? FILE_ATTRIBUTE_DIRECTORY : FILE_ATTRIBUTE_NORMAL;
+                break;
+            case kpidMTime:
+                value->vt = VT_FILETIME;
+                value->filetime = m_mtime;
+                break;
+        }
+        return S_OK;
+    }
+
+    STDMETHOD(GetStream)(UInt32 index, ISequentialInStream **inStream) {
+        *inStream = NULL;
+        if (index < m_numDirs) return S_OK;
+        CPatternInStream* stream = new CPatternInStream(index, m_payload);
+        stream->AddRef();
+        *inStream = stream;
+        return S_OK;
+    }
+
+    STDMETHOD(SetOperationResult)(Int32 operationResult) { return S_OK; }
+
+private:
+    UInt32 m_numFiles;
+    UInt32 m_numDirs;
+    UInt32 m_payload;
+    FILETIME m_mtime;
+    ULONG m_refCount;
+};
+
+// Written by the core's own output path, like Compress
+bool BuildArchive(const ArchiveFormat& fmt, const std::wstring& path, UInt32 entries,
+                  UInt32 payload) {
+    CSyntheticUpdateCallback* callback = new CSyntheticUpdateCallback(entries, payload);
+    callback->AddRef();
+    bool ok = SevenZipCore::Instance().CompressItems(callback, callback->GetItemCount(),
+                                                     (uint64_t)entries * payload, path, fmt.name);
+    callback->Release();
+    return ok;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Measurement
+//////////////////////////////////////////////////////////////////////////////
+
+struct Options {
+    std::wstring workDir = DefaultWorkDir(L"szscale");
+    std::vector<uint32_t> entries = { 100000, 1000000 };
+    std::vector<std::wstring> formats = { L"7z", L"Zip", L"Tar" };
+    std::vector<std::wstring> archives;
+    uint32_t payload = 0;
+    std::wstring csvPath = L"scale.csv";
+};
+
+void MeasureArchive(const std::wstring& label, const std::wstring& path, uint64_t entries,
+                    double buildSeconds, ResultWriter& csv) {
+    SevenZipCore& core = SevenZipCore::Instance();
+    core.CloseArchive();
+
+    // Timed pass, with stats off
+    core.EnableStats(false);
+    RssSampler rss;
+
+    Stopwatch swOpen;
+    bool ok = core.OpenArchive(path);
+    double openSec = swOpen.Seconds();
+
+    Stopwatch swCount;
+    uint32_t count = ok ? core.GetItemCount() : 0;
+    double countSec = swCount.Seconds();
+
+    Stopwatch swItems;
+    size_t listed = ok ? core.GetItems().size() : 0;
+    double itemsSec = swItems.Seconds();
+
+    // Glob selection straight from the handler's paths, without GetItems
+    PathFilter filter({ L"*7.txt" }, { L"d1*" });
+    Stopwatch swSelect;
+    size_t selected = ok ? core.SelectMatching(filter).size() : 0;
+    double selectSec = swSelect.Seconds();
+
+    uint64_t peak = rss.Stop();
+    core.CloseArchive();
+
+    // Counting pass: the open phases, and allocations of the same calls
+    core.EnableStats(true);
+    core.ResetStats();
+    CoreStats openStats = {};
+    uint64_t allocs = 0;
+    uint64_t allocBytes = 0;
+    uint64_t itemAllocs = 0;
+    if (ok) {
+        CAllocCounter counter;
+        core.OpenArchive(path);
+        openStats = core.GetStats();
+        core.GetItemCount();
+        uint64_t allocsItems0 = counter.GetCount();
+        core.GetItems();
+        itemAllocs = counter.GetCount() - allocsItems0;
+        core.SelectMatching(filter);
+        allocs = counter.GetCount();
+        allocBytes = counter.GetBytes();
+        core.CloseArchive();
+    }
+    core.EnableStats(false);
+
+    char row[512];
+    snprintf(row, sizeof(row),
+             "%s,%llu,%d,%.3f,%.4f,%.4f,%.4f,%.6f,%.4f,%.1f,%.1f,%llu,%llu,%.2f,%.4f,%.1f,%llu",
+             Narrow(label).c_str(), (unsigned long long)(entries ? entries : count), ok ? 1 : 0,
+             buildSeconds, openSec,
+             openStats.Phase(CorePhase::HeaderParse).totalNs / 1e9,
+             openStats.Phase(CorePhase::EncryptionScan).totalNs / 1e9,
+             countSec, itemsSec,
+             listed ? itemsSec * 1e9 / listed : 0.0,
+             peak / (1024.0 * 1024.0),
+             (unsigned long long)allocs, (unsigned long long)allocBytes,
+             listed ? (double)itemAllocs / listed : 0.0,
+             selectSec, count ? selectSec * 1e9 / count : 0.0, (unsigned long long)selected);
+    csv.Line(row);
+}
+
+bool ParseArgs(int argc, wchar_t** argv, Options& opt) {
+    for (int i = 1; i < argc; i++) {
+        std::wstring arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == L"--work" && hasValue) opt.workDir = argv[++i];
+        else if (arg == L"--entries" && hasValue) opt.entries = ParseList(argv[++i]);
+        else if (arg == L"--formats" && hasValue) opt.formats = SplitList(argv[++i]);
+        else if (arg == L"--payload" && hasValue) opt.payload = (uint32_t)_wtoi(argv[++i]);
+        else if (arg == L"--archive" && hasValue) opt.archives.push_back(argv[++i]);
+        else if (arg == L"--csv" && hasValue) opt.csvPath = argv[++i];
+        else {
+            fwprintf(stderr, L"unknown or incomplete argument: %ls\n", arg.c_str());
+            return false;
+        }
+    }
+    return true;
+}
+
+} // namespace
+
+int wmain(int argc, wchar_t** argv) {
+    Options opt;
+    if (!ParseArgs(argc, argv, opt)) {
+        fwprintf(stderr, L"usage: sevenzipcore_scale_bench [--work DIR] [--entries N,N] "
+                         L"[--formats 7z,Zip,Tar] [--payload BYTES] [--archive FILE]... "
+                         L"[--csv FILE]\n");
+        return 2;
+    }
+
+    SevenZipCore& core = SevenZipCore::Instance();
+    EnsureDir(opt.workDir);
+
+    ResultWriter csv(opt.csvPath);
+    csv.Line("format,entries,ok,buildSec,openSec,headerParseSec,encryptionScanSec,"
+             "itemCountSec,getItemsSec,getItemsNsPerItem,peakRssMB,allocs,allocBytes,"
+             "allocsPerItem,selectSec,selectNsPerItem,selected");
+
+    for (const auto& name : opt.formats) {
+        const ArchiveFormat* fmt = nullptr;
+        for (const auto& f : core.GetFormats()) {
+            if (_wcsicmp(f.name.c_str(), name.c_str()) == 0) fmt = &f;
+        }
+        if (!fmt || !fmt->canUpdate) {
+            fwprintf(stderr, L"skipping %ls: not writable, pass an existing archive with --archive\n",
+                     name.c_str());
+            continue;
+        }
+
+        for (uint32_t entries : opt.entries) {
+            std::wstring path = opt.workDir + L"\\scale-" + std::to_wstring(entries) + fmt->extension;
+            Stopwatch sw;
+            bool built = BuildArchive(*fmt, path, entries, opt.payload);
+            double buildSec = sw.Seconds();
+            if (!built) {
+                fwprintf(stderr, L"failed to build %ls\n", path.c_str());
+                DeleteFileW(path.c_str());
+                continue;
+            }
+            MeasureArchive(fmt->name, path, entries, buildSec, csv);
+            DeleteFileW(path.c_str());
+        }
+    }
+
+    for (const auto& path : opt.archives) {
+        MeasureArchive(PathFindExtensionW(path.c_str()), path, 0, 0.0, csv);
+    }
+    return 0;
+}
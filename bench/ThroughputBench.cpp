@@ -0,0 +1,883 @@
+// ThroughputBench.cpp - End-to-end Compress/GetItems/Extract throughput benchmark
+//
+// Generates synthetic corpora, then runs every updatable format from
+// SevenZipCore::GetFormats() across a set of thread counts. Each run emits one
+// JSON line with MB/s, files/s and the peak working set.
+//
+//   sevenzipcore_bench [--work DIR] [--threads 1,2,4] [--formats 7z,Zip]
+//                      [--corpora tiny,huge,random,source] [--scale 0.25]
+//                      [--json results.jsonl] [--stats] [--cancel-after MS]
+//                      [--extract-threads N] [--block-size MB] [--tarball]
+//                      [--hash] [--skip-unchanged] [--sparse]
+//                      [--direct-io MB] [--batched-io] [--read-ahead N]
+//                      [--seek-index] [--memory-budget MB]
+//                      [--placement node|node-nosmt] [--edit] [--convert]
+//                      [--item-read]
+//
+// --cancel-after adds an "extract-cancel" run per case that cancels the
+// extraction after MS milliseconds and reports the observed cancellation
+// latency against the token's bound. --extract-threads adds an
+// "extract-parallel" run that decodes independent blocks on N handler instances.
+// --tarball packs each corpus as .tar.<ext> in one pass for the single-stream
+// formats ("tarball-compress"; .tar.gz uses parallel gzip members) and
+// compares two-pass extraction (outer stream to a .tar file, then the tar)
+// with single-pass nested extraction, reporting disk bytes written by each.
+// --hash adds "hash-files" (HashFiles over the corpus tree) per corpus and
+// thread count, and "hash-items" (HashArchiveItems on the archive) per case,
+// both computing CRC32 + SHA-256. --skip-unchanged re-extracts over the
+// finished "extract" tree with ExtractSkipMode::SizeTime ("extract-again") and
+// ExtractSkipMode::Crc ("extract-again-crc"), where nothing should be written.
+// --sparse adds "extract-sparse" (OperationOptions::sparseOutput) with the
+// bytes written and left as holes; the "sparse" corpus (not run by default)
+// is a mostly-zero disk image. --direct-io adds "compress-direct" and
+// "extract-direct", which read and write files of at least MB megabytes
+// without the system cache (OperationOptions::directIoThreshold).
+// --batched-io adds "extract-batched" (IoBackend::Batched), to compare files/s
+// with the blocking "extract" run. --read-ahead adds "compress-readahead"
+// (OperationOptions::readAheadFiles = N); use --stats for the InputWait phase
+// and the prefetch hit/miss counters. --seek-index (with --tarball) lists the
+// .tar.gz once while building its seek index ("tarball-index-build"), then
+// extracts one item from the middle of the tar with the index
+// ("tarball-extract-one-indexed") and without it ("tarball-extract-one-full").
+// --memory-budget adds "compress-budget", run with
+// SevenZipCore::SetMemoryBudget(MB); compare its peak working set and MB/s
+// with the unbounded "compress" run. --placement sets
+// OperationOptions::threadPlacement for "extract-placed" (parallel
+// extraction, --extract-threads workers or one per NUMA node) and, with
+// --tarball, "tarball-compress-placed" (.tar.gz, parallel gzip workers); the
+// detected cores, SMT siblings, NUMA nodes and L3 domains are printed at
+// startup. Run it on a multi-socket machine with --threads 0 (one gzip
+// worker per processor of the node) to compare with the unplaced runs. --edit deletes
+// ("delete-one") and then renames ("rename-one") the middle item of a copy
+// of each multi-file archive; compare their seconds with "compress", since
+// unchanged items are copied packed instead of recompressed. --convert
+// converts each multi-file archive to 7z (a 7z one to Zip) in one pass
+// ("convert"); compare with "extract" plus "compress", the two-step route
+// through a temporary tree; for Tar it also converts a tar with its members
+// out of name order to 7z ("convert-unsorted"). --item-read reads the first
+// 64 KB of every file of each multi-file archive through
+// SevenZipCore::OpenItemStream twice ("item-read-cold", "item-read-warm")
+// and adds the decoded-block cache's hit rate of each round. Only verified
+// blocks are cached: the warm round hits for files that fit in one 256 KB
+// block (the cold read decodes them to the end) and for files decoded on
+// the way through a solid block; the heads of larger files are decoded
+// again. Stored items (Tar) are read in place and do not use the cache.
+
+#include "SevenZipCore.h"
+#include "BenchUtil.h"
+
+#include <algorithm>
+
+using namespace bench;
+
+namespace {
+
+struct Corpus {
+    std::wstring name;
+    std::wstring root;          // Directory passed to Compress
+    std::wstring largestFile;   // Input for single-stream formats
+    uint64_t largestSize = 0;
+    uint64_t totalBytes = 0;
+    uint64_t numFiles = 0;
+};
+
+struct Options {
+    std::wstring workDir = DefaultWorkDir(L"szbench");
+    std::vector<uint32_t> threads = { 1, 2, 4, 8 };
+    std::vector<std::wstring> formats;
+    std::vector<std::wstring> corpora = { L"tiny", L"huge", L"random", L"source" };
+    double scale = 1.0;
+    std::wstring jsonPath;
+    bool stats = false;
+    uint32_t cancelAfterMs = 0;
+    uint32_t extractThreads = 0;
+    uint64_t blockSize = 0;
+    bool tarball = false;
+    bool hash = false;
+    bool skipUnchanged = false;
+    bool sparse = false;
+    uint64_t directIoThreshold = 0;
+    bool batchedIo = false;
+    uint32_t readAheadFiles = 0;
+    bool seekIndex = false;
+    uint64_t memoryBudget = 0;
+    ThreadPlacement placement = ThreadPlacement::Default;
+    bool edit = false;
+    bool convert = false;
+    bool itemRead = false;
+};
+
+// Formats that hold a single stream rather than a file tree
+bool IsSingleStreamFormat(const std::wstring& name) {
+    return _wcsicmp(name.c_str(), L"GZip") == 0 || _wcsicmp(name.c_str(), L"BZip2") == 0 ||
+           _wcsicmp(name.c_str(), L"Xz") == 0 || _wcsicmp(name.c_str(), L"Zstd") == 0;
+}
+
+void AddFile(Corpus& corpus, const std::wstring& path, const void* data, size_t size) {
+    WriteWholeFile(path, data, size);
+    corpus.totalBytes += size;
+    corpus.numFiles++;
+    if (corpus.largestFile.empty() || size > corpus.largestSize) {
+        corpus.largestFile = path;
+        corpus.largestSize = size;
+    }
+}
+
+// Many tiny text files spread over 100 directories
+void GenerateTiny(Corpus& corpus, double scale) {
+    Rng rng(1);
+    std::string text;
+    uint32_t count = (uint32_t)(20000 * scale) + 1;
+    for (uint32_t i = 0; i < count; i++) {
+        std::wstring dir = corpus.root + L"\\d" + std::to_wstring(i % 100);
+        if (i < 100) EnsureDir(dir);
+        FillText(rng, text, 64 + rng.Below(4032));
+        AddFile(corpus, dir + L"\\f" + std::to_wstring(i) + L".txt", text.data(), text.size());
+    }
+}
+
+// A couple of large, moderately compressible files
+void GenerateHuge(Corpus& corpus, double scale) {
+    Rng rng(2);
+    size_t size = (size_t)(256.0 * scale * (1 << 20));
+    std::vector<uint8_t> data(size);
+    std::string text;
+    for (int file = 0; file < 2; file++) {
+        // Alternate text runs with random runs so the data is neither trivial nor noise
+        size_t pos = 0;
+        while (pos < size) {
+            size_t run = std::min<size_t>(size - pos, 4096 + rng.Below(61440));
+            if (rng.Below(4) == 0) {
+                rng.Fill(data.data() + pos, run);
+            } else {
+                FillText(rng, text, run);
+                memcpy(data.data() + pos, text.data(), run);
+            }
+            pos += run;
+        }
+        AddFile(corpus, corpus.root + L"\\huge" + std::to_wstring(file) + L".bin",
+                data.data(), data.size());
+    }
+}
+
+// Incompressible data: exercises the store/fallback paths and raw I/O
+void GenerateRandom(Corpus& corpus, double scale) {
+    Rng rng(3);
+    std::vector<uint8_t> data((size_t)(128.0 * scale * (1 << 20)));
+    rng.Fill(data.data(), data.size());
+    AddFile(corpus, corpus.root + L"\\random.bin", data.data(), data.size());
+}
+
+// Disk-image-like file: mostly zeros, with data in one 4 MB extent of eight
+void GenerateSparse(Corpus& corpus, double scale) {
+    Rng rng(5);
+    const size_t kExtent = 4 << 20;
+    size_t size = (size_t)(512.0 * scale * (1 << 20));
+    std::vector<uint8_t> data(size, 0);
+    std::string text;
+    for (size_t pos = 0; pos < size; pos += kExtent) {
+        if (rng.Below(8) != 0) continue;
+        size_t run = std::min(size - pos, kExtent);
+        FillText(rng, text, run);
+        memcpy(data.data() + pos, text.data(), run);
+    }
+    AddFile(corpus, corpus.root + L"\\disk.img", data.data(), data.size());
+}
+
+// Nested source-like tree with mixed file sizes
+void GenerateSource(Corpus& corpus, double scale) {
+    Rng rng(4);
+    std::string text;
+    static const wchar_t* const kExts[] = { L".cpp", L".h", L".c", L".txt", L".json" };
+    uint32_t count = (uint32_t)(3000 * scale) + 1;
+    for (uint32_t i = 0; i < count; i++) {
+        std::wstring dir = corpus.root + L"\\src" + std::to_wstring(i % 8) +
+                           L"\\mod" + std::to_wstring(i % 37) +
+                           L"\\part" + std::to_wstring(i % 5);
+        EnsureDir(dir);
+        size_t size = (rng.Below(10) == 0) ? 16384 + rng.Below(49152) : 512 + rng.Below(8192);
+        FillText(rng, text, size);
+        AddFile(corpus, dir + L"\\file" + std::to_wstring(i) + kExts[i % 5],
+                text.data(), text.size());
+    }
+}
+
+Corpus MakeCorpus(const Options& opt, const std::wstring& name) {
+    Corpus corpus;
+    corpus.name = name;
+    corpus.root = opt.workDir + L"\\corpus\\" + name;
+    RemoveTree(corpus.root);
+    EnsureDir(corpus.root);
+
+    if (name == L"tiny") GenerateTiny(corpus, opt.scale);
+    else if (name == L"huge") GenerateHuge(corpus, opt.scale);
+    else if (name == L"random") GenerateRandom(corpus, opt.scale);
+    else if (name == L"source") GenerateSource(corpus, opt.scale);
+    else if (name == L"sparse") GenerateSparse(corpus, opt.scale);
+    return corpus;
+}
+
+std::string ResultJson(const Corpus& corpus, const ArchiveFormat& fmt, uint32_t threads,
+                       const char* op, bool ok, double seconds, uint64_t bytes,
+                       uint64_t files, uint64_t peakRss, uint64_t archiveBytes,
+                       bool stats) {
+    char buf[512];
+    double mb = bytes / (1024.0 * 1024.0);
+    snprintf(buf, sizeof(buf),
+             "{\"corpus\":\"%s\",\"format\":\"%s\",\"threads\":%u,\"op\":\"%s\",\"ok\":%s,"
+             "\"seconds\":%.4f,\"bytes\":%llu,\"files\":%llu,\"archiveBytes\":%llu,"
+             "\"mbPerSec\":%.2f,\"filesPerSec\":%.1f,\"peakRssMB\":%.1f",
+             Narrow(corpus.name).c_str(), Narrow(fmt.name).c_str(), threads, op,
+             ok ? "true" : "false", seconds, (unsigned long long)bytes,
+             (unsigned long long)files, (unsigned long long)archiveBytes,
+             seconds > 0 ? mb / seconds : 0.0, seconds > 0 ? files / seconds : 0.0,
+             peakRss / (1024.0 * 1024.0));
+    std::string json = buf;
+    if (stats) {
+        json += ",\"stats\":" + SevenZipCore::Instance().GetStatsJson();
+    }
+    json += "}";
+    return json;
+}
+
+void RunCase(const Options& opt, const Corpus& corpus, const ArchiveFormat& fmt,
+             uint32_t threads, ResultWriter& out) {
+    SevenZipCore& core = SevenZipCore::Instance();
+    bool single = IsSingleStreamFormat(fmt.name);
+    uint64_t inBytes = single ? corpus.largestSize : corpus.totalBytes;
+    uint64_t inFiles = single ? 1 : corpus.numFiles;
+
+    std::wstring archive = opt.workDir + L"\\out\\" + corpus.name + L"-t" +
+                           std::to_wstring(threads) + fmt.extension;
+    std::wstring extractDir = opt.workDir + L"\\x";
+    EnsureDir(opt.workDir + L"\\out");
+    DeleteFileW(archive.c_str());
+
+    OperationOptions ops;
+    ops.numThreads = threads;
+    ops.blockSize = opt.blockSize;
+
+    // Compress
+    core.ResetStats();
+    {
+        std::vector<std::wstring> src = { single ? corpus.largestFile : corpus.root };
+        RssSampler rss;
+        Stopwatch sw;
+        bool ok = core.Compress(src, archive, fmt.name, nullptr, ops);
+        double seconds = sw.Seconds();
+        out.Line(ResultJson(corpus, fmt, threads, "compress", ok, seconds, inBytes, inFiles,
+                            rss.Stop(), FileSize(archive), opt.stats));
+        if (!ok) return;
+    }
+    uint64_t archiveBytes = FileSize(archive);
+
+    // Compress again with source files read ahead of the encoder
+    if (opt.readAheadFiles) {
+        OperationOptions readAheadOps = ops;
+        readAheadOps.readAheadFiles = opt.readAheadFiles;
+        std::wstring readAheadArchive = archive + L".readahead";
+        DeleteFileW(readAheadArchive.c_str());
+        core.ResetStats();
+        std::vector<std::wstring> src = { single ? corpus.largestFile : corpus.root };
+        RssSampler rss;
+        Stopwatch sw;
+        bool ok = core.Compress(src, readAheadArchive, fmt.name, nullptr, readAheadOps);
+        double seconds = sw.Seconds();
+        out.Line(ResultJson(corpus, fmt, threads, "compress-readahead", ok, seconds, inBytes,
+                            inFiles, rss.Stop(), FileSize(readAheadArchive), opt.stats));
+        DeleteFileW(readAheadArchive.c_str());
+    }
+
+    // Compress again under the memory budget
+    if (opt.memoryBudget) {
+        std::wstring budgetArchive = archive + L".budget";
+        DeleteFileW(budgetArchive.c_str());
+        core.ResetStats();
+        core.SetMemoryBudget(opt.memoryBudget);
+        std::vector<std::wstring> src = { single ? corpus.largestFile : corpus.root };
+        RssSampler rss;
+        Stopwatch sw;
+        bool ok = core.Compress(src, budgetArchive, fmt.name, nullptr, ops);
+        double seconds = sw.Seconds();
+        core.SetMemoryBudget(0);
+        std::string json = ResultJson(corpus, fmt, threads, "compress-budget", ok, seconds,
+                                      inBytes, inFiles, rss.Stop(), FileSize(budgetArchive),
+                                      opt.stats);
+        json.insert(json.size() - 1,
+                    ",\"memoryBudgetBytes\":" + std::to_string(opt.memoryBudget));
+        out.Line(json);
+        DeleteFileW(budgetArchive.c_str());
+    }
+
+    // Open + list
+    core.ResetStats();
+    {
+        RssSampler rss;
+        Stopwatch sw;
+        bool ok = core.OpenArchive(archive);
+        size_t numItems = ok ? core.GetItems().size() : 0;
+        double seconds = sw.Seconds();
+        out.Line(ResultJson(corpus, fmt, threads, "list", ok, seconds, archiveBytes, numItems,
+                            rss.Stop(), archiveBytes, opt.stats));
+        if (!ok) return;
+    }
+
+    // Extract
+    core.ResetStats();
+    RemoveTree(extractDir);
+    {
+        RssSampler rss;
+        Stopwatch sw;
+        bool ok = core.Extract(extractDir, L"", nullptr, ops);
+        double seconds = sw.Seconds();
+        out.Line(ResultJson(corpus, fmt, threads, "extract", ok, seconds, inBytes, inFiles,
+                            rss.Stop(), archiveBytes, opt.stats));
+    }
+
+    // Extract again over an up-to-date tree
+    if (opt.skipUnchanged) {
+        struct { const char* op; ExtractSkipMode mode; } again[] = {
+            { "extract-again", ExtractSkipMode::SizeTime },
+            { "extract-again-crc", ExtractSkipMode::Crc },
+        };
+        for (const auto& run : again) {
+            core.ResetStats();
+            OperationOptions againOps = ops;
+            againOps.skipUnchanged = run.mode;
+            RssSampler rss;
+            Stopwatch sw;
+            bool ok = core.Extract(extractDir, L"", nullptr, againOps);
+            double seconds = sw.Seconds();
+            out.Line(ResultJson(corpus, fmt, threads, run.op, ok, seconds, inBytes, inFiles,
+                                rss.Stop(), archiveBytes, opt.stats));
+        }
+    }
+
+    // Extract with zero runs left as holes
+    if (opt.sparse) {
+        bool statsOn = opt.stats;
+        core.EnableStats(true);
+        core.ResetStats();
+        RemoveTree(extractDir);
+        OperationOptions sparseOps = ops;
+        sparseOps.sparseOutput = true;
+        RssSampler rss;
+        Stopwatch sw;
+        bool ok = core.Extract(extractDir, L"", nullptr, sparseOps);
+        double seconds = sw.Seconds();
+        CoreStats stats = core.GetStats();
+        std::string json = ResultJson(corpus, fmt, threads, "extract-sparse", ok, seconds,
+                                      inBytes, inFiles, rss.Stop(), archiveBytes, statsOn);
+        json.insert(json.size() - 1,
+                    ",\"diskBytesWritten\":" +
+                        std::to_string(stats.Counter(CoreCounter::BytesWritten)) +
+                    ",\"sparseBytes\":" + std::to_string(stats.Counter(CoreCounter::BytesSparse)));
+        out.Line(json);
+        core.EnableStats(statsOn);
+    }
+
+    // Unbuffered I/O for large files, compared with the buffered runs above
+    if (opt.directIoThreshold) {
+        OperationOptions directOps = ops;
+        directOps.directIoThreshold = opt.directIoThreshold;
+        std::wstring directArchive = archive + L".direct";
+        DeleteFileW(directArchive.c_str());
+
+        core.ResetStats();
+        {
+            std::vector<std::wstring> src = { single ? corpus.largestFile : corpus.root };
+            RssSampler rss;
+            Stopwatch sw;
+            bool ok = core.Compress(src, directArchive, fmt.name, nullptr, directOps);
+            double seconds = sw.Seconds();
+            out.Line(ResultJson(corpus, fmt, threads, "compress-direct", ok, seconds, inBytes,
+                                inFiles, rss.Stop(), FileSize(directArchive), opt.stats));
+        }
+        DeleteFileW(directArchive.c_str());
+
+        core.ResetStats();
+        RemoveTree(extractDir);
+        {
+            RssSampler rss;
+            Stopwatch sw;
+            bool ok = core.Extract(extractDir, L"", nullptr, directOps);
+            double seconds = sw.Seconds();
+            out.Line(ResultJson(corpus, fmt, threads, "extract-direct", ok, seconds, inBytes,
+                                inFiles, rss.Stop(), archiveBytes, opt.stats));
+        }
+    }
+
+    // Small files created, written and closed on background I/O threads
+    if (opt.batchedIo) {
+        core.ResetStats();
+        RemoveTree(extractDir);
+        OperationOptions batchedOps = ops;
+        batchedOps.ioBackend = IoBackend::Batched;
+        RssSampler rss;
+        Stopwatch sw;
+        bool ok = core.Extract(extractDir, L"", nullptr, batchedOps);
+        double seconds = sw.Seconds();
+        out.Line(ResultJson(corpus, fmt, threads, "extract-batched", ok, seconds, inBytes,
+                            inFiles, rss.Stop(), archiveBytes, opt.stats));
+    }
+
+    // Parallel extraction workers, each on the least used NUMA node
+    if (opt.placement != ThreadPlacement::Default) {
+        core.ResetStats();
+        RemoveTree(extractDir);
+        OperationOptions placedOps = ops;
+        placedOps.threadPlacement = opt.placement;
+        placedOps.numExtractThreads = opt.extractThreads > 1
+            ? opt.extractThreads
+            : std::max<uint32_t>(2, (uint32_t)core.GetCpuTopology().nodes.size());
+        RssSampler rss;
+        Stopwatch sw;
+        bool ok = core.Extract(extractDir, L"", nullptr, placedOps);
+        double seconds = sw.Seconds();
+        out.Line(ResultJson(corpus, fmt, threads, "extract-placed", ok, seconds, inBytes,
+                            inFiles, rss.Stop(), archiveBytes, opt.stats));
+    }
+
+    // Parallel extract across independent blocks
+    if (opt.extractThreads > 1) {
+        core.ResetStats();
+        RemoveTree(extractDir);
+        OperationOptions parallelOps = ops;
+        parallelOps.numExtractThreads = opt.extractThreads;
+        RssSampler rss;
+        Stopwatch sw;
+        bool ok = core.Extract(extractDir, L"", nullptr, parallelOps);
+        double seconds = sw.Seconds();
+        out.Line(ResultJson(corpus, fmt, threads, "extract-parallel", ok, seconds, inBytes,
+                            inFiles, rss.Stop(), archiveBytes, opt.stats));
+    }
+
+    // Hash every item while decoding, without writing files
+    if (opt.hash) {
+        core.ResetStats();
+        RssSampler rss;
+        HashReport report = core.HashArchiveItems({}, HashCrc32 | HashSha256, L"", nullptr, ops);
+        out.Line(ResultJson(corpus, fmt, threads, "hash-items", report.ok, report.seconds,
+                            report.totalBytes, report.entries.size(), rss.Stop(), archiveBytes,
+                            opt.stats));
+    }
+
+    // Cancelled extract: how long until the operation notices
+    if (opt.cancelAfterMs) {
+        RemoveTree(extractDir);
+        OperationOptions cancelOps = ops;
+        cancelOps.cancel = std::make_shared<CancellationToken>();
+        std::thread timer([&] {
+            Sleep(opt.cancelAfterMs);
+            cancelOps.cancel->Cancel();
+        });
+        Stopwatch sw;
+        bool ok = core.Extract(extractDir, L"", nullptr, cancelOps);
+        double seconds = sw.Seconds();
+        timer.join();
+        char buf[256];
+        snprintf(buf, sizeof(buf),
+                 "{\"corpus\":\"%s\",\"format\":\"%s\",\"threads\":%u,\"op\":\"extract-cancel\","
+                 "\"completed\":%s,\"seconds\":%.4f,\"cancelLatencyMs\":%.3f,\"boundMs\":%u}",
+                 Narrow(corpus.name).c_str(), Narrow(fmt.name).c_str(), threads,
+                 ok ? "true" : "false", seconds, cancelOps.cancel->GetObservedLatencyMs(),
+                 cancelOps.cancel->GetLatencyBound());
+        out.Line(buf);
+    }
+    core.CloseArchive();
+
+    // Delete, then rename, one item of a copy of the archive
+    if (opt.edit && !single) {
+        std::wstring editArchive = archive + L".edit";
+        CopyFileW(archive.c_str(), editArchive.c_str(), FALSE);
+        bool opened = core.OpenArchive(editArchive, ops) && core.GetItemCount() > 2;
+        for (const char* op : { "delete-one", "rename-one" }) {
+            if (!opened) break;
+            uint32_t middle = core.GetItemCount() / 2;
+            core.ResetStats();
+            RssSampler rss;
+            Stopwatch sw;
+            bool ok = (strcmp(op, "delete-one") == 0)
+                ? core.DeleteItems({ middle }, L"", nullptr, ops)
+                : core.RenameItems({ { middle, L"renamed.bin" } }, L"", nullptr, ops);
+            double seconds = sw.Seconds();
+            out.Line(ResultJson(corpus, fmt, threads, op, ok, seconds, inBytes, inFiles,
+                                rss.Stop(), FileSize(editArchive), opt.stats));
+            opened = ok;
+        }
+        core.CloseArchive();
+        DeleteFileW(editArchive.c_str());
+    }
+
+    // Archive to archive through pipes, without an extracted tree
+    if (opt.convert && !single && core.OpenArchive(archive, ops)) {
+        std::wstring target = (_wcsicmp(fmt.name.c_str(), L"7z") == 0) ? L"Zip" : L"7z";
+        std::wstring convertArchive = archive + L".convert";
+        core.ResetStats();
+        RssSampler rss;
+        Stopwatch sw;
+        bool ok = core.Convert(convertArchive, target, L"", nullptr, ops);
+        double seconds = sw.Seconds();
+        std::string json = ResultJson(corpus, fmt, threads, "convert", ok, seconds, inBytes,
+                                      inFiles, rss.Stop(), FileSize(convertArchive), opt.stats);
+        json.insert(json.size() - 1, ",\"target\":\"" + Narrow(target) + "\"");
+        out.Line(json);
+        core.CloseArchive();
+        DeleteFileW(convertArchive.c_str());
+    }
+
+    // Tar members out of name order, as tars from readdir order on other
+    // systems are: the top-level entries packed in reverse. The 7z updater
+    // asks for files in name order, so Convert decodes them out of index order.
+    if (opt.convert && _wcsicmp(fmt.name.c_str(), L"Tar") == 0) {
+        std::vector<std::wstring> entries = ListDir(corpus.root);
+        std::reverse(entries.begin(), entries.end());
+        std::wstring unsortedTar = archive + L".unsorted.tar";
+        std::wstring convertArchive = archive + L".unsorted.7z";
+        if (core.Compress(entries, unsortedTar, L"Tar", nullptr, ops) &&
+            core.OpenArchive(unsortedTar, ops)) {
+            core.ResetStats();
+            RssSampler rss;
+            Stopwatch sw;
+            bool ok = core.Convert(convertArchive, L"7z", L"", nullptr, ops);
+            double seconds = sw.Seconds();
+            std::string json = ResultJson(corpus, fmt, threads, "convert-unsorted", ok, seconds,
+                                          inBytes, inFiles, rss.Stop(),
+                                          FileSize(convertArchive), opt.stats);
+            json.insert(json.size() - 1, ",\"target\":\"7z\"");
+            out.Line(json);
+            core.CloseArchive();
+        }
+        DeleteFileW(convertArchive.c_str());
+        DeleteFileW(unsortedTar.c_str());
+    }
+
+    // Random access to the head of every file; the second round should be
+    // served from the item cache
+    if (opt.itemRead && !single && core.OpenArchive(archive, ops)) {
+        std::vector<ArchiveItem> items = core.GetItems(ops);
+        std::vector<uint8_t> head(64 << 10);
+        for (const char* op : { "item-read-cold", "item-read-warm" }) {
+            core.ResetStats();
+            DecodedBlockCacheStats before = core.GetItemCacheStats();
+            RssSampler rss;
+            Stopwatch sw;
+            bool ok = true;
+            uint64_t bytes = 0;
+            uint64_t files = 0;
+            for (uint32_t i = 0; i < items.size() && ok; i++) {
+                if (items[i].isDir) continue;
+                std::unique_ptr<ItemReader> reader = core.OpenItemStream(i, L"", ops);
+                size_t read = 0;
+                ok = reader && reader->Read(head.data(), head.size(), read);
+                bytes += read;
+                files++;
+            }
+            double seconds = sw.Seconds();
+            DecodedBlockCacheStats after = core.GetItemCacheStats();
+            uint64_t hits = after.hits - before.hits;
+            uint64_t lookups = hits + after.misses - before.misses;
+            std::string json = ResultJson(corpus, fmt, threads, op, ok, seconds, bytes, files,
+                                          rss.Stop(), archiveBytes, opt.stats);
+            char extra[64];
+            snprintf(extra, sizeof(extra), ",\"cacheHitRate\":%.3f",
+                     lookups ? (double)hits / lookups : 0.0);
+            json.insert(json.size() - 1, extra);
+            out.Line(json);
+        }
+        core.CloseArchive();
+    }
+
+    RemoveTree(extractDir);
+    DeleteFileW(archive.c_str());
+}
+
+// HashFiles over the corpus tree; not tied to an archive format
+void RunHashFilesCase(const Options& opt, const Corpus& corpus, uint32_t threads,
+                      ResultWriter& out) {
+    SevenZipCore& core = SevenZipCore::Instance();
+    ArchiveFormat none = { L"none", L"", {}, false };
+    OperationOptions ops;
+    ops.numThreads = threads;
+
+    core.ResetStats();
+    RssSampler rss;
+    HashReport report = core.HashFiles({ corpus.root }, HashCrc32 | HashSha256, nullptr, ops);
+    out.Line(ResultJson(corpus, none, threads, "hash-files", report.ok, report.seconds,
+                        report.totalBytes, report.entries.size(), rss.Stop(), 0, opt.stats));
+}
+
+// Disk bytes written by the last operation(s), from the core's counters
+uint64_t BytesWritten() {
+    return SevenZipCore::Instance().GetStats().Counter(CoreCounter::BytesWritten);
+}
+
+// Single-item extraction from a .tar.gz with and without its seek index
+void RunSeekIndexCase(const Options& opt, const Corpus& corpus, const ArchiveFormat& fmt,
+                      uint32_t threads, const std::wstring& archive, ResultWriter& out) {
+    SevenZipCore& core = SevenZipCore::Instance();
+    std::wstring extractDir = opt.workDir + L"\\x";
+    std::wstring sidePath = archive + L".szidx";
+    uint64_t archiveBytes = FileSize(archive);
+    OperationOptions ops;
+    ops.numThreads = threads;
+    ops.openNested = true;
+
+    // Listing pass that records member starts and entry offsets
+    DeleteFileW(sidePath.c_str());
+    core.ResetStats();
+    std::vector<ArchiveItem> items;
+    {
+        OperationOptions indexOps = ops;
+        indexOps.seekIndexSpacing = 1 << 20;
+        RssSampler rss;
+        Stopwatch sw;
+        bool listed = false;
+        bool ok = core.OpenArchive(archive, indexOps);
+        if (ok) items = core.GetItems(indexOps, &listed);
+        double seconds = sw.Seconds();
+        core.CloseArchive();
+        ok = ok && listed && !items.empty() && FileSize(sidePath) != 0;
+        std::string json = ResultJson(corpus, fmt, threads, "tarball-index-build", ok, seconds,
+                                      corpus.totalBytes, items.size(), rss.Stop(), archiveBytes,
+                                      opt.stats);
+        json.insert(json.size() - 1, ",\"indexBytes\":" + std::to_string(FileSize(sidePath)));
+        out.Line(json);
+        if (!ok) return;
+    }
+
+    // First file in the second half of the walk
+    uint32_t target = (uint32_t)items.size() / 2;
+    while (target < items.size() && items[target].isDir) target++;
+    if (target == items.size()) return;
+    uint64_t targetBytes = items[target].size;
+
+    struct { const char* op; bool keepIndex; } runs[] = {
+        { "tarball-extract-one-indexed", true },
+        { "tarball-extract-one-full", false },
+    };
+    for (const auto& run : runs) {
+        if (!run.keepIndex) DeleteFileW(sidePath.c_str());
+        core.ResetStats();
+        RemoveTree(extractDir);
+        RssSampler rss;
+        Stopwatch sw;
+        bool ok = core.OpenArchive(archive, ops) && core.GetItemCount() > target &&
+                  core.ExtractFiles({ target }, extractDir, L"", nullptr, ops);
+        double seconds = sw.Seconds();
+        core.CloseArchive();
+        out.Line(ResultJson(corpus, fmt, threads, run.op, ok, seconds, targetBytes, 1,
+                            rss.Stop(), archiveBytes, opt.stats));
+    }
+    DeleteFileW(sidePath.c_str());
+    RemoveTree(extractDir);
+}
+
+void RunTarballCase(const Options& opt, const Corpus& corpus, const ArchiveFormat& fmt,
+                    uint32_t threads, ResultWriter& out) {
+    SevenZipCore& core = SevenZipCore::Instance();
+    std::wstring outDir = opt.workDir + L"\\out";
+    std::wstring tarFormat = L"tar" + fmt.extension;
+    std::wstring archive = outDir + L"\\" + corpus.name + L"." + tarFormat;
+    std::wstring extractDir = opt.workDir + L"\\x";
+    EnsureDir(outDir);
+
+    OperationOptions ops;
+    ops.numThreads = threads;
+    ops.blockSize = opt.blockSize;
+
+    // Counters are needed for the disk-bytes comparison even without --stats
+    core.EnableStats(true);
+
+    // Single-pass creation: Tar handler piped into the (parallel) compressor
+    core.ResetStats();
+    bool created;
+    {
+        RssSampler rss;
+        Stopwatch sw;
+        created = core.Compress({ corpus.root }, archive, tarFormat, nullptr, ops);
+        double seconds = sw.Seconds();
+        uint64_t written = BytesWritten();
+        std::string json = ResultJson(corpus, fmt, threads, "tarball-compress", created, seconds,
+                                      corpus.totalBytes, corpus.numFiles, rss.Stop(),
+                                      created ? FileSize(archive) : 0, opt.stats);
+        json.insert(json.size() - 1, ",\"diskBytesWritten\":" + std::to_string(written));
+        out.Line(json);
+    }
+    if (!created) {
+        core.EnableStats(opt.stats);
+        DeleteFileW(archive.c_str());
+        return;
+    }
+    uint64_t archiveBytes = FileSize(archive);
+
+    // Again with the parallel gzip workers on one NUMA node
+    if (opt.placement != ThreadPlacement::Default && fmt.name == L"GZip") {
+        OperationOptions placedOps = ops;
+        placedOps.threadPlacement = opt.placement;
+        std::wstring placedArchive = archive + L".placed";
+        DeleteFileW(placedArchive.c_str());
+        core.ResetStats();
+        RssSampler rss;
+        Stopwatch sw;
+        bool ok = core.Compress({ corpus.root }, placedArchive, tarFormat, nullptr, placedOps);
+        double seconds = sw.Seconds();
+        out.Line(ResultJson(corpus, fmt, threads, "tarball-compress-placed", ok, seconds,
+                            corpus.totalBytes, corpus.numFiles, rss.Stop(),
+                            FileSize(placedArchive), opt.stats));
+        DeleteFileW(placedArchive.c_str());
+    }
+
+    // Two passes: outer stream to an intermediate .tar, then the tar itself
+    core.ResetStats();
+    RemoveTree(extractDir);
+    {
+        RssSampler rss;
+        Stopwatch sw;
+        std::wstring stageDir = opt.workDir + L"\\stage";
+        bool ok = core.OpenArchive(archive, ops);
+        std::vector<ArchiveItem> items = ok ? core.GetItems() : std::vector<ArchiveItem>();
+        ok = ok && items.size() == 1 && core.Extract(stageDir, L"", nullptr, ops);
+        std::wstring innerTar = ok ? stageDir + L"\\" + items[0].path : L"";
+        ok = ok && core.OpenArchive(innerTar, ops) && core.Extract(extractDir, L"", nullptr, ops);
+        double seconds = sw.Seconds();
+        uint64_t written = BytesWritten();
+        core.CloseArchive();
+        RemoveTree(stageDir);
+        std::string json = ResultJson(corpus, fmt, threads, "tarball-two-pass", ok, seconds,
+                                      corpus.totalBytes, corpus.numFiles, rss.Stop(),
+                                      archiveBytes, opt.stats);
+        json.insert(json.size() - 1, ",\"diskBytesWritten\":" + std::to_string(written));
+        out.Line(json);
+    }
+
+    // One pass: outer decoder piped straight into the Tar handler
+    core.ResetStats();
+    RemoveTree(extractDir);
+    {
+        OperationOptions nested = ops;
+        nested.openNested = true;
+        RssSampler rss;
+        Stopwatch sw;
+        bool ok = core.OpenArchive(archive, nested) &&
+                  core.Extract(extractDir, L"", nullptr, nested);
+        double seconds = sw.Seconds();
+        uint64_t written = BytesWritten();
+        core.CloseArchive();
+        std::string json = ResultJson(corpus, fmt, threads, "tarball-one-pass", ok, seconds,
+                                      corpus.totalBytes, corpus.numFiles, rss.Stop(),
+                                      archiveBytes, opt.stats);
+        json.insert(json.size() - 1, ",\"diskBytesWritten\":" + std::to_string(written));
+        out.Line(json);
+    }
+
+    if (opt.seekIndex && _wcsicmp(fmt.name.c_str(), L"GZip") == 0) {
+        RunSeekIndexCase(opt, corpus, fmt, threads, archive, out);
+    }
+
+    core.EnableStats(opt.stats);
+    RemoveTree(extractDir);
+    DeleteFileW(archive.c_str());
+}
+
+bool ParseArgs(int argc, wchar_t** argv, Options& opt) {
+    for (int i = 1; i < argc; i++) {
+        std::wstring arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == L"--work" && hasValue) opt.workDir = argv[++i];
+        else if (arg == L"--threads" && hasValue) opt.threads = ParseList(argv[++i]);
+        else if (arg == L"--formats" && hasValue) opt.formats = SplitList(argv[++i]);
+        else if (arg == L"--corpora" && hasValue) opt.corpora = SplitList(argv[++i]);
+        else if (arg == L"--scale" && hasValue) opt.scale = _wtof(argv[++i]);
+        else if (arg == L"--json" && hasValue) opt.jsonPath = argv[++i];
+        else if (arg == L"--stats") opt.stats = true;
+        else if (arg == L"--cancel-after" && hasValue) opt.cancelAfterMs = (uint32_t)_wtoi(argv[++i]);
+        else if (arg == L"--extract-threads" && hasValue) opt.extractThreads = (uint32_t)_wtoi(argv[++i]);
+        else if (arg == L"--block-size" && hasValue) opt.blockSize = (uint64_t)_wtoi64(argv[++i]) << 20;
+        else if (arg == L"--tarball") opt.tarball = true;
+        else if (arg == L"--hash") opt.hash = true;
+        else if (arg == L"--skip-unchanged") opt.skipUnchanged = true;
+        else if (arg == L"--sparse") opt.sparse = true;
+        else if (arg == L"--batched-io") opt.batchedIo = true;
+        else if (arg == L"--seek-index") opt.seekIndex = true;
+        else if (arg == L"--read-ahead" && hasValue) opt.readAheadFiles = (uint32_t)_wtoi(argv[++i]);
+        else if (arg == L"--direct-io" && hasValue) opt.directIoThreshold = (uint64_t)_wtoi64(argv[++i]) << 20;
+        else if (arg == L"--memory-budget" && hasValue) opt.memoryBudget = (uint64_t)_wtoi64(argv[++i]) << 20;
+        else if (arg == L"--edit") opt.edit = true;
+        else if (arg == L"--convert") opt.convert = true;
+        else if (arg == L"--item-read") opt.itemRead = true;
+        else if (arg == L"--placement" && hasValue) {
+            std::wstring mode = argv[++i];
+            if (mode == L"node") opt.placement = ThreadPlacement::Node;
+            else if (mode == L"node-nosmt") opt.placement = ThreadPlacement::NodeNoSmt;
+            else return false;
+        }
+        else {
+            fwprintf(stderr, L"unknown or incomplete argument: %ls\n", arg.c_str());
+            return false;
+        }
+    }
+    return !opt.threads.empty() && opt.scale > 0;
+}
+
+} // namespace
+
+int wmain(int argc, wchar_t** argv) {
+    Options opt;
+    if (!ParseArgs(argc, argv, opt)) {
+        fwprintf(stderr, L"usage: sevenzipcore_bench [--work DIR] [--threads 1,2,4] "
+                         L"[--formats 7z,Zip] [--corpora tiny,huge,random,source,sparse] "
+                         L"[--scale F] [--json FILE] [--stats] [--cancel-after MS] "
+                         L"[--extract-threads N] [--block-size MB] [--tarball] [--hash] "
+                         L"[--skip-unchanged] [--sparse] [--direct-io MB] "
+                         L"[--batched-io] [--read-ahead N] [--seek-index] "
+                         L"[--memory-budget MB] [--placement node|node-nosmt] [--edit] "
+                         L"[--convert] [--item-read]\n");
+        return 2;
+    }
+
+    SevenZipCore& core = SevenZipCore::Instance();
+    core.EnableStats(opt.stats);
+    ResultWriter out(opt.jsonPath);
+    EnsureDir(opt.workDir);
+
+    if (opt.placement != ThreadPlacement::Default) {
+        const CpuTopology& topology = core.GetCpuTopology();
+        fwprintf(stderr, L"topology: %u logical processors, %u cores, %u NUMA nodes, %u L3\n",
+                 topology.logicalProcessors, (unsigned)topology.cores.size(),
+                 (unsigned)topology.nodes.size(), topology.caches);
+    }
+
+    for (const auto& name : opt.corpora) {
+        Stopwatch sw;
+        Corpus corpus = MakeCorpus(opt, name);
+        fwprintf(stderr, L"corpus %ls: %llu files, %llu bytes (%.1fs)\n", name.c_str(),
+                 (unsigned long long)corpus.numFiles, (unsigned long long)corpus.totalBytes,
+                 sw.Seconds());
+        if (corpus.numFiles == 0) continue;
+
+        if (opt.hash) {
+            for (uint32_t threads : opt.threads) {
+                RunHashFilesCase(opt, corpus, threads, out);
+            }
+        }
+
+        for (const auto& fmt : core.GetFormats()) {
+            if (!fmt.canUpdate) continue;
+            if (!opt.formats.empty() &&
+                std::none_of(opt.formats.begin(), opt.formats.end(), [&](const std::wstring& f) {
+                    return _wcsicmp(f.c_str(), fmt.name.c_str()) == 0;
+                })) {
+                continue;
+            }
+            for (uint32_t threads : opt.threads) {
+                RunCase(opt, corpus, fmt, threads, out);
+                if (opt.tarball && IsSingleStreamFormat(fmt.name)) {
+                    RunTarballCase(opt, corpus, fmt, threads, out);
+                }
+            }
+        }
+        RemoveTree(corpus.root);
+    }
+    return 0;
+}
@@ -0,0 +1,54 @@
+"""Plot sevenzipcore_scale_bench CSV output against entry count.
+
+usage: python plot_scale.py scale.csv [out.png]
+"""
+import csv
+import sys
+from collections import defaultdict
+
+import matplotlib.pyplot as plt
+
+METRICS = [
+    ("openSec", "OpenArchive (s)"),
+    ("encryptionScanSec", "Encryption scan (s)"),
+    ("getItemsSec", "GetItems (s)"),
+    ("getItemsNsPerItem", "GetItems ns/item"),
+    ("peakRssMB", "Peak working set (MB)"),
+    ("allocsPerItem", "Allocations per item"),
+    ("selectSec", "SelectMatching (s)"),
+    ("selectNsPerItem", "SelectMatching ns/item"),
+]
+
+
+def main():
+    if len(sys.argv) < 2:
+        print(__doc__)
+        return 2
+    rows = defaultdict(list)
+    with open(sys.argv[1], newline="") as f:
+        for row in csv.DictReader(f):
+            if row["ok"] == "1":
+                rows[row["format"]].append(row)
+
+    fig, axes = plt.subplots(2, 4, figsize=(20, 8))
+    for ax, (key, title) in zip(axes.flat, METRICS):
+        for fmt, series in sorted(rows.items()):
+            series.sort(key=lambda r: int(r["entries"]))
+            # Allocation columns are empty in release builds
+            ax.plot([int(r["entries"]) for r in series],
+                    [float(r[key]) if r[key] else float("nan") for r in series],
+                    marker="o", label=fmt)
+        ax.set_xscale("log")
+        ax.set_title(title)
+        ax.set_xlabel("entries")
+        ax.grid(True, which="both", alpha=0.3)
+    axes.flat[0].legend()
+    fig.tight_layout()
+    out = sys.argv[2] if len(sys.argv) > 2 else "scale.png"
+    fig.savefig(out)
+    print("wrote", out)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,97 @@
+// ArchiveProps.h - PROPVARIANT readers for IInArchive item/archive properties
+#pragma once
+
+#include <Windows.h>
+#include <PropIdl.h>
+#include <string>
+
+#include "Common/Common.h"
+#include "7zip/Archive/IArchive.h"
+#include "7zip/PropID.h"
+
+namespace ArchiveProps {
+
+inline bool ToUInt64(const PROPVARIANT& prop, UInt64& value) {
+    switch (prop.vt) {
+        case VT_UI1: value = prop.bVal; return true;
+        case VT_UI2: value = prop.uiVal; return true;
+        case VT_UI4: value = prop.ulVal; return true;
+        case VT_UI8: value = prop.uhVal.QuadPart; return true;
+        case VT_I4:  value = (UInt64)(Int64)prop.lVal; return true;
+        case VT_I8:  value = (UInt64)prop.hVal.QuadPart; return true;
+        default: return false;
+    }
+}
+
+// Numeric item property; returns false if the handler does not report it
+inline bool GetUInt64(IInArchive* archive, UInt32 index, PROPID propID, UInt64& value) {
+    PROPVARIANT prop;
+    PropVariantInit(&prop);
+    archive->GetProperty(index, propID, &prop);
+    bool defined = ToUInt64(prop, value);
+    PropVariantClear(&prop);
+    return defined;
+}
+
+inline UInt64 GetUInt64(IInArchive* archive, UInt32 index, PROPID propID) {
+    UInt64 value = 0;
+    GetUInt64(archive, index, propID, value);
+    return value;
+}
+
+inline bool GetBool(IInArchive* archive, UInt32 index, PROPID propID, bool& value) {
+    PROPVARIANT prop;
+    PropVariantInit(&prop);
+    archive->GetProperty(index, propID, &prop);
+    bool defined = (prop.vt == VT_BOOL);
+    value = defined && prop.boolVal != VARIANT_FALSE;
+    PropVariantClear(&prop);
+    return defined;
+}
+
+inline bool GetBool(IInArchive* archive, UInt32 index, PROPID propID) {
+    bool value = false;
+    GetBool(archive, index, propID, value);
+    return value;
+}
+
+inline std::wstring GetString(IInArchive* archive, UInt32 index, PROPID propID) {
+    PROPVARIANT prop;
+    PropVariantInit(&prop);
+    archive->GetProperty(index, propID, &prop);
+    std::wstring value = (prop.vt == VT_BSTR && prop.bstrVal) ? prop.bstrVal : L"";
+    PropVariantClear(&prop);
+    return value;
+}
+
+inline bool GetFileTime(IInArchive* archive, UInt32 index, PROPID propID, FILETIME& value) {
+    PROPVARIANT prop;
+    PropVariantInit(&prop);
+    archive->GetProperty(index, propID, &prop);
+    bool defined = (prop.vt == VT_FILETIME);
+    if (defined) value = prop.filetime;
+    PropVariantClear(&prop);
+    return defined;
+}
+
+// Archive-level property (e.g. kpidSolid)
+inline bool GetArchiveBool(IInArchive* archive, PROPID propID, bool& value) {
+    PROPVARIANT prop;
+    PropVariantInit(&prop);
+    archive->GetArchiveProperty(propID, &prop);
+    bool defined = (prop.vt == VT_BOOL);
+    value = defined && prop.boolVal != VARIANT_FALSE;
+    PropVariantClear(&prop);
+    return defined;
+}
+
+inline bool GetArchiveUInt64(IInArchive* archive, PROPID propID, UInt64& value) {
+    PROPVARIANT prop;
+    PropVariantInit(&prop);
+    archive->GetArchiveProperty(propID, &prop);
+    bool defined = ToUInt64(prop, value);
+    PropVariantClear(&prop);
+    return defined;
+}
+
+} // namespace ArchiveProps
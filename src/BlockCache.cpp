@@ -0,0 +1,97 @@
+// BlockCache.cpp - LRU cache of decoded item blocks for random-access item reads
+#include "BlockCache.h"
+#include "CoreStats.h"
+
+size_t CDecodedBlockCache::KeyHash::operator()(const DecodedBlockKey& key) const {
+    uint64_t h = key.source * 0x9E3779B97F4A7C15ull;
+    h ^= ((uint64_t)key.item << 32 | key.item) + 0x632BE59BD9B4E019ull + (h << 6) + (h >> 2);
+    h ^= key.block + 0x9E3779B97F4A7C15ull + (h << 6) + (h >> 2);
+    return (size_t)h;
+}
+
+CDecodedBlockCache::CDecodedBlockCache(uint64_t capacity) : m_capacity(capacity) {}
+
+void CDecodedBlockCache::SetCapacity(uint64_t bytes) {
+    std::lock_guard<std::mutex> guard(m_lock);
+    m_capacity = bytes;
+    EvictTo(m_capacity);
+}
+
+uint64_t CDecodedBlockCache::GetCapacity() const {
+    std::lock_guard<std::mutex> guard(m_lock);
+    return m_capacity;
+}
+
+uint64_t CDecodedBlockCache::NewSource() {
+    std::lock_guard<std::mutex> guard(m_lock);
+    return m_nextSource++;
+}
+
+CDecodedBlockCache::Block CDecodedBlockCache::Get(const DecodedBlockKey& key) {
+    Block result;
+    {
+        std::lock_guard<std::mutex> guard(m_lock);
+        auto found = m_index.find(key);
+        if (found != m_index.end()) {
+            m_lru.splice(m_lru.begin(), m_lru, found->second);
+            result = found->second->data;
+            m_hits++;
+        } else {
+            m_misses++;
+        }
+    }
+    CoreStats_Add(result ? CoreCounter::ItemCacheHits : CoreCounter::ItemCacheMisses);
+    return result;
+}
+
+bool CDecodedBlockCache::Contains(const DecodedBlockKey& key) const {
+    std::lock_guard<std::mutex> guard(m_lock);
+    return m_index.count(key) != 0;
+}
+
+void CDecodedBlockCache::Put(const DecodedBlockKey& key, Block data) {
+    if (!data) return;
+    std::lock_guard<std::mutex> guard(m_lock);
+    auto found = m_index.find(key);
+    if (found != m_index.end()) Erase(found->second);
+    if (data->size() > m_capacity) return;
+
+    EvictTo(m_capacity - data->size());
+    m_bytes += data->size();
+    m_lru.push_front({ key, std::move(data) });
+    m_index[key] = m_lru.begin();
+}
+
+void CDecodedBlockCache::DropSource(uint64_t source) {
+    std::lock_guard<std::mutex> guard(m_lock);
+    for (auto it = m_lru.begin(); it != m_lru.end();) {
+        auto next = std::next(it);
+        if (it->key.source == source) Erase(it);
+        it = next;
+    }
+}
+
+DecodedBlockCacheStats CDecodedBlockCache::GetStats() const {
+    std::lock_guard<std::mutex> guard(m_lock);
+    DecodedBlockCacheStats stats;
+    stats.capacity = m_capacity;
+    stats.residentBytes = m_bytes;
+    stats.blocks = m_lru.size();
+    stats.hits = m_hits;
+    stats.misses = m_misses;
+    stats.evictions = m_evictions;
+    return stats;
+}
+
+void CDecodedBlockCache::EvictTo(uint64_t bytes) {
+    while (m_bytes > bytes && !m_lru.empty()) {
+        Erase(std::prev(m_lru.end()));
+        m_evictions++;
+    }
+}
+
+void CDecodedBlockCache::Erase(std::list<Entry>::iterator it) {
+    m_bytes -= it->data->size();
+    m_index.erase(it->key);
+    m_lru.erase(it);
+}
@@ -0,0 +1,94 @@
+// BlockCache.h - LRU cache of decoded item blocks for random-access item reads
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+// Decoded bytes per block; the last block of an item may be shorter
+static const uint32_t kDecodedBlockSize = 1 << 18;
+
+struct DecodedBlockKey {
+    uint64_t source;    // Archive, from CDecodedBlockCache::NewSource
+    uint32_t item;
+    uint64_t block;     // Item offset / kDecodedBlockSize
+
+    bool operator==(const DecodedBlockKey& other) const {
+        return source == other.source && item == other.item && block == other.block;
+    }
+};
+
+// Counters since the cache was created
+struct DecodedBlockCacheStats {
+    uint64_t capacity = 0;
+    uint64_t residentBytes = 0;
+    uint64_t blocks = 0;
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t evictions = 0;
+
+    double HitRate() const {
+        uint64_t lookups = hits + misses;
+        return lookups ? (double)hits / lookups : 0.0;
+    }
+};
+
+// Blocks of decoded item data, shared by every reader and bounded by a byte
+// capacity; the least recently used blocks go first. Blocks are immutable
+// once stored, so a reader keeps using one that was evicted meanwhile.
+class CDecodedBlockCache {
+public:
+    using Block = std::shared_ptr<const std::vector<uint8_t>>;
+
+    explicit CDecodedBlockCache(uint64_t capacity);
+
+    // 0 = store nothing; shrinking evicts at once
+    void SetCapacity(uint64_t bytes);
+    uint64_t GetCapacity() const;
+
+    // Key space of a newly opened archive
+    uint64_t NewSource();
+
+    // The block, now most recently used, or null. Counts a hit or a miss
+    // (also as CoreCounter::ItemCacheHits/ItemCacheMisses).
+    Block Get(const DecodedBlockKey& key);
+
+    // Presence test that neither counts nor touches the LRU order
+    bool Contains(const DecodedBlockKey& key) const;
+
+    // Stores or replaces the block; one larger than the capacity is dropped
+    void Put(const DecodedBlockKey& key, Block data);
+
+    // Forgets every block of a closed archive
+    void DropSource(uint64_t source);
+
+    DecodedBlockCacheStats GetStats() const;
+
+private:
+    struct KeyHash {
+        size_t operator()(const DecodedBlockKey& key) const;
+    };
+
+    struct Entry {
+        DecodedBlockKey key;
+        Block data;
+    };
+
+    // Lock held
+    void EvictTo(uint64_t bytes);
+    void Erase(std::list<Entry>::iterator it);
+
+    mutable std::mutex m_lock;
+    std::list<Entry> m_lru;     // Most recently used first
+    std::unordered_map<DecodedBlockKey, std::list<Entry>::iterator, KeyHash> m_index;
+    uint64_t m_capacity;
+    uint64_t m_bytes = 0;
+    uint64_t m_nextSource = 1;
+    uint64_t m_hits = 0;
+    uint64_t m_misses = 0;
+    uint64_t m_evictions = 0;
+};
@@ -0,0 +1,89 @@
+// CancellationToken.cpp - Bounded-latency cancellation for SevenZipCore operations
+#include "CancellationToken.h"
+#include "CoreStats.h"
+
+#include <algorithm>
+#include <chrono>
+
+CancellationToken::CancellationToken(uint32_t latencyBoundMs)
+    : m_boundMs(latencyBoundMs ? latencyBoundMs : 1)
+{
+}
+
+CancellationToken::~CancellationToken() {
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        m_shutdown = true;
+        for (auto& thread : m_threads) {
+            CloseHandle(thread.second);
+        }
+        m_threads.clear();
+    }
+    m_cv.notify_all();
+    if (m_watchdog.joinable()) {
+        m_watchdog.join();
+    }
+}
+
+void CancellationToken::Cancel() {
+    std::lock_guard<std::mutex> lock(m_lock);
+    if (m_cancelled.load()) return;
+    m_cancelNs.store(CoreStatsDetail::NowNs());
+    m_cancelled.store(true);
+    if (!m_shutdown && !m_watchdog.joinable()) {
+        m_watchdog = std::thread(&CancellationToken::WatchdogLoop, this);
+    }
+    m_cv.notify_all();
+}
+
+void CancellationToken::Observe() {
+    if (m_observedNs.load(std::memory_order_relaxed) >= 0) return;
+    int64_t latency = (int64_t)(CoreStatsDetail::NowNs() - m_cancelNs.load());
+    int64_t expected = -1;
+    if (m_observedNs.compare_exchange_strong(expected, latency)) {
+        m_cv.notify_all();
+    }
+}
+
+double CancellationToken::GetObservedLatencyMs() const {
+    int64_t ns = m_observedNs.load();
+    return ns < 0 ? -1.0 : ns / 1e6;
+}
+
+void CancellationToken::AttachThread() {
+    HANDLE handle = NULL;
+    DuplicateHandle(GetCurrentProcess(), GetCurrentThread(), GetCurrentProcess(), &handle,
+                    THREAD_TERMINATE, FALSE, 0);
+    std::lock_guard<std::mutex> lock(m_lock);
+    m_threads.push_back({ GetCurrentThreadId(), handle });
+}
+
+void CancellationToken::DetachThread() {
+    std::lock_guard<std::mutex> lock(m_lock);
+    DWORD tid = GetCurrentThreadId();
+    auto it = std::find_if(m_threads.begin(), m_threads.end(),
+                           [tid](const std::pair<DWORD, HANDLE>& t) { return t.first == tid; });
+    if (it != m_threads.end()) {
+        if (it->second) CloseHandle(it->second);
+        m_threads.erase(it);
+    }
+}
+
+void CancellationToken::WatchdogLoop() {
+    std::unique_lock<std::mutex> lock(m_lock);
+    auto bound = std::chrono::milliseconds(m_boundMs);
+
+    // Give the workers one full bound to reach a check point on their own
+    m_cv.wait_for(lock, bound, [this] { return m_shutdown || m_observedNs.load() >= 0; });
+
+    // Then keep interrupting blocking I/O until a check point sees the flag.
+    // CancelSynchronousIo is a no-op for a thread that is not inside a
+    // synchronous I/O call, so repeating it is harmless.
+    while (!m_shutdown && m_observedNs.load() < 0 && !m_threads.empty()) {
+        for (const auto& thread : m_threads) {
+            if (thread.second) CancelSynchronousIo(thread.second);
+        }
+        m_cv.wait_for(lock, bound / 4 + std::chrono::milliseconds(1),
+                      [this] { return m_shutdown || m_observedNs.load() >= 0; });
+    }
+}
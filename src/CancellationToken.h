@@ -0,0 +1,79 @@
+// CancellationToken.h - Bounded-latency cancellation for SevenZipCore operations
+#pragma once
+
+#include <Windows.h>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Shared between the caller and a running operation. The operation polls the
+// token in its stream Read/Write calls, GetStream and enumeration loops. If
+// the worker does not reach a check point within the latency bound (e.g. it is
+// stuck in CreateFileW on a slow share), a watchdog cancels its pending
+// synchronous I/O so the blocking call returns and the operation unwinds.
+class CancellationToken {
+public:
+    explicit CancellationToken(uint32_t latencyBoundMs = 250);
+    ~CancellationToken();
+
+    CancellationToken(const CancellationToken&) = delete;
+    CancellationToken& operator=(const CancellationToken&) = delete;
+
+    // Request cancellation (any thread)
+    void Cancel();
+    bool IsCancelled() const { return m_cancelled.load(std::memory_order_relaxed); }
+
+    // Check point: returns true when the operation must stop. The first
+    // observation after Cancel() records the cancellation latency.
+    bool Check() {
+        if (!m_cancelled.load(std::memory_order_relaxed)) return false;
+        Observe();
+        return true;
+    }
+
+    uint32_t GetLatencyBound() const { return m_boundMs; }
+
+    // Time from Cancel() to the first check point that observed it (ms),
+    // or -1 if cancellation has not been observed
+    double GetObservedLatencyMs() const;
+
+    // Worker threads register for the duration of an operation so the
+    // watchdog knows whose I/O to interrupt
+    void AttachThread();
+    void DetachThread();
+
+private:
+    void Observe();
+    void WatchdogLoop();
+
+    std::atomic<bool> m_cancelled{false};
+    std::atomic<uint64_t> m_cancelNs{0};
+    std::atomic<int64_t> m_observedNs{-1};
+    uint32_t m_boundMs;
+
+    std::mutex m_lock;
+    std::condition_variable m_cv;
+    std::vector<std::pair<DWORD, HANDLE>> m_threads;
+    std::thread m_watchdog;
+    bool m_shutdown = false;
+};
+
+// Attaches the calling thread to a token for the lifetime of the scope
+class CancellationScope {
+public:
+    explicit CancellationScope(CancellationToken* token) : m_token(token) {
+        if (m_token) m_token->AttachThread();
+    }
+    ~CancellationScope() {
+        if (m_token) m_token->DetachThread();
+    }
+
+    CancellationScope(const CancellationScope&) = delete;
+    CancellationScope& operator=(const CancellationScope&) = delete;
+
+private:
+    CancellationToken* m_token;
+};
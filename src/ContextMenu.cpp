@@ -12,7 +12,7 @@ LONG g_cDllRef = 0;
 static const wchar_t* g_archiveExtensions[] = {
     L".7z", L".zip", L".rar", L".tar", L".gz", L".bz2",
     L".xz", L".iso", L".cab", L".arj", L".lzh", L".tgz",
-    L".tbz2", L".wim"
+    L".tbz2", L".txz", L".wim", L".zst", L".tzst"
 };
 
 // Localized strings
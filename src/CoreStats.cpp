@@ -0,0 +1,179 @@
+// CoreStats.cpp - Per-phase timers and counters for SevenZipCore operations
+#include "CoreStats.h"
+
+#include <Windows.h>
+#include <chrono>
+#include <cstdarg>
+#include <cstdio>
+#include <mutex>
+#include <vector>
+
+namespace {
+
+struct PhaseAccum {
+    std::atomic<uint64_t> calls{0};
+    std::atomic<uint64_t> totalNs{0};
+    std::atomic<uint64_t> maxNs{0};
+};
+
+struct TraceEvent {
+    CorePhase phase;
+    DWORD tid;
+    uint64_t startNs;
+    uint64_t durNs;
+};
+
+// Cap the timeline so a multi-million item run cannot exhaust memory
+const size_t kMaxTraceEvents = 1 << 20;
+
+PhaseAccum g_phases[(size_t)CorePhase::Count];
+std::atomic<uint64_t> g_counters[(size_t)CoreCounter::Count];
+std::mutex g_traceLock;
+std::vector<TraceEvent> g_traceEvents;
+uint64_t g_epochNs = 0;
+
+const char* const kPhaseNames[] = {
+    "Open", "HeaderParse", "PropertyLookup", "EncryptionScan", "Enumerate", "Plan",
+    "Decode", "Encode", "Hash", "Read", "InputWait", "MemoryWait", "Write", "FileCreate",
+    "FileOpen", "FileClose", "DirCreate",
+};
+static_assert(sizeof(kPhaseNames) / sizeof(kPhaseNames[0]) == (size_t)CorePhase::Count,
+              "phase names out of sync");
+
+const char* const kCounterNames[] = {
+    "itemsEnumerated", "itemsExtracted", "itemsSkipped", "itemsCompressed",
+    "filesCreated", "dirsCreated", "propertyLookups", "bytesRead", "bytesWritten",
+    "bytesSparse", "plannedDecodeBytes", "bytesHashed", "prefetchHits", "prefetchMisses",
+    "itemCacheHits", "itemCacheMisses",
+};
+static_assert(sizeof(kCounterNames) / sizeof(kCounterNames[0]) == (size_t)CoreCounter::Count,
+              "counter names out of sync");
+
+void AppendFormat(std::string& out, const char* fmt, ...) {
+    char buf[256];
+    va_list args;
+    va_start(args, fmt);
+    int len = vsnprintf(buf, sizeof(buf), fmt, args);
+    va_end(args);
+    if (len > 0) out.append(buf, (size_t)len < sizeof(buf) ? (size_t)len : sizeof(buf) - 1);
+}
+
+} // namespace
+
+thread_local CoreScopedPhase* CoreScopedPhase::t_current = nullptr;
+
+namespace CoreStatsDetail {
+
+std::atomic<bool> g_enabled{false};
+std::atomic<bool> g_trace{false};
+
+uint64_t NowNs() {
+    return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void AddCounter(CoreCounter counter, uint64_t value) {
+    g_counters[(size_t)counter].fetch_add(value, std::memory_order_relaxed);
+}
+
+void AddPhase(CorePhase phase, uint64_t selfNs, uint64_t startNs, uint64_t totalNs) {
+    PhaseAccum& acc = g_phases[(size_t)phase];
+    acc.calls.fetch_add(1, std::memory_order_relaxed);
+    acc.totalNs.fetch_add(selfNs, std::memory_order_relaxed);
+    uint64_t prev = acc.maxNs.load(std::memory_order_relaxed);
+    while (selfNs > prev &&
+           !acc.maxNs.compare_exchange_weak(prev, selfNs, std::memory_order_relaxed)) {
+    }
+
+    if (g_trace.load(std::memory_order_relaxed)) {
+        std::lock_guard<std::mutex> lock(g_traceLock);
+        if (g_traceEvents.size() < kMaxTraceEvents) {
+            g_traceEvents.push_back({ phase, GetCurrentThreadId(), startNs, totalNs });
+        }
+    }
+}
+
+} // namespace CoreStatsDetail
+
+const char* CorePhaseName(CorePhase phase) {
+    return (size_t)phase < (size_t)CorePhase::Count ? kPhaseNames[(size_t)phase] : "";
+}
+
+const char* CoreCounterName(CoreCounter counter) {
+    return (size_t)counter < (size_t)CoreCounter::Count ? kCounterNames[(size_t)counter] : "";
+}
+
+void CoreStats_Enable(bool enable, bool trace) {
+    {
+        std::lock_guard<std::mutex> lock(g_traceLock);
+        if (trace && !CoreStatsDetail::g_trace.load()) {
+            g_epochNs = CoreStatsDetail::NowNs();
+        }
+    }
+    CoreStatsDetail::g_trace.store(enable && trace);
+    CoreStatsDetail::g_enabled.store(enable);
+}
+
+bool CoreStats_IsEnabled() {
+    return CoreStatsDetail::g_enabled.load(std::memory_order_relaxed);
+}
+
+void CoreStats_Reset() {
+    for (auto& acc : g_phases) {
+        acc.calls.store(0);
+        acc.totalNs.store(0);
+        acc.maxNs.store(0);
+    }
+    for (auto& counter : g_counters) {
+        counter.store(0);
+    }
+    std::lock_guard<std::mutex> lock(g_traceLock);
+    g_traceEvents.clear();
+    g_epochNs = CoreStatsDetail::NowNs();
+}
+
+CoreStats CoreStats_Snapshot() {
+    CoreStats stats;
+    for (size_t i = 0; i < (size_t)CorePhase::Count; i++) {
+        stats.phases[i].calls = g_phases[i].calls.load(std::memory_order_relaxed);
+        stats.phases[i].totalNs = g_phases[i].totalNs.load(std::memory_order_relaxed);
+        stats.phases[i].maxNs = g_phases[i].maxNs.load(std::memory_order_relaxed);
+    }
+    for (size_t i = 0; i < (size_t)CoreCounter::Count; i++) {
+        stats.counters[i] = g_counters[i].load(std::memory_order_relaxed);
+    }
+    return stats;
+}
+
+std::string CoreStats::ToJson() const {
+    std::string out = "{\"phases\":{";
+    for (size_t i = 0; i < (size_t)CorePhase::Count; i++) {
+        const PhaseStats& p = phases[i];
+        AppendFormat(out, "%s\"%s\":{\"calls\":%llu,\"totalMs\":%.3f,\"maxMs\":%.3f}",
+                     i ? "," : "", kPhaseNames[i], (unsigned long long)p.calls,
+                     p.totalNs / 1e6, p.maxNs / 1e6);
+    }
+    out += "},\"counters\":{";
+    for (size_t i = 0; i < (size_t)CoreCounter::Count; i++) {
+        AppendFormat(out, "%s\"%s\":%llu", i ? "," : "", kCounterNames[i],
+                     (unsigned long long)counters[i]);
+    }
+    out += "}}";
+    return out;
+}
+
+std::string CoreStats_TraceJson() {
+    std::lock_guard<std::mutex> lock(g_traceLock);
+    std::string out = "{\"traceEvents\":[";
+    DWORD pid = GetCurrentProcessId();
+    for (size_t i = 0; i < g_traceEvents.size(); i++) {
+        const TraceEvent& e = g_traceEvents[i];
+        uint64_t ts = (e.startNs > g_epochNs) ? e.startNs - g_epochNs : 0;
+        AppendFormat(out, "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%lu,\"tid\":%lu,"
+                     "\"ts\":%.3f,\"dur\":%.3f}",
+                     i ? "," : "", kPhaseNames[(size_t)e.phase], (unsigned long)pid,
+                     (unsigned long)e.tid, ts / 1e3, e.durNs / 1e3);
+    }
+    out += "],\"displayTimeUnit\":\"ms\"}";
+    return out;
+}
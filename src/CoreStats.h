@@ -0,0 +1,135 @@
+// CoreStats.h - Per-phase timers and counters for SevenZipCore operations
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+// Phases of an operation. Time is attributed exclusively: a phase that runs
+// inside another phase (e.g. Write inside Decode) is subtracted from its parent.
+enum class CorePhase : uint32_t {
+    Open,               // Opening the archive file
+    HeaderParse,        // IInArchive::Open (signature + header parsing)
+    PropertyLookup,     // IInArchive::GetProperty calls
+    EncryptionScan,     // Per-item kpidEncrypted scan in OpenArchive
+    Enumerate,          // Item enumeration (GetItems, source tree walk)
+    Plan,               // Extraction planning (solid block lookup)
+    Decode,             // Time inside IInArchive::Extract not spent in callbacks
+    Encode,             // Time inside IOutArchive::UpdateItems not spent in callbacks
+    Hash,               // Hashing file or item data (HashFiles, HashArchiveItems)
+    Read,               // Reading source files
+    InputWait,          // Encoder waiting for a source file still being read ahead
+    MemoryWait,         // Compress waiting for room under the memory budget
+    Write,              // Writing extracted files / archive output
+    FileCreate,         // Creating output files
+    FileOpen,           // Opening source files
+    FileClose,          // Closing files
+    DirCreate,          // Creating directories
+    Count
+};
+
+enum class CoreCounter : uint32_t {
+    ItemsEnumerated,
+    ItemsExtracted,
+    ItemsSkipped,
+    ItemsCompressed,
+    FilesCreated,
+    DirsCreated,
+    PropertyLookups,
+    BytesRead,
+    BytesWritten,
+    BytesSparse,        // Zero runs left as holes instead of written
+    PlannedDecodeBytes,
+    BytesHashed,
+    PrefetchHits,       // Source files served from read-ahead
+    PrefetchMisses,     // Source files opened on demand despite read-ahead
+    ItemCacheHits,      // Item reader blocks served from the decoded-block cache
+    ItemCacheMisses,    // Item reader blocks that had to be decoded
+    Count
+};
+
+struct PhaseStats {
+    uint64_t calls = 0;
+    uint64_t totalNs = 0;
+    uint64_t maxNs = 0;
+};
+
+// Snapshot of the collected statistics
+struct CoreStats {
+    PhaseStats phases[(size_t)CorePhase::Count];
+    uint64_t counters[(size_t)CoreCounter::Count] = {};
+
+    const PhaseStats& Phase(CorePhase phase) const { return phases[(size_t)phase]; }
+    uint64_t Counter(CoreCounter counter) const { return counters[(size_t)counter]; }
+
+    // {"phases":{"Decode":{"calls":..,"totalMs":..,"maxMs":..},..},"counters":{..}}
+    std::string ToJson() const;
+};
+
+const char* CorePhaseName(CorePhase phase);
+const char* CoreCounterName(CoreCounter counter);
+
+//////////////////////////////////////////////////////////////////////////////
+// Collector
+//////////////////////////////////////////////////////////////////////////////
+
+namespace CoreStatsDetail {
+    extern std::atomic<bool> g_enabled;
+    extern std::atomic<bool> g_trace;
+
+    void AddCounter(CoreCounter counter, uint64_t value);
+    void AddPhase(CorePhase phase, uint64_t selfNs, uint64_t startNs, uint64_t totalNs);
+    uint64_t NowNs();
+}
+
+// Enable/disable collection. Trace events are only recorded when both are on.
+void CoreStats_Enable(bool enable, bool trace);
+bool CoreStats_IsEnabled();
+void CoreStats_Reset();
+CoreStats CoreStats_Snapshot();
+
+// Chrome trace-event timeline ({"traceEvents":[...]}), loadable in
+// chrome://tracing or Perfetto
+std::string CoreStats_TraceJson();
+
+inline void CoreStats_Add(CoreCounter counter, uint64_t value = 1) {
+    if (CoreStatsDetail::g_enabled.load(std::memory_order_relaxed)) {
+        CoreStatsDetail::AddCounter(counter, value);
+    }
+}
+
+// RAII phase timer. When collection is disabled this is a single relaxed load.
+class CoreScopedPhase {
+public:
+    explicit CoreScopedPhase(CorePhase phase)
+        : m_phase(phase)
+        , m_active(CoreStatsDetail::g_enabled.load(std::memory_order_relaxed))
+    {
+        if (m_active) {
+            m_parent = t_current;
+            t_current = this;
+            m_start = CoreStatsDetail::NowNs();
+        }
+    }
+
+    ~CoreScopedPhase() {
+        if (!m_active) return;
+        uint64_t total = CoreStatsDetail::NowNs() - m_start;
+        t_current = m_parent;
+        if (m_parent) m_parent->m_childNs += total;
+        uint64_t self = (total > m_childNs) ? total - m_childNs : 0;
+        CoreStatsDetail::AddPhase(m_phase, self, m_start, total);
+    }
+
+    CoreScopedPhase(const CoreScopedPhase&) = delete;
+    CoreScopedPhase& operator=(const CoreScopedPhase&) = delete;
+
+private:
+    CorePhase m_phase;
+    bool m_active;
+    uint64_t m_start = 0;
+    uint64_t m_childNs = 0;
+    CoreScopedPhase* m_parent = nullptr;
+
+    static thread_local CoreScopedPhase* t_current;
+};
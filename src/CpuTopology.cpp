@@ -0,0 +1,172 @@
+// CpuTopology.cpp - Processor topology (cores, SMT siblings, NUMA nodes) and thread placement
+#include "CpuTopology.h"
+
+#include <algorithm>
+#include <mutex>
+#include <thread>
+
+static BYTE LowestBit(KAFFINITY mask) {
+    BYTE bit = 0;
+    while (bit < sizeof(KAFFINITY) * 8 - 1 && !(mask & ((KAFFINITY)1 << bit))) bit++;
+    return bit;
+}
+
+static uint32_t CountBits(KAFFINITY mask) {
+    uint32_t count = 0;
+    for (; mask; mask &= mask - 1) count++;
+    return count;
+}
+
+static bool Contains(const GROUP_AFFINITY& outer, WORD group, KAFFINITY mask) {
+    return outer.Group == group && (outer.Mask & mask) == mask;
+}
+
+static CpuTopology DetectTopology() {
+    CpuTopology topology;
+    std::vector<GROUP_AFFINITY> nodeMasks;
+    std::vector<GROUP_AFFINITY> cacheMasks;
+
+    DWORD length = 0;
+    GetLogicalProcessorInformationEx(RelationAll, nullptr, &length);
+    std::vector<BYTE> buffer(length);
+    if (length && GetLogicalProcessorInformationEx(
+            RelationAll, (PSYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX)buffer.data(), &length)) {
+        for (DWORD offset = 0; offset < length;) {
+            auto* info = (PSYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX)(buffer.data() + offset);
+            if (info->Relationship == RelationProcessorCore) {
+                CpuCore core = {};
+                core.group = info->Processor.GroupMask[0].Group;
+                core.mask = info->Processor.GroupMask[0].Mask;
+                topology.cores.push_back(core);
+                topology.logicalProcessors += CountBits(core.mask);
+            } else if (info->Relationship == RelationNumaNode) {
+                CpuNode node;
+                node.number = info->NumaNode.NodeNumber;
+                topology.nodes.push_back(node);
+                nodeMasks.push_back(info->NumaNode.GroupMask);
+            } else if (info->Relationship == RelationCache && info->Cache.Level == 3) {
+                cacheMasks.push_back(info->Cache.GroupMask);
+            }
+            offset += info->Size;
+        }
+    }
+
+    if (topology.cores.empty()) {
+        topology = CpuTopology();
+        nodeMasks.clear();
+        cacheMasks.clear();
+        uint32_t count = std::min<uint32_t>(std::max(1u, std::thread::hardware_concurrency()),
+                                            sizeof(KAFFINITY) * 8);
+        for (uint32_t i = 0; i < count; i++) {
+            topology.cores.push_back({ 0, (KAFFINITY)1 << i, 0, 0 });
+        }
+        topology.logicalProcessors = count;
+    }
+    if (topology.nodes.empty()) {
+        topology.nodes.push_back(CpuNode{ 0, {} });
+        nodeMasks.clear();
+    }
+
+    // Only a node's first processor group is reported here; cores of a
+    // node that spans groups, or of no node, are counted with node 0
+    for (uint32_t i = 0; i < topology.cores.size(); i++) {
+        CpuCore& core = topology.cores[i];
+        for (uint32_t n = 0; n < nodeMasks.size(); n++) {
+            if (Contains(nodeMasks[n], core.group, core.mask)) {
+                core.node = n;
+                break;
+            }
+        }
+        core.cache = core.node;
+        for (uint32_t c = 0; c < cacheMasks.size(); c++) {
+            if (Contains(cacheMasks[c], core.group, core.mask)) {
+                core.cache = c;
+                break;
+            }
+        }
+        topology.nodes[core.node].cores.push_back(i);
+    }
+    topology.caches = cacheMasks.empty() ? (uint32_t)topology.nodes.size()
+                                         : (uint32_t)cacheMasks.size();
+    return topology;
+}
+
+const CpuTopology& CpuTopology::Get() {
+    static const CpuTopology topology = DetectTopology();
+    return topology;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// CNodePlacement
+//////////////////////////////////////////////////////////////////////////////
+
+static std::mutex g_nodeLock;
+static std::vector<uint32_t> g_nodeUsers;  // Active placements per node
+
+CNodePlacement::CNodePlacement(ThreadPlacement mode) : m_mode(mode) {
+    if (mode == ThreadPlacement::Default) return;
+    const CpuTopology& topology = CpuTopology::Get();
+    {
+        std::lock_guard<std::mutex> guard(g_nodeLock);
+        g_nodeUsers.resize(topology.nodes.size());
+        m_node = 0;
+        for (uint32_t n = 0; n < topology.nodes.size(); n++) {
+            if (topology.nodes[n].cores.empty()) continue;
+            if (topology.nodes[m_node].cores.empty() || g_nodeUsers[n] < g_nodeUsers[m_node]) {
+                m_node = n;
+            }
+        }
+        g_nodeUsers[m_node]++;
+    }
+
+    const CpuNode& node = topology.nodes[m_node];
+    if (node.cores.empty()) return;
+    m_affinity.Group = topology.cores[node.cores[0]].group;
+
+    // One processor of every core first, then the SMT siblings, so two
+    // workers share a core only once every core has one
+    std::vector<KAFFINITY> remaining;
+    for (uint32_t index : node.cores) {
+        const CpuCore& core = topology.cores[index];
+        if (core.group != m_affinity.Group) continue;
+        KAFFINITY first = core.mask & (~core.mask + 1);
+        m_affinity.Mask |= (mode == ThreadPlacement::NodeNoSmt) ? first : core.mask;
+        m_slots.push_back({ core.group, LowestBit(first), 0 });
+        remaining.push_back(core.mask & ~first);
+    }
+    if (mode == ThreadPlacement::Node) {
+        for (bool any = true; any;) {
+            any = false;
+            for (KAFFINITY& mask : remaining) {
+                if (!mask) continue;
+                KAFFINITY next = mask & (~mask + 1);
+                m_slots.push_back({ m_affinity.Group, LowestBit(next), 0 });
+                mask &= ~next;
+                any = true;
+            }
+        }
+    }
+}
+
+CNodePlacement::~CNodePlacement() {
+    if (m_mode == ThreadPlacement::Default) return;
+    std::lock_guard<std::mutex> guard(g_nodeLock);
+    g_nodeUsers[m_node]--;
+}
+
+void CNodePlacement::Pin(uint32_t worker) const {
+    if (m_slots.empty()) return;
+    SetThreadGroupAffinity(GetCurrentThread(), &m_affinity, nullptr);
+    PROCESSOR_NUMBER ideal = m_slots[worker % m_slots.size()];
+    SetThreadIdealProcessorEx(GetCurrentThread(), &ideal, nullptr);
+}
+
+CScopedThreadPin::CScopedThreadPin(const CNodePlacement& placement, uint32_t worker) {
+    if (!placement.IsActive()) return;
+    m_pinned = GetThreadGroupAffinity(GetCurrentThread(), &m_previous) != FALSE;
+    if (m_pinned) placement.Pin(worker);
+}
+
+CScopedThreadPin::~CScopedThreadPin() {
+    if (m_pinned) SetThreadGroupAffinity(GetCurrentThread(), &m_previous, nullptr);
+}
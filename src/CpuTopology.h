@@ -0,0 +1,81 @@
+// CpuTopology.h - Processor topology (cores, SMT siblings, NUMA nodes) and thread placement
+#pragma once
+
+#include <Windows.h>
+#include <cstdint>
+#include <vector>
+
+// How the threads of one coder are spread over the machine
+enum class ThreadPlacement : uint32_t {
+    Default,        // Left to the scheduler
+    Node,           // All on one NUMA node: the one with the fewest coders
+    NodeNoSmt,      // As Node, one thread per physical core (no SMT siblings)
+};
+
+// One physical core; mask holds its logical processors (SMT siblings)
+struct CpuCore {
+    WORD group;
+    KAFFINITY mask;
+    uint32_t node;          // Index into CpuTopology::nodes
+    uint32_t cache;         // Index of its last-level cache (L3 domain)
+};
+
+struct CpuNode {
+    uint32_t number;                // NUMA node number
+    std::vector<uint32_t> cores;    // Indices into CpuTopology::cores
+};
+
+struct CpuTopology {
+    std::vector<CpuCore> cores;
+    std::vector<CpuNode> nodes;
+    uint32_t logicalProcessors = 0;
+    uint32_t caches = 0;            // Last-level cache domains
+
+    // Detected on first use (GetLogicalProcessorInformationEx); a failure
+    // yields one node of hardware_concurrency() single-thread cores
+    static const CpuTopology& Get();
+};
+
+// Claims a NUMA node for one coder until destroyed. Concurrent placements
+// take the least used node, so coders spread out while each coder's
+// threads, and the memory they touch first (Windows allocates physical
+// pages on the node of the touching thread), stay on its node.
+class CNodePlacement {
+public:
+    explicit CNodePlacement(ThreadPlacement mode);
+    ~CNodePlacement();
+
+    CNodePlacement(const CNodePlacement&) = delete;
+    CNodePlacement& operator=(const CNodePlacement&) = delete;
+
+    bool IsActive() const { return !m_slots.empty(); }
+    uint32_t GetNode() const { return m_node; }
+
+    // Processors of the node the workers may use (one per core for
+    // NodeNoSmt); 0 when inactive
+    uint32_t GetThreadCount() const { return (uint32_t)m_slots.size(); }
+
+    // Restricts the calling thread to the node (its first processor group)
+    // with the worker's processor as the ideal one. No-op when inactive.
+    void Pin(uint32_t worker) const;
+
+private:
+    ThreadPlacement m_mode;
+    uint32_t m_node = 0;
+    GROUP_AFFINITY m_affinity = {};         // Allowed processors
+    std::vector<PROCESSOR_NUMBER> m_slots;  // Ideal processor per worker
+};
+
+// Pins the calling thread for a scope and restores its affinity after
+class CScopedThreadPin {
+public:
+    CScopedThreadPin(const CNodePlacement& placement, uint32_t worker = 0);
+    ~CScopedThreadPin();
+
+    CScopedThreadPin(const CScopedThreadPin&) = delete;
+    CScopedThreadPin& operator=(const CScopedThreadPin&) = delete;
+
+private:
+    bool m_pinned = false;
+    GROUP_AFFINITY m_previous = {};
+};
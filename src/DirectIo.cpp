@@ -0,0 +1,207 @@
+// DirectIo.cpp - Unbuffered (FILE_FLAG_NO_BUFFERING) sequential file I/O
+#include "DirectIo.h"
+#include "CoreStats.h"
+
+#include <algorithm>
+#include <cstring>
+
+static Byte* AllocAligned() {
+    return (Byte*)VirtualAlloc(NULL, kDirectIoChunk, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+}
+
+static void FreeAligned(Byte* buffer) {
+    if (buffer) VirtualFree(buffer, 0, MEM_RELEASE);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// CDirectFileReader
+//////////////////////////////////////////////////////////////////////////////
+
+CDirectFileReader::CDirectFileReader(HANDLE hFile)
+    : m_hFile(hFile)
+    , m_nextOffset(0)
+    , m_cur(0)
+    , m_pos(0)
+    , m_avail(0)
+    , m_eof(false)
+    , m_error(S_OK)
+{
+    for (int slot = 0; slot < 2; slot++) {
+        m_buffers[slot] = AllocAligned();
+        memset(&m_ov[slot], 0, sizeof(m_ov[slot]));
+        m_ov[slot].hEvent = CreateEventW(NULL, TRUE, FALSE, NULL);
+        m_pending[slot] = false;
+    }
+    if (IsValid()) m_error = StartRead(0);
+}
+
+CDirectFileReader::~CDirectFileReader() {
+    // A read still in flight must finish before its buffer goes away
+    for (int slot = 0; slot < 2; slot++) {
+        if (m_pending[slot]) {
+            DWORD got = 0;
+            CancelIoEx(m_hFile, &m_ov[slot]);
+            GetOverlappedResult(m_hFile, &m_ov[slot], &got, TRUE);
+        }
+        CloseHandle(m_ov[slot].hEvent);
+        FreeAligned(m_buffers[slot]);
+    }
+}
+
+// A read starting at or past the end completes as ERROR_HANDLE_EOF, either
+// right away or through GetOverlappedResult
+HRESULT CDirectFileReader::StartRead(int slot) {
+    m_ov[slot].Offset = (DWORD)m_nextOffset;
+    m_ov[slot].OffsetHigh = (DWORD)(m_nextOffset >> 32);
+    m_nextOffset += kDirectIoChunk;
+    if (ReadFile(m_hFile, m_buffers[slot], kDirectIoChunk, NULL, &m_ov[slot]) ||
+        GetLastError() == ERROR_IO_PENDING) {
+        m_pending[slot] = true;
+        return S_OK;
+    }
+    DWORD err = GetLastError();
+    return err == ERROR_HANDLE_EOF ? S_OK : HRESULT_FROM_WIN32(err);
+}
+
+HRESULT CDirectFileReader::WaitRead(int slot, DWORD& got) {
+    got = 0;
+    if (!m_pending[slot]) return S_OK;
+    m_pending[slot] = false;
+    if (!GetOverlappedResult(m_hFile, &m_ov[slot], &got, TRUE)) {
+        DWORD err = GetLastError();
+        got = 0;
+        if (err != ERROR_HANDLE_EOF) return HRESULT_FROM_WIN32(err);
+    }
+    return S_OK;
+}
+
+HRESULT CDirectFileReader::Read(void* data, UInt32 size, UInt32* processedSize) {
+    if (processedSize) *processedSize = 0;
+    RINOK(m_error);
+    if (size == 0) return S_OK;
+
+    if (m_pos == m_avail) {
+        if (m_eof) return S_OK;
+        DWORD got = 0;
+        m_error = WaitRead(m_cur, got);
+        RINOK(m_error);
+        m_pos = 0;
+        m_avail = got;
+        // Only a full chunk can be followed by more data
+        if (got == kDirectIoChunk) {
+            m_error = StartRead(m_cur ^ 1);
+            RINOK(m_error);
+        } else {
+            m_eof = true;
+        }
+        if (got == 0) return S_OK;
+        CoreStats_Add(CoreCounter::BytesRead, got);
+    }
+
+    UInt32 n = (UInt32)std::min<DWORD>(size, m_avail - m_pos);
+    memcpy(data, m_buffers[m_cur] + m_pos, n);
+    m_pos += n;
+    if (m_pos == m_avail && !m_eof) {
+        m_cur ^= 1;
+        m_pos = m_avail = 0;
+    }
+    if (processedSize) *processedSize = n;
+    return S_OK;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// CDirectFileWriter
+//////////////////////////////////////////////////////////////////////////////
+
+CDirectFileWriter::CDirectFileWriter(HANDLE hFile)
+    : m_hFile(hFile)
+    , m_offset(0)
+    , m_cur(0)
+    , m_fill(0)
+    , m_error(S_OK)
+{
+    for (int slot = 0; slot < 2; slot++) {
+        m_buffers[slot] = AllocAligned();
+        memset(&m_ov[slot], 0, sizeof(m_ov[slot]));
+        m_ov[slot].hEvent = CreateEventW(NULL, TRUE, FALSE, NULL);
+        m_pending[slot] = false;
+    }
+}
+
+CDirectFileWriter::~CDirectFileWriter() {
+    for (int slot = 0; slot < 2; slot++) {
+        Wait(slot);
+        CloseHandle(m_ov[slot].hEvent);
+        FreeAligned(m_buffers[slot]);
+    }
+}
+
+HRESULT CDirectFileWriter::Wait(int slot) {
+    if (!m_pending[slot]) return S_OK;
+    m_pending[slot] = false;
+    DWORD written = 0;
+    if (!GetOverlappedResult(m_hFile, &m_ov[slot], &written, TRUE)) {
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
+    CoreStats_Add(CoreCounter::BytesWritten, written);
+    return S_OK;
+}
+
+// Writes m_buffers[m_cur] (size is a multiple of kDirectIoAlign) and
+// switches to the other buffer once its previous write is done
+HRESULT CDirectFileWriter::Submit(DWORD size) {
+    m_ov[m_cur].Offset = (DWORD)m_offset;
+    m_ov[m_cur].OffsetHigh = (DWORD)(m_offset >> 32);
+    if (!WriteFile(m_hFile, m_buffers[m_cur], size, NULL, &m_ov[m_cur]) &&
+        GetLastError() != ERROR_IO_PENDING) {
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
+    m_pending[m_cur] = true;
+    m_offset += size;
+    m_cur ^= 1;
+    m_fill = 0;
+    return Wait(m_cur);
+}
+
+HRESULT CDirectFileWriter::Write(const void* data, UInt32 size) {
+    RINOK(m_error);
+    const Byte* p = (const Byte*)data;
+    while (size != 0) {
+        DWORD n = std::min<DWORD>(size, kDirectIoChunk - m_fill);
+        memcpy(m_buffers[m_cur] + m_fill, p, n);
+        m_fill += n;
+        p += n;
+        size -= n;
+        if (m_fill == kDirectIoChunk) {
+            m_error = Submit(kDirectIoChunk);
+            RINOK(m_error);
+        }
+    }
+    return S_OK;
+}
+
+HRESULT CDirectFileWriter::Finish() {
+    RINOK(m_error);
+    UInt64 fileSize = m_offset + m_fill;
+    if (m_fill != 0) {
+        DWORD padded = (m_fill + kDirectIoAlign - 1) & ~(kDirectIoAlign - 1);
+        memset(m_buffers[m_cur] + m_fill, 0, padded - m_fill);
+        m_error = Submit(padded);
+        RINOK(m_error);
+    }
+    for (int slot = 0; slot < 2; slot++) {
+        m_error = Wait(slot);
+        RINOK(m_error);
+    }
+
+    // Drop the padding of the last sector; setting the end of file has no
+    // alignment requirement
+    if (m_offset != fileSize) {
+        LARGE_INTEGER pos;
+        pos.QuadPart = (LONGLONG)fileSize;
+        if (!SetFilePointerEx(m_hFile, pos, NULL, FILE_BEGIN) || !SetEndOfFile(m_hFile)) {
+            m_error = HRESULT_FROM_WIN32(GetLastError());
+        }
+    }
+    return m_error;
+}
@@ -0,0 +1,72 @@
+// DirectIo.h - Unbuffered (FILE_FLAG_NO_BUFFERING) sequential file I/O
+#pragma once
+
+#include <Windows.h>
+
+#include "Common/Common.h"
+
+// Alignment of offsets, sizes and buffer addresses for unbuffered I/O. 4 KB
+// covers both 512-byte and 4Kn sectors; VirtualAlloc buffers are page aligned.
+static const DWORD kDirectIoAlign = 4096;
+
+// Size of each of the two buffers of a direct reader or writer
+static const DWORD kDirectIoChunk = 1 << 20;
+
+// Flags for CreateFileW when a handle is used by CDirectFileReader/Writer
+static const DWORD kDirectIoFileFlags = FILE_FLAG_NO_BUFFERING | FILE_FLAG_OVERLAPPED;
+
+// Sequential reader over a handle opened with kDirectIoFileFlags. One chunk
+// is read ahead while the caller consumes the other; the short read at the
+// end of the file needs no special handling.
+class CDirectFileReader {
+public:
+    explicit CDirectFileReader(HANDLE hFile);
+    ~CDirectFileReader();
+
+    bool IsValid() const { return m_buffers[0] && m_buffers[1]; }
+
+    HRESULT Read(void* data, UInt32 size, UInt32* processedSize);
+
+private:
+    HRESULT StartRead(int slot);
+    HRESULT WaitRead(int slot, DWORD& got);
+
+    HANDLE m_hFile;
+    Byte* m_buffers[2];
+    OVERLAPPED m_ov[2];
+    bool m_pending[2];
+    UInt64 m_nextOffset;    // File offset of the next chunk to request
+    int m_cur;
+    DWORD m_pos;            // Consumed bytes of m_buffers[m_cur]
+    DWORD m_avail;          // Valid bytes of m_buffers[m_cur]
+    bool m_eof;
+    HRESULT m_error;
+};
+
+// Sequential writer over a handle opened with kDirectIoFileFlags. Full
+// chunks are written while the caller fills the other buffer; Finish pads
+// the tail to the alignment, writes it and truncates the file back to the
+// real size.
+class CDirectFileWriter {
+public:
+    explicit CDirectFileWriter(HANDLE hFile);
+    ~CDirectFileWriter();
+
+    bool IsValid() const { return m_buffers[0] && m_buffers[1]; }
+
+    HRESULT Write(const void* data, UInt32 size);
+    HRESULT Finish();
+
+private:
+    HRESULT Submit(DWORD size);
+    HRESULT Wait(int slot);
+
+    HANDLE m_hFile;
+    Byte* m_buffers[2];
+    OVERLAPPED m_ov[2];
+    bool m_pending[2];
+    UInt64 m_offset;        // File offset of the next chunk to write
+    int m_cur;
+    DWORD m_fill;           // Bytes buffered in m_buffers[m_cur]
+    HRESULT m_error;
+};
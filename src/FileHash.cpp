@@ -0,0 +1,265 @@
+// FileHash.cpp - CRC32/CRC64/SHA-1/SHA-256 over files and archive item streams
+#include "FileHash.h"
+
+#include <cstdio>
+
+#include "7zCrc.h"
+#include "XzCrc64.h"
+
+// Read granularity of HashDiskFile; two chunks are in use per file
+static const DWORD kHashChunkSize = 1 << 20;
+
+static std::string ToHex(const Byte* data, size_t size) {
+    static const char kDigits[] = "0123456789abcdef";
+    std::string hex(size * 2, '0');
+    for (size_t i = 0; i < size; i++) {
+        hex[i * 2] = kDigits[data[i] >> 4];
+        hex[i * 2 + 1] = kDigits[data[i] & 0xF];
+    }
+    return hex;
+}
+
+static std::string ToUtf8(const std::wstring& text) {
+    if (text.empty()) return std::string();
+    int len = WideCharToMultiByte(CP_UTF8, 0, text.c_str(), (int)text.size(), NULL, 0, NULL, NULL);
+    std::string out(len > 0 ? len : 0, '\0');
+    if (len > 0) {
+        WideCharToMultiByte(CP_UTF8, 0, text.c_str(), (int)text.size(), &out[0], len, NULL, NULL);
+    }
+    return out;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// CMultiHasher
+//////////////////////////////////////////////////////////////////////////////
+
+CMultiHasher::CMultiHasher(uint32_t algorithms)
+    : m_algorithms(algorithms)
+    , m_crc32(CRC_INIT_VAL)
+    , m_crc64(CRC64_INIT_VAL)
+    , m_size(0)
+{
+    if (m_algorithms & HashSha1) Sha1_Init(&m_sha1);
+    if (m_algorithms & HashSha256) Sha256_Init(&m_sha256);
+}
+
+void CMultiHasher::Update(const void* data, size_t size) {
+    CoreScopedPhase phase(CorePhase::Hash);
+    if (m_algorithms & HashCrc32) m_crc32 = CrcUpdate(m_crc32, data, size);
+    if (m_algorithms & HashCrc64) m_crc64 = Crc64Update(m_crc64, data, size);
+    if (m_algorithms & HashSha1) Sha1_Update(&m_sha1, (const Byte*)data, size);
+    if (m_algorithms & HashSha256) Sha256_Update(&m_sha256, (const Byte*)data, size);
+    m_size += size;
+    CoreStats_Add(CoreCounter::BytesHashed, size);
+}
+
+void CMultiHasher::Final(HashEntry& entry) {
+    char buf[32];
+    entry.size = m_size;
+    if (m_algorithms & HashCrc32) {
+        snprintf(buf, sizeof(buf), "%08x", (unsigned)CRC_GET_DIGEST(m_crc32));
+        entry.crc32 = buf;
+    }
+    if (m_algorithms & HashCrc64) {
+        snprintf(buf, sizeof(buf), "%016llx", (unsigned long long)CRC64_GET_DIGEST(m_crc64));
+        entry.crc64 = buf;
+    }
+    if (m_algorithms & HashSha1) {
+        Byte digest[SHA1_DIGEST_SIZE];
+        Sha1_Final(&m_sha1, digest);
+        entry.sha1 = ToHex(digest, sizeof(digest));
+    }
+    if (m_algorithms & HashSha256) {
+        Byte digest[SHA256_DIGEST_SIZE];
+        Sha256_Final(&m_sha256, digest);
+        entry.sha256 = ToHex(digest, sizeof(digest));
+    }
+}
+
+STDMETHODIMP CHashOutStream::Write(const void *data, UInt32 size, UInt32 *processedSize) {
+    m_hasher.Update(data, size);
+    if (processedSize) *processedSize = size;
+    return S_OK;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Disk files
+//////////////////////////////////////////////////////////////////////////////
+
+static bool EnumerateHashDirectory(const std::wstring& basePath, const std::wstring& relBasePath,
+                                   std::vector<HashSourceFile>& files,
+                                   CancellationToken* cancel) {
+    WIN32_FIND_DATAW fd;
+    HANDLE hFind = FindFirstFileW((basePath + L"\\*").c_str(), &fd);
+    if (hFind == INVALID_HANDLE_VALUE) return true;
+
+    bool completed = true;
+    do {
+        if (cancel && cancel->Check()) {
+            completed = false;
+            break;
+        }
+        if (wcscmp(fd.cFileName, L".") == 0 || wcscmp(fd.cFileName, L"..") == 0) {
+            continue;
+        }
+
+        std::wstring fullPath = basePath + L"\\" + fd.cFileName;
+        std::wstring relPath = relBasePath + L"\\" + fd.cFileName;
+        CoreStats_Add(CoreCounter::ItemsEnumerated);
+        if (fd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) {
+            if (!EnumerateHashDirectory(fullPath, relPath, files, cancel)) {
+                completed = false;
+                break;
+            }
+        } else {
+            uint64_t size = ((uint64_t)fd.nFileSizeHigh << 32) | fd.nFileSizeLow;
+            files.push_back({ fullPath, relPath, size });
+        }
+    } while (FindNextFileW(hFind, &fd));
+
+    FindClose(hFind);
+    return completed;
+}
+
+bool EnumerateHashSources(const std::vector<std::wstring>& paths,
+                          std::vector<HashSourceFile>& files,
+                          CancellationToken* cancel) {
+    CoreScopedPhase phase(CorePhase::Enumerate);
+    for (const auto& path : paths) {
+        if (cancel && cancel->Check()) return false;
+        size_t pos = path.rfind(L'\\');
+        std::wstring name = (pos != std::wstring::npos) ? path.substr(pos + 1) : path;
+
+        WIN32_FILE_ATTRIBUTE_DATA fad;
+        if (!GetFileAttributesExW(path.c_str(), GetFileExInfoStandard, &fad)) {
+            // Reported as a failed entry by HashDiskFile
+            files.push_back({ path, name, 0 });
+        } else if (fad.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) {
+            if (!EnumerateHashDirectory(path, name, files, cancel)) return false;
+        } else {
+            uint64_t size = ((uint64_t)fad.nFileSizeHigh << 32) | fad.nFileSizeLow;
+            files.push_back({ path, name, size });
+        }
+    }
+    return true;
+}
+
+HRESULT HashDiskFile(const std::wstring& path, uint32_t algorithms, CancellationToken* cancel,
+                     const std::function<bool(uint64_t)>& onBytes, HashEntry& entry) {
+    entry.ok = false;
+    HANDLE hFile;
+    {
+        CoreScopedPhase phase(CorePhase::FileOpen);
+        hFile = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+                            FILE_FLAG_OVERLAPPED | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    }
+    if (hFile == INVALID_HANDLE_VALUE) return HRESULT_FROM_WIN32(GetLastError());
+
+    // The next chunk is in flight while the current one is hashed
+    std::vector<Byte> buffers[2] = { std::vector<Byte>(kHashChunkSize),
+                                     std::vector<Byte>(kHashChunkSize) };
+    OVERLAPPED ov[2] = {};
+    ov[0].hEvent = CreateEventW(NULL, TRUE, FALSE, NULL);
+    ov[1].hEvent = CreateEventW(NULL, TRUE, FALSE, NULL);
+    bool pending[2] = { false, false };
+
+    // A read starting at or past the end completes as ERROR_HANDLE_EOF,
+    // either right away or through GetOverlappedResult
+    auto startRead = [&](int slot, UInt64 offset) -> HRESULT {
+        ov[slot].Offset = (DWORD)offset;
+        ov[slot].OffsetHigh = (DWORD)(offset >> 32);
+        if (ReadFile(hFile, buffers[slot].data(), kHashChunkSize, NULL, &ov[slot]) ||
+            GetLastError() == ERROR_IO_PENDING) {
+            pending[slot] = true;
+            return S_OK;
+        }
+        DWORD err = GetLastError();
+        return err == ERROR_HANDLE_EOF ? S_OK : HRESULT_FROM_WIN32(err);
+    };
+
+    CMultiHasher hasher(algorithms);
+    UInt64 offset = 0;
+    int cur = 0;
+    HRESULT hr = startRead(cur, 0);
+    while (SUCCEEDED(hr) && pending[cur]) {
+        DWORD got = 0;
+        {
+            CoreScopedPhase phase(CorePhase::Read);
+            if (!GetOverlappedResult(hFile, &ov[cur], &got, TRUE)) {
+                DWORD err = GetLastError();
+                if (err != ERROR_HANDLE_EOF) hr = HRESULT_FROM_WIN32(err);
+                got = 0;
+            }
+        }
+        pending[cur] = false;
+        if (FAILED(hr) || got == 0) break;
+        CoreStats_Add(CoreCounter::BytesRead, got);
+        offset += got;
+
+        hr = startRead(cur ^ 1, offset);
+        if (FAILED(hr)) break;
+        hasher.Update(buffers[cur].data(), got);
+
+        if ((cancel && cancel->Check()) || (onBytes && !onBytes(got))) {
+            hr = E_ABORT;
+            break;
+        }
+        cur ^= 1;
+    }
+
+    // A read still in flight must finish before its buffer goes away
+    for (int slot = 0; slot < 2; slot++) {
+        if (pending[slot]) {
+            DWORD got = 0;
+            CancelIoEx(hFile, &ov[slot]);
+            GetOverlappedResult(hFile, &ov[slot], &got, TRUE);
+        }
+        CloseHandle(ov[slot].hEvent);
+    }
+    {
+        CoreScopedPhase phase(CorePhase::FileClose);
+        CloseHandle(hFile);
+    }
+
+    if (SUCCEEDED(hr)) {
+        hasher.Final(entry);
+        entry.ok = true;
+    }
+    return hr;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// HashReport
+//////////////////////////////////////////////////////////////////////////////
+
+double HashReport::MBPerSec() const {
+    return seconds > 0 ? totalBytes / (1024.0 * 1024.0) / seconds : 0.0;
+}
+
+std::string HashReport::ToManifest() const {
+    std::string out = "#";
+    if (algorithms & HashCrc32) out += " crc32";
+    if (algorithms & HashCrc64) out += " crc64";
+    if (algorithms & HashSha1) out += " sha1";
+    if (algorithms & HashSha256) out += " sha256";
+    out += " size path\n";
+
+    size_t failed = 0;
+    for (const auto& entry : entries) {
+        if (!entry.ok) {
+            out += "# error " + ToUtf8(entry.path) + "\n";
+            failed++;
+            continue;
+        }
+        for (const std::string* digest : { &entry.crc32, &entry.crc64, &entry.sha1, &entry.sha256 }) {
+            if (!digest->empty()) out += *digest + " ";
+        }
+        out += std::to_string(entry.size) + " " + ToUtf8(entry.path) + "\n";
+    }
+
+    char summary[160];
+    snprintf(summary, sizeof(summary), "# %zu files, %zu errors, %llu bytes, %.3f s, %.1f MB/s\n",
+             entries.size() - failed, failed, (unsigned long long)totalBytes, seconds, MBPerSec());
+    out += summary;
+    return out;
+}
@@ -0,0 +1,88 @@
+// FileHash.h - CRC32/CRC64/SHA-1/SHA-256 over files and archive item streams
+#pragma once
+
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "SevenZipCore.h"
+
+#include "Common/Common.h"
+#include "7zip/IStream.h"
+#include "Common/MyCom.h"
+
+#include "Sha1.h"
+#include "Sha256.h"
+
+// Runs every requested algorithm over one byte stream, using the CRC and SHA
+// kernels 7-Zip selected for this CPU
+class CMultiHasher {
+public:
+    explicit CMultiHasher(uint32_t algorithms);
+
+    void Update(const void* data, size_t size);
+
+    // Fills the requested digests and the size of the hashed data
+    void Final(HashEntry& entry);
+
+private:
+    uint32_t m_algorithms;
+    UInt32 m_crc32;
+    UInt64 m_crc64;
+    CSha1 m_sha1;
+    CSha256 m_sha256;
+    uint64_t m_size;
+};
+
+// Output stream of an extracted item that only hashes the data
+class CHashOutStream :
+    public ISequentialOutStream,
+    public CMyUnknownImp
+{
+public:
+    explicit CHashOutStream(uint32_t algorithms) : m_hasher(algorithms), m_refCount(0) {}
+    virtual ~CHashOutStream() {}
+
+    void Final(HashEntry& entry) { m_hasher.Final(entry); }
+
+    // IUnknown
+    STDMETHOD(QueryInterface)(REFIID iid, void **outObject) {
+        if (iid == IID_IUnknown || iid == IID_ISequentialOutStream) {
+            *outObject = this;
+            AddRef();
+            return S_OK;
+        }
+        *outObject = NULL;
+        return E_NOINTERFACE;
+    }
+
+    STDMETHOD_(ULONG, AddRef)() { return ++m_refCount; }
+    STDMETHOD_(ULONG, Release)() {
+        ULONG res = --m_refCount;
+        if (res == 0) delete this;
+        return res;
+    }
+
+    STDMETHOD(Write)(const void *data, UInt32 size, UInt32 *processedSize);
+
+private:
+    CMultiHasher m_hasher;
+    ULONG m_refCount;
+};
+
+// Source file of HashFiles
+struct HashSourceFile {
+    std::wstring fullPath;
+    std::wstring relativePath;      // Same naming as Compress: root name + subpath
+    uint64_t size;
+};
+
+// Expands files and directories (recursively); returns false if cancelled
+bool EnumerateHashSources(const std::vector<std::wstring>& paths,
+                          std::vector<HashSourceFile>& files,
+                          CancellationToken* cancel);
+
+// Hashes one file on disk with one chunk of overlapped read-ahead. onBytes
+// is called after each chunk; returning false stops with E_ABORT.
+HRESULT HashDiskFile(const std::wstring& path, uint32_t algorithms, CancellationToken* cancel,
+                     const std::function<bool(uint64_t)>& onBytes, HashEntry& entry);
@@ -0,0 +1,168 @@
+// FilePrefetcher.cpp - Read-ahead of small source files for Compress
+#include "FilePrefetcher.h"
+#include "CoreStats.h"
+
+#include <algorithm>
+#include <cstring>
+
+// Buffered bytes of read-ahead, on top of the file count window
+static const UInt64 kPrefetchMaxBytes = 64 << 20;
+
+static bool ReadWholeFile(const std::wstring& path, std::vector<Byte>& data) {
+    HANDLE hFile;
+    {
+        CoreScopedPhase phase(CorePhase::FileOpen);
+        hFile = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+                            FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    }
+    if (hFile == INVALID_HANDLE_VALUE) return false;
+
+    bool ok;
+    {
+        CoreScopedPhase phase(CorePhase::Read);
+        LARGE_INTEGER size;
+        ok = GetFileSizeEx(hFile, &size) != FALSE && size.QuadPart <= (LONGLONG)kPrefetchMaxBytes;
+        DWORD read = 0;
+        if (ok) {
+            data.resize((size_t)size.QuadPart);
+            ok = data.empty() || ReadFile(hFile, data.data(), (DWORD)data.size(), &read, NULL);
+            // A file that shrank meanwhile is sent as it is now
+            data.resize(read);
+            CoreStats_Add(CoreCounter::BytesRead, read);
+        }
+    }
+
+    CoreScopedPhase phase(CorePhase::FileClose);
+    CloseHandle(hFile);
+    return ok;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// CFilePrefetcher
+//////////////////////////////////////////////////////////////////////////////
+
+CFilePrefetcher::CFilePrefetcher(std::vector<PrefetchSource> sources, uint32_t windowFiles,
+                                 uint32_t numThreads, CancellationToken* cancel)
+    : m_sources(std::move(sources))
+    , m_windowFiles(windowFiles ? windowFiles : 1)
+    , m_cancel(cancel)
+{
+    for (UInt32 i = 0; i < m_sources.size(); i++) {
+        m_positions[m_sources[i].index] = i;
+    }
+    {
+        std::lock_guard<std::mutex> guard(m_lock);
+        Schedule();
+    }
+    for (uint32_t i = 0; i < numThreads; i++) {
+        m_threads.emplace_back([this] { WorkerLoop(); });
+    }
+}
+
+CFilePrefetcher::~CFilePrefetcher() {
+    {
+        std::lock_guard<std::mutex> guard(m_lock);
+        m_stop = true;
+        m_queue.clear();
+    }
+    m_workReady.notify_all();
+    for (auto& thread : m_threads) {
+        thread.join();
+    }
+}
+
+// Called with m_lock held: fills the window with the eligible files after
+// the last scheduled one
+void CFilePrefetcher::Schedule() {
+    bool added = false;
+    while (m_nextToSchedule < m_sources.size() && m_slots.size() < m_windowFiles &&
+           m_slotBytes < kPrefetchMaxBytes) {
+        UInt32 position = m_nextToSchedule++;
+        const PrefetchSource& source = m_sources[position];
+        if (!source.eligible) continue;
+        m_slots[position] = std::make_shared<Slot>();
+        m_slotBytes += source.size;
+        m_queue.push_back(position);
+        added = true;
+    }
+    if (added) m_workReady.notify_all();
+}
+
+void CFilePrefetcher::WorkerLoop() {
+    CancellationScope cancelScope(m_cancel);
+    for (;;) {
+        UInt32 position;
+        std::shared_ptr<Slot> slot;
+        {
+            std::unique_lock<std::mutex> guard(m_lock);
+            m_workReady.wait(guard, [this] { return m_stop || !m_queue.empty(); });
+            if (m_stop) return;
+            position = m_queue.front();
+            m_queue.pop_front();
+            auto it = m_slots.find(position);
+            if (it == m_slots.end()) continue;      // Dropped: the encoder moved past it
+            slot = it->second;
+        }
+
+        auto data = std::make_shared<std::vector<Byte>>();
+        bool ok = !(m_cancel && m_cancel->IsCancelled()) &&
+                  ReadWholeFile(m_sources[position].path, *data);
+        {
+            std::lock_guard<std::mutex> guard(m_lock);
+            slot->data = std::move(data);
+            slot->ok = ok;
+            slot->done = true;
+        }
+        m_slotDone.notify_all();
+    }
+}
+
+std::shared_ptr<const std::vector<Byte>> CFilePrefetcher::Take(UInt32 index) {
+    auto found = m_positions.find(index);
+    if (found == m_positions.end()) return nullptr;
+    UInt32 position = found->second;
+    std::unique_lock<std::mutex> guard(m_lock);
+
+    // Files before the requested one were skipped by the handler's order;
+    // their buffers are released and their place in the window reused
+    for (auto it = m_slots.begin(); it != m_slots.end();) {
+        if (it->first < position) {
+            m_slotBytes -= m_sources[it->first].size;
+            it = m_slots.erase(it);
+        } else {
+            ++it;
+        }
+    }
+
+    std::shared_ptr<const std::vector<Byte>> result;
+    auto it = m_slots.find(position);
+    if (it != m_slots.end()) {
+        std::shared_ptr<Slot> slot = it->second;
+        if (!slot->done) {
+            CoreScopedPhase phase(CorePhase::InputWait);
+            m_slotDone.wait(guard, [&slot] { return slot->done; });
+        }
+        if (slot->ok) result = slot->data;
+        m_slotBytes -= m_sources[position].size;
+        m_slots.erase(position);
+    }
+    if (m_sources[position].eligible) {
+        CoreStats_Add(result ? CoreCounter::PrefetchHits : CoreCounter::PrefetchMisses);
+    }
+
+    m_nextToSchedule = std::max<UInt32>(m_nextToSchedule, position + 1);
+    Schedule();
+    return result;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// CPrefetchedInStream
+//////////////////////////////////////////////////////////////////////////////
+
+STDMETHODIMP CPrefetchedInStream::Read(void *data, UInt32 size, UInt32 *processedSize) {
+    size_t n = std::min<size_t>(size, m_data->size() - m_pos);
+    memcpy(data, m_data->data() + m_pos, n);
+    m_pos += n;
+    if (processedSize) *processedSize = (UInt32)n;
+    return S_OK;
+}
@@ -0,0 +1,111 @@
+// FilePrefetcher.h - Read-ahead of small source files for Compress
+#pragma once
+
+#include <Windows.h>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "Common/Common.h"
+#include "7zip/IStream.h"
+#include "Common/MyCom.h"
+
+#include "CancellationToken.h"
+
+// Largest source file that is read ahead; bigger ones are streamed
+static const UInt64 kPrefetchMaxFileSize = 1 << 20;
+
+// I/O threads of one prefetcher
+static const uint32_t kPrefetchThreads = 4;
+
+// Source file of the update callback, in the order the handler is expected
+// to ask for it
+struct PrefetchSource {
+    UInt32 index;       // Item index in the update callback
+    std::wstring path;
+    UInt64 size;
+    bool eligible;      // Small regular file worth reading ahead
+};
+
+// Reads the files that follow the encoder's current item on a few I/O
+// threads, into memory, bounded by a file count and a byte budget. Sources
+// are given in the handler's expected request order (ascending for Zip and
+// Tar); a request out of that order, or for an item not in the list, is a
+// miss and the caller opens the file itself.
+class CFilePrefetcher {
+public:
+    CFilePrefetcher(std::vector<PrefetchSource> sources, uint32_t windowFiles,
+                    uint32_t numThreads, CancellationToken* cancel);
+    ~CFilePrefetcher();
+
+    // Content of the item (waits while it is being read), or null if it was
+    // not read ahead or reading failed. Schedules the files after it in the
+    // source order.
+    std::shared_ptr<const std::vector<Byte>> Take(UInt32 index);
+
+private:
+    struct Slot {
+        std::shared_ptr<std::vector<Byte>> data;
+        bool done = false;
+        bool ok = false;
+    };
+
+    void Schedule();
+    void WorkerLoop();
+
+    std::vector<PrefetchSource> m_sources;
+    std::unordered_map<UInt32, UInt32> m_positions;     // Item index -> source
+    uint32_t m_windowFiles;
+    CancellationToken* m_cancel;
+
+    std::mutex m_lock;
+    std::condition_variable m_workReady;
+    std::condition_variable m_slotDone;
+    std::unordered_map<UInt32, std::shared_ptr<Slot>> m_slots;     // By source
+    std::deque<UInt32> m_queue;
+    UInt64 m_slotBytes = 0;         // Source sizes of the scheduled slots
+    UInt32 m_nextToSchedule = 0;
+    bool m_stop = false;
+    std::vector<std::thread> m_threads;
+};
+
+// Source stream over a read-ahead buffer
+class CPrefetchedInStream :
+    public ISequentialInStream,
+    public CMyUnknownImp
+{
+public:
+    explicit CPrefetchedInStream(std::shared_ptr<const std::vector<Byte>> data)
+        : m_data(std::move(data)), m_pos(0), m_refCount(0) {}
+    virtual ~CPrefetchedInStream() {}
+
+    // IUnknown
+    STDMETHOD(QueryInterface)(REFIID iid, void **outObject) {
+        if (iid == IID_IUnknown || iid == IID_ISequentialInStream) {
+            *outObject = this;
+            AddRef();
+            return S_OK;
+        }
+        *outObject = NULL;
+        return E_NOINTERFACE;
+    }
+
+    STDMETHOD_(ULONG, AddRef)() { return ++m_refCount; }
+    STDMETHOD_(ULONG, Release)() {
+        ULONG res = --m_refCount;
+        if (res == 0) delete this;
+        return res;
+    }
+
+    STDMETHOD(Read)(void *data, UInt32 size, UInt32 *processedSize);
+
+private:
+    std::shared_ptr<const std::vector<Byte>> m_data;
+    size_t m_pos;
+    ULONG m_refCount;
+};
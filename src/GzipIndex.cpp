@@ -0,0 +1,399 @@
+// GzipIndex.cpp - Seek index of a .tar.gz (gzip member starts, tar entry offsets)
+#include "GzipIndex.h"
+#include "CoreStats.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+#include "7zip/ICoder.h"
+#include "7zip/Common/CreateCoder.h"
+#include "7zip/Common/StreamUtils.h"
+
+#include "7zCrc.h"
+
+static const UInt64 kDeflateMethodId = 0x040108;
+
+// Gzip header flags (RFC 1952)
+static const Byte kGzipFlagHeaderCrc = 0x02;
+static const Byte kGzipFlagExtra = 0x04;
+static const Byte kGzipFlagName = 0x08;
+static const Byte kGzipFlagComment = 0x10;
+
+static const char kSideFileSignature[] = "SZIDX 1";
+
+static UInt32 GetUInt32LE(const Byte* p) {
+    return (UInt32)p[0] | ((UInt32)p[1] << 8) | ((UInt32)p[2] << 16) | ((UInt32)p[3] << 24);
+}
+
+static UInt64 FileTimeToUInt64(const FILETIME& ft) {
+    return ((UInt64)ft.dwHighDateTime << 32) | ft.dwLowDateTime;
+}
+
+static FILETIME UInt64ToFileTime(UInt64 value) {
+    FILETIME ft;
+    ft.dwLowDateTime = (DWORD)value;
+    ft.dwHighDateTime = (DWORD)(value >> 32);
+    return ft;
+}
+
+static std::string ToUtf8(const std::wstring& text) {
+    if (text.empty()) return std::string();
+    int len = WideCharToMultiByte(CP_UTF8, 0, text.c_str(), (int)text.size(), NULL, 0, NULL, NULL);
+    std::string out(len > 0 ? len : 0, '\0');
+    if (len > 0) {
+        WideCharToMultiByte(CP_UTF8, 0, text.c_str(), (int)text.size(), &out[0], len, NULL, NULL);
+    }
+    return out;
+}
+
+static std::wstring FromUtf8(const char* text, size_t size) {
+    if (size == 0) return std::wstring();
+    int len = MultiByteToWideChar(CP_UTF8, 0, text, (int)size, NULL, 0);
+    std::wstring out(len > 0 ? len : 0, L'\0');
+    if (len > 0) MultiByteToWideChar(CP_UTF8, 0, text, (int)size, &out[0], len);
+    return out;
+}
+
+static bool GetArchiveStamp(const std::wstring& archivePath, UInt64& size, FILETIME& mtime) {
+    WIN32_FILE_ATTRIBUTE_DATA attr;
+    if (!GetFileAttributesExW(archivePath.c_str(), GetFileExInfoStandard, &attr)) return false;
+    size = ((UInt64)attr.nFileSizeHigh << 32) | attr.nFileSizeLow;
+    mtime = attr.ftLastWriteTime;
+    return true;
+}
+
+// Parses one unsigned decimal field and the separator after it
+static bool ParseUInt64(const char*& p, UInt64& value) {
+    if (*p < '0' || *p > '9') return false;
+    char* end = nullptr;
+    value = strtoull(p, &end, 10);
+    if (end == p || (*end != ' ' && *end != '\n')) return false;
+    p = (*end == ' ') ? end + 1 : end;
+    return true;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// GzipSeekIndex
+//////////////////////////////////////////////////////////////////////////////
+
+std::wstring GzipSeekIndex::SidePath(const std::wstring& archivePath) {
+    return archivePath + L".szidx";
+}
+
+bool GzipSeekIndex::Load(const std::wstring& archivePath) {
+    UInt64 currentSize;
+    FILETIME currentMTime;
+    if (!GetArchiveStamp(archivePath, currentSize, currentMTime)) return false;
+
+    std::string text;
+    {
+        CoreScopedPhase phase(CorePhase::FileOpen);
+        HANDLE hFile = CreateFileW(SidePath(archivePath).c_str(), GENERIC_READ, FILE_SHARE_READ,
+                                   NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+        if (hFile == INVALID_HANDLE_VALUE) return false;
+        LARGE_INTEGER size;
+        DWORD read = 0;
+        bool ok = GetFileSizeEx(hFile, &size) != FALSE && size.QuadPart < ((LONGLONG)1 << 31);
+        if (ok) {
+            text.resize((size_t)size.QuadPart);
+            ok = text.empty() || (ReadFile(hFile, &text[0], (DWORD)text.size(), &read, NULL) &&
+                                  read == text.size());
+        }
+        CloseHandle(hFile);
+        if (!ok) return false;
+    }
+
+    // "SZIDX 1 <archive size> <archive mtime>", then "P <pack> <unpack>"
+    // per seek point and "I <data offset|-> <size> <packed size> <mtime>
+    // <isDir> <path>" per tar entry
+    CoreScopedPhase phase(CorePhase::HeaderParse);
+    const char* p = text.c_str();
+    const char* end = p + text.size();
+    size_t sigLen = sizeof(kSideFileSignature) - 1;
+    if (text.compare(0, sigLen, kSideFileSignature) != 0 || p[sigLen] != ' ') return false;
+    p += sigLen + 1;
+    UInt64 mtimeValue;
+    if (!ParseUInt64(p, archiveSize) || !ParseUInt64(p, mtimeValue) || *p != '\n') return false;
+    archiveMTime = UInt64ToFileTime(mtimeValue);
+    if (archiveSize != currentSize || CompareFileTime(&archiveMTime, &currentMTime) != 0) {
+        return false;
+    }
+
+    points.clear();
+    items.clear();
+    dataOffsets.clear();
+    for (p++; p < end; p++) {
+        const char* lineEnd = (const char*)memchr(p, '\n', end - p);
+        if (!lineEnd || lineEnd - p < 2 || p[1] != ' ') return false;
+        char tag = p[0];
+        p += 2;
+        if (tag == 'P') {
+            GzipSeekPoint point;
+            if (!ParseUInt64(p, point.packOffset) || !ParseUInt64(p, point.unpackOffset)) {
+                return false;
+            }
+            if (!points.empty() && point.unpackOffset <= points.back().unpackOffset) return false;
+            points.push_back(point);
+        } else if (tag == 'I') {
+            UInt64 dataOffset = kNoTarDataOffset;
+            if (*p == '-' && p[1] == ' ') {
+                p += 2;
+            } else if (!ParseUInt64(p, dataOffset)) {
+                return false;
+            }
+            UInt64 size, packedSize, isDir;
+            if (!ParseUInt64(p, size) || !ParseUInt64(p, packedSize) ||
+                !ParseUInt64(p, mtimeValue) || !ParseUInt64(p, isDir)) {
+                return false;
+            }
+            ArchiveItem item;
+            item.size = size;
+            item.packedSize = packedSize;
+            item.mtime = UInt64ToFileTime(mtimeValue);
+            item.isDir = (isDir != 0);
+            item.isEncrypted = false;
+            item.path = FromUtf8(p, lineEnd - p);
+            items.push_back(std::move(item));
+            dataOffsets.push_back(dataOffset);
+        } else {
+            return false;
+        }
+        p = lineEnd;
+    }
+    return !points.empty() && points.front().unpackOffset == 0;
+}
+
+bool GzipSeekIndex::Save(const std::wstring& archivePath) {
+    if (!GetArchiveStamp(archivePath, archiveSize, archiveMTime)) return false;
+
+    std::string text = std::string(kSideFileSignature) + " " + std::to_string(archiveSize) + " " +
+                       std::to_string(FileTimeToUInt64(archiveMTime)) + "\n";
+    for (const GzipSeekPoint& point : points) {
+        text += "P " + std::to_string(point.packOffset) + " " +
+                std::to_string(point.unpackOffset) + "\n";
+    }
+    for (size_t i = 0; i < items.size(); i++) {
+        const ArchiveItem& item = items[i];
+        // A line per entry: names with line breaks are not indexed at all
+        if (item.path.find(L'\n') != std::wstring::npos) return false;
+        text += "I ";
+        text += (dataOffsets[i] == kNoTarDataOffset) ? std::string("-")
+                                                     : std::to_string(dataOffsets[i]);
+        text += " " + std::to_string(item.size) + " " + std::to_string(item.packedSize) + " " +
+                std::to_string(FileTimeToUInt64(item.mtime)) + " " +
+                (item.isDir ? "1 " : "0 ") + ToUtf8(item.path) + "\n";
+    }
+
+    std::wstring sidePath = SidePath(archivePath);
+    HANDLE hFile;
+    {
+        CoreScopedPhase phase(CorePhase::FileCreate);
+        hFile = CreateFileW(sidePath.c_str(), GENERIC_WRITE, 0, NULL, CREATE_ALWAYS,
+                            FILE_ATTRIBUTE_NORMAL, NULL);
+    }
+    if (hFile == INVALID_HANDLE_VALUE) return false;
+    DWORD written = 0;
+    bool ok;
+    {
+        CoreScopedPhase phase(CorePhase::Write);
+        ok = WriteFile(hFile, text.data(), (DWORD)text.size(), &written, NULL) &&
+             written == text.size();
+        CoreStats_Add(CoreCounter::BytesWritten, written);
+    }
+    CloseHandle(hFile);
+    if (!ok) DeleteFileW(sidePath.c_str());
+    return ok;
+}
+
+const GzipSeekPoint& GzipSeekIndex::Find(UInt64 unpackOffset) const {
+    auto it = std::upper_bound(points.begin(), points.end(), unpackOffset,
+                               [](UInt64 offset, const GzipSeekPoint& point) {
+                                   return offset < point.unpackOffset;
+                               });
+    return (it == points.begin()) ? points.front() : *(it - 1);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Member decoding
+//////////////////////////////////////////////////////////////////////////////
+
+// Passes decoded data on while computing the member's CRC32 and size
+class CGzipCheckOutStream :
+    public ISequentialOutStream,
+    public CMyUnknownImp
+{
+public:
+    explicit CGzipCheckOutStream(ISequentialOutStream* target)
+        : m_target(target), m_crc(CRC_INIT_VAL), m_size(0), m_refCount(0) {}
+    virtual ~CGzipCheckOutStream() {}
+
+    void Init() {
+        m_crc = CRC_INIT_VAL;
+        m_size = 0;
+    }
+    UInt32 GetCrc() const { return CRC_GET_DIGEST(m_crc); }
+    UInt64 GetSize() const { return m_size; }
+
+    // IUnknown
+    STDMETHOD(QueryInterface)(REFIID iid, void **outObject) {
+        if (iid == IID_IUnknown || iid == IID_ISequentialOutStream) {
+            *outObject = this;
+            AddRef();
+            return S_OK;
+        }
+        *outObject = NULL;
+        return E_NOINTERFACE;
+    }
+
+    STDMETHOD_(ULONG, AddRef)() { return ++m_refCount; }
+    STDMETHOD_(ULONG, Release)() {
+        ULONG res = --m_refCount;
+        if (res == 0) delete this;
+        return res;
+    }
+
+    STDMETHOD(Write)(const void *data, UInt32 size, UInt32 *processedSize) {
+        if (processedSize) *processedSize = 0;
+        RINOK(WriteStream(m_target, data, size));
+        m_crc = CrcUpdate(m_crc, data, size);
+        m_size += size;
+        if (processedSize) *processedSize = size;
+        return S_OK;
+    }
+
+private:
+    ISequentialOutStream* m_target;
+    UInt32 m_crc;
+    UInt64 m_size;
+    ULONG m_refCount;
+};
+
+// Reads the member header at the stream position. S_FALSE: no gzip member
+// starts here (end of data or a foreign tail).
+static HRESULT ReadMemberHeader(ISequentialInStream* stream, UInt64& headerSize) {
+    Byte header[10];
+    size_t processed = sizeof(header);
+    RINOK(ReadStream(stream, header, &processed));
+    if (processed != sizeof(header) || header[0] != 0x1F || header[1] != 0x8B || header[2] != 8) {
+        return S_FALSE;
+    }
+    headerSize = sizeof(header);
+
+    Byte flags = header[3];
+    if (flags & kGzipFlagExtra) {
+        Byte len[2];
+        RINOK(ReadStream_FAIL(stream, len, 2));
+        UInt32 extraSize = len[0] | ((UInt32)len[1] << 8);
+        std::vector<Byte> extra(extraSize);
+        if (extraSize) RINOK(ReadStream_FAIL(stream, extra.data(), extraSize));
+        headerSize += 2 + extraSize;
+    }
+    for (Byte flag : { kGzipFlagName, kGzipFlagComment }) {
+        if (!(flags & flag)) continue;
+        Byte c;
+        do {
+            RINOK(ReadStream_FAIL(stream, &c, 1));
+            headerSize++;
+        } while (c != 0);
+    }
+    if (flags & kGzipFlagHeaderCrc) {
+        Byte crc[2];
+        RINOK(ReadStream_FAIL(stream, crc, 2));
+        headerSize += 2;
+    }
+    return S_OK;
+}
+
+HRESULT DecodeGzipMembers(IInStream* inStream, const GzipSeekPoint& start,
+                          ISequentialOutStream* outStream,
+                          std::vector<GzipSeekPoint>* points, UInt64 spacing,
+                          CancellationToken* cancel, UInt64 stopAt) {
+    CMyComPtr<ICompressCoder> decoder;
+    RINOK(CreateCoder_Id(kDeflateMethodId, false, decoder));
+    if (!decoder) return E_NOTIMPL;
+    CMyComPtr<ICompressGetInStreamProcessedSize> getProcessed;
+    decoder.QueryInterface(IID_ICompressGetInStreamProcessedSize, &getProcessed);
+    if (!getProcessed) return E_NOTIMPL;
+
+    CGzipCheckOutStream* checkStream = new CGzipCheckOutStream(outStream);
+    checkStream->AddRef();
+
+    UInt64 packPos = start.packOffset;
+    UInt64 unpackPos = start.unpackOffset;
+    bool anyMember = false;
+    HRESULT hr;
+    for (;;) {
+        if (cancel && cancel->Check()) {
+            hr = E_ABORT;
+            break;
+        }
+        hr = inStream->Seek((Int64)packPos, STREAM_SEEK_SET, NULL);
+        if (FAILED(hr)) break;
+        UInt64 headerSize = 0;
+        hr = ReadMemberHeader(inStream, headerSize);
+        if (hr == S_FALSE) {
+            hr = anyMember ? S_OK : E_FAIL;
+            break;
+        }
+        if (FAILED(hr)) break;
+
+        if (points && (points->empty() || unpackPos - points->back().unpackOffset >= spacing)) {
+            points->push_back({ packPos, unpackPos });
+        }
+
+        // The decoder reads ahead of the member's end; the trailer is found
+        // through the exact Deflate size instead of the stream position
+        checkStream->Init();
+        hr = decoder->Code(inStream, checkStream, NULL, NULL, NULL);
+        if (hr != S_OK) {
+            if (hr == S_FALSE) hr = E_FAIL;
+            break;
+        }
+        UInt64 deflateSize = 0;
+        hr = getProcessed->GetInStreamProcessedSize(&deflateSize);
+        if (FAILED(hr)) break;
+
+        Byte trailer[8];
+        UInt64 trailerPos = packPos + headerSize + deflateSize;
+        hr = inStream->Seek((Int64)trailerPos, STREAM_SEEK_SET, NULL);
+        if (SUCCEEDED(hr)) hr = ReadStream_FAIL(inStream, trailer, sizeof(trailer));
+        if (FAILED(hr)) break;
+        if (GetUInt32LE(trailer) != checkStream->GetCrc() ||
+            GetUInt32LE(trailer + 4) != (UInt32)checkStream->GetSize()) {
+            hr = E_FAIL;
+            break;
+        }
+
+        packPos = trailerPos + sizeof(trailer);
+        unpackPos += checkStream->GetSize();
+        anyMember = true;
+        if (unpackPos >= stopAt) break;
+    }
+
+    checkStream->Release();
+    return hr;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// CRangeOutStream
+//////////////////////////////////////////////////////////////////////////////
+
+STDMETHODIMP CRangeOutStream::Write(const void *data, UInt32 size, UInt32 *processedSize) {
+    if (processedSize) *processedSize = 0;
+    const Byte* p = (const Byte*)data;
+    UInt32 rest = size;
+    if (m_skip != 0) {
+        UInt32 skipped = (UInt32)std::min<UInt64>(m_skip, rest);
+        m_skip -= skipped;
+        p += skipped;
+        rest -= skipped;
+    }
+    UInt32 passed = (UInt32)std::min<UInt64>(m_left, rest);
+    if (passed != 0) {
+        RINOK(WriteStream(m_target, p, passed));
+        m_left -= passed;
+    }
+    if (processedSize) *processedSize = size;
+    return S_OK;
+}
@@ -0,0 +1,104 @@
+// GzipIndex.h - Seek index of a .tar.gz (gzip member starts, tar entry offsets)
+#pragma once
+
+#include <Windows.h>
+#include <string>
+#include <vector>
+
+#include "SevenZipCore.h"
+
+#include "Common/Common.h"
+#include "7zip/IStream.h"
+#include "Common/MyCom.h"
+
+// Start of a gzip member: decoding can begin here without earlier data
+struct GzipSeekPoint {
+    UInt64 packOffset;      // Offset of the member header in the .gz file
+    UInt64 unpackOffset;    // Offset of its first byte in the decoded stream
+};
+
+// Tar entry without a recorded data offset (directory, link, sparse member)
+static const UInt64 kNoTarDataOffset = (UInt64)(Int64)-1;
+
+// Seek index of a .tar.gz, kept next to it as "<archive>.szidx" (UTF-8
+// text). Besides the seek points it holds the listing of the sequential Tar
+// walk with each entry's data offset in the decoded stream, so a reopened
+// archive is listed without decoding and single entries are extracted from
+// the nearest point.
+//
+// Deflate data inside a member cannot be entered without the preceding
+// 32 KB window, which 7-Zip's decoder cannot be primed with, so the points
+// are member starts: every 1 MB in archives written by Compress (parallel
+// gzip) or bgzip, only the start of a single-member gzip.
+struct GzipSeekIndex {
+    UInt64 archiveSize = 0;
+    FILETIME archiveMTime = {};
+    std::vector<GzipSeekPoint> points;      // Ascending, first one at 0
+    std::vector<ArchiveItem> items;         // Tar walk order
+    std::vector<UInt64> dataOffsets;        // Per item, or kNoTarDataOffset
+
+    static std::wstring SidePath(const std::wstring& archivePath);
+
+    // Fails if the side file is missing or malformed, or was built for
+    // another version of the archive (size or mtime differ)
+    bool Load(const std::wstring& archivePath);
+
+    // Stamps the archive's current size and mtime
+    bool Save(const std::wstring& archivePath);
+
+    // Last seek point at or before unpackOffset
+    const GzipSeekPoint& Find(UInt64 unpackOffset) const;
+};
+
+// Decodes gzip members one after another from `start` to the end of the
+// file (or a non-gzip tail after at least one member), checking each
+// member's CRC32 and ISIZE. If points is given, every member start at least
+// `spacing` bytes past the last point is appended. Stops with the output
+// stream's error when it refuses data, or with S_OK after the member whose
+// output reaches the uncompressed offset stopAt, once its trailer checks out.
+HRESULT DecodeGzipMembers(IInStream* inStream, const GzipSeekPoint& start,
+                          ISequentialOutStream* outStream,
+                          std::vector<GzipSeekPoint>* points, UInt64 spacing,
+                          CancellationToken* cancel, UInt64 stopAt = (UInt64)(Int64)-1);
+
+// Output stream that drops `skip` bytes, passes the next `size` bytes to
+// `target` and drops the rest. The rest still goes through the decoder so
+// the member's trailer can be checked; pass the range end as stopAt to
+// DecodeGzipMembers to stop at that member.
+class CRangeOutStream :
+    public ISequentialOutStream,
+    public CMyUnknownImp
+{
+public:
+    CRangeOutStream(ISequentialOutStream* target, UInt64 skip, UInt64 size)
+        : m_target(target), m_skip(skip), m_left(size), m_refCount(0) {}
+    virtual ~CRangeOutStream() {}
+
+    bool IsComplete() const { return m_left == 0; }
+
+    // IUnknown
+    STDMETHOD(QueryInterface)(REFIID iid, void **outObject) {
+        if (iid == IID_IUnknown || iid == IID_ISequentialOutStream) {
+            *outObject = this;
+            AddRef();
+            return S_OK;
+        }
+        *outObject = NULL;
+        return E_NOINTERFACE;
+    }
+
+    STDMETHOD_(ULONG, AddRef)() { return ++m_refCount; }
+    STDMETHOD_(ULONG, Release)() {
+        ULONG res = --m_refCount;
+        if (res == 0) delete this;
+        return res;
+    }
+
+    STDMETHOD(Write)(const void *data, UInt32 size, UInt32 *processedSize);
+
+private:
+    ISequentialOutStream* m_target;
+    UInt64 m_skip;
+    UInt64 m_left;
+    ULONG m_refCount;
+};
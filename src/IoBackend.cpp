@@ -0,0 +1,230 @@
+// IoBackend.cpp - File I/O under the extraction output streams
+#include "IoBackend.h"
+#include "CoreStats.h"
+
+#include <condition_variable>
+#include <cwctype>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+
+// Files up to this size are submitted whole to the batched backend
+static const UInt32 kBatchedWholeFileLimit = 1 << 20;
+
+// Buffered bytes queued before WriteWholeFile blocks the decoder
+static const size_t kBatchedMaxQueuedBytes = 64 << 20;
+
+static HRESULT WriteWholeFileNow(const std::wstring& path, const std::vector<Byte>& data,
+                                 const FILETIME* mtime) {
+    HANDLE hFile;
+    {
+        CoreScopedPhase phase(CorePhase::FileCreate);
+        hFile = CreateFileW(path.c_str(), GENERIC_WRITE, 0, NULL, CREATE_ALWAYS,
+                            FILE_ATTRIBUTE_NORMAL, NULL);
+    }
+    if (hFile == INVALID_HANDLE_VALUE) return HRESULT_FROM_WIN32(GetLastError());
+    CoreStats_Add(CoreCounter::FilesCreated);
+
+    HRESULT hr = S_OK;
+    if (!data.empty()) {
+        CoreScopedPhase phase(CorePhase::Write);
+        DWORD written = 0;
+        if (!WriteFile(hFile, data.data(), (DWORD)data.size(), &written, NULL)) {
+            hr = HRESULT_FROM_WIN32(GetLastError());
+        } else if (written != data.size()) {
+            hr = E_FAIL;
+        }
+        CoreStats_Add(CoreCounter::BytesWritten, written);
+    }
+
+    CoreScopedPhase phase(CorePhase::FileClose);
+    if (mtime) SetFileTime(hFile, NULL, NULL, mtime);
+    CloseHandle(hFile);
+    if (FAILED(hr)) DeleteFileW(path.c_str());
+    return hr;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Blocking backend
+//////////////////////////////////////////////////////////////////////////////
+
+class CBlockingIoBackend : public CFileIoBackend {
+public:
+    UInt32 GetWholeFileLimit() const override { return 0; }
+
+    HRESULT WriteWholeFile(const std::wstring& path, std::vector<Byte>&& data,
+                           const FILETIME* mtime) override {
+        return WriteWholeFileNow(path, data, mtime);
+    }
+
+    HRESULT CloseFile(HANDLE hFile, const std::wstring& path) override {
+        CoreScopedPhase phase(CorePhase::FileClose);
+        return CloseHandle(hFile) ? S_OK : HRESULT_FROM_WIN32(GetLastError());
+    }
+
+    void WaitForPath(const std::wstring& path) override {}
+
+    HRESULT Flush() override { return S_OK; }
+};
+
+//////////////////////////////////////////////////////////////////////////////
+// Batched backend
+//////////////////////////////////////////////////////////////////////////////
+
+class CBatchedIoBackend : public CFileIoBackend {
+public:
+    explicit CBatchedIoBackend(uint32_t numThreads) {
+        for (uint32_t i = 0; i < numThreads; i++) {
+            m_threads.emplace_back([this] { WorkerLoop(); });
+        }
+    }
+
+    ~CBatchedIoBackend() override {
+        {
+            std::lock_guard<std::mutex> guard(m_lock);
+            m_stop = true;
+        }
+        m_workReady.notify_all();
+        for (auto& thread : m_threads) {
+            thread.join();
+        }
+    }
+
+    UInt32 GetWholeFileLimit() const override { return kBatchedWholeFileLimit; }
+
+    HRESULT WriteWholeFile(const std::wstring& path, std::vector<Byte>&& data,
+                           const FILETIME* mtime) override {
+        Job job;
+        job.path = path;
+        job.data = std::move(data);
+        job.hasMTime = (mtime != nullptr);
+        if (mtime) job.mtime = *mtime;
+        return Submit(std::move(job));
+    }
+
+    HRESULT CloseFile(HANDLE hFile, const std::wstring& path) override {
+        Job job;
+        job.path = path;
+        job.hFile = hFile;
+        return Submit(std::move(job));
+    }
+
+    void WaitForPath(const std::wstring& path) override {
+        std::wstring key = PathKey(path);
+        std::unique_lock<std::mutex> guard(m_lock);
+        m_idle.wait(guard, [&] { return m_pathJobs.find(key) == m_pathJobs.end(); });
+    }
+
+    HRESULT Flush() override {
+        std::unique_lock<std::mutex> guard(m_lock);
+        m_idle.wait(guard, [this] { return m_queue.empty() && m_running == 0; });
+        return m_error;
+    }
+
+private:
+    // Either a whole file or a handle to close (hFile set) of path
+    struct Job {
+        std::wstring path;
+        std::wstring key;
+        std::vector<Byte> data;
+        FILETIME mtime = {};
+        bool hasMTime = false;
+        HANDLE hFile = INVALID_HANDLE_VALUE;
+    };
+
+    HRESULT Submit(Job&& job) {
+        std::unique_lock<std::mutex> guard(m_lock);
+        // Bound the buffered data; one job is always admitted so a file
+        // larger than the bound cannot stall
+        m_idle.wait(guard, [this] {
+            return m_queuedBytes < kBatchedMaxQueuedBytes || m_error != S_OK;
+        });
+        if (m_error != S_OK) {
+            if (job.hFile != INVALID_HANDLE_VALUE) CloseHandle(job.hFile);
+            return m_error;
+        }
+        m_queuedBytes += job.data.size();
+        job.key = PathKey(job.path);
+        m_pathJobs[job.key]++;
+        m_queue.push_back(std::move(job));
+        guard.unlock();
+        m_workReady.notify_one();
+        return S_OK;
+    }
+
+    void WorkerLoop() {
+        for (;;) {
+            Job job;
+            {
+                std::unique_lock<std::mutex> guard(m_lock);
+                auto next = m_queue.end();
+                m_workReady.wait(guard, [&] {
+                    next = NextRunnable();
+                    return next != m_queue.end() || (m_stop && m_queue.empty());
+                });
+                if (next == m_queue.end()) return;
+                job = std::move(*next);
+                m_queue.erase(next);
+                m_busyPaths.insert(job.key);
+                m_running++;
+            }
+
+            HRESULT hr;
+            if (job.hFile != INVALID_HANDLE_VALUE) {
+                CoreScopedPhase phase(CorePhase::FileClose);
+                hr = CloseHandle(job.hFile) ? S_OK : HRESULT_FROM_WIN32(GetLastError());
+            } else {
+                hr = WriteWholeFileNow(job.path, job.data, job.hasMTime ? &job.mtime : nullptr);
+            }
+
+            {
+                std::lock_guard<std::mutex> guard(m_lock);
+                m_queuedBytes -= job.data.size();
+                m_running--;
+                m_busyPaths.erase(job.key);
+                auto pending = m_pathJobs.find(job.key);
+                if (--pending->second == 0) m_pathJobs.erase(pending);
+                if (FAILED(hr) && m_error == S_OK) m_error = hr;
+            }
+            m_idle.notify_all();
+            m_workReady.notify_all();
+        }
+    }
+
+    // Oldest queued job whose path has no job running; later jobs of a
+    // path wait behind it
+    std::deque<Job>::iterator NextRunnable() {
+        for (auto it = m_queue.begin(); it != m_queue.end(); ++it) {
+            if (!m_busyPaths.count(it->key)) return it;
+        }
+        return m_queue.end();
+    }
+
+    // File names are case-insensitive
+    static std::wstring PathKey(const std::wstring& path) {
+        std::wstring key = path;
+        for (auto& c : key) c = (wchar_t)towlower(c);
+        return key;
+    }
+
+    std::mutex m_lock;
+    std::condition_variable m_workReady;
+    std::condition_variable m_idle;         // A job finished
+    std::deque<Job> m_queue;
+    std::unordered_map<std::wstring, uint32_t> m_pathJobs;  // Queued or running
+    std::unordered_set<std::wstring> m_busyPaths;           // Running
+    std::vector<std::thread> m_threads;
+    size_t m_queuedBytes = 0;
+    uint32_t m_running = 0;
+    HRESULT m_error = S_OK;
+    bool m_stop = false;
+};
+
+std::unique_ptr<CFileIoBackend> CreateFileIoBackend(IoBackend kind, uint32_t numThreads) {
+    if (kind == IoBackend::Batched) {
+        return std::unique_ptr<CFileIoBackend>(new CBatchedIoBackend(numThreads ? numThreads : 4));
+    }
+    return std::unique_ptr<CFileIoBackend>(new CBlockingIoBackend());
+}
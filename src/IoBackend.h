@@ -0,0 +1,45 @@
+// IoBackend.h - File I/O under the extraction output streams
+#pragma once
+
+#include <Windows.h>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "SevenZipCore.h"
+
+#include "Common/Common.h"
+
+// What CSimpleOutFileStream hands to the file system. Large files are
+// written through their own handle and only the close goes through the
+// backend; files up to GetWholeFileLimit() are buffered by the stream and
+// submitted whole (create, write, mtime, close).
+class CFileIoBackend {
+public:
+    virtual ~CFileIoBackend() {}
+
+    // Largest file the stream should buffer for WriteWholeFile; 0 = none
+    virtual UInt32 GetWholeFileLimit() const = 0;
+
+    // Creates path (CREATE_ALWAYS; the parent directory exists), writes
+    // data, sets mtime if given and closes the file
+    virtual HRESULT WriteWholeFile(const std::wstring& path, std::vector<Byte>&& data,
+                                   const FILETIME* mtime) = 0;
+
+    // Closes a handle the stream wrote through directly to path
+    virtual HRESULT CloseFile(HANDLE hFile, const std::wstring& path) = 0;
+
+    // Waits for everything submitted for path, before the stream opens it
+    // itself, so the last entry for a path is the one left on disk
+    virtual void WaitForPath(const std::wstring& path) = 0;
+
+    // Waits for everything submitted so far; returns the first failure
+    virtual HRESULT Flush() = 0;
+};
+
+// IoBackend::Blocking: every call runs on the caller's thread.
+// IoBackend::Batched: submissions are queued and run on numThreads I/O
+// threads (0 = 4), so the decoder does not wait for file creation, Defender
+// scans on close, or small writes. Submissions for the same path run one at
+// a time, in order.
+std::unique_ptr<CFileIoBackend> CreateFileIoBackend(IoBackend kind, uint32_t numThreads);
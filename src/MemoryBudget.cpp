@@ -0,0 +1,138 @@
+// MemoryBudget.cpp - Encoder memory estimates and the process-wide memory budget
+#include "MemoryBudget.h"
+#include "CoreStats.h"
+
+#include <algorithm>
+#include <chrono>
+#include <thread>
+
+static const uint64_t kMB = 1 << 20;
+
+// How often a waiting job looks at its cancellation token
+static const auto kGovernorPollInterval = std::chrono::milliseconds(50);
+
+static uint64_t RoundUpToPowerOfTwo(uint64_t value) {
+    uint64_t result = 1;
+    while (result < value && result < ((uint64_t)1 << 62)) result <<= 1;
+    return result;
+}
+
+uint64_t DefaultLzmaDictSize(int32_t level) {
+    if (level < 0) level = 5;
+    if (level <= 3) return (uint64_t)1 << (level * 2 + 16);
+    if (level <= 6) return (uint64_t)1 << (level + 19);
+    if (level <= 7) return (uint64_t)1 << 25;
+    return (uint64_t)1 << 26;
+}
+
+uint64_t EstimateEncoderMemory(EncoderKind kind, uint32_t numThreads, uint64_t dictSize,
+                               uint64_t inputSize, uint64_t blockSize, uint32_t windowLog) {
+    uint64_t threads = std::max<uint32_t>(numThreads, 1);
+    switch (kind) {
+        case EncoderKind::Lzma:
+            return dictSize * 23 / 2 + 4 * kMB;
+        case EncoderKind::Lzma2: {
+            // Each LZMA encoder works on blocks of 4 x dictionary (1-256 MB)
+            // with two threads; a small input never fills more than one block
+            uint64_t lzma2Block = std::min<uint64_t>(std::max<uint64_t>(dictSize * 4, kMB),
+                                                     256 * kMB);
+            uint64_t encoders = (threads + 1) / 2;
+            if (inputSize) {
+                encoders = std::min<uint64_t>(encoders, (inputSize + lzma2Block - 1) / lzma2Block);
+            }
+            encoders = std::max<uint64_t>(encoders, 1);
+            return encoders * (dictSize * 23 / 2 + 4 * kMB + (encoders > 1 ? lzma2Block : 0));
+        }
+        case EncoderKind::Deflate:
+            return threads * 2 * kMB;
+        case EncoderKind::ParallelGzip:
+            // Two blocks in flight per thread, each with its input and member
+            return threads * (2 * 2 * std::max<uint64_t>(blockSize, kMB) + kMB);
+        case EncoderKind::BZip2:
+            return threads * 10 * kMB;
+        case EncoderKind::Zstd: {
+            uint64_t window = windowLog ? ((uint64_t)1 << windowLog) : 8 * kMB;
+            return window + threads * (3 * window + 4 * kMB);
+        }
+        case EncoderKind::Other:
+            break;
+    }
+    return threads * kMB;
+}
+
+EncoderMemoryPlan PlanEncoderMemory(const EncoderMemoryInput& input, uint64_t budget) {
+    uint32_t cores = std::max(1u, std::thread::hardware_concurrency());
+    EncoderMemoryPlan plan;
+    plan.numThreads = input.numThreads ? input.numThreads : cores;
+
+    bool lzma = (input.kind == EncoderKind::Lzma || input.kind == EncoderKind::Lzma2);
+    if (lzma) {
+        plan.dictSize = input.dictSize ? input.dictSize : DefaultLzmaDictSize(input.level);
+        if (input.inputSize) {
+            uint64_t fit = std::max(kMinDictionarySize, RoundUpToPowerOfTwo(input.inputSize));
+            plan.dictSize = std::min(plan.dictSize, fit);
+        }
+    }
+
+    auto estimate = [&input, &plan] {
+        return EstimateEncoderMemory(input.kind, plan.numThreads, plan.dictSize, input.inputSize,
+                                     input.blockSize, input.windowLog);
+    };
+    plan.bytes = estimate();
+    if (budget) {
+        // Fewer threads first: that costs time, a smaller dictionary costs ratio
+        while (plan.bytes > budget && plan.numThreads > 1) {
+            plan.numThreads--;
+            plan.threadsReduced = true;
+            plan.bytes = estimate();
+        }
+        while (lzma && plan.bytes > budget && plan.dictSize > kMinDictionarySize) {
+            plan.dictSize /= 2;
+            plan.bytes = estimate();
+        }
+    }
+    return plan;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// CMemoryGovernor
+//////////////////////////////////////////////////////////////////////////////
+
+void CMemoryGovernor::SetBudget(uint64_t bytes) {
+    {
+        std::lock_guard<std::mutex> guard(m_lock);
+        m_budget = bytes;
+    }
+    m_released.notify_all();
+}
+
+uint64_t CMemoryGovernor::GetBudget() const {
+    std::lock_guard<std::mutex> guard(m_lock);
+    return m_budget;
+}
+
+bool CMemoryGovernor::Acquire(uint64_t bytes, CancellationToken* cancel) {
+    std::unique_lock<std::mutex> guard(m_lock);
+    auto fits = [this, bytes] {
+        return m_budget == 0 || m_jobs == 0 || m_inUse + bytes <= m_budget;
+    };
+    if (!fits()) {
+        CoreScopedPhase phase(CorePhase::MemoryWait);
+        while (!fits()) {
+            if (cancel && cancel->Check()) return false;
+            m_released.wait_for(guard, kGovernorPollInterval);
+        }
+    }
+    m_inUse += bytes;
+    m_jobs++;
+    return true;
+}
+
+void CMemoryGovernor::Release(uint64_t bytes) {
+    {
+        std::lock_guard<std::mutex> guard(m_lock);
+        m_inUse -= bytes;
+        m_jobs--;
+    }
+    m_released.notify_all();
+}
@@ -0,0 +1,93 @@
+// MemoryBudget.h - Encoder memory estimates and the process-wide memory budget
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+
+#include "CancellationToken.h"
+
+// Encoder families with distinct memory behaviour
+enum class EncoderKind : uint32_t {
+    Lzma,           // 7z LZMA: one encoder, at most two match-finder threads
+    Lzma2,          // 7z/XZ LZMA2: one LZMA encoder per two threads
+    Deflate,        // Zip/GZip Deflate, Deflate64
+    ParallelGzip,   // .tar.gz members (CParallelGzipEncoder)
+    BZip2,
+    Zstd,
+    Other,          // Copy, PPMd, Tar: small or fixed
+};
+
+// Smallest dictionary the planner goes down to
+static const uint64_t kMinDictionarySize = 1 << 16;
+
+struct EncoderMemoryInput {
+    EncoderKind kind = EncoderKind::Other;
+    int32_t level = -1;             // -1 = 5, the handlers' default
+    uint32_t numThreads = 0;        // 0 = one per core
+    uint64_t dictSize = 0;          // LZMA/LZMA2; 0 = level default
+    uint64_t inputSize = 0;         // Total source bytes
+    uint64_t blockSize = 0;         // ParallelGzip member size
+    uint32_t windowLog = 0;         // ZSTD long window, 0 = level default
+};
+
+struct EncoderMemoryPlan {
+    uint32_t numThreads = 0;        // Effective thread count
+    uint64_t dictSize = 0;          // LZMA/LZMA2 dictionary, 0 for other kinds
+    uint64_t bytes = 0;             // Estimated encoder memory
+    bool threadsReduced = false;    // Below the requested (or core) count
+};
+
+// LZMA dictionary of a compression level, as LzmaEncProps_Normalize picks it
+uint64_t DefaultLzmaDictSize(int32_t level);
+
+// Rough peak allocation of an encoder; follows 7-Zip's figures of about
+// 11.5 x dictionary for the bt4 match finder plus block buffers per thread
+uint64_t EstimateEncoderMemory(EncoderKind kind, uint32_t numThreads, uint64_t dictSize,
+                               uint64_t inputSize, uint64_t blockSize, uint32_t windowLog);
+
+// The dictionary never exceeds the input (rounded up to a power of two);
+// with a budget (0 = none), threads and then the dictionary are reduced
+// until the estimate fits or both are at their minimum
+EncoderMemoryPlan PlanEncoderMemory(const EncoderMemoryInput& input, uint64_t budget);
+
+// Admits concurrent jobs while their estimates fit the budget. A job larger
+// than the whole budget still runs, alone, so nothing waits forever.
+class CMemoryGovernor {
+public:
+    // 0 = unlimited; waiting jobs are re-checked
+    void SetBudget(uint64_t bytes);
+    uint64_t GetBudget() const;
+
+    // Blocks until bytes fit beside the running jobs. Returns false if the
+    // token was cancelled while waiting.
+    bool Acquire(uint64_t bytes, CancellationToken* cancel);
+    void Release(uint64_t bytes);
+
+private:
+    mutable std::mutex m_lock;
+    std::condition_variable m_released;
+    uint64_t m_budget = 0;
+    uint64_t m_inUse = 0;
+    uint32_t m_jobs = 0;
+};
+
+// Acquire in the constructor, Release in the destructor
+class CMemoryReservation {
+public:
+    CMemoryReservation(CMemoryGovernor& governor, uint64_t bytes, CancellationToken* cancel)
+        : m_governor(governor), m_bytes(bytes), m_held(governor.Acquire(bytes, cancel)) {}
+    ~CMemoryReservation() {
+        if (m_held) m_governor.Release(m_bytes);
+    }
+
+    CMemoryReservation(const CMemoryReservation&) = delete;
+    CMemoryReservation& operator=(const CMemoryReservation&) = delete;
+
+    bool IsHeld() const { return m_held; }
+
+private:
+    CMemoryGovernor& m_governor;
+    uint64_t m_bytes;
+    bool m_held;
+};
@@ -0,0 +1,195 @@
+// ParallelGzip.cpp - Block-parallel gzip encoder (multi-member output)
+#include "ParallelGzip.h"
+
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "7zip/Common/CreateCoder.h"
+#include "7zip/Common/StreamObjects.h"
+#include "7zip/Common/StreamUtils.h"
+#include "Common/MyCom.h"
+
+#include "7zCrc.h"
+
+static const UInt64 kDeflateMethodId = 0x040108;
+
+// ID1 ID2 CM=Deflate FLG=0 MTIME=0 XFL=0 OS=0 (FAT, as 7-Zip writes it)
+static const Byte kGzipHeader[10] = { 0x1F, 0x8B, 8, 0, 0, 0, 0, 0, 0, 0 };
+
+struct CGzipBlock {
+    std::vector<Byte> data;
+    std::vector<Byte> member;
+    HRESULT hr = S_OK;
+    bool done = false;
+};
+
+static void SetUInt32LE(Byte* p, UInt32 value) {
+    p[0] = (Byte)value;
+    p[1] = (Byte)(value >> 8);
+    p[2] = (Byte)(value >> 16);
+    p[3] = (Byte)(value >> 24);
+}
+
+static HRESULT SetLevel(ICompressCoder* coder, int level) {
+    ICompressSetCoderProperties* setProps = nullptr;
+    coder->QueryInterface(IID_ICompressSetCoderProperties, (void**)&setProps);
+    if (!setProps) return S_OK;
+    PROPID propID = NCoderPropID::kLevel;
+    PROPVARIANT value;
+    value.vt = VT_UI4;
+    value.ulVal = (UInt32)level;
+    HRESULT hr = setProps->SetCoderProperties(&propID, &value, 1);
+    setProps->Release();
+    return hr;
+}
+
+// Deflates one block into a self-contained gzip member
+static HRESULT EncodeMember(ICompressCoder* coder, CGzipBlock& block) {
+    CBufInStream* inStream = new CBufInStream;
+    inStream->AddRef();
+    inStream->Init(block.data.data(), block.data.size());
+    CDynBufSeqOutStream* outStream = new CDynBufSeqOutStream;
+    outStream->AddRef();
+    outStream->Init();
+
+    UInt64 inSize = block.data.size();
+    HRESULT hr = coder->Code(inStream, outStream, &inSize, NULL, NULL);
+    if (SUCCEEDED(hr)) {
+        size_t packSize = outStream->GetSize();
+        block.member.resize(sizeof(kGzipHeader) + packSize + 8);
+        Byte* p = block.member.data();
+        memcpy(p, kGzipHeader, sizeof(kGzipHeader));
+        memcpy(p + sizeof(kGzipHeader), outStream->GetBuffer(), packSize);
+        p += sizeof(kGzipHeader) + packSize;
+        SetUInt32LE(p, CrcCalc(block.data.data(), block.data.size()));
+        SetUInt32LE(p + 4, (UInt32)block.data.size());
+    }
+
+    outStream->Release();
+    inStream->Release();
+    return hr;
+}
+
+CParallelGzipEncoder::CParallelGzipEncoder(UInt32 numThreads, int level, size_t blockSize,
+                                           const CNodePlacement* placement)
+    : m_numThreads(numThreads ? numThreads : 1)
+    , m_level(level)
+    , m_blockSize(blockSize ? blockSize : 1)
+    , m_placement(placement)
+{
+}
+
+HRESULT CParallelGzipEncoder::Code(ISequentialInStream* inStream,
+                                   ISequentialOutStream* outStream,
+                                   ICompressProgressInfo* progress) {
+    std::mutex lock;
+    std::condition_variable workReady;
+    std::condition_variable blockDone;
+    std::deque<std::shared_ptr<CGzipBlock>> pending;    // Waiting for a worker
+    std::deque<std::shared_ptr<CGzipBlock>> inFlight;   // In output order
+    bool stop = false;
+
+    auto worker = [&](UInt32 index) {
+        if (m_placement) m_placement->Pin(index);
+        CMyComPtr<ICompressCoder> coder;
+        HRESULT coderHr = CreateCoder_Id(kDeflateMethodId, true, coder);
+        if (SUCCEEDED(coderHr) && !coder) coderHr = E_NOTIMPL;
+        if (SUCCEEDED(coderHr) && m_level >= 0) coderHr = SetLevel(coder, m_level);
+
+        for (;;) {
+            std::shared_ptr<CGzipBlock> block;
+            {
+                std::unique_lock<std::mutex> guard(lock);
+                workReady.wait(guard, [&] { return stop || !pending.empty(); });
+                if (pending.empty()) return;
+                block = pending.front();
+                pending.pop_front();
+            }
+            HRESULT hr = FAILED(coderHr) ? coderHr : EncodeMember(coder, *block);
+            std::vector<Byte>().swap(block->data);
+            {
+                std::lock_guard<std::mutex> guard(lock);
+                block->hr = hr;
+                block->done = true;
+            }
+            blockDone.notify_all();
+        }
+    };
+
+    std::vector<std::thread> workers;
+    for (UInt32 i = 0; i < m_numThreads; i++) {
+        workers.emplace_back(worker, i);
+    }
+
+    // Enough read-ahead to keep every worker busy while the oldest block
+    // is being written
+    const size_t maxInFlight = 2 * (size_t)m_numThreads;
+    UInt64 inProcessed = 0;
+    UInt64 outProcessed = 0;
+    bool eof = false;
+    bool anyBlock = false;
+    HRESULT hr = S_OK;
+
+    while (SUCCEEDED(hr)) {
+        // Write finished blocks in order; wait for the oldest one when the
+        // window is full or the input is exhausted
+        std::shared_ptr<CGzipBlock> front;
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            if (!inFlight.empty() && (eof || inFlight.size() >= maxInFlight)) {
+                blockDone.wait(guard, [&] { return inFlight.front()->done; });
+            }
+            if (!inFlight.empty() && inFlight.front()->done) {
+                front = inFlight.front();
+                inFlight.pop_front();
+            }
+        }
+        if (front) {
+            hr = front->hr;
+            if (SUCCEEDED(hr)) {
+                hr = WriteStream(outStream, front->member.data(), front->member.size());
+                outProcessed += front->member.size();
+            }
+            if (SUCCEEDED(hr) && progress) {
+                hr = progress->SetRatioInfo(&inProcessed, &outProcessed);
+            }
+            continue;
+        }
+        if (eof) break;
+
+        auto block = std::make_shared<CGzipBlock>();
+        block->data.resize(m_blockSize);
+        size_t size = m_blockSize;
+        hr = ReadStream(inStream, block->data.data(), &size);
+        if (FAILED(hr)) break;
+        block->data.resize(size);
+        eof = (size < m_blockSize);
+
+        // An empty input still needs one (empty) member to be valid gzip
+        if (size == 0 && anyBlock) continue;
+        anyBlock = true;
+        inProcessed += size;
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            pending.push_back(block);
+            inFlight.push_back(block);
+        }
+        workReady.notify_one();
+    }
+
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stop = true;
+        pending.clear();
+    }
+    workReady.notify_all();
+    for (auto& thread : workers) {
+        thread.join();
+    }
+    return hr;
+}
@@ -0,0 +1,33 @@
+// ParallelGzip.h - Block-parallel gzip encoder (multi-member output)
+#pragma once
+
+#include <cstddef>
+
+#include "Common/Common.h"
+#include "7zip/IStream.h"
+#include "7zip/ICoder.h"
+
+#include "CpuTopology.h"
+
+// Splits the input into fixed-size blocks and deflates them on worker
+// threads. Each block becomes a complete gzip member (header, Deflate data,
+// CRC32, ISIZE); members are written in input order, so the output is a
+// standard multi-member gzip stream that gzip, zlib and 7-Zip read as one
+// file. Blocks do not share a dictionary, which costs a little ratio at the
+// block boundaries.
+class CParallelGzipEncoder {
+public:
+    // level < 0 keeps the Deflate encoder's default; workers are pinned to
+    // the placement's node when one is given
+    CParallelGzipEncoder(UInt32 numThreads, int level, size_t blockSize,
+                         const CNodePlacement* placement = nullptr);
+
+    HRESULT Code(ISequentialInStream* inStream, ISequentialOutStream* outStream,
+                 ICompressProgressInfo* progress);
+
+private:
+    UInt32 m_numThreads;
+    int m_level;
+    size_t m_blockSize;
+    const CNodePlacement* m_placement;
+};
@@ -0,0 +1,205 @@
+// PathFilter.cpp - Include/exclude glob patterns compiled for matching item paths
+#include "PathFilter.h"
+
+#include <cwctype>
+
+static bool IsSeparator(wchar_t c) {
+    return c == L'\\' || c == L'/';
+}
+
+PathFilter::PathFilter(const std::vector<std::wstring>& include,
+                       const std::vector<std::wstring>& exclude,
+                       bool caseSensitive)
+    : m_caseSensitive(caseSensitive)
+{
+    for (const auto& glob : include) {
+        m_include.push_back(Compile(glob));
+    }
+    for (const auto& glob : exclude) {
+        m_exclude.push_back(Compile(glob));
+    }
+}
+
+wchar_t PathFilter::Fold(wchar_t c) const {
+    if (m_caseSensitive) return c;
+    if (c < 0x80) return (c >= L'A' && c <= L'Z') ? (wchar_t)(c + (L'a' - L'A')) : c;
+    return (wchar_t)towlower(c);
+}
+
+PathFilter::Pattern PathFilter::Compile(const std::wstring& glob) const {
+    // Leading "/" and "./" and trailing separators carry no meaning here
+    size_t begin = 0;
+    size_t end = glob.size();
+    for (;;) {
+        if (begin < end && IsSeparator(glob[begin])) {
+            begin++;
+        } else if (end - begin >= 2 && glob[begin] == L'.' && IsSeparator(glob[begin + 1])) {
+            begin += 2;
+        } else {
+            break;
+        }
+    }
+    while (end > begin && IsSeparator(glob[end - 1])) end--;
+
+    Pattern pattern;
+    auto& tokens = pattern.tokens;
+    auto push = [&tokens](TokenType type) {
+        tokens.push_back({ type, false, std::wstring() });
+    };
+
+    // A bare name matches at any depth
+    bool anchored = false;
+    for (size_t i = begin; i < end; i++) {
+        if (IsSeparator(glob[i])) anchored = true;
+    }
+    if (!anchored) push(TokenType::AnyDirs);
+
+    for (size_t i = begin; i < end;) {
+        wchar_t c = glob[i];
+        bool componentStart = (i == begin) || IsSeparator(glob[i - 1]);
+
+        if (IsSeparator(c)) {
+            if (tokens.empty() || tokens.back().type != TokenType::Separator) {
+                push(TokenType::Separator);
+            }
+            i++;
+        } else if (c == L'*' && i + 1 < end && glob[i + 1] == L'*' && componentStart &&
+                   (i + 2 == end || IsSeparator(glob[i + 2]))) {
+            // "**" component: its separator is part of what it matches
+            if (tokens.empty() || tokens.back().type != TokenType::AnyDirs) {
+                push(TokenType::AnyDirs);
+            }
+            i += 2;
+            while (i < end && IsSeparator(glob[i])) i++;
+        } else if (c == L'*') {
+            if (tokens.empty() || tokens.back().type != TokenType::Star) push(TokenType::Star);
+            i++;
+        } else if (c == L'?') {
+            push(TokenType::AnyChar);
+            i++;
+        } else if (c == L'[' && glob.find(L']', i + 2) < end) {
+            // Members are stored as (low, high) pairs; a single member is (c, c)
+            Token token = { TokenType::Set, false, std::wstring() };
+            size_t j = i + 1;
+            if (glob[j] == L'!' || glob[j] == L'^') {
+                token.negated = true;
+                j++;
+            }
+            bool first = true;
+            while (j < end && (glob[j] != L']' || first)) {
+                wchar_t low = glob[j];
+                wchar_t high = low;
+                if (j + 2 < end && glob[j + 1] == L'-' && glob[j + 2] != L']') {
+                    high = glob[j + 2];
+                    j += 2;
+                }
+                token.text += Fold(low);
+                token.text += Fold(high);
+                first = false;
+                j++;
+            }
+            if (j >= end) {
+                // No closing bracket after all: a literal '['
+                if (tokens.empty() || tokens.back().type != TokenType::Literal) {
+                    push(TokenType::Literal);
+                }
+                tokens.back().text += Fold(c);
+                i++;
+                continue;
+            }
+            tokens.push_back(std::move(token));
+            i = j + 1;
+        } else {
+            if (tokens.empty() || tokens.back().type != TokenType::Literal) {
+                push(TokenType::Literal);
+            }
+            tokens.back().text += Fold(c);
+            i++;
+        }
+    }
+    return pattern;
+}
+
+bool PathFilter::SetContains(const Token& token, wchar_t c) const {
+    wchar_t folded = Fold(c);
+    bool found = false;
+    for (size_t i = 0; i + 1 < token.text.size(); i += 2) {
+        if (folded >= token.text[i] && folded <= token.text[i + 1]) {
+            found = true;
+            break;
+        }
+    }
+    return found != token.negated;
+}
+
+bool PathFilter::MatchFrom(const Pattern& pattern, size_t ti, const wchar_t* path, size_t pos,
+                           size_t length) const {
+    const auto& tokens = pattern.tokens;
+    while (ti < tokens.size()) {
+        const Token& token = tokens[ti];
+        switch (token.type) {
+            case TokenType::Literal: {
+                size_t n = token.text.size();
+                if (length - pos < n) return false;
+                for (size_t i = 0; i < n; i++) {
+                    if (Fold(path[pos + i]) != token.text[i]) return false;
+                }
+                pos += n;
+                break;
+            }
+            case TokenType::AnyChar:
+                if (pos == length || IsSeparator(path[pos])) return false;
+                pos++;
+                break;
+            case TokenType::Set:
+                if (pos == length || IsSeparator(path[pos]) || !SetContains(token, path[pos])) {
+                    return false;
+                }
+                pos++;
+                break;
+            case TokenType::Separator:
+                if (pos == length || !IsSeparator(path[pos])) return false;
+                pos++;
+                break;
+            case TokenType::Star: {
+                // Only positions where the following literal can start
+                const Token* next = (ti + 1 < tokens.size()) ? &tokens[ti + 1] : nullptr;
+                wchar_t first = (next && next->type == TokenType::Literal) ? next->text[0] : 0;
+                for (size_t k = pos;; k++) {
+                    if ((first == 0 || (k < length && Fold(path[k]) == first)) &&
+                        MatchFrom(pattern, ti + 1, path, k, length)) {
+                        return true;
+                    }
+                    if (k == length || IsSeparator(path[k])) return false;
+                }
+            }
+            case TokenType::AnyDirs: {
+                if (ti + 1 == tokens.size()) return true;
+                // Zero components, then after each separator from here on
+                for (size_t k = pos; k <= length; k++) {
+                    if ((k == pos || IsSeparator(path[k - 1])) &&
+                        MatchFrom(pattern, ti + 1, path, k, length)) {
+                        return true;
+                    }
+                }
+                return false;
+            }
+        }
+        ti++;
+    }
+    // A match of a directory covers what lies below it
+    return pos == length || IsSeparator(path[pos]);
+}
+
+bool PathFilter::MatchAny(const std::vector<Pattern>& patterns, const wchar_t* path,
+                          size_t length) const {
+    for (const auto& pattern : patterns) {
+        if (MatchFrom(pattern, 0, path, 0, length)) return true;
+    }
+    return false;
+}
+
+bool PathFilter::Matches(const wchar_t* path, size_t length) const {
+    if (!m_include.empty() && !MatchAny(m_include, path, length)) return false;
+    return m_exclude.empty() || !MatchAny(m_exclude, path, length);
+}
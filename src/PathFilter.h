@@ -0,0 +1,68 @@
+// PathFilter.h - Include/exclude glob patterns compiled for matching item paths
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Glob syntax, matched against archive item paths ('/' and '\' are the same
+// separator):
+//   *        any run of characters within one path component
+//   ?        one character other than a separator
+//   [a-z]    one character of a set or range; [!...] negates
+//   **       as a whole component: zero or more components
+// A pattern without a separator matches a name at any depth ("*.so"); one
+// with a separator is anchored at the archive root ("lib/**/*.so"). A pattern
+// that matches a directory also matches everything below it, so "docs"
+// selects the whole docs tree and excluding "build" drops it.
+//
+// Patterns are parsed once into token lists (literals folded to lower case
+// unless caseSensitive), so matching a path costs no allocation and no
+// per-call parsing; it runs millions of times per second over raw item paths.
+class PathFilter {
+public:
+    // Matches every path
+    PathFilter() = default;
+
+    // Empty include = every path not excluded
+    PathFilter(const std::vector<std::wstring>& include,
+               const std::vector<std::wstring>& exclude,
+               bool caseSensitive = false);
+
+    bool MatchesAll() const { return m_include.empty() && m_exclude.empty(); }
+
+    bool Matches(const wchar_t* path, size_t length) const;
+    bool Matches(const std::wstring& path) const { return Matches(path.c_str(), path.size()); }
+
+private:
+    enum class TokenType : uint8_t {
+        Literal,    // text (already case-folded)
+        AnyChar,    // ?
+        Set,        // [...]; text holds the members, ranges as "a-z" triples
+        Star,       // *
+        AnyDirs,    // **/ or trailing **
+        Separator,
+    };
+
+    struct Token {
+        TokenType type;
+        bool negated;
+        std::wstring text;
+    };
+
+    struct Pattern {
+        std::vector<Token> tokens;
+    };
+
+    Pattern Compile(const std::wstring& glob) const;
+    bool MatchAny(const std::vector<Pattern>& patterns, const wchar_t* path, size_t length) const;
+    bool MatchFrom(const Pattern& pattern, size_t ti, const wchar_t* path, size_t pos,
+                   size_t length) const;
+    bool SetContains(const Token& token, wchar_t c) const;
+    wchar_t Fold(wchar_t c) const;
+
+    std::vector<Pattern> m_include;
+    std::vector<Pattern> m_exclude;
+    bool m_caseSensitive = false;
+};
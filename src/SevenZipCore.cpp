@@ -1,5 +1,17 @@
 // SevenZipCore.cpp - 7-Zip functionality wrapper implementation
 #include "SevenZipCore.h"
+#include "CoreStats.h"
+#include "CancellationToken.h"
+#include "ArchiveProps.h"
+#include "ZstdCodec.h"
+#include "StreamPipe.h"
+#include "ParallelGzip.h"
+#include "FileHash.h"
+#include "DirectIo.h"
+#include "IoBackend.h"
+#include "FilePrefetcher.h"
+#include "GzipIndex.h"
+#include "MemoryBudget.h"
 
 #include <Windows.h>
 #include <PropIdl.h>
@@ -10,10 +22,21 @@
 #include "7zip/Archive/IArchive.h"
 #include "7zip/IPassword.h"
 #include "7zip/Common/FileStreams.h"
+#include "7zip/Common/StreamUtils.h"
 #include "7zip/PropID.h"
 #include "Common/MyCom.h"
 #include "Common/MyString.h"
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <numeric>
+#include <thread>
+
 // Archive format GUIDs
 // {23170F69-40C1-278A-1000-000110070000} - 7z
 static const GUID CLSID_CFormat7z =
@@ -47,6 +70,14 @@ static const GUID CLSID_CFormatIso =
 static const GUID CLSID_CFormatCab =
     { 0x23170F69, 0x40C1, 0x278A, { 0x10, 0x00, 0x00, 0x01, 0x10, 0x08, 0x00, 0x00 } };
 
+// {23170F69-40C1-278A-1000-0001100C0000} - Xz
+static const GUID CLSID_CFormatXz =
+    { 0x23170F69, 0x40C1, 0x278A, { 0x10, 0x00, 0x00, 0x01, 0x10, 0x0C, 0x00, 0x00 } };
+
+// {23170F69-40C1-278A-1000-0001100E0000} - Zstd
+static const GUID CLSID_CFormatZstd =
+    { 0x23170F69, 0x40C1, 0x278A, { 0x10, 0x00, 0x00, 0x01, 0x10, 0x0E, 0x00, 0x00 } };
+
 // External function from 7-Zip to create archive objects
 STDAPI CreateObject(const GUID *clsid, const GUID *iid, void **outObject);
 
@@ -55,26 +86,197 @@ STDAPI CreateObject(const GUID *clsid, const GUID *iid, void **outObject);
 //////////////////////////////////////////////////////////////////////////////
 
 static void CreateDirectoryRecursive(const std::wstring& path) {
+    CoreScopedPhase phase(CorePhase::DirCreate);
     size_t pos = 0;
     while ((pos = path.find(L'\\', pos + 1)) != std::wstring::npos) {
-        CreateDirectoryW(path.substr(0, pos).c_str(), NULL);
+        if (CreateDirectoryW(path.substr(0, pos).c_str(), NULL)) {
+            CoreStats_Add(CoreCounter::DirsCreated);
+        }
+    }
+    if (CreateDirectoryW(path.c_str(), NULL)) {
+        CoreStats_Add(CoreCounter::DirsCreated);
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Helper: Coder properties passed to a handler through ISetProperties
+//////////////////////////////////////////////////////////////////////////////
+
+class CHandlerProps {
+public:
+    void AddUInt32(const wchar_t* name, UInt32 value) {
+        m_props.push_back({ name, VT_UI4, value, L"" });
+    }
+
+    void AddString(const wchar_t* name, const std::wstring& value) {
+        m_props.push_back({ name, VT_BSTR, 0, value });
+    }
+
+    bool IsEmpty() const { return m_props.empty(); }
+
+    // Handlers without ISetProperties keep their defaults
+    HRESULT Apply(IUnknown* handler) const {
+        if (m_props.empty()) return S_OK;
+
+        ISetProperties* setProps = nullptr;
+        handler->QueryInterface(IID_ISetProperties, (void**)&setProps);
+        if (!setProps) return S_OK;
+
+        std::vector<const wchar_t*> names;
+        std::vector<PROPVARIANT> values(m_props.size());
+        for (size_t i = 0; i < m_props.size(); i++) {
+            names.push_back(m_props[i].name.c_str());
+            PropVariantInit(&values[i]);
+            values[i].vt = m_props[i].vt;
+            if (m_props[i].vt == VT_BSTR) {
+                values[i].bstrVal = SysAllocString(m_props[i].str.c_str());
+            } else {
+                values[i].ulVal = m_props[i].u32;
+            }
+        }
+
+        HRESULT hr = setProps->SetProperties(names.data(), values.data(), (UInt32)values.size());
+        for (auto& value : values) {
+            PropVariantClear(&value);
+        }
+        setProps->Release();
+        return hr;
+    }
+
+private:
+    struct Prop {
+        std::wstring name;
+        VARTYPE vt;
+        UInt32 u32;
+        std::wstring str;
+    };
+    std::vector<Prop> m_props;
+};
+
+// Decoder threads of an input handler. Handlers keep "mt" until it is set
+// again, so every decoding call on the open archive sets it; 0 puts back
+// the handler default (one thread per processor).
+static HRESULT ApplyDecoderThreads(IInArchive* archive, uint32_t numThreads) {
+    CHandlerProps props;
+    if (numThreads) {
+        props.AddUInt32(L"mt", numThreads);
+    } else {
+        props.AddString(L"mt", L"on");
+    }
+    return props.Apply(archive);
+}
+
+// Size in the handlers' "<N>k" / "<N>m" notation
+static std::wstring SizeString(uint64_t bytes) {
+    if (bytes % (1 << 20) == 0) return std::to_wstring(bytes >> 20) + L"m";
+    return std::to_wstring((bytes + 1023) >> 10) + L"k";
+}
+
+// Encoder family of a format and its method option, for memory planning
+static EncoderKind EncoderKindFor(const GUID& formatId, const OperationOptions& options) {
+    if (options.level == 0 && options.method.empty()) return EncoderKind::Other;   // Stored
+    if (!options.method.empty()) {
+        const std::wstring& m = options.method;
+        if (_wcsicmp(m.c_str(), L"LZMA2") == 0) return EncoderKind::Lzma2;
+        if (_wcsicmp(m.c_str(), L"LZMA") == 0) return EncoderKind::Lzma;
+        if (_wcsnicmp(m.c_str(), L"Deflate", 7) == 0) return EncoderKind::Deflate;
+        if (_wcsicmp(m.c_str(), L"BZip2") == 0) return EncoderKind::BZip2;
+        if (_wcsicmp(m.c_str(), L"ZSTD") == 0) return EncoderKind::Zstd;
+        return EncoderKind::Other;
+    }
+    if (formatId == CLSID_CFormat7z || formatId == CLSID_CFormatXz) return EncoderKind::Lzma2;
+    if (formatId == CLSID_CFormatZip || formatId == CLSID_CFormatGZip) return EncoderKind::Deflate;
+    if (formatId == CLSID_CFormatBZip2) return EncoderKind::BZip2;
+#ifdef SEVENZIPCORE_WITH_ZSTD
+    if (formatId == CLSID_CFormatZstd) return EncoderKind::Zstd;
+#endif
+    return EncoderKind::Other;
+}
+
+// Encoder settings from OperationOptions for an output handler
+static void AddCompressProps(CHandlerProps& props, const GUID& formatId,
+                             const OperationOptions& options) {
+    // Only LZMA's "d" is a dictionary; BZip2's is its block size
+    EncoderKind kind = EncoderKindFor(formatId, options);
+    bool dictionary = options.dictionarySize &&
+                      (kind == EncoderKind::Lzma || kind == EncoderKind::Lzma2);
+
+    if (options.numThreads) props.AddUInt32(L"mt", options.numThreads);
+    if (!options.method.empty() && formatId == CLSID_CFormat7z) {
+        // Coder 0 with its own parameters, e.g. "ZSTD:x=3:d=27"
+        std::wstring method = options.method;
+        if (options.level >= 0) method += L":x=" + std::to_wstring(options.level);
+        if (options.longWindowLog) method += L":d=" + std::to_wstring(options.longWindowLog);
+        if (dictionary) method += L":d=" + SizeString(options.dictionarySize);
+        props.AddString(L"0", method);
+    } else {
+        if (!options.method.empty()) props.AddString(L"m", options.method);
+        if (options.level >= 0) props.AddUInt32(L"x", (UInt32)options.level);
+        if (dictionary) props.AddString(L"d", SizeString(options.dictionarySize));
+    }
+    if (options.blockSize) {
+        if (formatId == CLSID_CFormat7z || formatId == CLSID_CFormatXz) {
+            props.AddString(L"s", SizeString(options.blockSize));
+        } else if (formatId == CLSID_CFormatBZip2) {
+            // BZip2 block size (100k..900k; the encoder clamps it)
+            props.AddString(L"d", SizeString(options.blockSize));
+        }
     }
-    CreateDirectoryW(path.c_str(), NULL);
 }
 
 //////////////////////////////////////////////////////////////////////////////
 // Simple Output File Stream (minimal implementation for extraction)
 //////////////////////////////////////////////////////////////////////////////
 
+// Hole granularity of sparse output: NTFS deallocates sparse ranges in
+// 64 KB units, so smaller zero runs would stay allocated anyway
+static const UInt32 kSparseUnit = 1 << 16;
+
+// True if the block is all zeros. Checks one 64-byte line per step, which
+// compilers vectorize, and stops at the first line with data.
+static bool IsZeroBlock(const Byte* data, size_t size) {
+    const size_t kLine = 64;
+    size_t pos = 0;
+    for (; pos + kLine <= size; pos += kLine) {
+        UInt64 acc = 0;
+        for (size_t i = 0; i < kLine; i += 8) {
+            UInt64 word;
+            memcpy(&word, data + pos + i, 8);
+            acc |= word;
+        }
+        if (acc != 0) return false;
+    }
+    for (; pos < size; pos++) {
+        if (data[pos] != 0) return false;
+    }
+    return true;
+}
+
 class CSimpleOutFileStream :
     public ISequentialOutStream,
     public CMyUnknownImp
 {
 public:
-    CSimpleOutFileStream() : m_hFile(INVALID_HANDLE_VALUE), m_refCount(0) {}
+    explicit CSimpleOutFileStream(CancellationToken* cancel = nullptr)
+        : m_hFile(INVALID_HANDLE_VALUE), m_refCount(0), m_cancel(cancel), m_hasMTime(false)
+        , m_sparse(false), m_markedSparse(false), m_pos(0), m_hole(0)
+        , m_backend(nullptr), m_whole(false) {}
     virtual ~CSimpleOutFileStream() { Close(); }
 
-    bool Create(const wchar_t* path, bool createAlways = true) {
+    // Closes (and whole files) go through the backend; null = Win32 directly
+    void SetBackend(CFileIoBackend* backend) { m_backend = backend; }
+
+    // Zero units are skipped instead of written; see OperationOptions::sparseOutput
+    void SetSparse(bool sparse) { m_sparse = sparse; }
+
+    // Applied when the file is closed, after the last write
+    void SetMTime(const FILETIME& mtime) {
+        m_mtime = mtime;
+        m_hasMTime = true;
+    }
+
+    // direct: unbuffered writes through CDirectFileWriter (not with sparse)
+    bool Create(const wchar_t* path, bool createAlways = true, bool direct = false) {
         // Create parent directory if needed
         std::wstring dir = path;
         size_t pos = dir.rfind(L'\\');
@@ -83,17 +285,79 @@ public:
             CreateDirectoryRecursive(dir);
         }
 
+        // Earlier entries for the same path still queued go first
+        if (m_backend) m_backend->WaitForPath(path);
+        m_path = path;
+
+        CoreScopedPhase phase(CorePhase::FileCreate);
         m_hFile = CreateFileW(path, GENERIC_WRITE, 0, NULL,
                               createAlways ? CREATE_ALWAYS : CREATE_NEW,
-                              FILE_ATTRIBUTE_NORMAL, NULL);
-        return m_hFile != INVALID_HANDLE_VALUE;
+                              FILE_ATTRIBUTE_NORMAL | (direct ? kDirectIoFileFlags : 0), NULL);
+        if (m_hFile == INVALID_HANDLE_VALUE) return false;
+        if (direct) {
+            m_direct.reset(new CDirectFileWriter(m_hFile));
+            if (!m_direct->IsValid()) {
+                m_direct.reset();
+                CloseHandle(m_hFile);
+                m_hFile = INVALID_HANDLE_VALUE;
+                SetLastError(ERROR_NOT_ENOUGH_MEMORY);
+                return false;
+            }
+        }
+        CoreStats_Add(CoreCounter::FilesCreated);
+        return true;
     }
 
-    void Close() {
-        if (m_hFile != INVALID_HANDLE_VALUE) {
-            CloseHandle(m_hFile);
-            m_hFile = INVALID_HANDLE_VALUE;
+    // Buffers the whole file in memory; Close hands it to the backend,
+    // which creates and writes it
+    bool CreateWhole(const wchar_t* path, size_t sizeHint) {
+        std::wstring dir = path;
+        size_t pos = dir.rfind(L'\\');
+        if (pos != std::wstring::npos) {
+            CreateDirectoryRecursive(dir.substr(0, pos));
+        }
+        m_path = path;
+        m_data.reserve(sizeHint);
+        m_whole = true;
+        return true;
+    }
+
+    // The item failed: drop buffered data instead of submitting it
+    void Abandon() {
+        m_whole = false;
+        std::vector<Byte>().swap(m_data);
+    }
+
+    // Flushes the direct-I/O tail or extends the file over a trailing hole,
+    // then closes it
+    HRESULT Close() {
+        if (m_whole) {
+            m_whole = false;
+            return m_backend->WriteWholeFile(m_path, std::move(m_data),
+                                             m_hasMTime ? &m_mtime : nullptr);
+        }
+        if (m_hFile == INVALID_HANDLE_VALUE) return S_OK;
+        if (m_direct) {
+            HRESULT hr;
+            {
+                CoreScopedPhase phase(CorePhase::Write);
+                hr = m_direct->Finish();
+                m_direct.reset();
+            }
+            CoreScopedPhase phase(CorePhase::FileClose);
+            if (m_hasMTime) SetFileTime(m_hFile, NULL, NULL, &m_mtime);
+            HRESULT closeHr = CloseFileHandle();
+            return FAILED(hr) ? hr : closeHr;
         }
+        bool trailingHole = (m_hole != 0);
+        HRESULT hr = SeekOverHole();
+        if (SUCCEEDED(hr) && trailingHole && !SetEndOfFile(m_hFile)) {
+            hr = HRESULT_FROM_WIN32(GetLastError());
+        }
+        CoreScopedPhase phase(CorePhase::FileClose);
+        if (m_hasMTime) SetFileTime(m_hFile, NULL, NULL, &m_mtime);
+        HRESULT closeHr = CloseFileHandle();
+        return FAILED(hr) ? hr : closeHr;
     }
 
     // IUnknown
@@ -115,21 +379,149 @@ public:
     }
 
     STDMETHOD(Write)(const void *data, UInt32 size, UInt32 *processedSize) {
+        if (m_cancel && m_cancel->Check()) return E_ABORT;
+        CoreScopedPhase phase(CorePhase::Write);
+        if (processedSize) *processedSize = 0;
+        if (m_whole) {
+            m_data.insert(m_data.end(), (const Byte*)data, (const Byte*)data + size);
+            if (processedSize) *processedSize = size;
+            return S_OK;
+        }
+        if (m_direct) {
+            RINOK(m_direct->Write(data, size));
+            if (processedSize) *processedSize = size;
+            return S_OK;
+        }
+        if (!m_sparse) {
+            DWORD written = 0;
+            if (!WriteFile(m_hFile, data, size, &written, NULL)) {
+                return HRESULT_FROM_WIN32(GetLastError());
+            }
+            CoreStats_Add(CoreCounter::BytesWritten, written);
+            if (processedSize) *processedSize = written;
+            return S_OK;
+        }
+
+        // Data between holes goes out in one WriteFile per run; only whole,
+        // unit-aligned zero units become holes
+        const Byte* p = (const Byte*)data;
+        const Byte* run = p;
+        UInt32 left = size;
+        while (left != 0) {
+            UInt32 offsetInUnit = (UInt32)((m_pos + m_hole + (p - run)) % kSparseUnit);
+            UInt32 piece = std::min<UInt32>(left, kSparseUnit - offsetInUnit);
+            if (piece == kSparseUnit && IsZeroBlock(p, piece)) {
+                RINOK(WriteRun(run, (UInt32)(p - run)));
+                m_hole += piece;
+                CoreStats_Add(CoreCounter::BytesSparse, piece);
+                run = p + piece;
+            }
+            p += piece;
+            left -= piece;
+        }
+        RINOK(WriteRun(run, (UInt32)(p - run)));
+        if (processedSize) *processedSize = size;
+        return S_OK;
+    }
+
+private:
+    HRESULT CloseFileHandle() {
+        HANDLE hFile = m_hFile;
+        m_hFile = INVALID_HANDLE_VALUE;
+        if (m_backend) return m_backend->CloseFile(hFile, m_path);
+        CloseHandle(hFile);
+        return S_OK;
+    }
+
+    // Moves the file pointer over the pending hole. The gap past EOF is
+    // unallocated on a sparse file and zero-filled by the file system
+    // elsewhere (FAT, or if FSCTL_SET_SPARSE failed).
+    HRESULT SeekOverHole() {
+        if (m_hole == 0) return S_OK;
+        if (!m_markedSparse) {
+            DWORD bytes = 0;
+            DeviceIoControl(m_hFile, FSCTL_SET_SPARSE, NULL, 0, NULL, 0, &bytes, NULL);
+            m_markedSparse = true;
+        }
+        LARGE_INTEGER distance;
+        distance.QuadPart = (LONGLONG)m_hole;
+        if (!SetFilePointerEx(m_hFile, distance, NULL, FILE_CURRENT)) {
+            return HRESULT_FROM_WIN32(GetLastError());
+        }
+        m_pos += m_hole;
+        m_hole = 0;
+        return S_OK;
+    }
+
+    HRESULT WriteRun(const Byte* data, UInt32 size) {
+        if (size == 0) return S_OK;
+        RINOK(SeekOverHole());
         DWORD written = 0;
         if (!WriteFile(m_hFile, data, size, &written, NULL)) {
             return HRESULT_FROM_WIN32(GetLastError());
         }
-        if (processedSize) *processedSize = written;
+        if (written != size) return E_FAIL;
+        CoreStats_Add(CoreCounter::BytesWritten, written);
+        m_pos += written;
         return S_OK;
     }
 
-private:
     HANDLE m_hFile;
     ULONG m_refCount;
+    CancellationToken* m_cancel;
+    FILETIME m_mtime;
+    bool m_hasMTime;
+    bool m_sparse;
+    bool m_markedSparse;
+    UInt64 m_pos;       // File pointer, excluding the pending hole
+    UInt64 m_hole;      // Zero bytes skipped since the last data write
+    std::unique_ptr<CDirectFileWriter> m_direct;
+    CFileIoBackend* m_backend;
+    bool m_whole;
+    std::wstring m_path;
+    std::vector<Byte> m_data;
 };
 
 //////////////////////////////////////////////////////////////////////////////
-// Extract Callback
+// Helper: Skip-unchanged comparison of an item with its existing output file
+//////////////////////////////////////////////////////////////////////////////
+
+// Every attribute the archive records must match: size always, mtime if
+// stored, and with ExtractSkipMode::Crc the CRC32 if stored. An item with
+// neither an mtime nor a usable CRC is always treated as changed.
+static bool IsUnchangedOnDisk(IInArchive* archive, UInt32 index, const std::wstring& path,
+                              ExtractSkipMode mode, CancellationToken* cancel) {
+    WIN32_FILE_ATTRIBUTE_DATA fad;
+    if (!GetFileAttributesExW(path.c_str(), GetFileExInfoStandard, &fad)) return false;
+
+    CoreStats_Add(CoreCounter::PropertyLookups, 4);
+    if (ArchiveProps::GetBool(archive, index, kpidIsDir)) {
+        return (fad.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0;
+    }
+    if (fad.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) return false;
+
+    UInt64 size = 0;
+    UInt64 diskSize = ((UInt64)fad.nFileSizeHigh << 32) | fad.nFileSizeLow;
+    if (!ArchiveProps::GetUInt64(archive, index, kpidSize, size) || size != diskSize) {
+        return false;
+    }
+
+    FILETIME mtime;
+    bool hasMTime = ArchiveProps::GetFileTime(archive, index, kpidMTime, mtime);
+    if (hasMTime && CompareFileTime(&mtime, &fad.ftLastWriteTime) != 0) return false;
+
+    UInt64 crc = 0;
+    bool useCrc = (mode == ExtractSkipMode::Crc) &&
+                  ArchiveProps::GetUInt64(archive, index, kpidCRC, crc);
+    if (!useCrc) return hasMTime;
+
+    HashEntry entry;
+    if (FAILED(HashDiskFile(path, HashCrc32, cancel, nullptr, entry))) return false;
+    char expected[16];
+    snprintf(expected, sizeof(expected), "%08x", (unsigned)crc);
+    return entry.crc32 == expected;
+}
+
 //////////////////////////////////////////////////////////////////////////////
 
 class CExtractCallback :
@@ -139,19 +531,68 @@ class CExtractCallback :
 {
 public:
     CExtractCallback(IInArchive* archive, const std::wstring& outDir,
-                     const std::wstring& password, ProgressCallback progress)
+                     const std::wstring& password, ProgressCallback progress,
+                     CancellationToken* cancel = nullptr)
         : m_archive(archive)
         , m_outDir(outDir)
         , m_password(password)
         , m_progress(progress)
+        , m_cancel(cancel)
+        , m_abort(nullptr)
+        , m_selection(nullptr)
+        , m_filter(nullptr)
+        , m_skipMode(ExtractSkipMode::None)
+        , m_sparse(false)
+        , m_directIoThreshold(0)
+        , m_backend(CreateFileIoBackend(IoBackend::Blocking, 0))
+        , m_outFile(nullptr)
         , m_total(0)
         , m_completed(0)
         , m_passwordWasRequested(false)
         , m_refCount(0)
     {}
 
+    virtual ~CExtractCallback() {
+        if (m_outFile) m_outFile->Abandon();
+        CloseOutFile();
+    }
+
     bool WasPasswordRequested() const { return m_passwordWasRequested; }
 
+    // See OperationOptions::sparseOutput and directIoThreshold
+    void SetSparseOutput(bool sparse) { m_sparse = sparse; }
+    void SetDirectIoThreshold(UInt64 threshold) { m_directIoThreshold = threshold; }
+
+    // Before the first item; see OperationOptions::ioBackend
+    void SetIoBackend(IoBackend kind) { m_backend = CreateFileIoBackend(kind, 0); }
+
+    // Flag shared by the workers of one parallel extraction, set when one
+    // of them fails; checked with the cancellation token
+    void SetAbortFlag(const std::atomic<bool>* abort) { m_abort = abort; }
+
+    // Waits for output still queued in the backend; returns its first failure
+    HRESULT FlushOutput() { return m_backend->Flush(); }
+
+    // Compare each item with its output file here, for handlers that walk
+    // every item anyway (sequential Tar); others are filtered by SelectChanged
+    void SetSkipUnchanged(ExtractSkipMode mode) { m_skipMode = mode; }
+
+    // Items to write when the handler walks every item (sequential Tar);
+    // the others are skipped
+    void SetSelection(const std::vector<bool>* selection) { m_selection = selection; }
+
+    // Items to write by path, checked as the handler reaches them
+    void SetPathFilter(const PathFilter* filter) { m_filter = filter; }
+
+    // Closes and deletes the output file whose data was not completely
+    // written, if any
+    void DeletePartialFile() {
+        if (m_outFile) m_outFile->Abandon();
+        CloseOutFile();
+        m_backend->Flush();
+        if (!m_partialPath.empty()) DeleteFileW(m_partialPath.c_str());
+    }
+
     // IUnknown
     STDMETHOD(QueryInterface)(REFIID iid, void **outObject) {
         if (iid == IID_IUnknown) {
@@ -182,6 +623,7 @@ public:
     }
 
     STDMETHOD(SetCompleted)(const UInt64 *completeValue) {
+        if (IsAborted()) return E_ABORT;
         if (completeValue) {
             m_completed = *completeValue;
             if (m_progress && !m_progress(m_completed, m_total)) {
@@ -194,22 +636,33 @@ public:
     // IArchiveExtractCallback
     STDMETHOD(GetStream)(UInt32 index, ISequentialOutStream **outStream, Int32 askExtractMode) {
         *outStream = NULL;
+        if (IsAborted()) return E_ABORT;
         if (askExtractMode != NArchive::NExtract::NAskMode::kExtract) {
             return S_OK;
         }
+        if (m_selection && (index >= m_selection->size() || !(*m_selection)[index])) {
+            return S_OK;
+        }
 
-        // Get item path
-        PROPVARIANT prop;
-        PropVariantInit(&prop);
-        m_archive->GetProperty(index, kpidPath, &prop);
-        std::wstring itemPath = (prop.vt == VT_BSTR) ? prop.bstrVal : L"";
-        PropVariantClear(&prop);
+        std::wstring itemPath;
+        bool isDir = false;
+        {
+            CoreScopedPhase phase(CorePhase::PropertyLookup);
+            CoreStats_Add(CoreCounter::PropertyLookups, 2);
+
+            // Get item path
+            PROPVARIANT prop;
+            PropVariantInit(&prop);
+            m_archive->GetProperty(index, kpidPath, &prop);
+            itemPath = (prop.vt == VT_BSTR) ? prop.bstrVal : L"";
+            PropVariantClear(&prop);
 
-        // Check if directory
-        PropVariantInit(&prop);
-        m_archive->GetProperty(index, kpidIsDir, &prop);
-        bool isDir = (prop.vt == VT_BOOL && prop.boolVal != VARIANT_FALSE);
-        PropVariantClear(&prop);
+            // Check if directory
+            PropVariantInit(&prop);
+            m_archive->GetProperty(index, kpidIsDir, &prop);
+            isDir = (prop.vt == VT_BOOL && prop.boolVal != VARIANT_FALSE);
+            PropVariantClear(&prop);
+        }
 
         std::wstring fullPath = m_outDir;
         if (!fullPath.empty() && fullPath.back() != L'\\') {
@@ -217,18 +670,55 @@ public:
         }
         fullPath += itemPath;
 
+        if (m_filter && !m_filter->Matches(itemPath)) {
+            return S_OK;
+        }
+
+        if (!isDir && m_skipMode != ExtractSkipMode::None &&
+            IsUnchangedOnDisk(m_archive, index, fullPath, m_skipMode, m_cancel)) {
+            CoreStats_Add(CoreCounter::ItemsSkipped);
+            return S_OK;
+        }
+
+        CoreStats_Add(CoreCounter::ItemsExtracted);
+
         if (isDir) {
             CreateDirectoryRecursive(fullPath);
             return S_OK;
         }
 
+        // Unbuffered for huge items, whole-file submission for small ones
+        UInt32 wholeLimit = m_sparse ? 0 : m_backend->GetWholeFileLimit();
+        UInt64 size = 0;
+        bool sizeKnown = false;
+        if ((m_directIoThreshold && !m_sparse) || wholeLimit) {
+            CoreStats_Add(CoreCounter::PropertyLookups);
+            sizeKnown = ArchiveProps::GetUInt64(m_archive, index, kpidSize, size);
+        }
+        bool direct = m_directIoThreshold && !m_sparse && size >= m_directIoThreshold;
+        bool whole = sizeKnown && !direct && size <= wholeLimit;
+
         // Create output stream
-        CSimpleOutFileStream* stream = new CSimpleOutFileStream();
+        CSimpleOutFileStream* stream = new CSimpleOutFileStream(m_cancel);
         stream->AddRef();
-        if (!stream->Create(fullPath.c_str())) {
+        stream->SetBackend(m_backend.get());
+        bool created = whole ? stream->CreateWhole(fullPath.c_str(), (size_t)size)
+                             : stream->Create(fullPath.c_str(), true, direct);
+        if (!created) {
             stream->Release();
             return HRESULT_FROM_WIN32(GetLastError());
         }
+        FILETIME mtime;
+        if (ArchiveProps::GetFileTime(m_archive, index, kpidMTime, mtime)) {
+            stream->SetMTime(mtime);
+        }
+        stream->SetSparse(m_sparse);
+        m_partialPath = fullPath;
+
+        // Kept so SetOperationResult can close the file and report a failed
+        // extension over a trailing hole
+        m_outFile = stream;
+        m_outFile->AddRef();
         *outStream = stream;
         return S_OK;
     }
@@ -238,6 +728,8 @@ public:
     }
 
     STDMETHOD(SetOperationResult)(Int32 opRes) {
+        RINOK(CloseOutFile());
+        m_partialPath.clear();
         return S_OK;
     }
 
@@ -249,16 +741,168 @@ public:
     }
 
 private:
+    bool IsAborted() {
+        if (m_cancel && m_cancel->Check()) return true;
+        return m_abort && m_abort->load(std::memory_order_relaxed);
+    }
+
+    HRESULT CloseOutFile() {
+        if (!m_outFile) return S_OK;
+        HRESULT hr = m_outFile->Close();
+        m_outFile->Release();
+        m_outFile = nullptr;
+        return hr;
+    }
+
     IInArchive* m_archive;
     std::wstring m_outDir;
     std::wstring m_password;
     ProgressCallback m_progress;
+    CancellationToken* m_cancel;
+    const std::atomic<bool>* m_abort;
+    const std::vector<bool>* m_selection;
+    const PathFilter* m_filter;
+    ExtractSkipMode m_skipMode;
+    bool m_sparse;
+    UInt64 m_directIoThreshold;
+    std::unique_ptr<CFileIoBackend> m_backend;
+    CSimpleOutFileStream* m_outFile;
+    std::wstring m_partialPath;
     UInt64 m_total;
     UInt64 m_completed;
     bool m_passwordWasRequested;
     ULONG m_refCount;
 };
 
+//////////////////////////////////////////////////////////////////////////////
+// Hash Callback (items are hashed as they are decoded, nothing is written)
+//////////////////////////////////////////////////////////////////////////////
+
+class CHashExtractCallback :
+    public IArchiveExtractCallback,
+    public ICryptoGetTextPassword,
+    public CMyUnknownImp
+{
+public:
+    CHashExtractCallback(IInArchive* archive, uint32_t algorithms,
+                         std::vector<HashEntry>& entries, const std::wstring& password,
+                         ProgressCallback progress, CancellationToken* cancel)
+        : m_archive(archive)
+        , m_algorithms(algorithms)
+        , m_entries(entries)
+        , m_password(password)
+        , m_progress(progress)
+        , m_cancel(cancel)
+        , m_selection(nullptr)
+        , m_stream(nullptr)
+        , m_total(0)
+        , m_refCount(0)
+    {}
+
+    virtual ~CHashExtractCallback() {
+        if (m_stream) m_stream->Release();
+    }
+
+    // Items to hash when the handler walks every item (sequential Tar)
+    void SetSelection(const std::vector<bool>* selection) { m_selection = selection; }
+
+    // IUnknown
+    STDMETHOD(QueryInterface)(REFIID iid, void **outObject) {
+        if (iid == IID_IUnknown || iid == IID_IArchiveExtractCallback) {
+            *outObject = static_cast<IArchiveExtractCallback*>(this);
+        } else if (iid == IID_ICryptoGetTextPassword) {
+            *outObject = static_cast<ICryptoGetTextPassword*>(this);
+        } else {
+            *outObject = NULL;
+            return E_NOINTERFACE;
+        }
+        AddRef();
+        return S_OK;
+    }
+
+    STDMETHOD_(ULONG, AddRef)() { return ++m_refCount; }
+    STDMETHOD_(ULONG, Release)() {
+        ULONG res = --m_refCount;
+        if (res == 0) delete this;
+        return res;
+    }
+
+    // IProgress
+    STDMETHOD(SetTotal)(UInt64 total) {
+        m_total = total;
+        return S_OK;
+    }
+
+    STDMETHOD(SetCompleted)(const UInt64 *completeValue) {
+        if (m_cancel && m_cancel->Check()) return E_ABORT;
+        if (completeValue && m_progress && !m_progress(*completeValue, m_total)) {
+            return E_ABORT;
+        }
+        return S_OK;
+    }
+
+    // IArchiveExtractCallback
+    STDMETHOD(GetStream)(UInt32 index, ISequentialOutStream **outStream, Int32 askExtractMode) {
+        *outStream = NULL;
+        if (m_cancel && m_cancel->Check()) return E_ABORT;
+        if (askExtractMode != NArchive::NExtract::NAskMode::kExtract) {
+            return S_OK;
+        }
+        if (m_selection && (index >= m_selection->size() || !(*m_selection)[index])) {
+            return S_OK;
+        }
+
+        HashEntry entry;
+        {
+            CoreScopedPhase phase(CorePhase::PropertyLookup);
+            CoreStats_Add(CoreCounter::PropertyLookups, 2);
+            if (ArchiveProps::GetBool(m_archive, index, kpidIsDir)) return S_OK;
+            entry.path = ArchiveProps::GetString(m_archive, index, kpidPath);
+        }
+        m_entries.push_back(std::move(entry));
+
+        if (m_stream) m_stream->Release();
+        m_stream = new CHashOutStream(m_algorithms);
+        m_stream->AddRef();
+        m_stream->AddRef();
+        *outStream = m_stream;
+        return S_OK;
+    }
+
+    STDMETHOD(PrepareOperation)(Int32 askExtractMode) {
+        return S_OK;
+    }
+
+    STDMETHOD(SetOperationResult)(Int32 opRes) {
+        if (m_stream) {
+            HashEntry& entry = m_entries.back();
+            m_stream->Final(entry);
+            entry.ok = (opRes == NArchive::NExtract::NOperationResult::kOK);
+            m_stream->Release();
+            m_stream = nullptr;
+        }
+        return S_OK;
+    }
+
+    // ICryptoGetTextPassword
+    STDMETHOD(CryptoGetTextPassword)(BSTR *password) {
+        *password = SysAllocString(m_password.c_str());
+        return S_OK;
+    }
+
+private:
+    IInArchive* m_archive;
+    uint32_t m_algorithms;
+    std::vector<HashEntry>& m_entries;
+    std::wstring m_password;
+    ProgressCallback m_progress;
+    CancellationToken* m_cancel;
+    const std::vector<bool>* m_selection;
+    CHashOutStream* m_stream;      // Item being hashed
+    UInt64 m_total;
+    ULONG m_refCount;
+};
+
 //////////////////////////////////////////////////////////////////////////////
 // Simple Input File Stream (minimal implementation for compression)
 //////////////////////////////////////////////////////////////////////////////
@@ -268,17 +912,31 @@ class CSimpleInFileStream :
     public CMyUnknownImp
 {
 public:
-    CSimpleInFileStream() : m_hFile(INVALID_HANDLE_VALUE), m_refCount(0) {}
+    explicit CSimpleInFileStream(CancellationToken* cancel = nullptr)
+        : m_hFile(INVALID_HANDLE_VALUE), m_refCount(0), m_cancel(cancel) {}
     virtual ~CSimpleInFileStream() { Close(); }
 
-    bool Open(const wchar_t* path) {
-        m_hFile = CreateFileW(path, GENERIC_READ, FILE_SHARE_READ,
-                              NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
-        return m_hFile != INVALID_HANDLE_VALUE;
+    // direct: unbuffered read-ahead through CDirectFileReader
+    bool Open(const wchar_t* path, bool direct = false) {
+        CoreScopedPhase phase(CorePhase::FileOpen);
+        m_hFile = CreateFileW(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+                              FILE_ATTRIBUTE_NORMAL | (direct ? kDirectIoFileFlags : 0), NULL);
+        if (m_hFile == INVALID_HANDLE_VALUE) return false;
+        if (direct) {
+            m_direct.reset(new CDirectFileReader(m_hFile));
+            if (!m_direct->IsValid()) {
+                Close();
+                SetLastError(ERROR_NOT_ENOUGH_MEMORY);
+                return false;
+            }
+        }
+        return true;
     }
 
     void Close() {
+        m_direct.reset();
         if (m_hFile != INVALID_HANDLE_VALUE) {
+            CoreScopedPhase phase(CorePhase::FileClose);
             CloseHandle(m_hFile);
             m_hFile = INVALID_HANDLE_VALUE;
         }
@@ -303,10 +961,14 @@ public:
     }
 
     STDMETHOD(Read)(void *data, UInt32 size, UInt32 *processedSize) {
+        if (m_cancel && m_cancel->Check()) return E_ABORT;
+        CoreScopedPhase phase(CorePhase::Read);
+        if (m_direct) return m_direct->Read(data, size, processedSize);
         DWORD read = 0;
         if (!ReadFile(m_hFile, data, size, &read, NULL)) {
             return HRESULT_FROM_WIN32(GetLastError());
         }
+        CoreStats_Add(CoreCounter::BytesRead, read);
         if (processedSize) *processedSize = read;
         return S_OK;
     }
@@ -314,6 +976,8 @@ public:
 private:
     HANDLE m_hFile;
     ULONG m_refCount;
+    CancellationToken* m_cancel;
+    std::unique_ptr<CDirectFileReader> m_direct;
 };
 
 //////////////////////////////////////////////////////////////////////////////
@@ -326,10 +990,14 @@ class CFullInFileStream :
     public CMyUnknownImp
 {
 public:
-    CFullInFileStream() : m_hFile(INVALID_HANDLE_VALUE), m_refCount(0) {}
+    CFullInFileStream() : m_hFile(INVALID_HANDLE_VALUE), m_refCount(0), m_cancel(nullptr) {}
     virtual ~CFullInFileStream() { Close(); }
 
+    // The archive stream outlives single operations; each one binds its token
+    void SetCancel(CancellationToken* cancel) { m_cancel = cancel; }
+
     bool Open(const wchar_t* path) {
+        CoreScopedPhase phase(CorePhase::FileOpen);
         m_hFile = CreateFileW(path, GENERIC_READ, FILE_SHARE_READ,
                               NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
         return m_hFile != INVALID_HANDLE_VALUE;
@@ -337,6 +1005,7 @@ public:
 
     void Close() {
         if (m_hFile != INVALID_HANDLE_VALUE) {
+            CoreScopedPhase phase(CorePhase::FileClose);
             CloseHandle(m_hFile);
             m_hFile = INVALID_HANDLE_VALUE;
         }
@@ -371,10 +1040,13 @@ public:
     }
 
     STDMETHOD(Read)(void *data, UInt32 size, UInt32 *processedSize) {
+        if (m_cancel && m_cancel->Check()) return E_ABORT;
+        CoreScopedPhase phase(CorePhase::Read);
         DWORD read = 0;
         if (!ReadFile(m_hFile, data, size, &read, NULL)) {
             return HRESULT_FROM_WIN32(GetLastError());
         }
+        CoreStats_Add(CoreCounter::BytesRead, read);
         if (processedSize) *processedSize = read;
         return S_OK;
     }
@@ -402,6 +1074,34 @@ public:
 private:
     HANDLE m_hFile;
     ULONG m_refCount;
+    CancellationToken* m_cancel;
+};
+
+// Routes the archive stream's check points to an operation's token
+class CInStreamCancelBinding {
+public:
+    // Holds a reference: the operation may release the archive stream
+    // (failed open, CloseArchive) while the binding is still in scope
+    CInStreamCancelBinding(IInStream* stream, CancellationToken* cancel)
+        : m_stream(static_cast<CFullInFileStream*>(stream))
+    {
+        if (m_stream) {
+            m_stream->AddRef();
+            m_stream->SetCancel(cancel);
+        }
+    }
+    ~CInStreamCancelBinding() {
+        if (m_stream) {
+            m_stream->SetCancel(nullptr);
+            m_stream->Release();
+        }
+    }
+
+    CInStreamCancelBinding(const CInStreamCancelBinding&) = delete;
+    CInStreamCancelBinding& operator=(const CInStreamCancelBinding&) = delete;
+
+private:
+    CFullInFileStream* m_stream;
 };
 
 //////////////////////////////////////////////////////////////////////////////
@@ -413,7 +1113,8 @@ class CFullOutFileStream :
     public CMyUnknownImp
 {
 public:
-    CFullOutFileStream() : m_hFile(INVALID_HANDLE_VALUE), m_refCount(0) {}
+    explicit CFullOutFileStream(CancellationToken* cancel = nullptr)
+        : m_hFile(INVALID_HANDLE_VALUE), m_refCount(0), m_cancel(cancel) {}
     virtual ~CFullOutFileStream() { Close(); }
 
     bool Create(const wchar_t* path, bool createAlways = true) {
@@ -425,14 +1126,18 @@ public:
             CreateDirectoryRecursive(dir);
         }
 
+        CoreScopedPhase phase(CorePhase::FileCreate);
         m_hFile = CreateFileW(path, GENERIC_WRITE, 0, NULL,
                               createAlways ? CREATE_ALWAYS : CREATE_NEW,
                               FILE_ATTRIBUTE_NORMAL, NULL);
-        return m_hFile != INVALID_HANDLE_VALUE;
+        if (m_hFile == INVALID_HANDLE_VALUE) return false;
+        CoreStats_Add(CoreCounter::FilesCreated);
+        return true;
     }
 
     void Close() {
         if (m_hFile != INVALID_HANDLE_VALUE) {
+            CoreScopedPhase phase(CorePhase::FileClose);
             CloseHandle(m_hFile);
             m_hFile = INVALID_HANDLE_VALUE;
         }
@@ -462,10 +1167,13 @@ public:
     }
 
     STDMETHOD(Write)(const void *data, UInt32 size, UInt32 *processedSize) {
+        if (m_cancel && m_cancel->Check()) return E_ABORT;
+        CoreScopedPhase phase(CorePhase::Write);
         DWORD written = 0;
         if (!WriteFile(m_hFile, data, size, &written, NULL)) {
             return HRESULT_FROM_WIN32(GetLastError());
         }
+        CoreStats_Add(CoreCounter::BytesWritten, written);
         if (processedSize) *processedSize = written;
         return S_OK;
     }
@@ -496,11 +1204,49 @@ public:
 private:
     HANDLE m_hFile;
     ULONG m_refCount;
+    CancellationToken* m_cancel;
 };
 
-//////////////////////////////////////////////////////////////////////////////
-// Update Callback for Compression
-//////////////////////////////////////////////////////////////////////////////
+// 7-Zip's CompareFileNames on Windows, applied after the 7z handler's
+// MakeLegalName ('\\' -> '/'): code units compared case-insensitively
+// through CharUpperW. The 7z updater sorts new files by it, then by index,
+// before it asks for their streams.
+static wchar_t SevenZipCharUpper(wchar_t c) {
+    if (c < 'a') return c;
+    if (c <= 'z') return (wchar_t)(c - 0x20);
+    if (c <= 0x7F) return c;
+    return (wchar_t)(UINT_PTR)CharUpperW((LPWSTR)(UINT_PTR)c);
+}
+
+static int Compare7zNames(const std::wstring& a, const std::wstring& b) {
+    size_t n = std::min(a.size(), b.size());
+    for (size_t i = 0; i < n; i++) {
+        wchar_t c1 = (a[i] == L'\\') ? L'/' : a[i];
+        wchar_t c2 = (b[i] == L'\\') ? L'/' : b[i];
+        if (c1 == c2) continue;
+        wchar_t u1 = SevenZipCharUpper(c1);
+        wchar_t u2 = SevenZipCharUpper(c2);
+        if (u1 != u2) return (u1 < u2) ? -1 : 1;
+    }
+    return (a.size() == b.size()) ? 0 : (a.size() < b.size() ? -1 : 1);
+}
+
+// Extensions the 7z updater puts in a group of their own for the BCJ
+// filter; that group comes after the unfiltered files. (Newer updaters
+// also inspect file headers, so the guess can miss a few files.)
+static bool Is7zExeName(const std::wstring& name) {
+    size_t dot = name.find_last_of(L"./\\");
+    if (dot == std::wstring::npos || name[dot] != L'.') return false;
+    const wchar_t* ext = name.c_str() + dot + 1;
+    for (const wchar_t* exeExt : { L"dll", L"exe", L"ocx", L"sfx", L"sys" }) {
+        if (_wcsicmp(ext, exeExt) == 0) return true;
+    }
+    return false;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Update Callback for Compression
+//////////////////////////////////////////////////////////////////////////////
 
 class CUpdateCallback :
     public IArchiveUpdateCallback,
@@ -517,14 +1263,24 @@ public:
         DWORD attrib;
     };
 
-    CUpdateCallback(const std::vector<std::wstring>& srcPaths, ProgressCallback progress)
+    CUpdateCallback(const std::vector<std::wstring>& srcPaths, ProgressCallback progress,
+                    CancellationToken* cancel = nullptr)
         : m_progress(progress)
+        , m_cancel(cancel)
+        , m_cancelled(false)
         , m_total(0)
         , m_completed(0)
+        , m_directIoThreshold(0)
         , m_refCount(0)
     {
+        CoreScopedPhase phase(CorePhase::Enumerate);
+
         // Enumerate all files
         for (const auto& srcPath : srcPaths) {
+            if (m_cancel && m_cancel->Check()) {
+                m_cancelled = true;
+                break;
+            }
             std::wstring name = GetFileName(srcPath);
             DWORD attrs = GetFileAttributesW(srcPath.c_str());
             bool isDir = (attrs != INVALID_FILE_ATTRIBUTES && (attrs & FILE_ATTRIBUTE_DIRECTORY));
@@ -556,6 +1312,44 @@ public:
     }
 
     UInt32 GetItemCount() const { return (UInt32)m_files.size(); }
+    UInt64 GetTotalSize() const { return m_total; }
+
+    // Enumeration stopped early because the operation was cancelled
+    bool WasCancelled() const { return m_cancelled; }
+
+    // See OperationOptions::directIoThreshold
+    void SetDirectIoThreshold(UInt64 threshold) { m_directIoThreshold = threshold; }
+
+    // See OperationOptions::readAheadFiles; call after SetDirectIoThreshold.
+    // Zip and Tar ask for the streams in index order. The 7z updater asks
+    // only for non-empty files: unfiltered ones, then executables (BCJ
+    // group), each group by name, then by index.
+    void EnableReadAhead(uint32_t windowFiles, bool sevenZipOrder) {
+        std::vector<UInt32> order;
+        order.reserve(m_files.size());
+        for (UInt32 i = 0; i < m_files.size(); i++) {
+            if (!sevenZipOrder || (!m_files[i].isDir && m_files[i].size != 0)) order.push_back(i);
+        }
+        if (sevenZipOrder) {
+            std::stable_sort(order.begin(), order.end(), [this](UInt32 a, UInt32 b) {
+                bool exeA = Is7zExeName(m_files[a].relativePath);
+                bool exeB = Is7zExeName(m_files[b].relativePath);
+                if (exeA != exeB) return exeB;
+                return Compare7zNames(m_files[a].relativePath, m_files[b].relativePath) < 0;
+            });
+        }
+
+        std::vector<PrefetchSource> sources;
+        sources.reserve(order.size());
+        for (UInt32 index : order) {
+            const FileItem& item = m_files[index];
+            bool eligible = !item.isDir && item.size <= kPrefetchMaxFileSize &&
+                            !(m_directIoThreshold && item.size >= m_directIoThreshold);
+            sources.push_back({ index, item.fullPath, item.size, eligible });
+        }
+        m_prefetcher.reset(new CFilePrefetcher(std::move(sources), windowFiles,
+                                               kPrefetchThreads, m_cancel));
+    }
 
     // IUnknown
     STDMETHOD(QueryInterface)(REFIID iid, void **outObject) {
@@ -587,6 +1381,7 @@ public:
     }
 
     STDMETHOD(SetCompleted)(const UInt64 *completeValue) {
+        if (m_cancel && m_cancel->Check()) return E_ABORT;
         if (completeValue) {
             m_completed = *completeValue;
             if (m_progress && !m_progress(m_completed, m_total)) {
@@ -639,14 +1434,27 @@ public:
 
     STDMETHOD(GetStream)(UInt32 index, ISequentialInStream **inStream) {
         *inStream = NULL;
+        if (m_cancel && m_cancel->Check()) return E_ABORT;
         if (index >= m_files.size()) return E_INVALIDARG;
 
         const FileItem& item = m_files[index];
         if (item.isDir) return S_OK;
+        CoreStats_Add(CoreCounter::ItemsCompressed);
+
+        if (m_prefetcher) {
+            std::shared_ptr<const std::vector<Byte>> data = m_prefetcher->Take(index);
+            if (data) {
+                CPrefetchedInStream* prefetched = new CPrefetchedInStream(std::move(data));
+                prefetched->AddRef();
+                *inStream = prefetched;
+                return S_OK;
+            }
+        }
 
-        CSimpleInFileStream* stream = new CSimpleInFileStream();
+        bool direct = m_directIoThreshold && item.size >= m_directIoThreshold;
+        CSimpleInFileStream* stream = new CSimpleInFileStream(m_cancel);
         stream->AddRef();
-        if (!stream->Open(item.fullPath.c_str())) {
+        if (!stream->Open(item.fullPath.c_str(), direct)) {
             stream->Release();
             return HRESULT_FROM_WIN32(GetLastError());
         }
@@ -668,8 +1476,12 @@ public:
 private:
     std::vector<FileItem> m_files;
     ProgressCallback m_progress;
+    CancellationToken* m_cancel;
+    bool m_cancelled;
     UInt64 m_total;
     UInt64 m_completed;
+    UInt64 m_directIoThreshold;
+    std::unique_ptr<CFilePrefetcher> m_prefetcher;
     ULONG m_refCount;
 
     std::wstring GetFileName(const std::wstring& path) {
@@ -702,6 +1514,10 @@ private:
         if (hFind == INVALID_HANDLE_VALUE) return;
 
         do {
+            if (m_cancel && m_cancel->Check()) {
+                m_cancelled = true;
+                break;
+            }
             if (wcscmp(fd.cFileName, L".") == 0 || wcscmp(fd.cFileName, L"..") == 0) {
                 continue;
             }
@@ -709,6 +1525,7 @@ private:
             std::wstring fullPath = basePath + L"\\" + fd.cFileName;
             std::wstring relPath = relBasePath + L"\\" + fd.cFileName;
 
+            CoreStats_Add(CoreCounter::ItemsEnumerated);
             FileItem item;
             item.fullPath = fullPath;
             item.relativePath = relPath;
@@ -732,357 +1549,3540 @@ private:
 };
 
 //////////////////////////////////////////////////////////////////////////////
-// SevenZipCore Implementation
+// Parallel extraction progress (sums per-worker progress for the caller)
 //////////////////////////////////////////////////////////////////////////////
 
-SevenZipCore& SevenZipCore::Instance() {
-    static SevenZipCore instance;
-    return instance;
-}
+class CParallelProgress {
+public:
+    CParallelProgress(ProgressCallback progress, size_t numWorkers)
+        : m_progress(progress)
+        , m_completed(numWorkers, 0)
+        , m_totals(numWorkers, 0)
+        , m_aborted(false)
+    {}
 
-SevenZipCore::SevenZipCore() {
-    InitFormats();
-}
+    // Once the caller declines (or any worker is told to stop), every worker's
+    // next SetCompleted returns E_ABORT
+    ProgressCallback ForWorker(size_t worker) {
+        return [this, worker](uint64_t completed, uint64_t total) {
+            std::lock_guard<std::mutex> lock(m_lock);
+            m_completed[worker] = completed;
+            m_totals[worker] = total;
+            if (!m_aborted && m_progress) {
+                uint64_t sumCompleted = std::accumulate(m_completed.begin(), m_completed.end(), 0ull);
+                uint64_t sumTotal = std::accumulate(m_totals.begin(), m_totals.end(), 0ull);
+                m_aborted = !m_progress(sumCompleted, sumTotal);
+            }
+            return !m_aborted;
+        };
+    }
 
-SevenZipCore::~SevenZipCore() {
-    CloseArchive();
-}
+private:
+    ProgressCallback m_progress;
+    std::mutex m_lock;
+    std::vector<uint64_t> m_completed;
+    std::vector<uint64_t> m_totals;
+    bool m_aborted;
+};
 
-void SevenZipCore::InitFormats() {
-    m_formats = {
-        { L"7z",    L".7z",   CLSID_CFormat7z,    true  },
-        { L"Zip",   L".zip",  CLSID_CFormatZip,   true  },
-        { L"Rar",   L".rar",  CLSID_CFormatRar,   false },
-        { L"Tar",   L".tar",  CLSID_CFormatTar,   true  },
-        { L"GZip",  L".gz",   CLSID_CFormatGZip,  true  },
-        { L"BZip2", L".bz2",  CLSID_CFormatBZip2, true  },
-        { L"Iso",   L".iso",  CLSID_CFormatIso,   false },
-        { L"Cab",   L".cab",  CLSID_CFormatCab,   false },
-    };
-}
+#ifdef SEVENZIPCORE_WITH_ZSTD
+//////////////////////////////////////////////////////////////////////////////
+// Standalone .zst: the 7-Zip Zstd handler only reads, so the source file is
+// run through the ZSTD encoder directly
+//////////////////////////////////////////////////////////////////////////////
 
-IInArchive* SevenZipCore::CreateInArchive(const GUID& formatId) {
-    IInArchive* archive = nullptr;
-    HRESULT hr = CreateObject(&formatId, &IID_IInArchive, (void**)&archive);
-    if (FAILED(hr)) {
-        return nullptr;
+class CCoderProgress :
+    public ICompressProgressInfo,
+    public CMyUnknownImp
+{
+public:
+    CCoderProgress(ProgressCallback progress, UInt64 total)
+        : m_progress(progress), m_total(total), m_refCount(0) {}
+
+    // IUnknown
+    STDMETHOD(QueryInterface)(REFIID iid, void **outObject) {
+        if (iid == IID_IUnknown || iid == IID_ICompressProgressInfo) {
+            *outObject = this;
+            AddRef();
+            return S_OK;
+        }
+        *outObject = NULL;
+        return E_NOINTERFACE;
     }
-    return archive;
-}
 
-IOutArchive* SevenZipCore::CreateOutArchive(const GUID& formatId) {
-    IOutArchive* archive = nullptr;
-    HRESULT hr = CreateObject(&formatId, &IID_IOutArchive, (void**)&archive);
-    if (FAILED(hr)) {
-        return nullptr;
+    STDMETHOD_(ULONG, AddRef)() { return ++m_refCount; }
+    STDMETHOD_(ULONG, Release)() {
+        ULONG res = --m_refCount;
+        if (res == 0) delete this;
+        return res;
     }
-    return archive;
-}
 
-const GUID* SevenZipCore::GetFormatForExtension(const std::wstring& ext) {
-    for (const auto& fmt : m_formats) {
-        if (_wcsicmp(ext.c_str(), fmt.extension.c_str()) == 0) {
-            return &fmt.classId;
-        }
+    STDMETHOD(SetRatioInfo)(const UInt64 *inSize, const UInt64 *outSize) {
+        if (m_progress && inSize && !m_progress(*inSize, m_total)) return E_ABORT;
+        return S_OK;
     }
-    // Handle compound extensions
-    if (_wcsicmp(ext.c_str(), L".tgz") == 0 ||
-        _wcsicmp(ext.c_str(), L".tar.gz") == 0) {
-        return &CLSID_CFormatGZip;
+
+private:
+    ProgressCallback m_progress;
+    UInt64 m_total;
+    ULONG m_refCount;
+};
+
+// Runs one stream through the ZSTD encoder as a single checksummed frame
+static HRESULT EncodeZstdStream(ISequentialInStream* inStream, ISequentialOutStream* outStream,
+                                const UInt64* inSize, ICompressProgressInfo* progress,
+                                const OperationOptions& options) {
+    NCompress::NZstdExt::CEncoder* encoder = new NCompress::NZstdExt::CEncoder();
+    encoder->AddRef();
+    encoder->SetChecksum(true);
+
+    PROPID propIDs[3];
+    PROPVARIANT values[3];
+    UInt32 numProps = 0;
+    if (options.level >= 0) {
+        propIDs[numProps] = NCoderPropID::kLevel;
+        PropVariantInit(&values[numProps]);
+        values[numProps].vt = VT_UI4;
+        values[numProps++].ulVal = (UInt32)options.level;
     }
-    if (_wcsicmp(ext.c_str(), L".tbz2") == 0 ||
-        _wcsicmp(ext.c_str(), L".tar.bz2") == 0) {
-        return &CLSID_CFormatBZip2;
+    if (options.numThreads) {
+        propIDs[numProps] = NCoderPropID::kNumThreads;
+        PropVariantInit(&values[numProps]);
+        values[numProps].vt = VT_UI4;
+        values[numProps++].ulVal = options.numThreads;
     }
-    return nullptr;
-}
-
-const GUID* SevenZipCore::DetectFormat(const std::wstring& path) {
-    // First try by extension
-    const wchar_t* ext = PathFindExtensionW(path.c_str());
-    if (ext && *ext) {
-        const GUID* guid = GetFormatForExtension(ext);
-        if (guid) return guid;
+    if (options.longWindowLog) {
+        propIDs[numProps] = NCoderPropID::kDictionarySize;
+        PropVariantInit(&values[numProps]);
+        values[numProps].vt = VT_UI8;
+        values[numProps++].uhVal.QuadPart = (UInt64)1 << options.longWindowLog;
     }
 
-    // TODO: Add signature-based detection
-    return &CLSID_CFormat7z;  // Default to 7z
+    HRESULT hr = encoder->SetCoderProperties(propIDs, values, numProps);
+    if (SUCCEEDED(hr)) {
+        CoreScopedPhase phase(CorePhase::Encode);
+        hr = encoder->Code(inStream, outStream, inSize, nullptr, progress);
+    }
+    encoder->Release();
+    return hr;
 }
 
-bool SevenZipCore::OpenArchive(const std::wstring& path) {
-    CloseArchive();
-
-    // Detect format
-    const GUID* formatId = DetectFormat(path);
-    if (!formatId) {
-        return false;
-    }
+static HRESULT CompressZstdFile(const std::wstring& srcPath, const std::wstring& archivePath,
+                                ProgressCallback progress, const OperationOptions& options) {
+    CancellationToken* cancel = options.cancel.get();
 
-    // Create archive handler
-    m_archive = CreateInArchive(*formatId);
-    if (!m_archive) {
-        return false;
+    WIN32_FILE_ATTRIBUTE_DATA attr;
+    if (!GetFileAttributesExW(srcPath.c_str(), GetFileExInfoStandard, &attr) ||
+        (attr.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)) {
+        return E_INVALIDARG;
     }
+    UInt64 size = ((UInt64)attr.nFileSizeHigh << 32) | attr.nFileSizeLow;
 
-    // Open file stream
-    CFullInFileStream* inStream = new CFullInFileStream();
+    CSimpleInFileStream* inStream = new CSimpleInFileStream(cancel);
     inStream->AddRef();
-    if (!inStream->Open(path.c_str())) {
+    if (!inStream->Open(srcPath.c_str())) {
         inStream->Release();
-        m_archive->Release();
-        m_archive = nullptr;
-        return false;
+        return HRESULT_FROM_WIN32(GetLastError());
     }
-    m_inStream = inStream;
-
-    // Open archive
-    UInt64 maxCheckStartPosition = 1 << 22;
-    HRESULT hr = m_archive->Open(m_inStream, &maxCheckStartPosition, nullptr);
-    if (FAILED(hr)) {
-        m_inStream->Release();
-        m_inStream = nullptr;
-        m_archive->Release();
-        m_archive = nullptr;
-        return false;
+    CFullOutFileStream* outStream = new CFullOutFileStream(cancel);
+    outStream->AddRef();
+    if (!outStream->Create(archivePath.c_str())) {
+        outStream->Release();
+        inStream->Release();
+        return HRESULT_FROM_WIN32(GetLastError());
     }
 
-    m_currentPath = path;
-    m_needsPassword = false;
+    CCoderProgress* coderProgress = new CCoderProgress(progress, size);
+    coderProgress->AddRef();
 
-    // Check if any item is encrypted
-    UInt32 numItems = 0;
-    m_archive->GetNumberOfItems(&numItems);
-    for (UInt32 i = 0; i < numItems; i++) {
-        PROPVARIANT prop;
-        PropVariantInit(&prop);
-        m_archive->GetProperty(i, kpidEncrypted, &prop);
-        if (prop.vt == VT_BOOL && prop.boolVal != VARIANT_FALSE) {
-            m_needsPassword = true;
-            PropVariantClear(&prop);
-            break;
-        }
-        PropVariantClear(&prop);
+    HRESULT hr = EncodeZstdStream(inStream, outStream, &size, coderProgress, options);
+    if (SUCCEEDED(hr)) {
+        CoreStats_Add(CoreCounter::ItemsCompressed);
     }
 
-    return true;
+    coderProgress->Release();
+    outStream->Release();
+    inStream->Release();
+    return hr;
 }
+#endif // SEVENZIPCORE_WITH_ZSTD
 
-void SevenZipCore::CloseArchive() {
-    if (m_archive) {
-        m_archive->Close();
-        m_archive->Release();
-        m_archive = nullptr;
-    }
-    if (m_inStream) {
-        m_inStream->Release();
-        m_inStream = nullptr;
-    }
-    m_currentPath.clear();
-    m_needsPassword = false;
-}
+//////////////////////////////////////////////////////////////////////////////
+// Nested tarball: outer decoder -> pipe -> sequential Tar handler
+//////////////////////////////////////////////////////////////////////////////
 
-uint32_t SevenZipCore::GetItemCount() {
-    if (!m_archive) return 0;
-    UInt32 count = 0;
-    m_archive->GetNumberOfItems(&count);
-    return count;
-}
+// Enough to keep both threads busy without holding much of the tar in memory
+static const size_t kNestedPipeSize = 1 << 22;
 
-std::vector<ArchiveItem> SevenZipCore::GetItems() {
-    std::vector<ArchiveItem> items;
-    if (!m_archive) return items;
+// Extract callback of the outer (gzip/bzip2/xz/zstd) handler: its single
+// item goes into the pipe instead of a file
+class CPipeExtractCallback :
+    public IArchiveExtractCallback,
+    public CMyUnknownImp
+{
+public:
+    CPipeExtractCallback(std::shared_ptr<CStreamPipeState> pipe, ProgressCallback progress,
+                         CancellationToken* cancel)
+        : m_pipe(std::move(pipe))
+        , m_progress(progress)
+        , m_cancel(cancel)
+        , m_total(0)
+        , m_opRes(NArchive::NExtract::NOperationResult::kOK)
+        , m_refCount(0)
+    {}
 
-    UInt32 numItems = 0;
-    m_archive->GetNumberOfItems(&numItems);
+    Int32 GetOperationResult() const { return m_opRes; }
 
-    for (UInt32 i = 0; i < numItems; i++) {
-        ArchiveItem item;
-        PROPVARIANT prop;
+    // IUnknown
+    STDMETHOD(QueryInterface)(REFIID iid, void **outObject) {
+        if (iid == IID_IUnknown || iid == IID_IArchiveExtractCallback) {
+            *outObject = static_cast<IArchiveExtractCallback*>(this);
+            AddRef();
+            return S_OK;
+        }
+        *outObject = NULL;
+        return E_NOINTERFACE;
+    }
 
-        // Path
-        PropVariantInit(&prop);
-        m_archive->GetProperty(i, kpidPath, &prop);
-        item.path = (prop.vt == VT_BSTR) ? prop.bstrVal : L"";
-        PropVariantClear(&prop);
+    STDMETHOD_(ULONG, AddRef)() { return ++m_refCount; }
+    STDMETHOD_(ULONG, Release)() {
+        ULONG res = --m_refCount;
+        if (res == 0) delete this;
+        return res;
+    }
 
-        // Size
-        PropVariantInit(&prop);
-        m_archive->GetProperty(i, kpidSize, &prop);
-        item.size = (prop.vt == VT_UI8) ? prop.uhVal.QuadPart : 0;
-        PropVariantClear(&prop);
+    // IProgress
+    STDMETHOD(SetTotal)(UInt64 total) {
+        m_total = total;
+        return S_OK;
+    }
 
-        // Packed size
-        PropVariantInit(&prop);
-        m_archive->GetProperty(i, kpidPackSize, &prop);
-        item.packedSize = (prop.vt == VT_UI8) ? prop.uhVal.QuadPart : 0;
-        PropVariantClear(&prop);
+    STDMETHOD(SetCompleted)(const UInt64 *completeValue) {
+        if (m_cancel && m_cancel->Check()) return E_ABORT;
+        if (completeValue && m_progress && !m_progress(*completeValue, m_total)) {
+            return E_ABORT;
+        }
+        return S_OK;
+    }
 
-        // Is directory
-        PropVariantInit(&prop);
-        m_archive->GetProperty(i, kpidIsDir, &prop);
-        item.isDir = (prop.vt == VT_BOOL && prop.boolVal != VARIANT_FALSE);
-        PropVariantClear(&prop);
+    // IArchiveExtractCallback
+    STDMETHOD(GetStream)(UInt32 index, ISequentialOutStream **outStream, Int32 askExtractMode) {
+        *outStream = NULL;
+        if (m_cancel && m_cancel->Check()) return E_ABORT;
+        if (askExtractMode != NArchive::NExtract::NAskMode::kExtract) {
+            return S_OK;
+        }
+        CStreamPipeWriter* writer = new CStreamPipeWriter(m_pipe);
+        writer->AddRef();
+        *outStream = writer;
+        return S_OK;
+    }
 
-        // Is encrypted
-        PropVariantInit(&prop);
-        m_archive->GetProperty(i, kpidEncrypted, &prop);
-        item.isEncrypted = (prop.vt == VT_BOOL && prop.boolVal != VARIANT_FALSE);
+    STDMETHOD(PrepareOperation)(Int32 askExtractMode) {
+        return S_OK;
+    }
+
+    STDMETHOD(SetOperationResult)(Int32 opRes) {
+        m_opRes = opRes;
+        return S_OK;
+    }
+
+private:
+    std::shared_ptr<CStreamPipeState> m_pipe;
+    ProgressCallback m_progress;
+    CancellationToken* m_cancel;
+    UInt64 m_total;
+    Int32 m_opRes;
+    ULONG m_refCount;
+};
+
+// Extract callback of the Tar handler for listing: records each item as the
+// sequential walk reaches it and skips its data
+class CNestedListCallback :
+    public IArchiveExtractCallback,
+    public CMyUnknownImp
+{
+public:
+    CNestedListCallback(IInArchive* tar, std::vector<ArchiveItem>& items,
+                        CancellationToken* cancel)
+        : m_tar(tar), m_items(items), m_cancel(cancel), m_pipe(nullptr), m_dataOffsets(nullptr)
+        , m_refCount(0) {}
+
+    // Also record where each item's data starts in the decoded stream. The
+    // handler reads the pipe exactly up to the data when it asks for the
+    // item's stream. Sparse members (packed size below the size) get none.
+    void RecordDataOffsets(const CStreamPipeState* pipe, std::vector<UInt64>* dataOffsets) {
+        m_pipe = pipe;
+        m_dataOffsets = dataOffsets;
+    }
+
+    // IUnknown
+    STDMETHOD(QueryInterface)(REFIID iid, void **outObject) {
+        if (iid == IID_IUnknown || iid == IID_IArchiveExtractCallback) {
+            *outObject = static_cast<IArchiveExtractCallback*>(this);
+            AddRef();
+            return S_OK;
+        }
+        *outObject = NULL;
+        return E_NOINTERFACE;
+    }
+
+    STDMETHOD_(ULONG, AddRef)() { return ++m_refCount; }
+    STDMETHOD_(ULONG, Release)() {
+        ULONG res = --m_refCount;
+        if (res == 0) delete this;
+        return res;
+    }
+
+    // IProgress
+    STDMETHOD(SetTotal)(UInt64 total) { return S_OK; }
+    STDMETHOD(SetCompleted)(const UInt64 *completeValue) {
+        return (m_cancel && m_cancel->Check()) ? E_ABORT : S_OK;
+    }
+
+    // IArchiveExtractCallback
+    STDMETHOD(GetStream)(UInt32 index, ISequentialOutStream **outStream, Int32 askExtractMode) {
+        *outStream = NULL;
+        if (m_cancel && m_cancel->Check()) return E_ABORT;
+
+        CoreScopedPhase phase(CorePhase::PropertyLookup);
+        CoreStats_Add(CoreCounter::PropertyLookups, 5);
+        ArchiveItem item;
+        item.path = ArchiveProps::GetString(m_tar, index, kpidPath);
+        item.size = ArchiveProps::GetUInt64(m_tar, index, kpidSize);
+        item.packedSize = ArchiveProps::GetUInt64(m_tar, index, kpidPackSize);
+        item.isDir = ArchiveProps::GetBool(m_tar, index, kpidIsDir);
+        item.isEncrypted = false;
+        if (!ArchiveProps::GetFileTime(m_tar, index, kpidMTime, item.mtime)) {
+            memset(&item.mtime, 0, sizeof(item.mtime));
+        }
+        CoreStats_Add(CoreCounter::ItemsEnumerated);
+        if (m_dataOffsets) {
+            // Tar reports the packed size rounded up to whole records
+            bool contiguous = (item.packedSize == item.size) ||
+                              (item.packedSize == ((item.size + 511) & ~(uint64_t)511));
+            m_dataOffsets->push_back((!item.isDir && contiguous) ? m_pipe->GetBytesRead()
+                                                                 : kNoTarDataOffset);
+        }
+        m_items.push_back(std::move(item));
+        return S_OK;
+    }
+
+    STDMETHOD(PrepareOperation)(Int32 askExtractMode) { return S_OK; }
+    STDMETHOD(SetOperationResult)(Int32 opRes) { return S_OK; }
+
+private:
+    IInArchive* m_tar;
+    std::vector<ArchiveItem>& m_items;
+    CancellationToken* m_cancel;
+    const CStreamPipeState* m_pipe;
+    std::vector<UInt64>* m_dataOffsets;
+    ULONG m_refCount;
+};
+
+// Runs `produce` (which writes the decoded tar into the pipe) on a worker
+// thread while `tar` reads the pipe through IArchiveOpenSeq and extracts
+// with `callback`
+static HRESULT RunNestedTar(IInArchive* tar, IArchiveExtractCallback* callback, Int32 testMode,
+                            std::shared_ptr<CStreamPipeState> pipe,
+                            std::function<HRESULT()> produce, CancellationToken* cancel) {
+    IArchiveOpenSeq* openSeq = nullptr;
+    tar->QueryInterface(IID_IArchiveOpenSeq, (void**)&openSeq);
+    if (!openSeq) return E_NOTIMPL;
+
+    CStreamPipeReader* reader = new CStreamPipeReader(pipe);
+    reader->AddRef();
+
+    HRESULT outerResult = S_OK;
+    std::thread producer([&] {
+        CancellationScope cancelScope(cancel);
+        HRESULT hr = produce();
+        if (FAILED(hr)) {
+            pipe->Abort(hr);
+        } else {
+            pipe->CloseWrite();
+        }
+        outerResult = hr;
+    });
+
+    HRESULT hr;
+    {
+        CoreScopedPhase phase(CorePhase::HeaderParse);
+        hr = openSeq->OpenSeq(reader);
+    }
+    if (SUCCEEDED(hr)) {
+        CoreScopedPhase phase(CorePhase::Decode);
+        hr = tar->Extract(nullptr, (UInt32)-1, testMode, callback);
+    }
+
+    // Unblock the producer: on failure it stops, otherwise it drains the
+    // tail (end-of-archive padding) into a closed reader
+    if (FAILED(hr)) pipe->Abort(hr);
+    openSeq->Release();
+    tar->Close();
+    reader->Release();
+    pipe->CloseRead();
+    producer.join();
+
+    return FAILED(hr) ? hr : outerResult;
+}
+
+// Nested tar fed by the outer handler's Extract
+static HRESULT ExtractNestedTar(IInArchive* outer, IInArchive* tar,
+                                IArchiveExtractCallback* callback, Int32 testMode,
+                                ProgressCallback progress, CancellationToken* cancel) {
+    auto pipe = std::make_shared<CStreamPipeState>(kNestedPipeSize);
+    return RunNestedTar(tar, callback, testMode, pipe, [&] {
+        CPipeExtractCallback* outerCallback = new CPipeExtractCallback(pipe, progress, cancel);
+        outerCallback->AddRef();
+        UInt32 index = 0;
+        HRESULT hr;
+        {
+            CoreScopedPhase phase(CorePhase::Decode);
+            hr = outer->Extract(&index, 1, 0, outerCallback);
+        }
+        if (SUCCEEDED(hr) &&
+            outerCallback->GetOperationResult() != NArchive::NExtract::NOperationResult::kOK) {
+            hr = E_FAIL;
+        }
+        outerCallback->Release();
+        return hr;
+    }, cancel);
+}
+
+// Nested tar fed by walking the gzip members directly (7-Zip's GZip handler
+// does not report where members start), recording seek points on the way
+static HRESULT ListGzipTarIndexed(IInStream* inStream, IInArchive* tar,
+                                  CNestedListCallback* callback, UInt64 spacing,
+                                  std::vector<GzipSeekPoint>& points,
+                                  std::vector<UInt64>& dataOffsets, CancellationToken* cancel) {
+    auto pipe = std::make_shared<CStreamPipeState>(kNestedPipeSize);
+    callback->RecordDataOffsets(pipe.get(), &dataOffsets);
+    return RunNestedTar(tar, callback, 1, pipe, [&] {
+        CStreamPipeWriter* writer = new CStreamPipeWriter(pipe);
+        writer->AddRef();
+        HRESULT hr;
+        {
+            CoreScopedPhase phase(CorePhase::Decode);
+            hr = DecodeGzipMembers(inStream, { 0, 0 }, writer, &points, spacing, cancel);
+        }
+        writer->Release();
+        return hr;
+    }, cancel);
+}
+
+// Numeric field of a ustar header: octal, or base-256 (GNU) for large sizes
+static bool ParseTarNumber(const Byte* field, size_t len, UInt64& value) {
+    value = 0;
+    if (field[0] & 0x80) {
+        for (size_t i = 1; i < len; i++) {
+            if (value >> 56) return false;
+            value = (value << 8) | field[i];
+        }
+        return (field[0] & 0x7F) == 0;
+    }
+    size_t i = 0;
+    while (i < len && field[i] == ' ') i++;
+    for (; i < len && field[i] >= '0' && field[i] <= '7'; i++) {
+        value = (value << 3) | (UInt64)(field[i] - '0');
+    }
+    return i == len || field[i] == 0 || field[i] == ' ';
+}
+
+// Checks the ustar header in front of an indexed entry's data, then passes
+// the data on. A header that does not describe a regular file of the
+// expected size means the index is stale: the write fails and
+// IsHeaderMismatch() tells the caller to fall back to a full pass.
+class CTarHeaderCheckOutStream :
+    public ISequentialOutStream,
+    public CMyUnknownImp
+{
+public:
+    CTarHeaderCheckOutStream(ISequentialOutStream* target, UInt64 size)
+        : m_target(target), m_size(size), m_headerPos(0), m_mismatch(false), m_refCount(0) {}
+    virtual ~CTarHeaderCheckOutStream() {}
+
+    bool IsHeaderMismatch() const { return m_mismatch; }
+
+    // IUnknown
+    STDMETHOD(QueryInterface)(REFIID iid, void **outObject) {
+        if (iid == IID_IUnknown || iid == IID_ISequentialOutStream) {
+            *outObject = this;
+            AddRef();
+            return S_OK;
+        }
+        *outObject = NULL;
+        return E_NOINTERFACE;
+    }
+
+    STDMETHOD_(ULONG, AddRef)() { return ++m_refCount; }
+    STDMETHOD_(ULONG, Release)() {
+        ULONG res = --m_refCount;
+        if (res == 0) delete this;
+        return res;
+    }
+
+    STDMETHOD(Write)(const void *data, UInt32 size, UInt32 *processedSize) {
+        if (processedSize) *processedSize = 0;
+        const Byte* p = (const Byte*)data;
+        UInt32 rest = size;
+        if (m_headerPos < sizeof(m_header)) {
+            UInt32 n = std::min<UInt32>(rest, (UInt32)(sizeof(m_header) - m_headerPos));
+            memcpy(m_header + m_headerPos, p, n);
+            m_headerPos += n;
+            p += n;
+            rest -= n;
+            if (m_headerPos == sizeof(m_header) && !CheckHeader()) {
+                m_mismatch = true;
+                return E_FAIL;
+            }
+        }
+        if (rest != 0) RINOK(WriteStream(m_target, p, rest));
+        if (processedSize) *processedSize = size;
+        return S_OK;
+    }
+
+private:
+    bool CheckHeader() const {
+        if (memcmp(m_header + 257, "ustar", 5) != 0) return false;
+        Byte type = m_header[156];
+        if (type != '0' && type != 0 && type != '7') return false;
+        UInt64 size;
+        if (!ParseTarNumber(m_header + 124, 12, size) || size != m_size) return false;
+
+        // Checksum: byte sum with the checksum field read as spaces
+        UInt32 sum = 0;
+        for (size_t i = 0; i < sizeof(m_header); i++) {
+            sum += (i >= 148 && i < 156) ? ' ' : m_header[i];
+        }
+        UInt64 stored;
+        return ParseTarNumber(m_header + 148, 8, stored) && stored == sum;
+    }
+
+    ISequentialOutStream* m_target;
+    UInt64 m_size;
+    Byte m_header[512];
+    size_t m_headerPos;
+    bool m_mismatch;
+    ULONG m_refCount;
+};
+
+//////////////////////////////////////////////////////////////////////////////
+// Tarball creation: Tar handler -> pipe -> outer encoder
+//////////////////////////////////////////////////////////////////////////////
+
+// Uncompressed bytes per gzip member of a parallel .tar.gz: each member
+// starts with an empty dictionary, so much smaller blocks cost ratio
+static const size_t kGzipMemberSize = 1 << 20;
+
+// Outer format of a compound tarball format name, or nullptr
+static const GUID* GetTarballOuterFormat(const std::wstring& format) {
+    static const struct {
+        const wchar_t* name;
+        const GUID* formatId;
+    } kTarballs[] = {
+        { L"tgz",     &CLSID_CFormatGZip },
+        { L"tar.gz",  &CLSID_CFormatGZip },
+        { L"tbz",     &CLSID_CFormatBZip2 },
+        { L"tbz2",    &CLSID_CFormatBZip2 },
+        { L"tar.bz2", &CLSID_CFormatBZip2 },
+        { L"txz",     &CLSID_CFormatXz },
+        { L"tar.xz",  &CLSID_CFormatXz },
+#ifdef SEVENZIPCORE_WITH_ZSTD
+        { L"tzst",    &CLSID_CFormatZstd },
+        { L"tar.zst", &CLSID_CFormatZstd },
+#endif
+    };
+
+    const wchar_t* name = format.c_str();
+    if (*name == L'.') name++;
+    for (const auto& tarball : kTarballs) {
+        if (_wcsicmp(name, tarball.name) == 0) return tarball.formatId;
+    }
+    return nullptr;
+}
+
+// Name of the inner item: "src.tar.gz" -> "src.tar", "src.tgz" -> "src.tar"
+static std::wstring TarNameForArchive(const std::wstring& archivePath) {
+    std::wstring name = PathFindFileNameW(archivePath.c_str());
+    name.resize(name.size() - wcslen(PathFindExtensionW(name.c_str())));
+    if (_wcsicmp(PathFindExtensionW(name.c_str()), L".tar") != 0) name += L".tar";
+    return name;
+}
+
+// Update callback of the outer (gzip/bzip2/xz) handler: its single item is
+// the tar stream read from the pipe
+class CTarStreamUpdateCallback :
+    public IArchiveUpdateCallback,
+    public CMyUnknownImp
+{
+public:
+    CTarStreamUpdateCallback(ISequentialInStream* stream, const std::wstring& name,
+                             UInt64 sizeHint, CancellationToken* cancel)
+        : m_stream(stream)
+        , m_name(name)
+        , m_sizeHint(sizeHint)
+        , m_cancel(cancel)
+        , m_refCount(0)
+    {}
+
+    // IUnknown
+    STDMETHOD(QueryInterface)(REFIID iid, void **outObject) {
+        if (iid == IID_IUnknown || iid == IID_IArchiveUpdateCallback) {
+            *outObject = static_cast<IArchiveUpdateCallback*>(this);
+            AddRef();
+            return S_OK;
+        }
+        *outObject = NULL;
+        return E_NOINTERFACE;
+    }
+
+    STDMETHOD_(ULONG, AddRef)() { return ++m_refCount; }
+    STDMETHOD_(ULONG, Release)() {
+        ULONG res = --m_refCount;
+        if (res == 0) delete this;
+        return res;
+    }
+
+    // IProgress (the Tar handler's callback reports progress)
+    STDMETHOD(SetTotal)(UInt64 total) { return S_OK; }
+    STDMETHOD(SetCompleted)(const UInt64 *completeValue) {
+        return (m_cancel && m_cancel->Check()) ? E_ABORT : S_OK;
+    }
+
+    // IArchiveUpdateCallback
+    STDMETHOD(GetUpdateItemInfo)(UInt32 index, Int32 *newData, Int32 *newProps, UInt32 *indexInArchive) {
+        if (newData) *newData = 1;
+        if (newProps) *newProps = 1;
+        if (indexInArchive) *indexInArchive = (UInt32)-1;
+        return S_OK;
+    }
+
+    STDMETHOD(GetProperty)(UInt32 index, PROPID propID, PROPVARIANT *value) {
+        PropVariantInit(value);
+        switch (propID) {
+            case kpidPath:
+                value->vt = VT_BSTR;
+                value->bstrVal = SysAllocString(m_name.c_str());
+                break;
+            case kpidIsDir:
+                value->vt = VT_BOOL;
+                value->boolVal = VARIANT_FALSE;
+                break;
+            case kpidSize:
+                // The handlers need a size up front; they use it for progress
+                // and to cap the XZ dictionary, so a high estimate is safe
+                value->vt = VT_UI8;
+                value->uhVal.QuadPart = m_sizeHint;
+                break;
+            case kpidMTime:
+                value->vt = VT_FILETIME;
+                GetSystemTimeAsFileTime(&value->filetime);
+                break;
+        }
+        return S_OK;
+    }
+
+    STDMETHOD(GetStream)(UInt32 index, ISequentialInStream **inStream) {
+        if (m_cancel && m_cancel->Check()) {
+            *inStream = NULL;
+            return E_ABORT;
+        }
+        m_stream->AddRef();
+        *inStream = m_stream;
+        return S_OK;
+    }
+
+    STDMETHOD(SetOperationResult)(Int32 operationResult) {
+        return S_OK;
+    }
+
+private:
+    ISequentialInStream* m_stream;
+    std::wstring m_name;
+    UInt64 m_sizeHint;
+    CancellationToken* m_cancel;
+    ULONG m_refCount;
+};
+
+// Update callback that rewrites an open archive from its own items: each
+// output item is an existing one, copied packed (newData = 0), with a new
+// path when renamed. The handler asks for the password when it has to
+// repack a 7z solid block that lost items, and encrypts the result with it.
+class CCopyThroughUpdateCallback :
+    public IArchiveUpdateCallback,
+    public ICryptoGetTextPassword,
+    public ICryptoGetTextPassword2,
+    public CMyUnknownImp
+{
+public:
+    struct Item {
+        UInt32 indexInArchive;
+        std::wstring newPath;       // Empty = unchanged properties
+    };
+
+    CCopyThroughUpdateCallback(IInArchive* archive, std::vector<Item> items,
+                               const std::wstring& password, ProgressCallback progress,
+                               CancellationToken* cancel)
+        : m_archive(archive)
+        , m_items(std::move(items))
+        , m_password(password)
+        , m_progress(progress)
+        , m_cancel(cancel)
+        , m_total(0)
+        , m_refCount(0)
+    {}
+
+    // IUnknown
+    STDMETHOD(QueryInterface)(REFIID iid, void **outObject) {
+        if (iid == IID_IUnknown || iid == IID_IArchiveUpdateCallback) {
+            *outObject = static_cast<IArchiveUpdateCallback*>(this);
+        } else if (iid == IID_ICryptoGetTextPassword) {
+            *outObject = static_cast<ICryptoGetTextPassword*>(this);
+        } else if (iid == IID_ICryptoGetTextPassword2) {
+            *outObject = static_cast<ICryptoGetTextPassword2*>(this);
+        } else {
+            *outObject = NULL;
+            return E_NOINTERFACE;
+        }
+        AddRef();
+        return S_OK;
+    }
+
+    STDMETHOD_(ULONG, AddRef)() { return ++m_refCount; }
+    STDMETHOD_(ULONG, Release)() {
+        ULONG res = --m_refCount;
+        if (res == 0) delete this;
+        return res;
+    }
+
+    // IProgress
+    STDMETHOD(SetTotal)(UInt64 total) {
+        m_total = total;
+        return S_OK;
+    }
+
+    STDMETHOD(SetCompleted)(const UInt64 *completeValue) {
+        if (m_cancel && m_cancel->Check()) return E_ABORT;
+        if (completeValue && m_progress && !m_progress(*completeValue, m_total)) return E_ABORT;
+        return S_OK;
+    }
+
+    // IArchiveUpdateCallback
+    STDMETHOD(GetUpdateItemInfo)(UInt32 index, Int32 *newData, Int32 *newProps, UInt32 *indexInArchive) {
+        if (index >= m_items.size()) return E_INVALIDARG;
+        const Item& item = m_items[index];
+        if (newData) *newData = 0;
+        if (newProps) *newProps = item.newPath.empty() ? 0 : 1;
+        if (indexInArchive) *indexInArchive = item.indexInArchive;
+        return S_OK;
+    }
+
+    // Only asked for renamed items: the new path, the rest as stored
+    STDMETHOD(GetProperty)(UInt32 index, PROPID propID, PROPVARIANT *value) {
+        PropVariantInit(value);
+        if (index >= m_items.size()) return E_INVALIDARG;
+        const Item& item = m_items[index];
+        if (propID == kpidPath && !item.newPath.empty()) {
+            value->vt = VT_BSTR;
+            value->bstrVal = SysAllocString(item.newPath.c_str());
+            return S_OK;
+        }
+        if (propID == kpidIsAnti) {
+            value->vt = VT_BOOL;
+            value->boolVal = VARIANT_FALSE;
+            return S_OK;
+        }
+        return m_archive->GetProperty(item.indexInArchive, propID, value);
+    }
+
+    // No item has new data
+    STDMETHOD(GetStream)(UInt32 index, ISequentialInStream **inStream) {
+        *inStream = NULL;
+        return E_UNEXPECTED;
+    }
+
+    STDMETHOD(SetOperationResult)(Int32 operationResult) {
+        return S_OK;
+    }
+
+    // ICryptoGetTextPassword
+    STDMETHOD(CryptoGetTextPassword)(BSTR *password) {
+        *password = SysAllocString(m_password.c_str());
+        return S_OK;
+    }
+
+    // ICryptoGetTextPassword2
+    STDMETHOD(CryptoGetTextPassword2)(Int32 *passwordIsDefined, BSTR *password) {
+        *passwordIsDefined = m_password.empty() ? 0 : 1;
+        *password = SysAllocString(m_password.c_str());
+        return S_OK;
+    }
+
+private:
+    IInArchive* m_archive;
+    std::vector<Item> m_items;
+    std::wstring m_password;
+    ProgressCallback m_progress;
+    CancellationToken* m_cancel;
+    UInt64 m_total;
+    ULONG m_refCount;
+};
+
+//////////////////////////////////////////////////////////////////////////////
+// Conversion: source extract streams -> per-item pipes -> target update
+//////////////////////////////////////////////////////////////////////////////
+
+// Pipe of one item: small items fit whole, large ones get enough buffer to
+// keep the decoder and the encoder busy
+static const size_t kConvertPipeMinSize = 1 << 12;
+static const size_t kConvertPipeMaxSize = 1 << 22;
+
+// Data of items the source decodes ahead of the target's order, held in
+// memory until the target gets to them (see Convert)
+static const UInt64 kConvertHoldMax = (UInt64)256 << 20;
+
+// Properties of a source item, read before the conversion starts: the
+// target handler asks for them while the source handler is extracting,
+// and IInArchive is not called from two threads at once
+struct ConvertItem {
+    std::wstring path;
+    bool isDir = false;
+    bool sizeDefined = false;
+    UInt64 size = 0;
+    bool mtimeDefined = false;
+    bool ctimeDefined = false;
+    bool atimeDefined = false;
+    FILETIME mtime = {};
+    FILETIME ctime = {};
+    FILETIME atime = {};
+    bool attribDefined = false;
+    bool posixAttribDefined = false;
+    UInt64 attrib = 0;
+    UInt64 posixAttrib = 0;
+    std::wstring user;
+    std::wstring group;
+    std::wstring symLink;
+
+    // Goes through a pipe; items of unknown size do too
+    bool HasData() const { return !isDir && (!sizeDefined || size > 0); }
+};
+
+static ConvertItem ReadConvertItem(IInArchive* archive, UInt32 index) {
+    CoreScopedPhase lookup(CorePhase::PropertyLookup);
+    ConvertItem item;
+    item.path = ArchiveProps::GetString(archive, index, kpidPath);
+    item.isDir = ArchiveProps::GetBool(archive, index, kpidIsDir);
+    item.sizeDefined = ArchiveProps::GetUInt64(archive, index, kpidSize, item.size);
+    item.mtimeDefined = ArchiveProps::GetFileTime(archive, index, kpidMTime, item.mtime);
+    item.ctimeDefined = ArchiveProps::GetFileTime(archive, index, kpidCTime, item.ctime);
+    item.atimeDefined = ArchiveProps::GetFileTime(archive, index, kpidATime, item.atime);
+    item.attribDefined = ArchiveProps::GetUInt64(archive, index, kpidAttrib, item.attrib);
+    item.posixAttribDefined = ArchiveProps::GetUInt64(archive, index, kpidPosixAttrib,
+                                                      item.posixAttrib);
+    item.user = ArchiveProps::GetString(archive, index, kpidUser);
+    item.group = ArchiveProps::GetString(archive, index, kpidGroup);
+    item.symLink = ArchiveProps::GetString(archive, index, kpidSymLink);
+    CoreStats_Add(CoreCounter::PropertyLookups, 11);
+    return item;
+}
+
+// Collects an item decoded ahead of the target's order. All such items
+// together may not exceed kConvertHoldMax bytes.
+class CConvertHoldOutStream :
+    public ISequentialOutStream,
+    public CMyUnknownImp
+{
+public:
+    CConvertHoldOutStream(std::vector<Byte>& data, UInt64& heldBytes)
+        : m_data(data), m_heldBytes(heldBytes), m_refCount(0) {}
+    virtual ~CConvertHoldOutStream() {}
+
+    // IUnknown
+    STDMETHOD(QueryInterface)(REFIID iid, void **outObject) {
+        if (iid == IID_IUnknown || iid == IID_ISequentialOutStream) {
+            *outObject = this;
+            AddRef();
+            return S_OK;
+        }
+        *outObject = NULL;
+        return E_NOINTERFACE;
+    }
+
+    STDMETHOD_(ULONG, AddRef)() { return ++m_refCount; }
+    STDMETHOD_(ULONG, Release)() {
+        ULONG res = --m_refCount;
+        if (res == 0) delete this;
+        return res;
+    }
+
+    STDMETHOD(Write)(const void *data, UInt32 size, UInt32 *processedSize) {
+        if (processedSize) *processedSize = 0;
+        if (m_heldBytes + size > kConvertHoldMax) return E_OUTOFMEMORY;
+        const Byte* p = (const Byte*)data;
+        m_data.insert(m_data.end(), p, p + size);
+        m_heldBytes += size;
+        if (processedSize) *processedSize = size;
+        return S_OK;
+    }
+
+private:
+    std::vector<Byte>& m_data;
+    UInt64& m_heldBytes;
+    ULONG m_refCount;
+};
+
+// Extract callback of the source handler, over one or more Extract calls:
+// each item is written into a new pipe of the queue. The callback keeps a
+// writer reference until the handler reports the item's result, so the
+// reader sees EOF only for data that passed its CRC check and an error
+// otherwise. order is the target's order of the data items; an item the
+// source decodes before its turn is held in memory and goes into its pipe
+// once the items before it have.
+class CConvertExtractCallback :
+    public IArchiveExtractCallback,
+    public ICryptoGetTextPassword,
+    public CMyUnknownImp
+{
+public:
+    // total: data bytes of all items, over every Extract call
+    CConvertExtractCallback(CStreamPipeQueue& queue, const std::vector<ConvertItem>& items,
+                            const std::vector<UInt32>& order, UInt64 total,
+                            const std::wstring& password, ProgressCallback progress,
+                            CancellationToken* cancel)
+        : m_queue(queue)
+        , m_items(items)
+        , m_order(order)
+        , m_password(password)
+        , m_progress(progress)
+        , m_cancel(cancel)
+        , m_writer(nullptr)
+        , m_holder(nullptr)
+        , m_holdIndex(0)
+        , m_heldBytes(0)
+        , m_next(0)
+        , m_total(total)
+        , m_runBase(0)
+        , m_runCompleted(0)
+        , m_itemsDone(0)
+        , m_refCount(0)
+    {}
+
+    virtual ~CConvertExtractCallback() {
+        if (m_writer) m_writer->Release();
+        if (m_holder) m_holder->Release();
+    }
+
+    // Items decoded and verified
+    UInt32 GetItemsDone() const { return m_itemsDone; }
+
+    // Before each further Extract call: its progress counts on from here
+    void BeginRun() {
+        m_runBase += m_runCompleted;
+        m_runCompleted = 0;
+    }
+
+    // IUnknown
+    STDMETHOD(QueryInterface)(REFIID iid, void **outObject) {
+        if (iid == IID_IUnknown || iid == IID_IArchiveExtractCallback) {
+            *outObject = static_cast<IArchiveExtractCallback*>(this);
+        } else if (iid == IID_ICryptoGetTextPassword) {
+            *outObject = static_cast<ICryptoGetTextPassword*>(this);
+        } else {
+            *outObject = NULL;
+            return E_NOINTERFACE;
+        }
+        AddRef();
+        return S_OK;
+    }
+
+    STDMETHOD_(ULONG, AddRef)() { return ++m_refCount; }
+    STDMETHOD_(ULONG, Release)() {
+        ULONG res = --m_refCount;
+        if (res == 0) delete this;
+        return res;
+    }
+
+    // IProgress (the total of one Extract call is not the whole)
+    STDMETHOD(SetTotal)(UInt64 total) { return S_OK; }
+
+    STDMETHOD(SetCompleted)(const UInt64 *completeValue) {
+        if (m_cancel && m_cancel->Check()) return E_ABORT;
+        if (!completeValue) return S_OK;
+        m_runCompleted = *completeValue;
+        if (m_progress && !m_progress(m_runBase + m_runCompleted, m_total)) return E_ABORT;
+        return S_OK;
+    }
+
+    // IArchiveExtractCallback
+    STDMETHOD(GetStream)(UInt32 index, ISequentialOutStream **outStream, Int32 askExtractMode) {
+        *outStream = NULL;
+        if (m_cancel && m_cancel->Check()) return E_ABORT;
+        if (askExtractMode != NArchive::NExtract::NAskMode::kExtract) return S_OK;
+        if (index >= m_items.size()) return E_INVALIDARG;
+
+        if (m_next >= m_order.size() || index != m_order[m_next]) {
+            m_holdIndex = index;
+            m_holdData.clear();
+            m_holder = new CConvertHoldOutStream(m_holdData, m_heldBytes);
+            m_holder->AddRef();
+            m_holder->AddRef();
+            *outStream = m_holder;
+            return S_OK;
+        }
+
+        m_pipe = m_queue.Push(index, PipeCapacity(index));
+        if (!m_pipe) return m_queue.GetError();
+
+        m_writer = new CStreamPipeWriter(m_pipe);
+        m_writer->AddRef();
+        m_writer->AddRef();
+        *outStream = m_writer;
+        return S_OK;
+    }
+
+    STDMETHOD(PrepareOperation)(Int32 askExtractMode) {
+        return S_OK;
+    }
+
+    STDMETHOD(SetOperationResult)(Int32 opRes) {
+        bool ok = (opRes == NArchive::NExtract::NOperationResult::kOK);
+        if (m_holder) {
+            m_holder->Release();
+            m_holder = nullptr;
+            if (!ok) return E_FAIL;
+            m_held[m_holdIndex] = std::move(m_holdData);
+            m_holdData.clear();
+            return S_OK;
+        }
+        if (m_writer) {
+            if (!ok) m_pipe->Abort(E_FAIL);
+            m_writer->Release();
+            m_writer = nullptr;
+            m_pipe.reset();
+        }
+        if (!ok) return E_FAIL;
+        m_itemsDone++;
+        m_next++;
+        return PassHeld();
+    }
+
+    // ICryptoGetTextPassword
+    STDMETHOD(CryptoGetTextPassword)(BSTR *password) {
+        *password = SysAllocString(m_password.c_str());
+        return S_OK;
+    }
+
+private:
+    size_t PipeCapacity(UInt32 index) const {
+        const ConvertItem& item = m_items[index];
+        return item.sizeDefined
+            ? (size_t)std::min<UInt64>(std::max<UInt64>(item.size, kConvertPipeMinSize),
+                                       kConvertPipeMaxSize)
+            : kConvertPipeMaxSize;
+    }
+
+    // Held items that are next in the target's order go into their pipes
+    HRESULT PassHeld() {
+        while (m_next < m_order.size()) {
+            auto it = m_held.find(m_order[m_next]);
+            if (it == m_held.end()) break;
+            std::shared_ptr<CStreamPipeState> pipe = m_queue.Push(it->first,
+                                                                  PipeCapacity(it->first));
+            if (!pipe) return m_queue.GetError();
+            CStreamPipeWriter* writer = new CStreamPipeWriter(pipe);
+            writer->AddRef();
+            HRESULT hr = WriteStream(writer, it->second.data(), it->second.size());
+            if (FAILED(hr)) pipe->Abort(hr);
+            writer->Release();
+            RINOK(hr);
+            m_heldBytes -= it->second.size();
+            m_held.erase(it);
+            m_itemsDone++;
+            m_next++;
+        }
+        return S_OK;
+    }
+
+    CStreamPipeQueue& m_queue;
+    const std::vector<ConvertItem>& m_items;
+    const std::vector<UInt32>& m_order;
+    std::wstring m_password;
+    ProgressCallback m_progress;
+    CancellationToken* m_cancel;
+    std::shared_ptr<CStreamPipeState> m_pipe;
+    CStreamPipeWriter* m_writer;    // Held until SetOperationResult
+    CConvertHoldOutStream* m_holder;
+    UInt32 m_holdIndex;
+    std::vector<Byte> m_holdData;
+    std::map<UInt32, std::vector<Byte>> m_held;
+    UInt64 m_heldBytes;
+    size_t m_next;                  // Position in m_order
+    UInt64 m_total;
+    UInt64 m_runBase;
+    UInt64 m_runCompleted;
+    UInt32 m_itemsDone;
+    ULONG m_refCount;
+};
+
+// Update callback of the target handler: item properties from the snapshot,
+// item data from the queue. Both sides walk the data items in the order the
+// target handler asks for them (see Convert); a request out of that order
+// fails the conversion rather than wait for a pipe that would never come.
+class CConvertUpdateCallback :
+    public IArchiveUpdateCallback,
+    public ICryptoGetTextPassword2,
+    public CMyUnknownImp
+{
+public:
+    CConvertUpdateCallback(CStreamPipeQueue& queue, const std::vector<ConvertItem>& items,
+                           CancellationToken* cancel)
+        : m_queue(queue)
+        , m_items(items)
+        , m_cancel(cancel)
+        , m_refCount(0)
+    {}
+
+    // IUnknown
+    STDMETHOD(QueryInterface)(REFIID iid, void **outObject) {
+        if (iid == IID_IUnknown || iid == IID_IArchiveUpdateCallback) {
+            *outObject = static_cast<IArchiveUpdateCallback*>(this);
+        } else if (iid == IID_ICryptoGetTextPassword2) {
+            *outObject = static_cast<ICryptoGetTextPassword2*>(this);
+        } else {
+            *outObject = NULL;
+            return E_NOINTERFACE;
+        }
+        AddRef();
+        return S_OK;
+    }
+
+    STDMETHOD_(ULONG, AddRef)() { return ++m_refCount; }
+    STDMETHOD_(ULONG, Release)() {
+        ULONG res = --m_refCount;
+        if (res == 0) delete this;
+        return res;
+    }
+
+    // IProgress (the extract callback reports progress)
+    STDMETHOD(SetTotal)(UInt64 total) { return S_OK; }
+    STDMETHOD(SetCompleted)(const UInt64 *completeValue) {
+        return (m_cancel && m_cancel->Check()) ? E_ABORT : S_OK;
+    }
+
+    // IArchiveUpdateCallback
+    STDMETHOD(GetUpdateItemInfo)(UInt32 index, Int32 *newData, Int32 *newProps, UInt32 *indexInArchive) {
+        if (newData) *newData = 1;
+        if (newProps) *newProps = 1;
+        if (indexInArchive) *indexInArchive = (UInt32)-1;
+        return S_OK;
+    }
+
+    STDMETHOD(GetProperty)(UInt32 index, PROPID propID, PROPVARIANT *value) {
+        PropVariantInit(value);
+        if (index >= m_items.size()) return E_INVALIDARG;
+
+        const ConvertItem& item = m_items[index];
+        switch (propID) {
+            case kpidPath:
+                value->vt = VT_BSTR;
+                value->bstrVal = SysAllocString(item.path.c_str());
+                break;
+            case kpidIsDir:
+                value->vt = VT_BOOL;
+                value->boolVal = item.isDir ? VARIANT_TRUE : VARIANT_FALSE;
+                break;
+            case kpidIsAnti:
+                value->vt = VT_BOOL;
+                value->boolVal = VARIANT_FALSE;
+                break;
+            case kpidSize:
+                if (!item.isDir && item.sizeDefined) {
+                    value->vt = VT_UI8;
+                    value->uhVal.QuadPart = item.size;
+                }
+                break;
+            case kpidMTime:
+            case kpidCTime:
+            case kpidATime: {
+                bool defined = (propID == kpidMTime) ? item.mtimeDefined
+                             : (propID == kpidCTime) ? item.ctimeDefined : item.atimeDefined;
+                if (defined) {
+                    value->vt = VT_FILETIME;
+                    value->filetime = (propID == kpidMTime) ? item.mtime
+                                    : (propID == kpidCTime) ? item.ctime : item.atime;
+                }
+                break;
+            }
+            case kpidAttrib:
+                if (item.attribDefined) {
+                    value->vt = VT_UI4;
+                    value->ulVal = (UInt32)item.attrib;
+                }
+                break;
+            case kpidPosixAttrib:
+                if (item.posixAttribDefined) {
+                    value->vt = VT_UI4;
+                    value->ulVal = (UInt32)item.posixAttrib;
+                }
+                break;
+            case kpidUser:
+            case kpidGroup:
+            case kpidSymLink: {
+                const std::wstring& text = (propID == kpidUser) ? item.user
+                                         : (propID == kpidGroup) ? item.group : item.symLink;
+                if (!text.empty()) {
+                    value->vt = VT_BSTR;
+                    value->bstrVal = SysAllocString(text.c_str());
+                }
+                break;
+            }
+        }
+        return S_OK;
+    }
+
+    STDMETHOD(GetStream)(UInt32 index, ISequentialInStream **inStream) {
+        *inStream = NULL;
+        if (m_cancel && m_cancel->Check()) return E_ABORT;
+        if (index >= m_items.size()) return E_INVALIDARG;
+
+        const ConvertItem& item = m_items[index];
+        if (item.isDir) return S_OK;
+        CoreStats_Add(CoreCounter::ItemsCompressed);
+
+        std::shared_ptr<CStreamPipeState> pipe;
+        if (!item.HasData()) {
+            // Empty files are not extracted; they read as an empty stream
+            pipe = std::make_shared<CStreamPipeState>(1);
+            pipe->CloseWrite();
+        } else {
+            UInt32 next = 0;
+            pipe = m_queue.Pop(next);
+            if (!pipe) {
+                HRESULT hr = m_queue.GetError();
+                return FAILED(hr) ? hr : E_FAIL;
+            }
+            if (next != index) {
+                m_queue.Abort(E_FAIL);
+                return E_FAIL;
+            }
+        }
+        CStreamPipeReader* reader = new CStreamPipeReader(std::move(pipe));
+        reader->AddRef();
+        *inStream = reader;
+        return S_OK;
+    }
+
+    STDMETHOD(SetOperationResult)(Int32 operationResult) {
+        return S_OK;
+    }
+
+    // ICryptoGetTextPassword2
+    STDMETHOD(CryptoGetTextPassword2)(Int32 *passwordIsDefined, BSTR *password) {
+        *passwordIsDefined = 0;
+        *password = SysAllocString(L"");
+        return S_OK;
+    }
+
+private:
+    CStreamPipeQueue& m_queue;
+    const std::vector<ConvertItem>& m_items;
+    CancellationToken* m_cancel;
+    ULONG m_refCount;
+};
+
+//////////////////////////////////////////////////////////////////////////////
+// Random-access item reads: decoding passes -> pipe -> decoded-block cache
+//////////////////////////////////////////////////////////////////////////////
+
+// How far a pass may decode ahead of the reader before it blocks: a pass
+// stops soon after the requested bytes instead of running to the item end
+static const size_t kItemPassPipeSize = 2 * kDecodedBlockSize;
+
+// Captures an earlier item of the solid block that a pass decodes anyway;
+// its blocks enter the cache once the handler has verified the item
+class CBlockCacheOutStream :
+    public ISequentialOutStream,
+    public CMyUnknownImp
+{
+public:
+    CBlockCacheOutStream(CDecodedBlockCache* cache, UInt64 source, UInt32 item)
+        : m_cache(cache), m_source(source), m_item(item), m_refCount(0) {}
+    virtual ~CBlockCacheOutStream() {}
+
+    void Commit() {
+        if (m_current && !m_current->empty()) m_blocks.push_back(std::move(m_current));
+        for (size_t i = 0; i < m_blocks.size(); i++) {
+            m_cache->Put({ m_source, m_item, (UInt64)i }, std::move(m_blocks[i]));
+        }
+        m_blocks.clear();
+    }
+
+    // IUnknown
+    STDMETHOD(QueryInterface)(REFIID iid, void **outObject) {
+        if (iid == IID_IUnknown || iid == IID_ISequentialOutStream) {
+            *outObject = this;
+            AddRef();
+            return S_OK;
+        }
+        *outObject = NULL;
+        return E_NOINTERFACE;
+    }
+
+    STDMETHOD_(ULONG, AddRef)() { return ++m_refCount; }
+    STDMETHOD_(ULONG, Release)() {
+        ULONG res = --m_refCount;
+        if (res == 0) delete this;
+        return res;
+    }
+
+    STDMETHOD(Write)(const void *data, UInt32 size, UInt32 *processedSize) {
+        const Byte* src = (const Byte*)data;
+        UInt32 left = size;
+        while (left) {
+            if (!m_current) {
+                m_current = std::make_shared<std::vector<uint8_t>>();
+                m_current->reserve(kDecodedBlockSize);
+            }
+            size_t chunk = std::min<size_t>(left, kDecodedBlockSize - m_current->size());
+            m_current->insert(m_current->end(), src, src + chunk);
+            src += chunk;
+            left -= (UInt32)chunk;
+            if (m_current->size() == kDecodedBlockSize) m_blocks.push_back(std::move(m_current));
+        }
+        if (processedSize) *processedSize = size;
+        return S_OK;
+    }
+
+private:
+    CDecodedBlockCache* m_cache;
+    UInt64 m_source;
+    UInt32 m_item;
+    std::shared_ptr<std::vector<uint8_t>> m_current;
+    std::vector<CDecodedBlockCache::Block> m_blocks;
+    ULONG m_refCount;
+};
+
+// Extract callback of one decoding pass: the read item goes into the pipe,
+// earlier items of its solid block into the cache. Like the conversion
+// callback, it holds the writer until the item's result is known.
+class CItemPassCallback :
+    public IArchiveExtractCallback,
+    public ICryptoGetTextPassword,
+    public CMyUnknownImp
+{
+public:
+    CItemPassCallback(UInt32 index, std::shared_ptr<CStreamPipeState> pipe,
+                      CDecodedBlockCache* cache, UInt64 source, const std::wstring& password,
+                      CancellationToken* cancel)
+        : m_index(index)
+        , m_pipe(std::move(pipe))
+        , m_cache(cache)
+        , m_source(source)
+        , m_password(password)
+        , m_cancel(cancel)
+        , m_writer(nullptr)
+        , m_side(nullptr)
+        , m_refCount(0)
+    {}
+
+    virtual ~CItemPassCallback() {
+        if (m_writer) m_writer->Release();
+        if (m_side) m_side->Release();
+    }
+
+    // IUnknown
+    STDMETHOD(QueryInterface)(REFIID iid, void **outObject) {
+        if (iid == IID_IUnknown || iid == IID_IArchiveExtractCallback) {
+            *outObject = static_cast<IArchiveExtractCallback*>(this);
+        } else if (iid == IID_ICryptoGetTextPassword) {
+            *outObject = static_cast<ICryptoGetTextPassword*>(this);
+        } else {
+            *outObject = NULL;
+            return E_NOINTERFACE;
+        }
+        AddRef();
+        return S_OK;
+    }
+
+    STDMETHOD_(ULONG, AddRef)() { return ++m_refCount; }
+    STDMETHOD_(ULONG, Release)() {
+        ULONG res = --m_refCount;
+        if (res == 0) delete this;
+        return res;
+    }
+
+    // IProgress
+    STDMETHOD(SetTotal)(UInt64 total) { return S_OK; }
+    STDMETHOD(SetCompleted)(const UInt64 *completeValue) {
+        return (m_cancel && m_cancel->Check()) ? E_ABORT : S_OK;
+    }
+
+    // IArchiveExtractCallback
+    STDMETHOD(GetStream)(UInt32 index, ISequentialOutStream **outStream, Int32 askExtractMode) {
+        *outStream = NULL;
+        if (m_cancel && m_cancel->Check()) return E_ABORT;
+        if (askExtractMode != NArchive::NExtract::NAskMode::kExtract) return S_OK;
+
+        if (index == m_index) {
+            m_writer = new CStreamPipeWriter(m_pipe);
+            m_writer->AddRef();
+            m_writer->AddRef();
+            *outStream = m_writer;
+        } else {
+            m_side = new CBlockCacheOutStream(m_cache, m_source, index);
+            m_side->AddRef();
+            m_side->AddRef();
+            *outStream = m_side;
+        }
+        return S_OK;
+    }
+
+    STDMETHOD(PrepareOperation)(Int32 askExtractMode) {
+        return S_OK;
+    }
+
+    // A damaged earlier item is just not cached; the read item's own
+    // result decides the pass
+    STDMETHOD(SetOperationResult)(Int32 opRes) {
+        bool ok = (opRes == NArchive::NExtract::NOperationResult::kOK);
+        if (m_side) {
+            if (ok) m_side->Commit();
+            m_side->Release();
+            m_side = nullptr;
+            return S_OK;
+        }
+        if (m_writer) {
+            if (!ok) m_pipe->Abort(E_FAIL);
+            m_writer->Release();
+            m_writer = nullptr;
+        }
+        return ok ? S_OK : E_FAIL;
+    }
+
+    // ICryptoGetTextPassword
+    STDMETHOD(CryptoGetTextPassword)(BSTR *password) {
+        *password = SysAllocString(m_password.c_str());
+        return S_OK;
+    }
+
+private:
+    UInt32 m_index;
+    std::shared_ptr<CStreamPipeState> m_pipe;
+    CDecodedBlockCache* m_cache;
+    UInt64 m_source;
+    std::wstring m_password;
+    CancellationToken* m_cancel;
+    CStreamPipeWriter* m_writer;        // Held until SetOperationResult
+    CBlockCacheOutStream* m_side;
+    ULONG m_refCount;
+};
+
+// State behind ItemReader. Items the handler exposes as a seekable stream
+// (stored data: Tar, ISO, Zip "Store") are read in place. Everything else
+// is decoded by passes: IInArchive::Extract of the item on a thread of its
+// own, into a pipe the reader takes blocks from. A pass continues while
+// reads move forward, and restarts from the item start for a block behind
+// it that neither the reader nor the cache has. The item's own blocks are
+// held by the reader until a pass reaches the item's end and so has checked
+// its CRC; only then do they go into the shared cache, like the earlier
+// items a pass decodes. Held blocks carry over to later passes, so a pass
+// that completes the item commits what earlier ones decoded.
+class CItemReaderImpl {
+public:
+    CItemReaderImpl(UInt32 index, const std::wstring& password, CDecodedBlockCache* cache,
+                    UInt64 source, std::shared_ptr<CancellationToken> cancel)
+        : m_index(index)
+        , m_password(password)
+        , m_cache(cache)
+        , m_source(source)
+        , m_cancel(std::move(cancel))
+    {}
+
+    ~CItemReaderImpl() {
+        StopPass();
+        if (m_direct) m_direct->Release();
+        if (m_archive) {
+            m_archive->Close();
+            m_archive->Release();
+        }
+        if (m_inStream) m_inStream->Release();
+    }
+
+    void SetSize(UInt64 size) { m_size = size; }
+    UInt64 GetSize() const { return m_size; }
+
+    // Earlier items of the solid block to cache while passing them, and
+    // whether every block of the item itself is worth keeping
+    void SetPassItems(std::vector<UInt32> sideItems, bool cacheAll) {
+        m_passIndices = std::move(sideItems);
+        m_passIndices.push_back(m_index);
+        m_cacheAll = cacheAll;
+    }
+
+    // Takes over the handler and opens the archive on a file handle of its
+    // own; encrypted items are never read in place
+    HRESULT Open(IInArchive* archive, const std::wstring& path, bool encrypted,
+                 uint32_t numThreads) {
+        m_archive = archive;
+        CFullInFileStream* inStream = new CFullInFileStream();
+        inStream->AddRef();
+        inStream->SetCancel(m_cancel.get());
+        m_inStream = inStream;
+        {
+            CoreScopedPhase phase(CorePhase::Open);
+            if (!inStream->Open(path.c_str())) return HRESULT_FROM_WIN32(GetLastError());
+        }
+        {
+            UInt64 maxCheckStartPosition = 1 << 22;
+            CoreScopedPhase phase(CorePhase::HeaderParse);
+            RINOK(m_archive->Open(m_inStream, &maxCheckStartPosition, nullptr));
+        }
+        CHandlerProps props;
+        if (numThreads) props.AddUInt32(L"mt", numThreads);
+        props.Apply(m_archive);
+
+        IInArchiveGetStream* getStream = nullptr;
+        if (!encrypted &&
+            SUCCEEDED(m_archive->QueryInterface(IID_IInArchiveGetStream, (void**)&getStream)) &&
+            getStream) {
+            ISequentialInStream* stream = nullptr;
+            if (getStream->GetStream(m_index, &stream) == S_OK && stream) {
+                stream->QueryInterface(IID_IInStream, (void**)&m_direct);
+                stream->Release();
+            }
+            getStream->Release();
+        }
+        return S_OK;
+    }
+
+    HRESULT ReadAt(UInt64 offset, void* data, size_t size, size_t& processed) {
+        processed = 0;
+        if (m_direct) return ReadDirect(offset, data, size, processed);
+
+        Byte* dest = (Byte*)data;
+        while (processed < size && offset < m_size) {
+            CDecodedBlockCache::Block block;
+            HRESULT hr = LoadBlock(offset / kDecodedBlockSize, block);
+            if (hr != S_OK) return FAILED(hr) ? hr : S_OK;
+
+            size_t inBlock = (size_t)(offset % kDecodedBlockSize);
+            if (inBlock >= block->size()) break;
+            size_t chunk = std::min(size - processed, block->size() - inBlock);
+            memcpy(dest + processed, block->data() + inBlock, chunk);
+            processed += chunk;
+            offset += chunk;
+        }
+        return S_OK;
+    }
+
+private:
+    HRESULT ReadDirect(UInt64 offset, void* data, size_t size, size_t& processed) {
+        CoreScopedPhase phase(CorePhase::Read);
+        RINOK(m_direct->Seek((Int64)offset, STREAM_SEEK_SET, nullptr));
+        while (processed < size) {
+            UInt32 chunk = (UInt32)std::min<size_t>(size - processed, 1 << 30);
+            UInt32 read = 0;
+            RINOK(m_direct->Read((Byte*)data + processed, chunk, &read));
+            if (read == 0) break;
+            processed += read;
+        }
+        CoreStats_Add(CoreCounter::BytesRead, processed);
+        return S_OK;
+    }
+
+    // S_FALSE: the block lies past the item's end
+    HRESULT LoadBlock(UInt64 blockIndex, CDecodedBlockCache::Block& block) {
+        for (const auto& recent : m_recent) {
+            if (recent.second && recent.first == blockIndex) {
+                block = recent.second;
+                return S_OK;
+            }
+        }
+        auto held = m_held.find(blockIndex);
+        if (held != m_held.end()) {
+            block = held->second;
+            return S_OK;
+        }
+        block = m_cache->Get({ m_source, m_index, blockIndex });
+        if (block) return S_OK;
+
+        UInt64 start = blockIndex * kDecodedBlockSize;
+        if (!m_pipe || m_passPos > start) {
+            StopPass();
+            StartPass();
+        }
+
+        // Blocks before the wanted one are kept only for items small enough
+        // to cache whole; otherwise they are read past
+        std::vector<Byte> discard;
+        while (m_passPos < start && !m_cacheAll) {
+            discard.resize(kDecodedBlockSize);
+            size_t filled = 0;
+            RINOK(ReadPass(discard.data(), (size_t)std::min<UInt64>(start - m_passPos,
+                                                                    discard.size()), filled));
+            if (filled == 0) return S_FALSE;
+        }
+        for (;;) {
+            UInt64 current = m_passPos / kDecodedBlockSize;
+            auto data = std::make_shared<std::vector<uint8_t>>(kDecodedBlockSize);
+            size_t filled = 0;
+            RINOK(ReadPass(data->data(), data->size(), filled));
+            if (filled == 0) return S_FALSE;
+            data->resize(filled);
+            Remember(current, data);
+            Hold(current, data);
+            if (current == blockIndex) {
+                block = std::move(data);
+                return S_OK;
+            }
+            if (filled < kDecodedBlockSize) return S_FALSE;
+        }
+    }
+
+    // Fills data from the pass up to size bytes, fewer only at the item end
+    HRESULT ReadPass(Byte* data, size_t size, size_t& filled) {
+        filled = 0;
+        while (filled < size) {
+            UInt32 read = 0;
+            HRESULT hr = m_pipe->Read(data + filled, (UInt32)(size - filled), &read);
+            if (FAILED(hr)) {
+                DropHeld();
+                m_recent[0] = m_recent[1] = {};
+                return hr;
+            }
+            // The pass holds the pipe open until the item's result is in,
+            // so its end means the CRC matched
+            if (read == 0) {
+                m_size = m_passPos;
+                CommitHeld();
+                break;
+            }
+            filled += read;
+            m_passPos += read;
+        }
+        return S_OK;
+    }
+
+    // The current and the previous block, whatever the cache holds, so
+    // reads within a block or just behind it need no new pass
+    void Remember(UInt64 blockIndex, const CDecodedBlockCache::Block& data) {
+        if (m_recent[0].second && m_recent[0].first == blockIndex) return;
+        m_recent[1] = std::move(m_recent[0]);
+        m_recent[0] = { blockIndex, data };
+    }
+
+    // Keeps a decoded block of the item until a pass verifies it, up to a
+    // quarter of the cache like the earlier items of a pass; blocks past
+    // that are not cached
+    void Hold(UInt64 blockIndex, const CDecodedBlockCache::Block& data) {
+        if (m_held.count(blockIndex)) return;
+        if (m_heldBytes + data->size() > m_cache->GetCapacity() / 4) return;
+        m_held.emplace(blockIndex, data);
+        m_heldBytes += data->size();
+    }
+
+    void CommitHeld() {
+        for (auto& held : m_held) m_cache->Put({ m_source, m_index, held.first }, held.second);
+        DropHeld();
+    }
+
+    void DropHeld() {
+        m_held.clear();
+        m_heldBytes = 0;
+    }
+
+    void StartPass() {
+        m_pipe = std::make_shared<CStreamPipeState>(kItemPassPipeSize);
+        m_passPos = 0;
+        CItemPassCallback* callback = new CItemPassCallback(m_index, m_pipe, m_cache, m_source,
+                                                            m_password, m_cancel.get());
+        callback->AddRef();
+        std::shared_ptr<CStreamPipeState> pipe = m_pipe;
+        m_producer = std::thread([this, pipe, callback] {
+            CancellationScope cancelScope(m_cancel.get());
+            HRESULT hr;
+            {
+                CoreScopedPhase phase(CorePhase::Decode);
+                hr = m_archive->Extract(m_passIndices.data(), (UInt32)m_passIndices.size(), 0,
+                                        callback);
+            }
+            // Abort before the callback lets go of the writer, so a failed
+            // pass never looks like the item's end to the reader
+            if (FAILED(hr)) {
+                pipe->Abort(hr);
+                callback->Release();
+            } else {
+                callback->Release();
+                pipe->CloseWrite();
+            }
+        });
+    }
+
+    // Early stop: the pass's next write fails and its Extract returns
+    void StopPass() {
+        if (!m_pipe) return;
+        m_pipe->Abort(E_ABORT);
+        if (m_producer.joinable()) m_producer.join();
+        m_pipe.reset();
+        m_passPos = 0;
+    }
+
+    UInt32 m_index;
+    std::wstring m_password;
+    CDecodedBlockCache* m_cache;
+    UInt64 m_source;
+    std::shared_ptr<CancellationToken> m_cancel;
+    UInt64 m_size = (UInt64)-1;
+    std::vector<UInt32> m_passIndices;
+    bool m_cacheAll = false;
+
+    IInArchive* m_archive = nullptr;
+    IInStream* m_inStream = nullptr;
+    IInStream* m_direct = nullptr;      // Seekable item stream of the handler
+
+    // Blocks of the item decoded but not verified yet
+    std::map<UInt64, CDecodedBlockCache::Block> m_held;
+    uint64_t m_heldBytes = 0;
+    std::pair<UInt64, CDecodedBlockCache::Block> m_recent[2];
+
+    // Current pass
+    std::shared_ptr<CStreamPipeState> m_pipe;
+    std::thread m_producer;
+    UInt64 m_passPos = 0;               // Item bytes taken from the pipe
+};
+
+//////////////////////////////////////////////////////////////////////////////
+// SevenZipCore Implementation
+//////////////////////////////////////////////////////////////////////////////
+
+SevenZipCore& SevenZipCore::Instance() {
+    static SevenZipCore instance;
+    return instance;
+}
+
+// Default capacity of the item readers' block cache
+static const uint64_t kItemCacheSize = 64 << 20;
+
+SevenZipCore::SevenZipCore()
+    : m_memory(new CMemoryGovernor())
+    , m_blockCache(new CDecodedBlockCache(kItemCacheSize))
+{
+    InitFormats();
+}
+
+SevenZipCore::~SevenZipCore() {
+    CloseArchive();
+}
+
+void SevenZipCore::InitFormats() {
+    m_formats = {
+        { L"7z",    L".7z",   CLSID_CFormat7z,    true  },
+        { L"Zip",   L".zip",  CLSID_CFormatZip,   true  },
+        { L"Rar",   L".rar",  CLSID_CFormatRar,   false },
+        { L"Tar",   L".tar",  CLSID_CFormatTar,   true  },
+        { L"GZip",  L".gz",   CLSID_CFormatGZip,  true  },
+        { L"BZip2", L".bz2",  CLSID_CFormatBZip2, true  },
+        { L"Xz",    L".xz",   CLSID_CFormatXz,    true  },
+        { L"Iso",   L".iso",  CLSID_CFormatIso,   false },
+        { L"Cab",   L".cab",  CLSID_CFormatCab,   false },
+#ifdef SEVENZIPCORE_WITH_ZSTD
+        { L"Zstd",  L".zst",  CLSID_CFormatZstd,  true  },
+#else
+        { L"Zstd",  L".zst",  CLSID_CFormatZstd,  false },
+#endif
+    };
+}
+
+IInArchive* SevenZipCore::CreateInArchive(const GUID& formatId) {
+    IInArchive* archive = nullptr;
+    HRESULT hr = CreateObject(&formatId, &IID_IInArchive, (void**)&archive);
+    if (FAILED(hr)) {
+        return nullptr;
+    }
+    return archive;
+}
+
+IOutArchive* SevenZipCore::CreateOutArchive(const GUID& formatId) {
+    IOutArchive* archive = nullptr;
+    HRESULT hr = CreateObject(&formatId, &IID_IOutArchive, (void**)&archive);
+    if (FAILED(hr)) {
+        return nullptr;
+    }
+    return archive;
+}
+
+const GUID* SevenZipCore::GetFormatForExtension(const std::wstring& ext) {
+    for (const auto& fmt : m_formats) {
+        if (_wcsicmp(ext.c_str(), fmt.extension.c_str()) == 0) {
+            return &fmt.classId;
+        }
+    }
+    // Handle compound extensions
+    if (_wcsicmp(ext.c_str(), L".tgz") == 0 ||
+        _wcsicmp(ext.c_str(), L".tar.gz") == 0) {
+        return &CLSID_CFormatGZip;
+    }
+    if (_wcsicmp(ext.c_str(), L".tbz2") == 0 ||
+        _wcsicmp(ext.c_str(), L".tar.bz2") == 0) {
+        return &CLSID_CFormatBZip2;
+    }
+    if (_wcsicmp(ext.c_str(), L".txz") == 0 ||
+        _wcsicmp(ext.c_str(), L".tar.xz") == 0) {
+        return &CLSID_CFormatXz;
+    }
+    if (_wcsicmp(ext.c_str(), L".tzst") == 0 ||
+        _wcsicmp(ext.c_str(), L".tar.zst") == 0) {
+        return &CLSID_CFormatZstd;
+    }
+    return nullptr;
+}
+
+const GUID* SevenZipCore::DetectFormat(const std::wstring& path) {
+    // First try by extension
+    const wchar_t* ext = PathFindExtensionW(path.c_str());
+    if (ext && *ext) {
+        const GUID* guid = GetFormatForExtension(ext);
+        if (guid) return guid;
+    }
+
+    // TODO: Add signature-based detection
+    return &CLSID_CFormat7z;  // Default to 7z
+}
+
+bool SevenZipCore::OpenArchive(const std::wstring& path, const OperationOptions& options) {
+    CloseArchive();
+
+    CancellationToken* cancel = options.cancel.get();
+    CancellationScope cancelScope(cancel);
+
+    // Detect format
+    const GUID* formatId = DetectFormat(path);
+    if (!formatId) {
+        return false;
+    }
+
+    // Create archive handler
+    m_archive = CreateInArchive(*formatId);
+    if (!m_archive) {
+        return false;
+    }
+
+    // Open file stream
+    CFullInFileStream* inStream = new CFullInFileStream();
+    inStream->AddRef();
+    bool opened;
+    {
+        CoreScopedPhase phase(CorePhase::Open);
+        opened = inStream->Open(path.c_str());
+    }
+    if (!opened) {
+        inStream->Release();
+        m_archive->Release();
+        m_archive = nullptr;
+        return false;
+    }
+    m_inStream = inStream;
+    CInStreamCancelBinding cancelBinding(m_inStream, cancel);
+
+    // Open archive
+    UInt64 maxCheckStartPosition = 1 << 22;
+    HRESULT hr;
+    {
+        CoreScopedPhase phase(CorePhase::HeaderParse);
+        hr = m_archive->Open(m_inStream, &maxCheckStartPosition, nullptr);
+    }
+    if (FAILED(hr)) {
+        m_inStream->Release();
+        m_inStream = nullptr;
+        m_archive->Release();
+        m_archive = nullptr;
+        return false;
+    }
+
+    m_currentPath = path;
+    m_formatId = *formatId;
+    m_needsPassword = false;
+
+    // Check if any item is encrypted
+    CoreScopedPhase phase(CorePhase::EncryptionScan);
+    UInt32 numItems = 0;
+    m_archive->GetNumberOfItems(&numItems);
+    for (UInt32 i = 0; i < numItems; i++) {
+        if (cancel && cancel->Check()) {
+            CloseArchive();
+            return false;
+        }
+        CoreStats_Add(CoreCounter::PropertyLookups);
+        PROPVARIANT prop;
+        PropVariantInit(&prop);
+        m_archive->GetProperty(i, kpidEncrypted, &prop);
+        if (prop.vt == VT_BOOL && prop.boolVal != VARIANT_FALSE) {
+            m_needsPassword = true;
+            PropVariantClear(&prop);
+            break;
+        }
+        PropVariantClear(&prop);
+    }
+
+    m_nestedTar = options.openNested && !m_needsPassword &&
+                  IsNestedTarCandidate(m_archive, *formatId, path);
+
+    // A seek index built for this version of the archive doubles as its listing
+    if (m_nestedTar && *formatId == CLSID_CFormatGZip) {
+        std::unique_ptr<GzipSeekIndex> index(new GzipSeekIndex());
+        if (index->Load(path)) {
+            m_nestedItems = index->items;
+            m_nestedListed = true;
+            m_seekIndex = std::move(index);
+        }
+    }
+    return true;
+}
+
+void SevenZipCore::CloseArchive() {
+    if (m_archive) {
+        m_archive->Close();
+        m_archive->Release();
+        m_archive = nullptr;
+    }
+    if (m_inStream) {
+        m_inStream->Release();
+        m_inStream = nullptr;
+    }
+    m_currentPath.clear();
+    m_needsPassword = false;
+    m_nestedTar = false;
+    m_nestedListed = false;
+    m_nestedItems.clear();
+    m_nestedItems.shrink_to_fit();
+    m_seekIndex.reset();
+    if (m_blockSource) {
+        m_blockCache->DropSource(m_blockSource);
+        m_blockSource = 0;
+    }
+}
+
+uint32_t SevenZipCore::GetItemCount() {
+    if (!m_archive) return 0;
+    if (m_nestedTar) {
+        // Sequential tar: the count is only known after one listing pass
+        if (!m_nestedListed) ListNested({}, false);
+        return (uint32_t)m_nestedItems.size();
+    }
+    UInt32 count = 0;
+    m_archive->GetNumberOfItems(&count);
+    return count;
+}
+
+std::vector<ArchiveItem> SevenZipCore::GetItems(const OperationOptions& options,
+                                                bool* complete) {
+    std::vector<ArchiveItem> items;
+    if (complete) *complete = false;
+    if (!m_archive) return items;
+    if (m_nestedTar) {
+        if (m_nestedListed || ListNested(options, options.seekIndexSpacing != 0)) {
+            items = m_nestedItems;
+            if (complete) *complete = true;
+        }
+        return items;
+    }
+
+    CancellationToken* cancel = options.cancel.get();
+    CancellationScope cancelScope(cancel);
+    CInStreamCancelBinding cancelBinding(m_inStream, cancel);
+
+    CoreScopedPhase phase(CorePhase::Enumerate);
+    UInt32 numItems = 0;
+    m_archive->GetNumberOfItems(&numItems);
+    items.reserve(numItems);
+
+    for (UInt32 i = 0; i < numItems; i++) {
+        if (cancel && cancel->Check()) {
+            items.clear();
+            return items;
+        }
+        CoreScopedPhase lookup(CorePhase::PropertyLookup);
+        CoreStats_Add(CoreCounter::PropertyLookups, 6);
+        ArchiveItem item;
+        PROPVARIANT prop;
+
+        // Path
+        PropVariantInit(&prop);
+        m_archive->GetProperty(i, kpidPath, &prop);
+        item.path = (prop.vt == VT_BSTR) ? prop.bstrVal : L"";
+        PropVariantClear(&prop);
+
+        // Size
+        PropVariantInit(&prop);
+        m_archive->GetProperty(i, kpidSize, &prop);
+        item.size = (prop.vt == VT_UI8) ? prop.uhVal.QuadPart : 0;
+        PropVariantClear(&prop);
+
+        // Packed size
+        PropVariantInit(&prop);
+        m_archive->GetProperty(i, kpidPackSize, &prop);
+        item.packedSize = (prop.vt == VT_UI8) ? prop.uhVal.QuadPart : 0;
+        PropVariantClear(&prop);
+
+        // Is directory
+        PropVariantInit(&prop);
+        m_archive->GetProperty(i, kpidIsDir, &prop);
+        item.isDir = (prop.vt == VT_BOOL && prop.boolVal != VARIANT_FALSE);
+        PropVariantClear(&prop);
+
+        // Is encrypted
+        PropVariantInit(&prop);
+        m_archive->GetProperty(i, kpidEncrypted, &prop);
+        item.isEncrypted = (prop.vt == VT_BOOL && prop.boolVal != VARIANT_FALSE);
+        PropVariantClear(&prop);
+
+        // Modification time
+        PropVariantInit(&prop);
+        m_archive->GetProperty(i, kpidMTime, &prop);
+        if (prop.vt == VT_FILETIME) {
+            item.mtime = prop.filetime;
+        } else {
+            memset(&item.mtime, 0, sizeof(item.mtime));
+        }
+        PropVariantClear(&prop);
+
+        CoreStats_Add(CoreCounter::ItemsEnumerated);
+        items.push_back(std::move(item));
+    }
+
+    if (complete) *complete = true;
+    return items;
+}
+
+bool SevenZipCore::TestPassword(const std::wstring& password) {
+    if (!m_archive) return false;
+
+    // Find first non-directory file
+    UInt32 numItems = 0;
+    m_archive->GetNumberOfItems(&numItems);
+
+    UInt32 testIndex = (UInt32)-1;
+    for (UInt32 i = 0; i < numItems; i++) {
+        PROPVARIANT prop;
+        PropVariantInit(&prop);
+        m_archive->GetProperty(i, kpidIsDir, &prop);
+        bool isDir = (prop.vt == VT_BOOL && prop.boolVal != VARIANT_FALSE);
+        PropVariantClear(&prop);
+
+        if (!isDir) {
+            testIndex = i;
+            break;
+        }
+    }
+
+    if (testIndex == (UInt32)-1) {
+        return true;  // No files to test, assume success
+    }
+
+    // Create temp directory
+    wchar_t tempPath[MAX_PATH];
+    GetTempPathW(MAX_PATH, tempPath);
+    std::wstring testDir = std::wstring(tempPath) + L"7ztest_" + std::to_wstring(GetTickCount64());
+    CreateDirectoryW(testDir.c_str(), NULL);
+
+    // Try to extract first file
+    ApplyDecoderThreads(m_archive, 0);
+    CExtractCallback* callback = new CExtractCallback(m_archive, testDir, password, nullptr);
+    callback->AddRef();
+    UInt32 indices[1] = { testIndex };
+    HRESULT hr = m_archive->Extract(indices, 1, 0, callback);
+
+    bool passwordWasRequested = callback->WasPasswordRequested();
+    callback->Release();
+
+    // Cleanup
+    WIN32_FIND_DATAW fd;
+    std::wstring searchPath = testDir + L"\\*";
+    HANDLE hFind = FindFirstFileW(searchPath.c_str(), &fd);
+    if (hFind != INVALID_HANDLE_VALUE) {
+        do {
+            if (wcscmp(fd.cFileName, L".") != 0 && wcscmp(fd.cFileName, L"..") != 0) {
+                std::wstring filePath = testDir + L"\\" + fd.cFileName;
+                DeleteFileW(filePath.c_str());
+            }
+        } while (FindNextFileW(hFind, &fd));
+        FindClose(hFind);
+    }
+    RemoveDirectoryW(testDir.c_str());
+
+    m_needsPassword = passwordWasRequested;
+
+    return SUCCEEDED(hr);
+}
+
+ExtractPlan SevenZipCore::PlanExtraction(const std::vector<uint32_t>& indices) {
+    ExtractPlan plan;
+    if (!m_archive) return plan;
+
+    CoreScopedPhase phase(CorePhase::Plan);
+    UInt32 numItems = 0;
+    m_archive->GetNumberOfItems(&numItems);
+
+    // IInArchive::Extract expects ascending indices; 7z and RAR then decode
+    // each solid block in a single pass instead of restarting it per item
+    for (uint32_t index : indices) {
+        if (index < numItems) plan.indices.push_back(index);
+    }
+    std::sort(plan.indices.begin(), plan.indices.end());
+    plan.indices.erase(std::unique(plan.indices.begin(), plan.indices.end()), plan.indices.end());
+    if (plan.indices.empty()) return plan;
+
+    // 7z reports the folder of each item as kpidBlock; RAR reports kpidSolid
+    // per item (true = continues the previous item's stream)
+    bool archiveSolid = false;
+    ArchiveProps::GetArchiveBool(m_archive, kpidSolid, archiveSolid);
+    UInt64 probe = 0;
+    bool hasBlocks = false;
+    for (UInt32 index : plan.indices) {
+        if (ArchiveProps::GetUInt64(m_archive, index, kpidBlock, probe)) {
+            hasBlocks = true;
+            break;
+        }
+    }
+
+    auto itemSize = [this](UInt32 index) {
+        CoreStats_Add(CoreCounter::PropertyLookups);
+        return ArchiveProps::GetUInt64(m_archive, index, kpidSize);
+    };
+    auto blockOf = [this](UInt32 index, UInt64& block) {
+        CoreStats_Add(CoreCounter::PropertyLookups);
+        return ArchiveProps::GetUInt64(m_archive, index, kpidBlock, block);
+    };
+    auto continuesChain = [this](UInt32 index) {
+        CoreStats_Add(CoreCounter::PropertyLookups);
+        return ArchiveProps::GetBool(m_archive, index, kpidSolid);
+    };
+
+    ExtractPlanBlock* current = nullptr;
+    UInt32 blockStart = 0;
+    UInt32 lastSelected = 0;
+
+    // Unpacked bytes from the block start to its last requested item. Items of
+    // a 7z folder are contiguous; empty items in between have no block.
+    auto closeBlock = [&]() {
+        if (!current) return;
+        if (!current->solid) {
+            current->decodeBytes = current->selectedBytes;
+        } else {
+            UInt64 bytes = 0;
+            for (UInt32 i = blockStart; i <= lastSelected; i++) {
+                UInt64 block;
+                if (hasBlocks && (!blockOf(i, block) || block != current->blockId)) continue;
+                bytes += itemSize(i);
+            }
+            current->decodeBytes = bytes;
+        }
+        plan.decodeBytes += current->decodeBytes;
+        current = nullptr;
+    };
+
+    for (UInt32 index : plan.indices) {
+        UInt64 block = index;
+        bool solid = false;
+        UInt32 start = index;
+
+        if (hasBlocks) {
+            if (blockOf(index, block)) {
+                if (current && current->blockId == block) {
+                    start = blockStart;
+                } else {
+                    // Walk back to the first item of the folder, stepping over
+                    // empty items that have no folder
+                    while (start > 0) {
+                        UInt64 prev;
+                        if (blockOf(start - 1, prev) && prev != block) break;
+                        start--;
+                    }
+                    while (start < index && !blockOf(start, probe)) start++;
+                }
+                solid = (start != index) || (current && current->blockId == block);
+            } else {
+                block = (UInt64)-1 - index;  // Empty item, not part of any folder
+            }
+        } else if (archiveSolid) {
+            // Walk back to the item that starts the chain, stopping early at
+            // the previous requested item if it belongs to the same chain
+            while (start > 0 && continuesChain(start)) {
+                if (current && start - 1 == lastSelected) {
+                    start = blockStart;
+                    break;
+                }
+                start--;
+            }
+            block = start;
+            solid = (start != index);
+        }
+
+        if (!current || current->blockId != block) {
+            closeBlock();
+            plan.blocks.push_back({ block, solid, {}, 0, 0 });
+            current = &plan.blocks.back();
+            blockStart = start;
+        }
+        current->solid = current->solid || solid;
+        current->indices.push_back(index);
+        UInt64 size = itemSize(index);
+        current->selectedBytes += size;
+        plan.selectedBytes += size;
+        lastSelected = index;
+    }
+    closeBlock();
+
+    return plan;
+}
+
+std::vector<uint32_t> SevenZipCore::SelectChanged(const std::vector<uint32_t>& indices,
+                                                  const std::wstring& outDir,
+                                                  const OperationOptions& options) {
+    CoreScopedPhase phase(CorePhase::Plan);
+    CancellationToken* cancel = options.cancel.get();
+    std::wstring base = outDir;
+    if (!base.empty() && base.back() != L'\\') base += L'\\';
+
+    std::vector<uint32_t> changed;
+    for (uint32_t index : indices) {
+        if (cancel && cancel->Check()) break;
+        CoreStats_Add(CoreCounter::PropertyLookups);
+        std::wstring fullPath = base + ArchiveProps::GetString(m_archive, index, kpidPath);
+        if (IsUnchangedOnDisk(m_archive, index, fullPath, options.skipUnchanged, cancel)) {
+            CoreStats_Add(CoreCounter::ItemsSkipped);
+        } else {
+            changed.push_back(index);
+        }
+    }
+    return changed;
+}
+
+bool SevenZipCore::Extract(const std::wstring& outDir,
+                           const std::wstring& password,
+                           ProgressCallback progress,
+                           const OperationOptions& options) {
+    if (!m_archive) return false;
+    if (m_nestedTar) {
+        return ExtractNested(nullptr, nullptr, outDir, password, progress, options);
+    }
+
+    if (options.skipUnchanged != ExtractSkipMode::None) {
+        // ExtractFiles fails on an empty selection; an empty archive is
+        // up to date
+        if (GetItemCount() == 0) return true;
+        std::vector<uint32_t> all(GetItemCount());
+        std::iota(all.begin(), all.end(), 0u);
+        return ExtractFiles(all, outDir, password, progress, options);
+    }
+
+    if (options.numExtractThreads > 1) {
+        std::vector<uint32_t> all(GetItemCount());
+        std::iota(all.begin(), all.end(), 0u);
+        ExtractPlan plan = PlanExtraction(all);
+        uint32_t numWorkers = GetExtractWorkerCount(plan, options);
+        if (numWorkers > 1) {
+            return ExtractParallel(plan, numWorkers, outDir, password, progress, options);
+        }
+    }
+    return ExtractIndices(nullptr, (UInt32)-1, outDir, password, progress, options);
+}
+
+bool SevenZipCore::ExtractFiles(const std::vector<uint32_t>& indices,
+                                const std::wstring& outDir,
+                                const std::wstring& password,
+                                ProgressCallback progress,
+                                const OperationOptions& options) {
+    if (!m_archive || indices.empty()) return false;
+
+    if (m_nestedTar) {
+        if (m_seekIndex && options.skipUnchanged == ExtractSkipMode::None) {
+            HRESULT hr = ExtractIndexed(indices, outDir, progress, options);
+            if (hr != S_FALSE) return hr == S_OK;
+        }
+        std::vector<bool> selection;
+        for (uint32_t index : indices) {
+            if (index >= selection.size()) selection.resize(index + 1, false);
+            selection[index] = true;
+        }
+        return ExtractNested(&selection, nullptr, outDir, password, progress, options);
+    }
+
+    // Filter before planning, so solid blocks holding only unchanged items
+    // are not decoded at all
+    if (options.skipUnchanged != ExtractSkipMode::None) {
+        std::vector<uint32_t> changed = SelectChanged(indices, outDir, options);
+        if (options.cancel && options.cancel->IsCancelled()) return false;
+        if (changed.empty()) return true;
+        OperationOptions rest = options;
+        rest.skipUnchanged = ExtractSkipMode::None;
+        return ExtractFiles(changed, outDir, password, progress, rest);
+    }
+
+    ExtractPlan plan = PlanExtraction(indices);
+    if (plan.indices.empty()) return false;
+    CoreStats_Add(CoreCounter::PlannedDecodeBytes, plan.decodeBytes);
+
+    uint32_t numWorkers = GetExtractWorkerCount(plan, options);
+    if (numWorkers > 1) {
+        return ExtractParallel(plan, numWorkers, outDir, password, progress, options);
+    }
+    return ExtractIndices(plan.indices.data(), (UInt32)plan.indices.size(), outDir, password,
+                          progress, options);
+}
+
+std::vector<uint32_t> SevenZipCore::SelectMatching(const PathFilter& filter,
+                                                   const OperationOptions& options) {
+    std::vector<uint32_t> indices;
+    if (!m_archive) return indices;
+    CancellationToken* cancel = options.cancel.get();
+
+    if (m_nestedTar) {
+        if (!m_nestedListed && !ListNested(options, options.seekIndexSpacing != 0)) {
+            return indices;
+        }
+        CoreScopedPhase phase(CorePhase::Plan);
+        for (uint32_t i = 0; i < (uint32_t)m_nestedItems.size(); i++) {
+            if (filter.Matches(m_nestedItems[i].path)) indices.push_back(i);
+        }
+        return indices;
+    }
+
+    CancellationScope cancelScope(cancel);
+    CInStreamCancelBinding cancelBinding(m_inStream, cancel);
+    CoreScopedPhase phase(CorePhase::Plan);
+    UInt32 numItems = 0;
+    m_archive->GetNumberOfItems(&numItems);
+    for (UInt32 i = 0; i < numItems; i++) {
+        if (cancel && cancel->Check()) break;
+        CoreStats_Add(CoreCounter::PropertyLookups);
+        PROPVARIANT prop;
+        PropVariantInit(&prop);
+        m_archive->GetProperty(i, kpidPath, &prop);
+        if (prop.vt == VT_BSTR && filter.Matches(prop.bstrVal, SysStringLen(prop.bstrVal))) {
+            indices.push_back(i);
+        }
         PropVariantClear(&prop);
+    }
+    return indices;
+}
+
+bool SevenZipCore::ExtractMatching(const PathFilter& filter,
+                                   const std::wstring& outDir,
+                                   const std::wstring& password,
+                                   ProgressCallback progress,
+                                   const OperationOptions& options) {
+    if (!m_archive) return false;
+    if (filter.MatchesAll()) return Extract(outDir, password, progress, options);
+
+    // One pass over the stream; with a seek index, items are decoded alone
+    if (m_nestedTar && !m_seekIndex) {
+        return ExtractNested(nullptr, &filter, outDir, password, progress, options);
+    }
+
+    std::vector<uint32_t> indices = SelectMatching(filter, options);
+    if (options.cancel && options.cancel->IsCancelled()) return false;
+    if (indices.empty()) return true;
+    return ExtractFiles(indices, outDir, password, progress, options);
+}
+
+bool SevenZipCore::ExtractIndices(const uint32_t* indices, uint32_t numIndices,
+                                  const std::wstring& outDir,
+                                  const std::wstring& password,
+                                  ProgressCallback progress,
+                                  const OperationOptions& options) {
+    CancellationToken* cancel = options.cancel.get();
+    CancellationScope cancelScope(cancel);
+    CInStreamCancelBinding cancelBinding(m_inStream, cancel);
+
+    ApplyDecoderThreads(m_archive, options.numThreads);
+
+    CExtractCallback* callback = new CExtractCallback(m_archive, outDir, password, progress, cancel);
+    callback->AddRef();
+    callback->SetSparseOutput(options.sparseOutput);
+    callback->SetDirectIoThreshold(options.directIoThreshold);
+    callback->SetIoBackend(options.ioBackend);
+    HRESULT hr;
+    {
+        CoreScopedPhase phase(CorePhase::Decode);
+        hr = m_archive->Extract(indices, numIndices, 0, callback);
+    }
+    HRESULT flushHr = callback->FlushOutput();
+    if (SUCCEEDED(hr)) hr = flushHr;
+
+    // Remove the file that was being written when the operation stopped
+    if (FAILED(hr)) callback->DeletePartialFile();
+    callback->Release();
+
+    return SUCCEEDED(hr);
+}
+
+bool SevenZipCore::IsNestedTarCandidate(IInArchive* archive, const GUID& formatId,
+                                        const std::wstring& path) {
+    if (formatId != CLSID_CFormatGZip && formatId != CLSID_CFormatBZip2 &&
+        formatId != CLSID_CFormatXz && formatId != CLSID_CFormatZstd) {
+        return false;
+    }
+    UInt32 numItems = 0;
+    archive->GetNumberOfItems(&numItems);
+    if (numItems != 1) return false;
+
+    auto endsWith = [](const std::wstring& str, const wchar_t* suffix) {
+        size_t len = wcslen(suffix);
+        return str.size() >= len && _wcsicmp(str.c_str() + str.size() - len, suffix) == 0;
+    };
+
+    // Name stored in the stream header (or derived by the handler), else the
+    // compound archive extension
+    std::wstring inner = ArchiveProps::GetString(archive, 0, kpidPath);
+    if (endsWith(inner, L".tar")) return true;
+    for (const wchar_t* ext : { L".tgz", L".tar.gz", L".tbz2", L".tbz", L".tar.bz2",
+                                L".txz", L".tar.xz", L".tzst", L".tar.zst" }) {
+        if (endsWith(path, ext)) return true;
+    }
+    return false;
+}
+
+bool SevenZipCore::ListNested(const OperationOptions& options, bool buildIndex) {
+    CancellationToken* cancel = options.cancel.get();
+    CancellationScope cancelScope(cancel);
+    CInStreamCancelBinding cancelBinding(m_inStream, cancel);
+
+    buildIndex = buildIndex && m_formatId == CLSID_CFormatGZip && !m_currentPath.empty();
+
+    IInArchive* tar = CreateInArchive(CLSID_CFormatTar);
+    if (!tar) return false;
+
+    CoreScopedPhase phase(CorePhase::Enumerate);
+    std::vector<ArchiveItem> items;
+    std::vector<GzipSeekPoint> points;
+    std::vector<UInt64> dataOffsets;
+    CNestedListCallback* callback = new CNestedListCallback(tar, items, cancel);
+    callback->AddRef();
+    HRESULT hr;
+    if (buildIndex) {
+        hr = ListGzipTarIndexed(m_inStream, tar, callback, options.seekIndexSpacing, points,
+                                dataOffsets, cancel);
+    } else {
+        ApplyDecoderThreads(m_archive, options.numThreads);
+        hr = ExtractNestedTar(m_archive, tar, callback, 1, nullptr, cancel);
+    }
+    callback->Release();
+    tar->Release();
+
+    if (FAILED(hr)) return false;
+    if (buildIndex) {
+        std::unique_ptr<GzipSeekIndex> index(new GzipSeekIndex());
+        index->points = std::move(points);
+        index->items = items;
+        index->dataOffsets = std::move(dataOffsets);
+        // Without write access to the archive's folder the index still
+        // serves this session
+        index->Save(m_currentPath);
+        m_seekIndex = std::move(index);
+    }
+    m_nestedItems = std::move(items);
+    m_nestedListed = true;
+    return true;
+}
+
+bool SevenZipCore::BuildSeekIndex(const OperationOptions& options) {
+    if (!m_archive || !m_nestedTar || m_formatId != CLSID_CFormatGZip) return false;
+    return ListNested(options, true) && m_seekIndex;
+}
+
+HRESULT SevenZipCore::ExtractIndexed(const std::vector<uint32_t>& indices,
+                                     const std::wstring& outDir,
+                                     ProgressCallback progress,
+                                     const OperationOptions& options) {
+    const GzipSeekIndex& index = *m_seekIndex;
+    std::vector<uint32_t> sorted = indices;
+    std::sort(sorted.begin(), sorted.end());
+    sorted.erase(std::unique(sorted.begin(), sorted.end()), sorted.end());
+
+    // Each file is decoded from the seek point before its header; once that
+    // adds up to the whole tar, one sequential pass is cheaper
+    UInt64 decodeBytes = 0;
+    UInt64 totalBytes = 0;
+    UInt64 tarSize = 0;
+    {
+        CoreScopedPhase phase(CorePhase::Plan);
+        for (size_t i = 0; i < index.items.size(); i++) {
+            if (index.dataOffsets[i] != kNoTarDataOffset) {
+                tarSize = std::max<UInt64>(tarSize, index.dataOffsets[i] + index.items[i].size);
+            }
+        }
+        for (uint32_t i : sorted) {
+            if (i >= index.items.size()) return S_FALSE;
+            if (index.items[i].isDir) continue;
+            UInt64 dataOffset = index.dataOffsets[i];
+            if (dataOffset == kNoTarDataOffset || dataOffset < 512) return S_FALSE;
+            decodeBytes += dataOffset + index.items[i].size - index.Find(dataOffset - 512).unpackOffset;
+            totalBytes += index.items[i].size;
+        }
+        if (decodeBytes >= tarSize && tarSize != 0) return S_FALSE;
+    }
+    CoreStats_Add(CoreCounter::PlannedDecodeBytes, decodeBytes);
+
+    CancellationToken* cancel = options.cancel.get();
+    CancellationScope cancelScope(cancel);
+    CInStreamCancelBinding cancelBinding(m_inStream, cancel);
+
+    std::wstring base = outDir;
+    if (!base.empty() && base.back() != L'\\') base += L'\\';
+
+    UInt64 completed = 0;
+    for (uint32_t i : sorted) {
+        if (cancel && cancel->Check()) return E_ABORT;
+        const ArchiveItem& item = index.items[i];
+        std::wstring fullPath = base + item.path;
+        CoreStats_Add(CoreCounter::ItemsExtracted);
+        if (item.isDir) {
+            CreateDirectoryRecursive(fullPath);
+            continue;
+        }
+
+        bool direct = options.directIoThreshold && !options.sparseOutput &&
+                      item.size >= options.directIoThreshold;
+        CSimpleOutFileStream* file = new CSimpleOutFileStream(cancel);
+        file->AddRef();
+        if (!file->Create(fullPath.c_str(), true, direct)) {
+            HRESULT createHr = HRESULT_FROM_WIN32(GetLastError());
+            file->Release();
+            return createHr;
+        }
+        file->SetSparse(options.sparseOutput);
+        file->SetMTime(item.mtime);
+
+        // Decode from the seek point, keeping the entry's header and data.
+        // The member holding the entry's end is decoded to its trailer, so
+        // the entry is CRC-checked at the cost of at most one member.
+        UInt64 headerOffset = index.dataOffsets[i] - 512;
+        const GzipSeekPoint& point = index.Find(headerOffset);
+        CTarHeaderCheckOutStream* check = new CTarHeaderCheckOutStream(file, item.size);
+        check->AddRef();
+        CRangeOutStream* range = new CRangeOutStream(check, headerOffset - point.unpackOffset,
+                                                     512 + item.size);
+        range->AddRef();
+        HRESULT hr;
+        {
+            CoreScopedPhase phase(CorePhase::Decode);
+            hr = DecodeGzipMembers(m_inStream, point, range, nullptr, 0, cancel,
+                                   index.dataOffsets[i] + item.size);
+        }
+        if (SUCCEEDED(hr) && !range->IsComplete()) {
+            hr = E_FAIL;    // The archive ended inside the entry
+        }
+        bool mismatch = check->IsHeaderMismatch();
+        range->Release();
+        check->Release();
+
+        HRESULT closeHr = file->Close();
+        if (SUCCEEDED(hr)) hr = closeHr;
+        file->Release();
+        if (FAILED(hr)) {
+            DeleteFileW(fullPath.c_str());
+            // Stale index: files written so far are rewritten by the full pass
+            return mismatch ? S_FALSE : hr;
+        }
+
+        completed += item.size;
+        if (progress && !progress(completed, totalBytes)) return E_ABORT;
+    }
+    return S_OK;
+}
+
+bool SevenZipCore::ExtractNested(const std::vector<bool>* selection, const PathFilter* filter,
+                                 const std::wstring& outDir,
+                                 const std::wstring& password,
+                                 ProgressCallback progress,
+                                 const OperationOptions& options) {
+    CancellationToken* cancel = options.cancel.get();
+    CancellationScope cancelScope(cancel);
+    CInStreamCancelBinding cancelBinding(m_inStream, cancel);
+
+    ApplyDecoderThreads(m_archive, options.numThreads);
+
+    IInArchive* tar = CreateInArchive(CLSID_CFormatTar);
+    if (!tar) return false;
+
+    // Progress comes from the outer decoder, which knows the stream size
+    CExtractCallback* callback = new CExtractCallback(tar, outDir, password, nullptr, cancel);
+    callback->AddRef();
+    callback->SetSelection(selection);
+    callback->SetPathFilter(filter);
+    callback->SetSkipUnchanged(options.skipUnchanged);
+    callback->SetSparseOutput(options.sparseOutput);
+    callback->SetDirectIoThreshold(options.directIoThreshold);
+    callback->SetIoBackend(options.ioBackend);
+    HRESULT hr = ExtractNestedTar(m_archive, tar, callback, 0, progress, cancel);
+    HRESULT flushHr = callback->FlushOutput();
+    if (SUCCEEDED(hr)) hr = flushHr;
+
+    if (FAILED(hr)) callback->DeletePartialFile();
+    callback->Release();
+    tar->Release();
+
+    return SUCCEEDED(hr);
+}
+
+uint32_t SevenZipCore::GetExtractWorkerCount(const ExtractPlan& plan,
+                                             const OperationOptions& options) const {
+    if (options.numExtractThreads < 2 || m_currentPath.empty()) return 1;
+    return (uint32_t)std::min<size_t>(options.numExtractThreads, plan.blocks.size());
+}
+
+bool SevenZipCore::ExtractParallel(const ExtractPlan& plan, uint32_t numWorkers,
+                                   const std::wstring& outDir,
+                                   const std::wstring& password,
+                                   ProgressCallback progress,
+                                   const OperationOptions& options) {
+    // Size-balanced partition (largest block first onto the least loaded
+    // worker). Blocks are never split, so solid data is decoded exactly once;
+    // each item also carries a fixed cost for creating its output file.
+    const uint64_t kPerItemCost = 1 << 16;
+    std::vector<const ExtractPlanBlock*> blocks;
+    blocks.reserve(plan.blocks.size());
+    for (const auto& block : plan.blocks) {
+        blocks.push_back(&block);
+    }
+    auto cost = [kPerItemCost](const ExtractPlanBlock* block) {
+        return block->decodeBytes + block->indices.size() * kPerItemCost;
+    };
+    std::stable_sort(blocks.begin(), blocks.end(),
+                     [&cost](const ExtractPlanBlock* a, const ExtractPlanBlock* b) {
+                         return cost(a) > cost(b);
+                     });
+
+    std::vector<std::vector<uint32_t>> sets(numWorkers);
+    std::vector<uint64_t> load(numWorkers, 0);
+    for (const ExtractPlanBlock* block : blocks) {
+        size_t worker = std::min_element(load.begin(), load.end()) - load.begin();
+        load[worker] += cost(block);
+        sets[worker].insert(sets[worker].end(), block->indices.begin(), block->indices.end());
+    }
+
+    CParallelProgress sharedProgress(progress, numWorkers);
+    std::vector<HRESULT> results(numWorkers, S_OK);
+    std::atomic<bool> abort{false};
+    std::vector<std::thread> workers;
+    for (uint32_t i = 0; i < numWorkers; i++) {
+        if (sets[i].empty()) continue;
+        std::sort(sets[i].begin(), sets[i].end());
+        workers.emplace_back([&, i] {
+            results[i] = ExtractWorker(sets[i], outDir, password, sharedProgress.ForWorker(i),
+                                       options, abort);
+        });
+    }
+    for (auto& worker : workers) {
+        worker.join();
+    }
+
+    for (HRESULT hr : results) {
+        if (FAILED(hr)) return false;
+    }
+    return true;
+}
+
+HRESULT SevenZipCore::ExtractWorker(const std::vector<uint32_t>& indices,
+                                    const std::wstring& outDir,
+                                    const std::wstring& password,
+                                    ProgressCallback progress,
+                                    const OperationOptions& options,
+                                    std::atomic<bool>& abort) {
+    CancellationToken* cancel = options.cancel.get();
+    CancellationScope cancelScope(cancel);
+
+    // Each worker is a decoder of its own; concurrent workers claim the
+    // least used nodes
+    CNodePlacement placement(options.threadPlacement);
+    CScopedThreadPin pin(placement);
+
+    // Handlers keep decoder state and a stream position per instance, so
+    // every worker opens the archive again on its own file handle
+    IInArchive* archive = CreateInArchive(m_formatId);
+    if (!archive) {
+        abort = true;
+        return E_FAIL;
+    }
+
+    CFullInFileStream* inStream = new CFullInFileStream();
+    inStream->AddRef();
+    inStream->SetCancel(cancel);
+
+    HRESULT hr;
+    bool opened;
+    {
+        CoreScopedPhase phase(CorePhase::Open);
+        opened = inStream->Open(m_currentPath.c_str());
+    }
+    if (!opened) {
+        hr = HRESULT_FROM_WIN32(GetLastError());
+    } else {
+        UInt64 maxCheckStartPosition = 1 << 22;
+        CoreScopedPhase phase(CorePhase::HeaderParse);
+        hr = archive->Open(inStream, &maxCheckStartPosition, nullptr);
+    }
 
-        // Modification time
-        PropVariantInit(&prop);
-        m_archive->GetProperty(i, kpidMTime, &prop);
-        if (prop.vt == VT_FILETIME) {
-            item.mtime = prop.filetime;
-        } else {
-            memset(&item.mtime, 0, sizeof(item.mtime));
+    if (SUCCEEDED(hr)) {
+        CHandlerProps props;
+        if (options.numThreads) props.AddUInt32(L"mt", options.numThreads);
+        props.Apply(archive);
+
+        CExtractCallback* callback = new CExtractCallback(archive, outDir, password, progress,
+                                                          cancel);
+        callback->AddRef();
+        callback->SetSparseOutput(options.sparseOutput);
+        callback->SetDirectIoThreshold(options.directIoThreshold);
+        callback->SetIoBackend(options.ioBackend);
+        callback->SetAbortFlag(&abort);
+        {
+            CoreScopedPhase phase(CorePhase::Decode);
+            hr = archive->Extract(indices.data(), (UInt32)indices.size(), 0, callback);
         }
-        PropVariantClear(&prop);
-
-        items.push_back(item);
+        HRESULT flushHr = callback->FlushOutput();
+        if (SUCCEEDED(hr)) hr = flushHr;
+        if (FAILED(hr)) callback->DeletePartialFile();
+        callback->Release();
+        archive->Close();
     }
 
-    return items;
+    // Stops the other workers at their next check point
+    if (FAILED(hr)) abort = true;
+    archive->Release();
+    inStream->Release();
+    return hr;
 }
 
-bool SevenZipCore::TestPassword(const std::wstring& password) {
-    if (!m_archive) return false;
+void SevenZipCore::SetMemoryBudget(uint64_t bytes) {
+    m_memory->SetBudget(bytes);
+}
 
-    // Find first non-directory file
-    UInt32 numItems = 0;
-    m_archive->GetNumberOfItems(&numItems);
+uint64_t SevenZipCore::GetMemoryBudget() const {
+    return m_memory->GetBudget();
+}
 
-    UInt32 testIndex = (UInt32)-1;
-    for (UInt32 i = 0; i < numItems; i++) {
-        PROPVARIANT prop;
-        PropVariantInit(&prop);
-        m_archive->GetProperty(i, kpidIsDir, &prop);
-        bool isDir = (prop.vt == VT_BOOL && prop.boolVal != VARIANT_FALSE);
-        PropVariantClear(&prop);
+OperationOptions SevenZipCore::FitCompressOptions(const GUID& formatId, bool parallelGzip,
+                                                  const OperationOptions& options,
+                                                  const CNodePlacement* placement,
+                                                  uint64_t inputSize, uint64_t& bytes) const {
+    EncoderMemoryInput input;
+    input.kind = parallelGzip ? EncoderKind::ParallelGzip : EncoderKindFor(formatId, options);
+    input.level = options.level;
+    input.numThreads = options.numThreads ? options.numThreads
+                                          : placement ? placement->GetThreadCount() : 0;
+    input.dictSize = options.dictionarySize;
+    input.inputSize = inputSize;
+    input.blockSize = options.blockSize ? options.blockSize : kGzipMemberSize;
+    input.windowLog = options.longWindowLog;
+    EncoderMemoryPlan plan = PlanEncoderMemory(input, m_memory->GetBudget());
+
+    OperationOptions fitted = options;
+    if (plan.threadsReduced || input.numThreads != options.numThreads) {
+        fitted.numThreads = plan.numThreads;
+    }
+    // Passed on only when it differs from what the level would pick
+    if (plan.dictSize && (options.dictionarySize || plan.dictSize < DefaultLzmaDictSize(options.level))) {
+        fitted.dictionarySize = plan.dictSize;
+    }
+    // Read-ahead keeps up to 1 MB per queued file
+    bytes = plan.bytes + (uint64_t)options.readAheadFiles * (1 << 20);
+    return fitted;
+}
 
-        if (!isDir) {
-            testIndex = i;
-            break;
+bool SevenZipCore::Compress(const std::vector<std::wstring>& srcPaths,
+                            const std::wstring& archivePath,
+                            const std::wstring& format,
+                            ProgressCallback progress,
+                            const OperationOptions& options) {
+    CancellationToken* cancel = options.cancel.get();
+    CancellationScope cancelScope(cancel);
+
+    // Compound tarball formats have no handler of their own
+    if (const GUID* outerFormatId = GetTarballOuterFormat(format)) {
+        if (FAILED(CompressTarball(srcPaths, archivePath, *outerFormatId, progress, options))) {
+            DeleteFileW(archivePath.c_str());
+            return false;
         }
+        return true;
     }
 
-    if (testIndex == (UInt32)-1) {
-        return true;  // No files to test, assume success
+    const GUID* formatId = FindUpdateFormat(format);
+
+#ifdef SEVENZIPCORE_WITH_ZSTD
+    // Single stream: the first source file becomes the .zst payload
+    if (*formatId == CLSID_CFormatZstd) {
+        HRESULT hr = E_INVALIDARG;
+        WIN32_FILE_ATTRIBUTE_DATA attr;
+        if (!srcPaths.empty() &&
+            GetFileAttributesExW(srcPaths[0].c_str(), GetFileExInfoStandard, &attr)) {
+            uint64_t bytes = 0;
+            OperationOptions fitted = FitCompressOptions(
+                *formatId, false, options, nullptr,
+                ((uint64_t)attr.nFileSizeHigh << 32) | attr.nFileSizeLow, bytes);
+            CMemoryReservation reservation(*m_memory, bytes, cancel);
+            hr = reservation.IsHeld()
+                ? CompressZstdFile(srcPaths[0], archivePath, progress, fitted)
+                : E_ABORT;
+        }
+        if (FAILED(hr)) {
+            DeleteFileW(archivePath.c_str());
+            return false;
+        }
+        return true;
     }
+#endif
 
-    // Create temp directory
-    wchar_t tempPath[MAX_PATH];
-    GetTempPathW(MAX_PATH, tempPath);
-    std::wstring testDir = std::wstring(tempPath) + L"7ztest_" + std::to_wstring(GetTickCount64());
-    CreateDirectoryW(testDir.c_str(), NULL);
-
-    // Try to extract first file
-    CExtractCallback* callback = new CExtractCallback(m_archive, testDir, password, nullptr);
+    // Create update callback; its source walk gives the input size the
+    // encoder settings are fitted to
+    CUpdateCallback* callback = new CUpdateCallback(srcPaths, progress, cancel);
     callback->AddRef();
-    UInt32 indices[1] = { testIndex };
-    HRESULT hr = m_archive->Extract(indices, 1, 0, callback);
+    callback->SetDirectIoThreshold(options.directIoThreshold);
+    if (options.readAheadFiles) {
+        callback->EnableReadAhead(options.readAheadFiles, *formatId == CLSID_CFormat7z);
+    }
 
-    bool passwordWasRequested = callback->WasPasswordRequested();
+    HRESULT hr = callback->WasCancelled()
+        ? E_ABORT
+        : EncodeArchive(callback, callback->GetItemCount(), callback->GetTotalSize(), archivePath,
+                        *formatId, false, options);
     callback->Release();
+    return SUCCEEDED(hr);
+}
 
-    // Cleanup
-    WIN32_FIND_DATAW fd;
-    std::wstring searchPath = testDir + L"\\*";
-    HANDLE hFind = FindFirstFileW(searchPath.c_str(), &fd);
-    if (hFind != INVALID_HANDLE_VALUE) {
-        do {
-            if (wcscmp(fd.cFileName, L".") != 0 && wcscmp(fd.cFileName, L"..") != 0) {
-                std::wstring filePath = testDir + L"\\" + fd.cFileName;
-                DeleteFileW(filePath.c_str());
-            }
-        } while (FindNextFileW(hFind, &fd));
-        FindClose(hFind);
+bool SevenZipCore::CompressItems(IArchiveUpdateCallback* callback, uint32_t numItems,
+                                 uint64_t totalSize, const std::wstring& archivePath,
+                                 const std::wstring& format,
+                                 const OperationOptions& options) {
+    CancellationScope cancelScope(options.cancel.get());
+
+    HRESULT hr;
+    if (const GUID* outerFormatId = GetTarballOuterFormat(format)) {
+        hr = EncodeTarball(callback, numItems, totalSize, archivePath, *outerFormatId, options);
+        if (FAILED(hr)) DeleteFileW(archivePath.c_str());
+    } else {
+        hr = EncodeArchive(callback, numItems, totalSize, archivePath, *FindUpdateFormat(format),
+                           false, options);
     }
-    RemoveDirectoryW(testDir.c_str());
+    return SUCCEEDED(hr);
+}
 
-    m_needsPassword = passwordWasRequested;
+const GUID* SevenZipCore::FindUpdateFormat(const std::wstring& format) const {
+    for (const auto& fmt : m_formats) {
+        if (_wcsicmp(format.c_str(), fmt.name.c_str()) == 0 ||
+            _wcsicmp((L"." + format).c_str(), fmt.extension.c_str()) == 0) {
+            if (fmt.canUpdate) return &fmt.classId;
+        }
+    }
+    // Default to 7z
+    return &CLSID_CFormat7z;
+}
 
-    return SUCCEEDED(hr);
+HRESULT SevenZipCore::EncodeArchive(IArchiveUpdateCallback* callback, uint32_t numItems,
+                                    uint64_t totalSize, const std::wstring& archivePath,
+                                    const GUID& formatId, bool inputOrder,
+                                    const OperationOptions& options) {
+    CancellationToken* cancel = options.cancel.get();
+
+    IOutArchive* outArchive = CreateOutArchive(formatId);
+    if (!outArchive) return E_NOTIMPL;
+
+    uint64_t memoryBytes = 0;
+    OperationOptions fitted = FitCompressOptions(formatId, false, options, nullptr, totalSize,
+                                                 memoryBytes);
+    CHandlerProps props;
+    AddCompressProps(props, formatId, fitted);
+    if (inputOrder && formatId == CLSID_CFormat7z) {
+        // 7z groups executables apart for the BCJ filter and can sort by
+        // type; either would ask for item streams out of name order
+        props.AddString(L"f", L"off");
+        props.AddString(L"qs", L"off");
+    }
+    if (FAILED(props.Apply(outArchive))) {
+        outArchive->Release();
+        return E_INVALIDARG;
+    }
+
+    CFullOutFileStream* outStream = new CFullOutFileStream(cancel);
+    outStream->AddRef();
+    if (!outStream->Create(archivePath.c_str())) {
+        HRESULT hr = HRESULT_FROM_WIN32(GetLastError());
+        outStream->Release();
+        outArchive->Release();
+        return hr;
+    }
+
+    HRESULT hr = E_ABORT;
+    {
+        CMemoryReservation reservation(*m_memory, memoryBytes, cancel);
+        if (reservation.IsHeld()) {
+            CoreScopedPhase phase(CorePhase::Encode);
+            hr = outArchive->UpdateItems(outStream, numItems, callback);
+        }
+    }
+
+    outStream->Release();
+    outArchive->Release();
+    if (FAILED(hr)) DeleteFileW(archivePath.c_str());
+    return hr;
 }
 
-bool SevenZipCore::Extract(const std::wstring& outDir,
-                           const std::wstring& password,
-                           ProgressCallback progress) {
-    if (!m_archive) return false;
+HRESULT SevenZipCore::CompressTarball(const std::vector<std::wstring>& srcPaths,
+                                      const std::wstring& archivePath,
+                                      const GUID& outerFormatId,
+                                      ProgressCallback progress,
+                                      const OperationOptions& options) {
+    CancellationToken* cancel = options.cancel.get();
 
-    CExtractCallback* callback = new CExtractCallback(m_archive, outDir, password, progress);
+    CUpdateCallback* callback = new CUpdateCallback(srcPaths, progress, cancel);
     callback->AddRef();
-    HRESULT hr = m_archive->Extract(nullptr, (UInt32)-1, 0, callback);
+    callback->SetDirectIoThreshold(options.directIoThreshold);
+    if (options.readAheadFiles) callback->EnableReadAhead(options.readAheadFiles, false);
+
+    HRESULT hr = callback->WasCancelled()
+        ? E_ABORT
+        : EncodeTarball(callback, callback->GetItemCount(), callback->GetTotalSize(), archivePath,
+                        outerFormatId, options);
     callback->Release();
+    return hr;
+}
 
-    return SUCCEEDED(hr);
+HRESULT SevenZipCore::EncodeTarball(IArchiveUpdateCallback* callback, uint32_t numItems,
+                                    uint64_t totalSize, const std::wstring& archivePath,
+                                    const GUID& outerFormatId, const OperationOptions& options) {
+    CancellationToken* cancel = options.cancel.get();
+
+    IOutArchive* tar = CreateOutArchive(CLSID_CFormatTar);
+    if (!tar) return E_NOTIMPL;
+
+    // gzip goes through the block-parallel encoder unless one thread was
+    // asked for; ZSTD has no output handler; the rest use their handlers
+    UInt32 numThreads = options.numThreads ? options.numThreads
+                                           : std::max(1u, std::thread::hardware_concurrency());
+    bool parallelGzip = (outerFormatId == CLSID_CFormatGZip && numThreads > 1);
+    bool zstd = false;
+#ifdef SEVENZIPCORE_WITH_ZSTD
+    zstd = (outerFormatId == CLSID_CFormatZstd);
+#endif
+    CFullOutFileStream* outStream = new CFullOutFileStream(cancel);
+    outStream->AddRef();
+    if (!outStream->Create(archivePath.c_str())) {
+        HRESULT hr = HRESULT_FROM_WIN32(GetLastError());
+        outStream->Release();
+        tar->Release();
+        return hr;
+    }
+
+    // The tar stream is about as large as its files. Only the parallel gzip
+    // encoder's threads are ours to place.
+    CNodePlacement placement(parallelGzip ? options.threadPlacement : ThreadPlacement::Default);
+    uint64_t memoryBytes = 0;
+    OperationOptions fitted = FitCompressOptions(outerFormatId, parallelGzip, options, &placement,
+                                                 totalSize, memoryBytes);
+    IOutArchive* outer = nullptr;
+    if (!parallelGzip && !zstd) {
+        outer = CreateOutArchive(outerFormatId);
+        CHandlerProps props;
+        AddCompressProps(props, outerFormatId, fitted);
+        if (!outer || FAILED(props.Apply(outer))) {
+            if (outer) outer->Release();
+            outStream->Release();
+            tar->Release();
+            return E_FAIL;
+        }
+    }
+
+    CMemoryReservation reservation(*m_memory, memoryBytes, cancel);
+    CScopedThreadPin pin(placement);
+    HRESULT hr = E_ABORT;
+    if (reservation.IsHeld()) {
+        auto pipe = std::make_shared<CStreamPipeState>(kNestedPipeSize);
+        CStreamPipeWriter* writer = new CStreamPipeWriter(pipe);
+        writer->AddRef();
+        CStreamPipeReader* reader = new CStreamPipeReader(pipe);
+        reader->AddRef();
+
+        HRESULT tarResult = S_OK;
+        std::thread producer([&] {
+            CancellationScope cancelScope(cancel);
+            placement.Pin(0);
+            HRESULT tarHr;
+            {
+                CoreScopedPhase phase(CorePhase::Encode);
+                tarHr = tar->UpdateItems(writer, numItems, callback);
+            }
+            if (FAILED(tarHr)) {
+                pipe->Abort(tarHr);
+            } else {
+                pipe->CloseWrite();
+            }
+            writer->Release();
+            tarResult = tarHr;
+        });
+
+        if (parallelGzip) {
+            CoreScopedPhase phase(CorePhase::Encode);
+            CParallelGzipEncoder encoder(fitted.numThreads ? fitted.numThreads : numThreads,
+                                         options.level,
+                                         options.blockSize ? (size_t)options.blockSize
+                                                           : kGzipMemberSize,
+                                         &placement);
+            hr = encoder.Code(reader, outStream, nullptr);
+        }
+#ifdef SEVENZIPCORE_WITH_ZSTD
+        else if (zstd) {
+            hr = EncodeZstdStream(reader, outStream, nullptr, nullptr, fitted);
+        }
+#endif
+        else {
+            // File data rounded up to 512-byte records, a header plus room for
+            // a long-name header per item, and the end-of-archive records
+            UInt64 sizeHint = totalSize + (UInt64)numItems * 2048 + 10240;
+            CTarStreamUpdateCallback* outerCallback = new CTarStreamUpdateCallback(
+                reader, TarNameForArchive(archivePath), sizeHint, cancel);
+            outerCallback->AddRef();
+            {
+                CoreScopedPhase phase(CorePhase::Encode);
+                hr = outer->UpdateItems(outStream, 1, outerCallback);
+            }
+            outerCallback->Release();
+        }
+
+        // Unblock the producer if the encoder stopped early
+        if (FAILED(hr)) pipe->Abort(hr);
+        reader->Release();
+        pipe->CloseRead();
+        producer.join();
+        if (SUCCEEDED(hr)) hr = tarResult;
+    }
+
+    outStream->Release();
+    if (outer) outer->Release();
+    tar->Release();
+    return hr;
 }
 
-bool SevenZipCore::ExtractFiles(const std::vector<uint32_t>& indices,
-                                const std::wstring& outDir,
-                                const std::wstring& password,
-                                ProgressCallback progress) {
-    if (!m_archive || indices.empty()) return false;
+// True if path lies below the directory dir (either separator)
+static bool IsUnderDirectory(const std::wstring& path, const std::wstring& dir) {
+    return path.size() > dir.size() && path.compare(0, dir.size(), dir) == 0 &&
+           (path[dir.size()] == L'\\' || path[dir.size()] == L'/');
+}
 
-    CExtractCallback* callback = new CExtractCallback(m_archive, outDir, password, progress);
-    callback->AddRef();
-    HRESULT hr = m_archive->Extract(indices.data(), (UInt32)indices.size(), 0, callback);
-    callback->Release();
+bool SevenZipCore::DeleteItems(const std::vector<uint32_t>& indices,
+                               const std::wstring& password,
+                               ProgressCallback progress,
+                               const OperationOptions& options) {
+    return EditArchive(indices, {}, password, progress, options);
+}
 
-    return SUCCEEDED(hr);
+bool SevenZipCore::RenameItems(const std::vector<std::pair<uint32_t, std::wstring>>& renames,
+                               const std::wstring& password,
+                               ProgressCallback progress,
+                               const OperationOptions& options) {
+    return EditArchive({}, renames, password, progress, options);
 }
 
-bool SevenZipCore::Compress(const std::vector<std::wstring>& srcPaths,
-                            const std::wstring& archivePath,
-                            const std::wstring& format,
-                            ProgressCallback progress) {
-    // Find format
-    const GUID* formatId = nullptr;
-    for (const auto& fmt : m_formats) {
-        if (_wcsicmp(format.c_str(), fmt.name.c_str()) == 0 ||
-            _wcsicmp((L"." + format).c_str(), fmt.extension.c_str()) == 0) {
-            if (fmt.canUpdate) {
-                formatId = &fmt.classId;
-                break;
-            }
+bool SevenZipCore::EditArchive(const std::vector<uint32_t>& deletions,
+                               const std::vector<std::pair<uint32_t, std::wstring>>& renames,
+                               const std::wstring& password,
+                               ProgressCallback progress,
+                               const OperationOptions& options) {
+    if (!m_archive || m_nestedTar) return false;
+    CancellationToken* cancel = options.cancel.get();
+    CancellationScope cancelScope(cancel);
+    // Unbound before CloseArchive below: the binding's reference would keep
+    // the old file open under MoveFileExW
+    std::unique_ptr<CInStreamCancelBinding> cancelBinding(
+        new CInStreamCancelBinding(m_inStream, cancel));
+
+    // The handler that read the archive writes the new one
+    IOutArchive* outArchive = nullptr;
+    if (FAILED(m_archive->QueryInterface(IID_IOutArchive, (void**)&outArchive)) || !outArchive) {
+        return false;
+    }
+
+    UInt32 numItems = 0;
+    m_archive->GetNumberOfItems(&numItems);
+    std::vector<std::wstring> paths(numItems);
+    std::vector<bool> isDir(numItems);
+    {
+        CoreScopedPhase phase(CorePhase::Enumerate);
+        for (UInt32 i = 0; i < numItems; i++) {
+            paths[i] = ArchiveProps::GetString(m_archive, i, kpidPath);
+            isDir[i] = ArchiveProps::GetBool(m_archive, i, kpidIsDir);
         }
     }
 
-    if (!formatId) {
-        // Default to 7z
-        formatId = &CLSID_CFormat7z;
+    // Edits of a directory apply to everything below it
+    std::vector<bool> removed(numItems, false);
+    std::vector<std::wstring> newPaths(numItems);
+    std::vector<std::wstring> removedDirs;
+    std::vector<std::pair<std::wstring, std::wstring>> movedDirs;
+    bool valid = true;
+    for (uint32_t index : deletions) {
+        if (index >= numItems) {
+            valid = false;
+            break;
+        }
+        removed[index] = true;
+        if (isDir[index]) removedDirs.push_back(paths[index]);
+    }
+    for (const auto& rename : renames) {
+        if (rename.first >= numItems || rename.second.empty()) {
+            valid = false;
+            break;
+        }
+        newPaths[rename.first] = rename.second;
+        if (isDir[rename.first]) movedDirs.emplace_back(paths[rename.first], rename.second);
+    }
+    if (!valid) {
+        outArchive->Release();
+        return false;
+    }
+
+    std::vector<CCopyThroughUpdateCallback::Item> items;
+    items.reserve(numItems);
+    for (UInt32 i = 0; i < numItems; i++) {
+        for (const auto& dir : removedDirs) {
+            if (IsUnderDirectory(paths[i], dir)) removed[i] = true;
+        }
+        if (removed[i]) continue;
+        if (newPaths[i].empty()) {
+            for (const auto& move : movedDirs) {
+                if (IsUnderDirectory(paths[i], move.first)) {
+                    newPaths[i] = move.second + paths[i].substr(move.first.size());
+                    break;
+                }
+            }
+        }
+        items.push_back({ i, std::move(newPaths[i]) });
     }
 
-    // Create output archive
-    IOutArchive* outArchive = CreateOutArchive(*formatId);
-    if (!outArchive) {
+    CHandlerProps props;
+    AddCompressProps(props, m_formatId, options);
+    if (FAILED(props.Apply(outArchive))) {
+        outArchive->Release();
         return false;
     }
 
-    // Create output stream
-    CFullOutFileStream* outStream = new CFullOutFileStream();
+    // Written next to the archive and moved over it once complete
+    std::wstring archivePath = m_currentPath;
+    std::wstring tempPath = archivePath + L".tmp";
+    CFullOutFileStream* outStream = new CFullOutFileStream(cancel);
     outStream->AddRef();
-    if (!outStream->Create(archivePath.c_str())) {
+    if (!outStream->Create(tempPath.c_str())) {
         outStream->Release();
         outArchive->Release();
         return false;
     }
 
-    // Create update callback
-    CUpdateCallback* callback = new CUpdateCallback(srcPaths, progress);
+    CCopyThroughUpdateCallback* callback = new CCopyThroughUpdateCallback(
+        m_archive, std::move(items), password, progress, cancel);
     callback->AddRef();
-
-    // Update archive
-    HRESULT hr = outArchive->UpdateItems(outStream, callback->GetItemCount(), callback);
-
+    UInt32 numOut = (UInt32)(numItems - std::count(removed.begin(), removed.end(), true));
+    HRESULT hr;
+    {
+        CoreScopedPhase phase(CorePhase::Encode);
+        hr = outArchive->UpdateItems(outStream, numOut, callback);
+    }
     callback->Release();
     outStream->Release();
     outArchive->Release();
 
     if (FAILED(hr)) {
-        DeleteFileW(archivePath.c_str());
+        DeleteFileW(tempPath.c_str());
+        return false;
+    }
+
+    // The handler and its input stream must let go of the old file first
+    cancelBinding.reset();
+    CloseArchive();
+    if (!MoveFileExW(tempPath.c_str(), archivePath.c_str(), MOVEFILE_REPLACE_EXISTING)) {
+        DeleteFileW(tempPath.c_str());
+        OpenArchive(archivePath, options);
         return false;
     }
+    return OpenArchive(archivePath, options);
+}
+
+bool SevenZipCore::Convert(const std::wstring& archivePath,
+                           const std::wstring& format,
+                           const std::wstring& password,
+                           ProgressCallback progress,
+                           const OperationOptions& options) {
+    if (!m_archive || m_nestedTar) return false;
+    if (_wcsicmp(archivePath.c_str(), m_currentPath.c_str()) == 0) return false;
+    CancellationToken* cancel = options.cancel.get();
+    CancellationScope cancelScope(cancel);
+    CInStreamCancelBinding cancelBinding(m_inStream, cancel);
+
+    const GUID* outerFormatId = GetTarballOuterFormat(format);
+    const GUID* formatId = outerFormatId ? &CLSID_CFormatTar : FindUpdateFormat(format);
+#ifdef SEVENZIPCORE_WITH_ZSTD
+    // A .zst holds one stream, not items
+    if (*formatId == CLSID_CFormatZstd) return false;
+#endif
+
+    UInt32 numItems = 0;
+    m_archive->GetNumberOfItems(&numItems);
+    std::vector<ConvertItem> items(numItems);
+    std::vector<UInt32> dataIndices;
+    uint64_t totalSize = 0;
+    {
+        CoreScopedPhase phase(CorePhase::Enumerate);
+        for (UInt32 i = 0; i < numItems; i++) {
+            if (cancel && cancel->Check()) return false;
+            items[i] = ReadConvertItem(m_archive, i);
+            if (!items[i].HasData()) continue;
+            // A tar header needs the size before the data
+            if (*formatId == CLSID_CFormatTar && !items[i].sizeDefined) return false;
+            dataIndices.push_back(i);
+            totalSize += items[i].size;
+        }
+    }
+
+    // Zip and Tar ask for the item streams in index order; the 7z updater
+    // sorts files by name first (filters and type sorting are off, see
+    // EncodeArchive). The source still decodes each solid block once and
+    // in full, when the target first needs one of its items; the items it
+    // decodes ahead of their turn wait in memory. A conversion that would
+    // hold more than kConvertHoldMax fails here, before anything is written.
+    std::vector<UInt32> decodeOrder = dataIndices;
+    if (!outerFormatId && *formatId == CLSID_CFormat7z) {
+        std::stable_sort(dataIndices.begin(), dataIndices.end(),
+                         [&items](UInt32 a, UInt32 b) {
+                             return Compare7zNames(items[a].path, items[b].path) < 0;
+                         });
+
+        ExtractPlan plan = PlanExtraction(decodeOrder);
+        std::vector<size_t> blockOf(numItems);
+        for (size_t b = 0; b < plan.blocks.size(); b++) {
+            for (uint32_t index : plan.blocks[b].indices) blockOf[index] = b;
+        }
+        std::vector<bool> blockQueued(plan.blocks.size(), false);
+        decodeOrder.clear();
+        for (UInt32 index : dataIndices) {
+            size_t b = blockOf[index];
+            if (blockQueued[b]) continue;
+            blockQueued[b] = true;
+            decodeOrder.insert(decodeOrder.end(), plan.blocks[b].indices.begin(),
+                               plan.blocks[b].indices.end());
+        }
+
+        std::vector<bool> waiting(numItems, false);
+        UInt64 held = 0;
+        UInt64 peak = 0;
+        size_t next = 0;
+        for (UInt32 index : decodeOrder) {
+            if (index != dataIndices[next]) {
+                waiting[index] = true;
+                held += items[index].size;
+                peak = std::max(peak, held);
+                continue;
+            }
+            next++;
+            while (next < dataIndices.size() && waiting[dataIndices[next]]) {
+                waiting[dataIndices[next]] = false;
+                held -= items[dataIndices[next]].size;
+                next++;
+            }
+        }
+        if (peak > kConvertHoldMax) return false;
+    }
+
+    ApplyDecoderThreads(m_archive, options.numThreads);
+    CStreamPipeQueue queue;
+    CConvertExtractCallback* extractCallback = new CConvertExtractCallback(
+        queue, items, dataIndices, totalSize, password, progress, cancel);
+    extractCallback->AddRef();
+    CConvertUpdateCallback* updateCallback = new CConvertUpdateCallback(queue, items, cancel);
+    updateCallback->AddRef();
+
+    // The source handler decodes the data items on its own thread while the
+    // target handler reads them from the pipes here. IInArchive::Extract
+    // takes ascending indices, so each ascending run of the decode order is
+    // one call; a solid block lies within one run and is decoded once.
+    HRESULT extractResult = S_OK;
+    std::thread producer([&] {
+        CancellationScope producerScope(cancel);
+        {
+            CoreScopedPhase phase(CorePhase::Decode);
+            size_t runStart = 0;
+            while (runStart < decodeOrder.size() && SUCCEEDED(extractResult)) {
+                size_t runEnd = runStart + 1;
+                while (runEnd < decodeOrder.size() &&
+                       decodeOrder[runEnd] > decodeOrder[runEnd - 1]) {
+                    runEnd++;
+                }
+                extractCallback->BeginRun();
+                extractResult = m_archive->Extract(&decodeOrder[runStart],
+                                                   (UInt32)(runEnd - runStart), 0,
+                                                   extractCallback);
+                runStart = runEnd;
+            }
+        }
+        if (FAILED(extractResult)) {
+            queue.Abort(extractResult);
+        } else {
+            queue.Close();
+        }
+    });
+
+    HRESULT hr = outerFormatId
+        ? EncodeTarball(updateCallback, numItems, totalSize, archivePath, *outerFormatId, options)
+        : EncodeArchive(updateCallback, numItems, totalSize, archivePath, *formatId, true,
+                        options);
+
+    // Unblock the producer if the target stopped early; every data item
+    // must have gone through for the result to count
+    queue.Abort(FAILED(hr) ? hr : E_ABORT);
+    producer.join();
+    if (SUCCEEDED(hr) && extractCallback->GetItemsDone() != dataIndices.size()) {
+        hr = (FAILED(extractResult) && extractResult != E_ABORT) ? extractResult : E_FAIL;
+    }
+    extractCallback->Release();
+    updateCallback->Release();
 
+    if (FAILED(hr)) {
+        // EncodeArchive removes its own output; a tarball's is removed here
+        if (outerFormatId) DeleteFileW(archivePath.c_str());
+        return false;
+    }
     return true;
 }
+
+//////////////////////////////////////////////////////////////////////////////
+// ItemReader
+//////////////////////////////////////////////////////////////////////////////
+
+ItemReader::ItemReader(std::unique_ptr<CItemReaderImpl> impl) : m_impl(std::move(impl)) {}
+
+ItemReader::~ItemReader() {}
+
+uint64_t ItemReader::GetSize() const {
+    return m_impl->GetSize();
+}
+
+bool ItemReader::Read(void* data, size_t size, size_t& processed) {
+    bool ok = ReadAt(m_position, data, size, processed);
+    m_position += processed;
+    return ok;
+}
+
+bool ItemReader::ReadAt(uint64_t offset, void* data, size_t size, size_t& processed) {
+    return SUCCEEDED(m_impl->ReadAt(offset, data, size, processed));
+}
+
+// First item of the solid block (7z folder, RAR chain) that holds index,
+// walked back as in PlanExtraction; index itself when it is not solid
+static UInt32 SolidBlockStart(IInArchive* archive, UInt32 index) {
+    UInt64 block = 0;
+    UInt64 other = 0;
+    UInt32 start = index;
+    if (ArchiveProps::GetUInt64(archive, index, kpidBlock, block)) {
+        while (start > 0) {
+            if (ArchiveProps::GetUInt64(archive, start - 1, kpidBlock, other) && other != block) break;
+            start--;
+        }
+        while (start < index && !ArchiveProps::GetUInt64(archive, start, kpidBlock, other)) start++;
+        return start;
+    }
+    bool solid = false;
+    if (ArchiveProps::GetArchiveBool(archive, kpidSolid, solid) && solid) {
+        while (start > 0 && ArchiveProps::GetBool(archive, start, kpidSolid)) start--;
+    }
+    return start;
+}
+
+std::unique_ptr<ItemReader> SevenZipCore::OpenItemStream(uint32_t index,
+                                                         const std::wstring& password,
+                                                         const OperationOptions& options) {
+    if (!m_archive || m_nestedTar) return nullptr;
+    CancellationScope cancelScope(options.cancel.get());
+
+    UInt32 numItems = 0;
+    m_archive->GetNumberOfItems(&numItems);
+    if (index >= numItems || ArchiveProps::GetBool(m_archive, index, kpidIsDir)) return nullptr;
+
+    IInArchive* archive = CreateInArchive(m_formatId);
+    if (!archive) return nullptr;
+    if (!m_blockSource) m_blockSource = m_blockCache->NewSource();
+
+    std::unique_ptr<CItemReaderImpl> impl(new CItemReaderImpl(
+        index, password, m_blockCache.get(), m_blockSource, options.cancel));
+    UInt64 size = 0;
+    bool sizeDefined;
+    {
+        CoreScopedPhase lookup(CorePhase::PropertyLookup);
+        sizeDefined = ArchiveProps::GetUInt64(m_archive, index, kpidSize, size);
+    }
+    if (sizeDefined) impl->SetSize(size);
+
+    // A pass over a solid block decodes the files before the item anyway;
+    // those not cached yet are kept, up to a quarter of the cache
+    uint64_t capacity = m_blockCache->GetCapacity();
+    std::vector<UInt32> sideItems;
+    {
+        CoreScopedPhase plan(CorePhase::Plan);
+        uint64_t sideBytes = 0;
+        for (UInt32 i = SolidBlockStart(m_archive, index); i < index; i++) {
+            UInt64 sideSize = 0;
+            if (ArchiveProps::GetBool(m_archive, i, kpidIsDir) ||
+                !ArchiveProps::GetUInt64(m_archive, i, kpidSize, sideSize) || sideSize == 0) {
+                continue;
+            }
+            if (sideBytes + sideSize > capacity / 4) break;
+            if (m_blockCache->Contains({ m_blockSource, i, 0 })) continue;
+            sideItems.push_back(i);
+            sideBytes += sideSize;
+        }
+    }
+    impl->SetPassItems(std::move(sideItems), sizeDefined && size <= capacity / 4);
+
+    bool encrypted = ArchiveProps::GetBool(m_archive, index, kpidEncrypted);
+    if (FAILED(impl->Open(archive, m_currentPath, encrypted, options.numThreads))) {
+        return nullptr;
+    }
+    return std::unique_ptr<ItemReader>(new ItemReader(std::move(impl)));
+}
+
+void SevenZipCore::SetItemCacheSize(uint64_t bytes) {
+    m_blockCache->SetCapacity(bytes);
+}
+
+DecodedBlockCacheStats SevenZipCore::GetItemCacheStats() const {
+    return m_blockCache->GetStats();
+}
+
+HashReport SevenZipCore::HashFiles(const std::vector<std::wstring>& paths,
+                                   uint32_t algorithms,
+                                   ProgressCallback progress,
+                                   const OperationOptions& options) {
+    CancellationToken* cancel = options.cancel.get();
+    auto start = std::chrono::steady_clock::now();
+    HashReport report;
+    report.algorithms = algorithms;
+
+    std::vector<HashSourceFile> files;
+    {
+        CancellationScope cancelScope(cancel);
+        if (!EnumerateHashSources(paths, files, cancel)) return report;
+    }
+    report.entries.resize(files.size());
+    uint64_t total = 0;
+    for (const auto& file : files) {
+        total += file.size;
+    }
+
+    // Largest files first, so a big file does not start last and leave the
+    // other workers idle at the end
+    std::vector<size_t> order(files.size());
+    std::iota(order.begin(), order.end(), (size_t)0);
+    std::stable_sort(order.begin(), order.end(), [&files](size_t a, size_t b) {
+        return files[a].size > files[b].size;
+    });
+
+    CNodePlacement placement(options.threadPlacement);
+    uint32_t numWorkers = options.numThreads ? options.numThreads : placement.GetThreadCount();
+    if (!numWorkers) numWorkers = std::max(1u, std::thread::hardware_concurrency());
+    numWorkers = (uint32_t)std::min<size_t>(numWorkers, std::max<size_t>(files.size(), 1));
+
+    std::atomic<size_t> next{0};
+    std::atomic<bool> aborted{false};
+    std::mutex progressLock;
+    uint64_t completed = 0;
+    auto onBytes = [&](uint64_t bytes) {
+        if (!progress) return !aborted.load();
+        std::lock_guard<std::mutex> lock(progressLock);
+        completed += bytes;
+        if (!aborted && !progress(completed, total)) aborted = true;
+        return !aborted.load();
+    };
+
+    std::vector<std::thread> workers;
+    for (uint32_t i = 0; i < numWorkers; i++) {
+        workers.emplace_back([&, i] {
+            CancellationScope cancelScope(cancel);
+            placement.Pin(i);
+            for (size_t n = next++; n < order.size() && !aborted; n = next++) {
+                const HashSourceFile& file = files[order[n]];
+                HashEntry& entry = report.entries[order[n]];
+                entry.path = file.relativePath;
+                // Unreadable files stay in the report as failed entries
+                if (HashDiskFile(file.fullPath, algorithms, cancel, onBytes, entry) == E_ABORT) {
+                    aborted = true;
+                }
+            }
+        });
+    }
+    for (auto& worker : workers) {
+        worker.join();
+    }
+
+    report.ok = !aborted;
+    for (const auto& entry : report.entries) {
+        report.ok = report.ok && entry.ok;
+        if (entry.ok) report.totalBytes += entry.size;
+    }
+    report.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return report;
+}
+
+HashReport SevenZipCore::HashArchiveItems(const std::vector<uint32_t>& indices,
+                                          uint32_t algorithms,
+                                          const std::wstring& password,
+                                          ProgressCallback progress,
+                                          const OperationOptions& options) {
+    auto start = std::chrono::steady_clock::now();
+    HashReport report;
+    report.algorithms = algorithms;
+    if (!m_archive) return report;
+
+    CancellationToken* cancel = options.cancel.get();
+    CancellationScope cancelScope(cancel);
+    CInStreamCancelBinding cancelBinding(m_inStream, cancel);
+
+    ApplyDecoderThreads(m_archive, options.numThreads);
+
+    std::vector<bool> selection;
+    for (uint32_t index : indices) {
+        if (index >= selection.size()) selection.resize(index + 1, false);
+        selection[index] = true;
+    }
+
+    HRESULT hr;
+    if (m_nestedTar) {
+        IInArchive* tar = CreateInArchive(CLSID_CFormatTar);
+        if (!tar) return report;
+        CHashExtractCallback* callback = new CHashExtractCallback(tar, algorithms, report.entries,
+                                                                  password, nullptr, cancel);
+        callback->AddRef();
+        if (!indices.empty()) callback->SetSelection(&selection);
+        hr = ExtractNestedTar(m_archive, tar, callback, 0, progress, cancel);
+        callback->Release();
+        tar->Release();
+    } else {
+        ExtractPlan plan;
+        if (!indices.empty()) plan = PlanExtraction(indices);
+        CHashExtractCallback* callback = new CHashExtractCallback(m_archive, algorithms,
+                                                                  report.entries, password,
+                                                                  progress, cancel);
+        callback->AddRef();
+        {
+            CoreScopedPhase phase(CorePhase::Decode);
+            hr = indices.empty()
+                ? m_archive->Extract(nullptr, (UInt32)-1, 0, callback)
+                : m_archive->Extract(plan.indices.data(), (UInt32)plan.indices.size(), 0, callback);
+        }
+        callback->Release();
+    }
+
+    report.ok = SUCCEEDED(hr);
+    for (const auto& entry : report.entries) {
+        report.ok = report.ok && entry.ok;
+        if (entry.ok) report.totalBytes += entry.size;
+    }
+    report.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return report;
+}
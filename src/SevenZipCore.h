@@ -7,11 +7,23 @@
 #include <functional>
 #include <memory>
 #include <cstdint>
+#include <atomic>
+#include <utility>
+
+#include "CoreStats.h"
+#include "CancellationToken.h"
+#include "PathFilter.h"
+#include "CpuTopology.h"
+#include "BlockCache.h"
 
 // Forward declarations for 7-Zip types
 struct IInArchive;
 struct IOutArchive;
+struct IArchiveUpdateCallback;
 struct IInStream;
+struct GzipSeekIndex;
+class CMemoryGovernor;
+class CItemReaderImpl;
 
 // Progress callback: returns false to cancel operation
 using ProgressCallback = std::function<bool(uint64_t completed, uint64_t total)>;
@@ -26,6 +38,166 @@ struct ArchiveItem {
     FILETIME mtime;
 };
 
+// Extract/ExtractFiles: how an existing output file is matched against its item
+enum class ExtractSkipMode : uint32_t {
+    None,       // Always write
+    SizeTime,   // Skip when size and mtime match
+    Crc,        // Also compare the stored CRC32 with the file's (reads the file)
+};
+
+// Extract/ExtractFiles: how output files reach the file system
+enum class IoBackend : uint32_t {
+    Blocking,   // Create, write and close on the decoding thread
+    Batched,    // Small files are buffered whole and, like the closes of
+                // large ones, written on background I/O threads
+};
+
+// Per-operation tuning
+struct OperationOptions {
+    // Coder threads, 0 = codec default. XZ, BZip2 and LZMA2 encode and
+    // decode independent blocks in parallel; BZip2 output is identical to
+    // the single-threaded encoder's.
+    uint32_t numThreads = 0;
+
+    // OpenArchive: present .tar.gz/.tar.bz2/.tar.xz/.tar.zst as the inner
+    // tar. Listing and extraction decode the outer stream straight into the
+    // Tar handler in one pass, without an intermediate .tar file. Off by
+    // default: the archive lists as its single compressed item.
+    bool openNested = false;
+
+    // GetItems on a nested .tar.gz: the listing pass also records seek
+    // points (gzip member starts at least this many bytes apart) and each
+    // tar entry's data offset, saved as "<archive>.szidx". Later opens of
+    // the unchanged archive load it, list without decoding, and ExtractFiles
+    // decodes single entries from the nearest point. Points exist only at
+    // member starts (1 MB members from Compress, 64 KB from bgzip), so
+    // single-member gzip output gains the listing only. 0 = no index is
+    // built; an existing one is still used.
+    uint64_t seekIndexSpacing = 0;
+
+    // Extract/ExtractFiles: handler instances decoding independent blocks
+    // (Zip entries, non-solid 7z folders, CAB folders, ISO files) in
+    // parallel. 0 or 1 = a single IInArchive::Extract call.
+    uint32_t numExtractThreads = 0;
+
+    // Extract/ExtractFiles: leave files that already match their item
+    // untouched. Only changed items are planned, so solid blocks without
+    // changes are not decoded at all; unchanged items ahead of a changed one
+    // in a solid block are decoded without being written. Extracted files
+    // get the item's mtime, which the next run compares against.
+    ExtractSkipMode skipUnchanged = ExtractSkipMode::None;
+
+    // Extract/ExtractFiles: write all-zero 64 KB ranges of the output as
+    // holes (NTFS sparse files) instead of data. Suits disk images and
+    // database files; tar sparse members arrive as zero runs and become
+    // holes again.
+    bool sparseOutput = false;
+
+    // Extract/ExtractFiles/Compress: files of at least this many bytes are
+    // written or read without the system cache (FILE_FLAG_NO_BUFFERING),
+    // through two aligned 1 MB buffers, so huge items do not evict the
+    // page cache of everything else. 0 = always buffered. Items extracted
+    // with sparseOutput stay buffered.
+    uint64_t directIoThreshold = 0;
+
+    // Extract/ExtractFiles: see IoBackend. Batched pays off for trees of
+    // many small files; failures are reported when the operation ends.
+    IoBackend ioBackend = IoBackend::Blocking;
+
+    // Threads this library starts itself: the workers of numExtractThreads
+    // (each claims a NUMA node), of HashFiles and of the parallel gzip
+    // encoder (.tar.gz) stay on one node, where the memory they touch
+    // first is allocated too. With numThreads = 0, HashFiles and the gzip
+    // encoder get one thread per processor of the node (per core for
+    // NodeNoSmt). Threads that 7-Zip and ZSTD coders start do not inherit
+    // the placement, so other coders are left to Windows, as with Default.
+    ThreadPlacement threadPlacement = ThreadPlacement::Default;
+
+    // Compress: read source files of up to 1 MB this many files ahead of
+    // the encoder, on four I/O threads, so trees of tiny files (or network
+    // shares) do not stall it on open/read latency. Files are read in the
+    // order the handler asks for them: item order for Zip and Tar, name
+    // order for 7z (executables last, as its BCJ group). 0 = off.
+    uint32_t readAheadFiles = 0;
+
+    // Compress: codec inside 7z/Zip (e.g. L"LZMA2", L"Deflate", L"ZSTD";
+    // empty = format default) and level (-1 = default; 0-9, or 1-22 for ZSTD)
+    std::wstring method;
+    int32_t level = -1;
+
+    // Compress: bytes per independently coded block (XZ blocks, 7z solid
+    // blocks, BZip2 blocks of 100-900 KB, gzip members of a parallel
+    // .tar.gz); smaller blocks let encode and decode spread across threads.
+    // 0 = format default.
+    uint64_t blockSize = 0;
+
+    // ZSTD: long-distance matching window as log2 bytes (e.g. 27 = 128 MB),
+    // 0 = off
+    uint32_t longWindowLog = 0;
+
+    // Compress: LZMA/LZMA2 dictionary in bytes, 0 = the level's. Either way
+    // it is cut to the total input size (rounded up to a power of two, at
+    // least 64 KB), which saves memory without changing the ratio.
+    uint64_t dictionarySize = 0;
+
+    // Optional; polled in stream I/O, GetStream and enumeration loops.
+    // A cancelled operation returns false and removes its partial output.
+    std::shared_ptr<CancellationToken> cancel;
+};
+
+// Requested items that share one solid block (7z folder, RAR solid chain).
+// Non-solid items form a block of their own.
+struct ExtractPlanBlock {
+    uint64_t blockId;               // Folder index, or first item index of the chain/item
+    bool solid;                     // Decoding depends on earlier items in the block
+    std::vector<uint32_t> indices;  // Ascending
+    uint64_t selectedBytes;         // Unpacked size of the requested items
+    uint64_t decodeBytes;           // Unpacked bytes from block start to the last requested item
+};
+
+// Extraction plan: indices deduplicated and sorted so the handler walks each
+// solid block once, front to back
+struct ExtractPlan {
+    std::vector<uint32_t> indices;
+    std::vector<ExtractPlanBlock> blocks;
+    uint64_t selectedBytes = 0;
+    uint64_t decodeBytes = 0;       // Total bytes that must be unpacked for the selection
+};
+
+// Hash algorithms for HashFiles / HashArchiveItems (combine with |)
+enum HashAlgorithm : uint32_t {
+    HashCrc32  = 1 << 0,
+    HashCrc64  = 1 << 1,
+    HashSha1   = 1 << 2,
+    HashSha256 = 1 << 3,
+};
+
+// Digests of one file or archive item, as lowercase hex; a digest is empty
+// when its algorithm was not requested
+struct HashEntry {
+    std::wstring path;      // Relative to the hashed root, or the item path
+    uint64_t size = 0;
+    bool ok = false;        // Data was read or decoded completely
+    std::string crc32;
+    std::string crc64;
+    std::string sha1;
+    std::string sha256;
+};
+
+struct HashReport {
+    uint32_t algorithms = 0;
+    std::vector<HashEntry> entries;     // Enumeration order, or archive order
+    uint64_t totalBytes = 0;
+    double seconds = 0;
+    bool ok = false;                    // Every entry hashed and not cancelled
+
+    double MBPerSec() const;
+
+    // UTF-8 text: a "# crc32 sha256 size path" style header, one line per
+    // entry, and a summary line with the file count, bytes and MB/s
+    std::string ToManifest() const;
+};
+
 // Archive format information
 struct ArchiveFormat {
     std::wstring name;
@@ -34,6 +206,38 @@ struct ArchiveFormat {
     bool canUpdate;
 };
 
+// Seekable read access to the decoded data of one archive item, from
+// SevenZipCore::OpenItemStream. It has a handler and file handle of its
+// own, so it stays valid after CloseArchive; use one reader per thread.
+class ItemReader {
+public:
+    ~ItemReader();
+
+    ItemReader(const ItemReader&) = delete;
+    ItemReader& operator=(const ItemReader&) = delete;
+
+    // Unpacked size; UINT64_MAX while the handler does not report it and
+    // no read has reached the end yet
+    uint64_t GetSize() const;
+
+    uint64_t GetPosition() const { return m_position; }
+    void Seek(uint64_t position) { m_position = position; }
+
+    // Reads at the position and advances it. processed < size only at the
+    // item's end. False on a data error, a wrong password or cancellation.
+    bool Read(void* data, size_t size, size_t& processed);
+
+    // Reads at offset; the position is left alone
+    bool ReadAt(uint64_t offset, void* data, size_t size, size_t& processed);
+
+private:
+    friend class SevenZipCore;
+    explicit ItemReader(std::unique_ptr<CItemReaderImpl> impl);
+
+    std::unique_ptr<CItemReaderImpl> m_impl;
+    uint64_t m_position = 0;
+};
+
 // 7-Zip Core functionality wrapper
 class SevenZipCore {
 public:
@@ -43,7 +247,7 @@ public:
     const std::vector<ArchiveFormat>& GetFormats() const { return m_formats; }
 
     // Open an archive for reading
-    bool OpenArchive(const std::wstring& path);
+    bool OpenArchive(const std::wstring& path, const OperationOptions& options = {});
 
     // Close the current archive
     void CloseArchive();
@@ -51,8 +255,12 @@ public:
     // Check if an archive is open
     bool IsOpen() const { return m_archive != nullptr; }
 
-    // Get the list of items in the archive
-    std::vector<ArchiveItem> GetItems();
+    // Get the list of items in the archive. A listing cut short by
+    // options.cancel (or a failed decoding pass over a nested tarball)
+    // returns no items; complete, if given, tells that apart from an empty
+    // archive: false unless every item was listed.
+    std::vector<ArchiveItem> GetItems(const OperationOptions& options = {},
+                                      bool* complete = nullptr);
 
     // Get number of items
     uint32_t GetItemCount();
@@ -66,19 +274,137 @@ public:
     // Extract all files to the output directory
     bool Extract(const std::wstring& outDir,
                  const std::wstring& password = L"",
-                 ProgressCallback progress = nullptr);
+                 ProgressCallback progress = nullptr,
+                 const OperationOptions& options = {});
 
-    // Extract specific files by index
+    // Map indices to solid blocks and compute the decode cost of extracting them
+    ExtractPlan PlanExtraction(const std::vector<uint32_t>& indices);
+
+    // Extract specific files by index (reordered per PlanExtraction)
     bool ExtractFiles(const std::vector<uint32_t>& indices,
                       const std::wstring& outDir,
                       const std::wstring& password = L"",
-                      ProgressCallback progress = nullptr);
+                      ProgressCallback progress = nullptr,
+                      const OperationOptions& options = {});
+
+    // Indices of the items whose path passes the filter, in archive order.
+    // Paths are matched as the handler reports them, without building the
+    // item list (a nested tarball is listed first unless it already is).
+    std::vector<uint32_t> SelectMatching(const PathFilter& filter,
+                                         const OperationOptions& options = {});
 
-    // Compress files to an archive
+    // Extract the items whose path passes the filter (e.g. include
+    // "lib/**/*.so"). A nested tarball is filtered inside its one decoding
+    // pass; other archives go through SelectMatching and ExtractFiles.
+    bool ExtractMatching(const PathFilter& filter,
+                         const std::wstring& outDir,
+                         const std::wstring& password = L"",
+                         ProgressCallback progress = nullptr,
+                         const OperationOptions& options = {});
+
+    // Compress files to an archive. Besides the format names, "tgz"/"tar.gz",
+    // "tbz2"/"tar.bz2", "txz"/"tar.xz" (and "tzst"/"tar.zst" with ZSTD) write
+    // a compressed tarball in one pass.
     bool Compress(const std::vector<std::wstring>& srcPaths,
                   const std::wstring& archivePath,
                   const std::wstring& format = L"7z",
-                  ProgressCallback progress = nullptr);
+                  ProgressCallback progress = nullptr,
+                  const OperationOptions& options = {});
+
+    // Compress the items an update callback supplies (generated content,
+    // e.g. the benchmarks' synthetic entries; totalSize bytes of data) the
+    // way Compress writes files, tarball names included
+    bool CompressItems(IArchiveUpdateCallback* callback, uint32_t numItems,
+                       uint64_t totalSize, const std::wstring& archivePath,
+                       const std::wstring& format = L"7z",
+                       const OperationOptions& options = {});
+
+    // Rewrite the open archive without the given items; a directory takes
+    // what lies below it along. Remaining items are copied packed (no
+    // decoding or recompression), so the cost is one pass of I/O; only a
+    // 7z solid block that loses items is repacked, which needs the password
+    // of an encrypted one. The new archive is written next to the old one,
+    // replaces it when complete, and is open afterwards. Not for nested
+    // tarballs.
+    bool DeleteItems(const std::vector<uint32_t>& indices,
+                     const std::wstring& password = L"",
+                     ProgressCallback progress = nullptr,
+                     const OperationOptions& options = {});
+
+    // Same rewrite with new paths for the given items; renaming a directory
+    // moves what lies below it. Item data is copied, never repacked.
+    bool RenameItems(const std::vector<std::pair<uint32_t, std::wstring>>& renames,
+                     const std::wstring& password = L"",
+                     ProgressCallback progress = nullptr,
+                     const OperationOptions& options = {});
+
+    // Write the items of the open archive into a new archive of another
+    // format (names as for Compress, tarballs included). The source
+    // handler's extract streams feed the target handler through bounded
+    // in-memory pipes, one item at a time: no temporary files, and each
+    // item's data is read once. Paths, times, attributes, POSIX mode,
+    // owner and symlink targets carry over where both formats have them.
+    // password decrypts the source; the result is not encrypted. The
+    // target must differ from the open archive. Not for nested tarballs.
+    // A 7z target takes files in name order: each solid block of the
+    // source is still decoded once, and items it yields ahead of that
+    // order wait in memory. Fails before writing when that would exceed
+    // 256 MB.
+    bool Convert(const std::wstring& archivePath,
+                 const std::wstring& format = L"7z",
+                 const std::wstring& password = L"",
+                 ProgressCallback progress = nullptr,
+                 const OperationOptions& options = {});
+
+    // Upper bound for the estimated encoder memory of Compress calls, shared
+    // by all of them (0 = unlimited, the default). A call that would not fit
+    // runs with fewer threads, then a smaller LZMA dictionary; concurrent
+    // calls wait until their estimates fit beside the running ones.
+    void SetMemoryBudget(uint64_t bytes);
+    uint64_t GetMemoryBudget() const;
+
+    // Reader over the decoded data of one file item of the open archive,
+    // without extracting it; nullptr for directories, nested tarballs or a
+    // failed open. Stored items are read in place. Compressed ones are
+    // decoded from the item start (the start of its solid block) in passes
+    // that run only a little ahead of the reads, into blocks of
+    // kDecodedBlockSize kept in the shared item cache, so later reads of
+    // the same ranges, and of earlier files of the solid block that a pass
+    // decoded on the way, need no decoding. Data is verified against the
+    // item's CRC only when a pass reaches its end; until then the reader
+    // keeps the blocks to itself, so the cache holds only verified data.
+    // Items read only in part are never verified, so later readers find
+    // none of their blocks cached.
+    std::unique_ptr<ItemReader> OpenItemStream(uint32_t index,
+                                               const std::wstring& password = L"",
+                                               const OperationOptions& options = {});
+
+    // Capacity of the decoded-block cache shared by all item readers
+    // (default 64 MB; 0 = no caching). Its hits and misses also show up as
+    // the itemCacheHits/itemCacheMisses counters of GetStatsJson.
+    void SetItemCacheSize(uint64_t bytes);
+    DecodedBlockCacheStats GetItemCacheStats() const;
+
+    // Build the seek index of the .tar.gz opened with openNested (see
+    // seekIndexSpacing; here 0 = a point at every member) in one decoding
+    // pass and save it
+    bool BuildSeekIndex(const OperationOptions& options = {});
+
+    // Hash files and directories (recursively) on disk. Files are spread
+    // over options.numThreads workers (0 = one per core), largest first;
+    // each file is read ahead one chunk while the previous chunk is hashed.
+    HashReport HashFiles(const std::vector<std::wstring>& paths,
+                         uint32_t algorithms = HashCrc32 | HashSha256,
+                         ProgressCallback progress = nullptr,
+                         const OperationOptions& options = {});
+
+    // Hash items of the open archive as they are decoded, without writing
+    // them to disk (empty indices = all items)
+    HashReport HashArchiveItems(const std::vector<uint32_t>& indices = {},
+                                uint32_t algorithms = HashCrc32 | HashSha256,
+                                const std::wstring& password = L"",
+                                ProgressCallback progress = nullptr,
+                                const OperationOptions& options = {});
 
     // Get the format GUID for a file extension
     const GUID* GetFormatForExtension(const std::wstring& ext);
@@ -86,6 +412,16 @@ public:
     // Detect format from file content
     const GUID* DetectFormat(const std::wstring& path);
 
+    // Cores, SMT siblings, NUMA nodes and L3 domains of this machine
+    const CpuTopology& GetCpuTopology() const { return CpuTopology::Get(); }
+
+    // Per-phase instrumentation (process-wide, off by default)
+    void EnableStats(bool enable, bool trace = false) { CoreStats_Enable(enable, trace); }
+    void ResetStats() { CoreStats_Reset(); }
+    CoreStats GetStats() const { return CoreStats_Snapshot(); }
+    std::string GetStatsJson() const { return CoreStats_Snapshot().ToJson(); }
+    std::string GetStatsTrace() const { return CoreStats_TraceJson(); }
+
 private:
     SevenZipCore();
     ~SevenZipCore();
@@ -101,11 +437,112 @@ private:
     IInArchive* CreateInArchive(const GUID& formatId);
     IOutArchive* CreateOutArchive(const GUID& formatId);
 
+    // Shared body of Extract/ExtractFiles (indices == nullptr means all items)
+    bool ExtractIndices(const uint32_t* indices, uint32_t numIndices,
+                        const std::wstring& outDir,
+                        const std::wstring& password,
+                        ProgressCallback progress,
+                        const OperationOptions& options);
+
+    // Parallel body of Extract/ExtractFiles: plan blocks are split across
+    // workers, each with its own handler and file handle. The first worker
+    // to fail sets abort; the others stop at their next check point.
+    uint32_t GetExtractWorkerCount(const ExtractPlan& plan, const OperationOptions& options) const;
+    bool ExtractParallel(const ExtractPlan& plan, uint32_t numWorkers,
+                         const std::wstring& outDir,
+                         const std::wstring& password,
+                         ProgressCallback progress,
+                         const OperationOptions& options);
+    HRESULT ExtractWorker(const std::vector<uint32_t>& indices,
+                          const std::wstring& outDir,
+                          const std::wstring& password,
+                          ProgressCallback progress,
+                          const OperationOptions& options,
+                          std::atomic<bool>& abort);
+
+    // Skip-unchanged: the subset of indices whose output file differs
+    std::vector<uint32_t> SelectChanged(const std::vector<uint32_t>& indices,
+                                        const std::wstring& outDir,
+                                        const OperationOptions& options);
+
+    // Nested tarball: the outer handler's single item is decoded through a
+    // pipe into a sequentially opened Tar handler
+    static bool IsNestedTarCandidate(IInArchive* archive, const GUID& formatId,
+                                     const std::wstring& path);
+    bool ListNested(const OperationOptions& options, bool buildIndex);
+    bool ExtractNested(const std::vector<bool>* selection, const PathFilter* filter,
+                       const std::wstring& outDir,
+                       const std::wstring& password,
+                       ProgressCallback progress,
+                       const OperationOptions& options);
+
+    // Nested .tar.gz with a seek index: each item is decoded from the
+    // nearest seek point. S_FALSE = the index cannot serve the request
+    // (full pass instead).
+    HRESULT ExtractIndexed(const std::vector<uint32_t>& indices,
+                           const std::wstring& outDir,
+                           ProgressCallback progress,
+                           const OperationOptions& options);
+
+    // DeleteItems/RenameItems: copy-through rewrite of the open archive
+    bool EditArchive(const std::vector<uint32_t>& deletions,
+                     const std::vector<std::pair<uint32_t, std::wstring>>& renames,
+                     const std::wstring& password,
+                     ProgressCallback progress,
+                     const OperationOptions& options);
+
+    // Compress: options with the thread count and LZMA dictionary fitted to
+    // the input size and the memory budget (and the parallel gzip encoder's
+    // threads to its node); bytes gets the estimate
+    OperationOptions FitCompressOptions(const GUID& formatId, bool parallelGzip,
+                                        const OperationOptions& options,
+                                        const CNodePlacement* placement,
+                                        uint64_t inputSize, uint64_t& bytes) const;
+
+    // Compressed tarball: the Tar handler writes through a pipe into the
+    // outer encoder (parallel gzip members, or the BZip2/XZ/ZSTD coder)
+    HRESULT CompressTarball(const std::vector<std::wstring>& srcPaths,
+                            const std::wstring& archivePath,
+                            const GUID& outerFormatId,
+                            ProgressCallback progress,
+                            const OperationOptions& options);
+
+    // Updatable format by name or extension; 7z if there is none
+    const GUID* FindUpdateFormat(const std::wstring& format) const;
+
+    // The items of callback (totalSize bytes of data) in a new archive of a
+    // handler format, removed again on failure. inputOrder: the callback
+    // serves item streams only in the order Convert predicts, so 7z may
+    // not regroup them by filter or type.
+    HRESULT EncodeArchive(IArchiveUpdateCallback* callback, uint32_t numItems,
+                          uint64_t totalSize, const std::wstring& archivePath,
+                          const GUID& formatId, bool inputOrder,
+                          const OperationOptions& options);
+
+    // The tarball pipeline behind CompressTarball and Convert: the items of
+    // callback (totalSize bytes of data) in a compressed tar
+    HRESULT EncodeTarball(IArchiveUpdateCallback* callback, uint32_t numItems,
+                          uint64_t totalSize, const std::wstring& archivePath,
+                          const GUID& outerFormatId, const OperationOptions& options);
+
     // Current archive state
     IInArchive* m_archive = nullptr;
     IInStream* m_inStream = nullptr;
     std::wstring m_currentPath;
+    GUID m_formatId = {};
     bool m_needsPassword = false;
+    bool m_nestedTar = false;
+    bool m_nestedListed = false;
+    std::vector<ArchiveItem> m_nestedItems;
+    std::unique_ptr<GzipSeekIndex> m_seekIndex;
+
+    // Admission of Compress calls under the memory budget
+    std::unique_ptr<CMemoryGovernor> m_memory;
+
+    // Blocks decoded by item readers; the open archive's key space is
+    // assigned on first use and dropped by CloseArchive
+    std::unique_ptr<CDecodedBlockCache> m_blockCache;
+    uint64_t m_blockSource = 0;
 
     // Supported formats
     std::vector<ArchiveFormat> m_formats;
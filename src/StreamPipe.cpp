@@ -0,0 +1,137 @@
+// StreamPipe.cpp - Bounded in-memory pipe between two 7-Zip stream consumers
+#include "StreamPipe.h"
+
+#include <algorithm>
+#include <cstring>
+
+CStreamPipeState::CStreamPipeState(size_t capacity)
+    : m_buf(capacity ? capacity : 1)
+{
+}
+
+HRESULT CStreamPipeState::Write(const void* data, UInt32 size, UInt32* processedSize) {
+    if (processedSize) *processedSize = 0;
+    const Byte* src = (const Byte*)data;
+    UInt32 written = 0;
+
+    std::unique_lock<std::mutex> lock(m_lock);
+    while (written < size) {
+        m_canWrite.wait(lock, [this] {
+            return m_error != S_OK || m_readClosed || m_size < m_buf.size();
+        });
+        if (m_error != S_OK) return m_error;
+        if (m_readClosed) {
+            written = size;
+            break;
+        }
+
+        size_t writePos = (m_readPos + m_size) % m_buf.size();
+        size_t chunk = std::min<size_t>(size - written, m_buf.size() - m_size);
+        chunk = std::min(chunk, m_buf.size() - writePos);
+        memcpy(&m_buf[writePos], src + written, chunk);
+        m_size += chunk;
+        written += (UInt32)chunk;
+        m_totalWritten += chunk;
+        m_canRead.notify_one();
+    }
+
+    if (processedSize) *processedSize = written;
+    return S_OK;
+}
+
+HRESULT CStreamPipeState::Read(void* data, UInt32 size, UInt32* processedSize) {
+    if (processedSize) *processedSize = 0;
+    if (size == 0) return S_OK;
+
+    std::unique_lock<std::mutex> lock(m_lock);
+    m_canRead.wait(lock, [this] { return m_error != S_OK || m_writeClosed || m_size > 0; });
+    if (m_error != S_OK) return m_error;
+
+    // Like a file stream, return what is available rather than waiting for
+    // the full request
+    size_t chunk = std::min<size_t>(size, m_size);
+    chunk = std::min(chunk, m_buf.size() - m_readPos);
+    if (chunk) {
+        memcpy(data, &m_buf[m_readPos], chunk);
+        m_readPos = (m_readPos + chunk) % m_buf.size();
+        m_size -= chunk;
+        m_totalRead += chunk;
+        m_canWrite.notify_one();
+    }
+    if (processedSize) *processedSize = (UInt32)chunk;
+    return S_OK;
+}
+
+void CStreamPipeState::CloseWrite() {
+    std::lock_guard<std::mutex> lock(m_lock);
+    m_writeClosed = true;
+    m_canRead.notify_all();
+}
+
+void CStreamPipeState::CloseRead() {
+    std::lock_guard<std::mutex> lock(m_lock);
+    m_readClosed = true;
+    m_size = 0;
+    m_canWrite.notify_all();
+}
+
+void CStreamPipeState::Abort(HRESULT hr) {
+    std::lock_guard<std::mutex> lock(m_lock);
+    if (m_error == S_OK) m_error = FAILED(hr) ? hr : E_ABORT;
+    m_canRead.notify_all();
+    m_canWrite.notify_all();
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// CStreamPipeQueue
+//////////////////////////////////////////////////////////////////////////////
+
+std::shared_ptr<CStreamPipeState> CStreamPipeQueue::Push(UInt32 item, size_t capacity) {
+    std::unique_lock<std::mutex> lock(m_lock);
+    m_changed.wait(lock, [this] { return m_error != S_OK || !m_next; });
+    if (m_error != S_OK) return nullptr;
+
+    m_pipes.erase(std::remove_if(m_pipes.begin(), m_pipes.end(),
+                                 [](const std::weak_ptr<CStreamPipeState>& pipe) {
+                                     return pipe.expired();
+                                 }),
+                  m_pipes.end());
+    m_next = std::make_shared<CStreamPipeState>(capacity);
+    m_nextItem = item;
+    m_pipes.push_back(m_next);
+    m_changed.notify_all();
+    return m_next;
+}
+
+std::shared_ptr<CStreamPipeState> CStreamPipeQueue::Pop(UInt32& item) {
+    std::unique_lock<std::mutex> lock(m_lock);
+    m_changed.wait(lock, [this] { return m_error != S_OK || m_next || m_closed; });
+    if (m_error != S_OK || !m_next) return nullptr;
+
+    std::shared_ptr<CStreamPipeState> pipe = std::move(m_next);
+    m_next.reset();
+    item = m_nextItem;
+    m_changed.notify_all();
+    return pipe;
+}
+
+void CStreamPipeQueue::Close() {
+    std::lock_guard<std::mutex> lock(m_lock);
+    m_closed = true;
+    m_changed.notify_all();
+}
+
+void CStreamPipeQueue::Abort(HRESULT hr) {
+    std::lock_guard<std::mutex> lock(m_lock);
+    if (m_error == S_OK) m_error = FAILED(hr) ? hr : E_ABORT;
+    for (const auto& weak : m_pipes) {
+        if (auto pipe = weak.lock()) pipe->Abort(m_error);
+    }
+    m_next.reset();
+    m_changed.notify_all();
+}
+
+HRESULT CStreamPipeQueue::GetError() {
+    std::lock_guard<std::mutex> lock(m_lock);
+    return m_error;
+}
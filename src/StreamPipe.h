@@ -0,0 +1,160 @@
+// StreamPipe.h - Bounded in-memory pipe between two 7-Zip stream consumers
+#pragma once
+
+#include <Windows.h>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "Common/Common.h"
+#include "7zip/IStream.h"
+#include "Common/MyCom.h"
+
+// Shared state of one pipe: a ring buffer written by a producer thread (e.g.
+// a decoder's output stream) and read by a consumer thread (e.g. the Tar
+// handler's sequential input). Write blocks while the buffer is full, Read
+// blocks while it is empty.
+class CStreamPipeState {
+public:
+    explicit CStreamPipeState(size_t capacity);
+
+    HRESULT Write(const void* data, UInt32 size, UInt32* processedSize);
+    HRESULT Read(void* data, UInt32 size, UInt32* processedSize);
+
+    // Producer is done: Read returns the buffered tail, then 0 bytes (EOF)
+    void CloseWrite();
+
+    // Consumer is done: later writes are accepted and dropped, so a decoder
+    // can finish trailing data (tar padding) the consumer no longer needs
+    void CloseRead();
+
+    // Either side failed or was cancelled: both sides return hr from now on
+    void Abort(HRESULT hr);
+
+    uint64_t GetBytesWritten() const { return m_totalWritten; }
+
+    // Bytes handed to the consumer so far: its position in the stream
+    uint64_t GetBytesRead() const { return m_totalRead; }
+
+private:
+    std::mutex m_lock;
+    std::condition_variable m_canRead;
+    std::condition_variable m_canWrite;
+    std::vector<Byte> m_buf;
+    size_t m_readPos = 0;
+    size_t m_size = 0;
+    std::atomic<uint64_t> m_totalWritten{0};
+    std::atomic<uint64_t> m_totalRead{0};
+    bool m_writeClosed = false;
+    bool m_readClosed = false;
+    HRESULT m_error = S_OK;
+};
+
+// Writing end; closes the pipe for writing when the last reference goes away
+class CStreamPipeWriter :
+    public ISequentialOutStream,
+    public CMyUnknownImp
+{
+public:
+    explicit CStreamPipeWriter(std::shared_ptr<CStreamPipeState> state)
+        : m_state(std::move(state)), m_refCount(0) {}
+    virtual ~CStreamPipeWriter() { m_state->CloseWrite(); }
+
+    // IUnknown
+    STDMETHOD(QueryInterface)(REFIID iid, void **outObject) {
+        if (iid == IID_IUnknown || iid == IID_ISequentialOutStream) {
+            *outObject = this;
+            AddRef();
+            return S_OK;
+        }
+        *outObject = NULL;
+        return E_NOINTERFACE;
+    }
+
+    STDMETHOD_(ULONG, AddRef)() { return ++m_refCount; }
+    STDMETHOD_(ULONG, Release)() {
+        ULONG res = --m_refCount;
+        if (res == 0) delete this;
+        return res;
+    }
+
+    STDMETHOD(Write)(const void *data, UInt32 size, UInt32 *processedSize) {
+        return m_state->Write(data, size, processedSize);
+    }
+
+private:
+    std::shared_ptr<CStreamPipeState> m_state;
+    ULONG m_refCount;
+};
+
+// Reading end; closes the pipe for reading when the last reference goes away
+class CStreamPipeReader :
+    public ISequentialInStream,
+    public CMyUnknownImp
+{
+public:
+    explicit CStreamPipeReader(std::shared_ptr<CStreamPipeState> state)
+        : m_state(std::move(state)), m_refCount(0) {}
+    virtual ~CStreamPipeReader() { m_state->CloseRead(); }
+
+    // IUnknown
+    STDMETHOD(QueryInterface)(REFIID iid, void **outObject) {
+        if (iid == IID_IUnknown || iid == IID_ISequentialInStream) {
+            *outObject = this;
+            AddRef();
+            return S_OK;
+        }
+        *outObject = NULL;
+        return E_NOINTERFACE;
+    }
+
+    STDMETHOD_(ULONG, AddRef)() { return ++m_refCount; }
+    STDMETHOD_(ULONG, Release)() {
+        ULONG res = --m_refCount;
+        if (res == 0) delete this;
+        return res;
+    }
+
+    STDMETHOD(Read)(void *data, UInt32 size, UInt32 *processedSize) {
+        return m_state->Read(data, size, processedSize);
+    }
+
+private:
+    std::shared_ptr<CStreamPipeState> m_state;
+    ULONG m_refCount;
+};
+
+// Pipes of consecutive items, handed from a producer (an extract callback
+// writing item after item) to a consumer (an update callback reading them)
+// in the same order. Push waits until the consumer has taken the previous
+// pipe, so at most one item is buffered ahead of the items being read.
+class CStreamPipeQueue {
+public:
+    // Producer: a pipe of capacity bytes for the item; nullptr once aborted
+    std::shared_ptr<CStreamPipeState> Push(UInt32 item, size_t capacity);
+
+    // Consumer: the next pipe and its item; nullptr once the producer is
+    // done (Close) with nothing queued, or after Abort
+    std::shared_ptr<CStreamPipeState> Pop(UInt32& item);
+
+    // Producer has no more items
+    void Close();
+
+    // Fails every pipe handed out or queued; later Push/Pop return nullptr
+    void Abort(HRESULT hr);
+
+    // S_OK, or the first Abort's error
+    HRESULT GetError();
+
+private:
+    std::mutex m_lock;
+    std::condition_variable m_changed;
+    std::shared_ptr<CStreamPipeState> m_next;
+    UInt32 m_nextItem = 0;
+    std::vector<std::weak_ptr<CStreamPipeState>> m_pipes;
+    bool m_closed = false;
+    HRESULT m_error = S_OK;
+};
@@ -0,0 +1,243 @@
+// ZstdCodec.cpp - Zstandard coder (libzstd) for 7z containers and standalone .zst
+#ifdef SEVENZIPCORE_WITH_ZSTD
+
+#include "ZstdCodec.h"
+
+#include <zstd.h>
+
+#include "7zip/Common/RegisterCodec.h"
+#include "7zip/Common/StreamUtils.h"
+
+namespace NCompress {
+namespace NZstdExt {
+
+// Decoder window limit: accepts long-distance frames up to 2 GB windows
+#if defined(_WIN64)
+const int kMaxWindowLog = 31;
+#else
+const int kMaxWindowLog = 30;
+#endif
+
+static bool GetUInt64Value(const PROPVARIANT& prop, UInt64& value) {
+    if (prop.vt == VT_UI4) { value = prop.ulVal; return true; }
+    if (prop.vt == VT_UI8) { value = prop.uhVal.QuadPart; return true; }
+    return false;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Encoder
+//////////////////////////////////////////////////////////////////////////////
+
+CEncoder::CEncoder()
+    : m_ctx(nullptr)
+    , m_level(ZSTD_CLEVEL_DEFAULT)
+    , m_numThreads(0)
+    , m_windowLog(0)
+    , m_checksum(false)
+    , m_refCount(0)
+{}
+
+CEncoder::~CEncoder() {
+    if (m_ctx) ZSTD_freeCCtx(m_ctx);
+}
+
+STDMETHODIMP CEncoder::QueryInterface(REFIID iid, void **outObject) {
+    if (iid == IID_IUnknown || iid == IID_ICompressCoder) {
+        *outObject = static_cast<ICompressCoder*>(this);
+    } else if (iid == IID_ICompressSetCoderProperties) {
+        *outObject = static_cast<ICompressSetCoderProperties*>(this);
+    } else if (iid == IID_ICompressWriteCoderProperties) {
+        *outObject = static_cast<ICompressWriteCoderProperties*>(this);
+    } else {
+        *outObject = NULL;
+        return E_NOINTERFACE;
+    }
+    AddRef();
+    return S_OK;
+}
+
+STDMETHODIMP CEncoder::SetCoderProperties(const PROPID *propIDs, const PROPVARIANT *props,
+                                          UInt32 numProps) {
+    for (UInt32 i = 0; i < numProps; i++) {
+        UInt64 value = 0;
+        bool isNumber = GetUInt64Value(props[i], value);
+        switch (propIDs[i]) {
+            case NCoderPropID::kLevel:
+                if (!isNumber) return E_INVALIDARG;
+                // 7z level 0 means "store"; the closest ZSTD setting is level 1
+                m_level = (int)(value < 1 ? 1 : value > (UInt64)ZSTD_maxCLevel()
+                                                    ? ZSTD_maxCLevel() : value);
+                break;
+            case NCoderPropID::kNumThreads:
+                if (!isNumber) return E_INVALIDARG;
+                m_numThreads = (UInt32)value;
+                break;
+            case NCoderPropID::kDictionarySize: {
+                if (!isNumber) return E_INVALIDARG;
+                UInt32 log = ZSTD_WINDOWLOG_MIN;
+                while (log < (UInt32)kMaxWindowLog && ((UInt64)1 << log) < value) log++;
+                m_windowLog = log;
+                break;
+            }
+            default:
+                // Size hints and options meant for LZ-family coders
+                break;
+        }
+    }
+    return S_OK;
+}
+
+STDMETHODIMP CEncoder::WriteCoderProperties(ISequentialOutStream *outStream) {
+    Byte props[kPropsSize] = { ZSTD_VERSION_MAJOR, ZSTD_VERSION_MINOR, (Byte)m_level, 0, 0 };
+    return WriteStream(outStream, props, kPropsSize);
+}
+
+STDMETHODIMP CEncoder::Code(ISequentialInStream *inStream, ISequentialOutStream *outStream,
+                            const UInt64 *inSize, const UInt64 * /* outSize */,
+                            ICompressProgressInfo *progress) {
+    if (!m_ctx) {
+        m_ctx = ZSTD_createCCtx();
+        if (!m_ctx) return E_OUTOFMEMORY;
+        m_inBuf.resize(ZSTD_CStreamInSize());
+        m_outBuf.resize(ZSTD_CStreamOutSize());
+    }
+
+    ZSTD_CCtx_reset(m_ctx, ZSTD_reset_session_and_parameters);
+    if (ZSTD_isError(ZSTD_CCtx_setParameter(m_ctx, ZSTD_c_compressionLevel, m_level))) {
+        return E_INVALIDARG;
+    }
+    ZSTD_CCtx_setParameter(m_ctx, ZSTD_c_checksumFlag, m_checksum ? 1 : 0);
+    if (m_windowLog) {
+        ZSTD_CCtx_setParameter(m_ctx, ZSTD_c_enableLongDistanceMatching, 1);
+        ZSTD_CCtx_setParameter(m_ctx, ZSTD_c_windowLog, (int)m_windowLog);
+    }
+    // Fails harmlessly when libzstd was built without ZSTD_MULTITHREAD
+    if (m_numThreads > 1) {
+        ZSTD_CCtx_setParameter(m_ctx, ZSTD_c_nbWorkers, (int)m_numThreads);
+    }
+    if (inSize) {
+        ZSTD_CCtx_setPledgedSrcSize(m_ctx, *inSize);
+    }
+
+    UInt64 inProcessed = 0;
+    UInt64 outProcessed = 0;
+    for (;;) {
+        size_t inLen = m_inBuf.size();
+        RINOK(ReadStream(inStream, m_inBuf.data(), &inLen))
+        bool last = inLen < m_inBuf.size();
+        ZSTD_EndDirective mode = last ? ZSTD_e_end : ZSTD_e_continue;
+        ZSTD_inBuffer in = { m_inBuf.data(), inLen, 0 };
+
+        // Continue: until the chunk is consumed. End: until the frame is flushed.
+        for (;;) {
+            ZSTD_outBuffer out = { m_outBuf.data(), m_outBuf.size(), 0 };
+            size_t remaining = ZSTD_compressStream2(m_ctx, &out, &in, mode);
+            if (ZSTD_isError(remaining)) return E_FAIL;
+            if (out.pos) {
+                RINOK(WriteStream(outStream, m_outBuf.data(), out.pos))
+                outProcessed += out.pos;
+            }
+            if (last ? remaining == 0 : in.pos == in.size) break;
+        }
+
+        inProcessed += inLen;
+        if (progress) {
+            RINOK(progress->SetRatioInfo(&inProcessed, &outProcessed))
+        }
+        if (last) break;
+    }
+    return S_OK;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Decoder
+//////////////////////////////////////////////////////////////////////////////
+
+CDecoder::CDecoder() : m_ctx(nullptr), m_refCount(0) {}
+
+CDecoder::~CDecoder() {
+    if (m_ctx) ZSTD_freeDCtx(m_ctx);
+}
+
+STDMETHODIMP CDecoder::QueryInterface(REFIID iid, void **outObject) {
+    if (iid == IID_IUnknown || iid == IID_ICompressCoder) {
+        *outObject = static_cast<ICompressCoder*>(this);
+    } else if (iid == IID_ICompressSetDecoderProperties2) {
+        *outObject = static_cast<ICompressSetDecoderProperties2*>(this);
+    } else {
+        *outObject = NULL;
+        return E_NOINTERFACE;
+    }
+    AddRef();
+    return S_OK;
+}
+
+STDMETHODIMP CDecoder::SetDecoderProperties2(const Byte * /* data */, UInt32 size) {
+    // Older writers stored 3 bytes (no reserved tail); the frame header has
+    // everything the decoder needs, so the contents are informational
+    return (size == 0 || size == 3 || size == kPropsSize) ? S_OK : E_NOTIMPL;
+}
+
+STDMETHODIMP CDecoder::Code(ISequentialInStream *inStream, ISequentialOutStream *outStream,
+                            const UInt64 * /* inSize */, const UInt64 *outSize,
+                            ICompressProgressInfo *progress) {
+    if (!m_ctx) {
+        m_ctx = ZSTD_createDCtx();
+        if (!m_ctx) return E_OUTOFMEMORY;
+        m_inBuf.resize(ZSTD_DStreamInSize());
+        m_outBuf.resize(ZSTD_DStreamOutSize());
+    }
+    ZSTD_DCtx_reset(m_ctx, ZSTD_reset_session_and_parameters);
+    ZSTD_DCtx_setParameter(m_ctx, ZSTD_d_windowLogMax, kMaxWindowLog);
+
+    UInt64 outLimit = outSize ? *outSize : (UInt64)(Int64)-1;
+    UInt64 inProcessed = 0;
+    UInt64 outProcessed = 0;
+    ZSTD_inBuffer in = { m_inBuf.data(), 0, 0 };
+    bool inEof = false;
+    bool frameDone = false;
+
+    for (;;) {
+        if (in.pos == in.size && !inEof) {
+            size_t inLen = m_inBuf.size();
+            RINOK(ReadStream(inStream, m_inBuf.data(), &inLen))
+            in.size = inLen;
+            in.pos = 0;
+            inEof = (inLen == 0);
+            inProcessed += inLen;
+        }
+
+        ZSTD_outBuffer out = { m_outBuf.data(), m_outBuf.size(), 0 };
+        size_t inPos = in.pos;
+        size_t ret = ZSTD_decompressStream(m_ctx, &out, &in);
+        if (ZSTD_isError(ret)) return S_FALSE;
+        if (ret == 0) {
+            frameDone = true;
+        } else if (in.pos != inPos) {
+            frameDone = false;      // Next frame (or more of this one) started
+        }
+
+        if (out.pos) {
+            size_t size = out.pos;
+            if (size > outLimit - outProcessed) size = (size_t)(outLimit - outProcessed);
+            RINOK(WriteStream(outStream, m_outBuf.data(), size))
+            outProcessed += size;
+            if (outProcessed == outLimit) return S_OK;
+        }
+        if (progress) {
+            RINOK(progress->SetRatioInfo(&inProcessed, &outProcessed))
+        }
+
+        // Input drained and the decoder had no more output to give
+        if (inEof && in.pos == in.size && out.pos < out.size) break;
+    }
+
+    // A truncated stream ends in the middle of a frame
+    return frameDone ? S_OK : S_FALSE;
+}
+
+REGISTER_CODEC_E(ZSTD, CDecoder(), CEncoder(), kMethodId, "ZSTD")
+
+}} // namespace NCompress::NZstdExt
+
+#endif // SEVENZIPCORE_WITH_ZSTD
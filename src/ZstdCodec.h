@@ -0,0 +1,102 @@
+// ZstdCodec.h - Zstandard coder (libzstd) for 7z containers and standalone .zst
+#pragma once
+
+#ifdef SEVENZIPCORE_WITH_ZSTD
+
+#include <vector>
+
+#include "Common/Common.h"
+#include "7zip/ICoder.h"
+#include "Common/MyCom.h"
+
+struct ZSTD_CCtx_s;
+struct ZSTD_DCtx_s;
+
+namespace NCompress {
+namespace NZstdExt {
+
+// 7z method ID used by other 7-Zip builds with ZSTD support, so archives
+// stay interchangeable with them
+const UInt64 kMethodId = 0x4F71101;
+
+// Coder properties: library version (major, minor), level, 2 reserved bytes
+const UInt32 kPropsSize = 5;
+
+// Properties:
+//   kLevel          1..22 (default 3)
+//   kNumThreads     libzstd worker threads (needs a multithreaded libzstd)
+//   kDictionarySize window size; setting it enables long-distance matching
+class CEncoder :
+    public ICompressCoder,
+    public ICompressSetCoderProperties,
+    public ICompressWriteCoderProperties,
+    public CMyUnknownImp
+{
+public:
+    CEncoder();
+    virtual ~CEncoder();
+
+    // IUnknown
+    STDMETHOD(QueryInterface)(REFIID iid, void **outObject);
+    STDMETHOD_(ULONG, AddRef)() { return ++m_refCount; }
+    STDMETHOD_(ULONG, Release)() {
+        ULONG res = --m_refCount;
+        if (res == 0) delete this;
+        return res;
+    }
+
+    STDMETHOD(Code)(ISequentialInStream *inStream, ISequentialOutStream *outStream,
+                    const UInt64 *inSize, const UInt64 *outSize,
+                    ICompressProgressInfo *progress);
+    STDMETHOD(SetCoderProperties)(const PROPID *propIDs, const PROPVARIANT *props,
+                                  UInt32 numProps);
+    STDMETHOD(WriteCoderProperties)(ISequentialOutStream *outStream);
+
+    // Standalone .zst frames carry their own content checksum; inside 7z the
+    // container CRC already covers the data
+    void SetChecksum(bool checksum) { m_checksum = checksum; }
+
+private:
+    ZSTD_CCtx_s* m_ctx;
+    std::vector<Byte> m_inBuf;
+    std::vector<Byte> m_outBuf;
+    int m_level;
+    UInt32 m_numThreads;
+    UInt32 m_windowLog;
+    bool m_checksum;
+    ULONG m_refCount;
+};
+
+class CDecoder :
+    public ICompressCoder,
+    public ICompressSetDecoderProperties2,
+    public CMyUnknownImp
+{
+public:
+    CDecoder();
+    virtual ~CDecoder();
+
+    // IUnknown
+    STDMETHOD(QueryInterface)(REFIID iid, void **outObject);
+    STDMETHOD_(ULONG, AddRef)() { return ++m_refCount; }
+    STDMETHOD_(ULONG, Release)() {
+        ULONG res = --m_refCount;
+        if (res == 0) delete this;
+        return res;
+    }
+
+    STDMETHOD(Code)(ISequentialInStream *inStream, ISequentialOutStream *outStream,
+                    const UInt64 *inSize, const UInt64 *outSize,
+                    ICompressProgressInfo *progress);
+    STDMETHOD(SetDecoderProperties2)(const Byte *data, UInt32 size);
+
+private:
+    ZSTD_DCtx_s* m_ctx;
+    std::vector<Byte> m_inBuf;
+    std::vector<Byte> m_outBuf;
+    ULONG m_refCount;
+};
+
+}} // namespace NCompress::NZstdExt
+
+#endif // SEVENZIPCORE_WITH_ZSTD